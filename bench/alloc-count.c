@@ -0,0 +1,37 @@
+// Count the allocations of every thread, for spotify-replay.
+//
+// Linked into the listener, this replaces glibc's malloc, calloc and realloc
+// with wrappers that count the calls of the calling thread before passing
+// them on. glibc calls the replacements for its own allocations too (e.g. in
+// strdup), as do the libraries loaded by the listener. The replay reads the
+// count before and after every signal through alloc_count.
+
+#include <stddef.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+// Initial-exec, so reading it never allocates
+static __thread unsigned long ALLOCATIONS
+    __attribute__((tls_model("initial-exec")));
+
+unsigned long alloc_count() { return ALLOCATIONS; }
+
+void* malloc(size_t size) {
+    ALLOCATIONS++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    ALLOCATIONS++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    ALLOCATIONS++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) { __libc_free(ptr); }
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Compare the libdbus and sd-bus builds: spotifyctl cold start and the CPU
+# time spotify-listener spends per PropertiesChanged signal.
+#
+# usage: bench/bus-backends.sh
+#
+# Build first with:
+#   make -C src all sdbus bench
+#
+# Spotify (or another org.mpris.MediaPlayer2.spotify player) must be running
+# on the session bus for the cold start numbers. Stop any running
+# spotify-listener first, since the signals are also seen by it.
+
+ROOT=$(dirname "$0")/..
+BIN=$ROOT/bin
+RUNS=${RUNS:-200}
+SIGNALS=${SIGNALS:-20000}
+
+for dir in "$BIN" "$BIN/sdbus"; do
+    if [ ! -x "$dir/spotifyctl" ] || [ ! -x "$dir/spotify-listener" ]; then
+        echo "$dir is missing binaries, see the build steps at the top of $0" >&2
+        continue
+    fi
+
+    echo "${dir#$BIN}/:"
+    printf '  %-18s ' "spotifyctl status"
+    "$BIN/spawn-bench" -n "$RUNS" -- "$dir/spotifyctl" --dbus status
+    printf '  %-18s ' "spotify-listener"
+    "$BIN/signal-bench" -n "$SIGNALS" -- "$dir/spotify-listener"
+done
@@ -0,0 +1,91 @@
+#!/bin/sh
+# Measure the cold start of every spotifyctl command against the fake MPRIS
+# player and spotify-listener on a private session bus.
+#
+# usage: bench/cold-start.sh [command]...
+#
+# Build first with:
+#   make -C src all bench
+#
+# Every command (a quoted list of spotifyctl arguments, e.g. "--dbus next")
+# is run RUNS times (200 by default) by spawn-bench, which measures the wall
+# time, CPU time, page faults, context switches and peak RSS of every run.
+# SPOTIFYCTL picks the spotifyctl to measure, e.g. bin/spotifyctl-static.
+# With PERF=1, `perf stat` also counts the syscalls of PERF_RUNS runs, which
+# needs access to the raw_syscalls tracepoints.
+#
+# The results are written to OUT (cold-start.<time> by default): summary.csv
+# with a row for every command, and <command>.csv with every run of it. The
+# summary is printed as well.
+
+ROOT=$(dirname "$0")/..
+BIN=$ROOT/bin
+SPOTIFYCTL=${SPOTIFYCTL:-$BIN/spotifyctl}
+RUNS=${RUNS:-200}
+PERF=${PERF:-0}
+PERF_RUNS=${PERF_RUNS:-50}
+OUT=${OUT:-cold-start.$(date +%Y%m%d-%H%M%S)}
+
+. "$ROOT/bench/private-bus.sh"
+
+[ $# -eq 0 ] && set -- "status" "--dbus status" "playpause" \
+    "--dbus playpause" "--dbus --wait playpause" "next" "stats" "bar-shown"
+
+require_bins fake-player spawn-bench spotify-listener "$SPOTIFYCTL"
+
+if [ "$PERF" = 1 ] && ! command -v perf >/dev/null; then
+    echo "perf is missing, run without PERF=1" >&2
+    exit 1
+fi
+
+mkdir -p "$OUT" || exit 1
+
+start_private_bus
+start_draining_bar cold
+
+"$BIN/fake-player" &
+PIDS="$PIDS $!"
+start_listener
+
+# Average syscalls of a run, or nothing without PERF=1
+syscalls() {
+    [ "$PERF" = 1 ] || return
+    perf stat -x , -e raw_syscalls:sys_enter -r "$PERF_RUNS" -- \
+        "$SPOTIFYCTL" $1 2>&1 >/dev/null |
+        awk -F , '/raw_syscalls/ { print $1 }'
+}
+
+# The columns of the summary line of spawn-bench, in its order
+echo "command,runs,failures,wall_mean_ms,wall_p50_ms,wall_p95_ms,max_rss_kb,\
+user_ms,sys_ms,minor_faults,major_faults,context_switches,syscalls" \
+    >"$OUT/summary.csv"
+
+for command in "$@"; do
+    name=$(echo "$command" | sed 's/--//g; s/[^a-z0-9-]/_/g')
+
+    summary=$("$BIN/spawn-bench" -n "$RUNS" -o "$OUT/$name.csv" -- \
+        "$SPOTIFYCTL" $command)
+
+    # key=value with units to CSV
+    echo "$summary" | awk -v command="$command" -v syscalls="$(syscalls \
+        "$command")" '{
+            line = command
+            for (i = 1; i <= NF; i++) {
+                value = substr($i, index($i, "=") + 1)
+                sub(/(ms|KiB)$/, "", value)
+                line = line "," value
+            }
+            print line "," syscalls
+        }' >>"$OUT/summary.csv"
+done
+
+require_listener
+
+printf '%-24s %8s %9s %9s %9s %9s %8s %8s %9s\n' "command" "failures" \
+    "mean (ms)" "p95 (ms)" "user (ms)" "sys (ms)" "minflt" "rss (KiB)" \
+    "syscalls"
+awk -F , 'NR > 1 {
+    printf "%-24s %8s %9s %9s %9s %9s %8s %8s %9s\n", $1, $3, $4, $6, $8, $9,
+           $10, $7, $13
+}' "$OUT/summary.csv"
+echo "Results are in $OUT"
@@ -0,0 +1,97 @@
+#!/bin/sh
+# Measure the latency from a player's signal to polybar, end to end, with the
+# fake MPRIS player and fake bars on a private session bus.
+#
+# usage: bench/e2e-latency.sh
+#
+# Build first with:
+#   make -C src all bench
+#
+# BARS fake bars (2 by default) run the spotify module's hook like polybar
+# does, and the fake player sends RATE signals per second (10 by default) of
+# SHAPE (status by default, see bench/fake-player.c) for DURATION seconds.
+# Every signal is matched with the first message each bar received after it,
+# and with the first time each bar showed the output of `spotifyctl status`
+# after it. Signals must be further apart than the messages they cause take,
+# or messages are matched with the wrong signal.
+#
+# For every bar, this prints the median, 99th percentile and maximum latency
+# from the signal to the bar receiving a message (hook) and to the bar
+# showing the track (shown).
+
+ROOT=$(dirname "$0")/..
+BIN=$ROOT/bin
+BARS=${BARS:-2}
+RATE=${RATE:-10}
+SHAPE=${SHAPE:-status}
+DURATION=${DURATION:-10}
+
+. "$ROOT/bench/private-bus.sh"
+
+require_bins fake-player fake-polybar spotify-listener spotifyctl
+start_private_bus
+
+# The hook of the spotify module from the README
+HOOK="hook:module/spotify2=$BIN/spotifyctl -q status --format '%artist%: %title%'"
+
+for bar in $(seq "$BARS"); do
+    "$BIN/fake-polybar" -d "$TMP/bars" -e "$HOOK" >"$TMP/bar.$bar" &
+    PIDS="$PIDS $!"
+done
+sleep 0.2
+
+start_listener
+
+"$BIN/fake-player" -r "$RATE" -s "$SHAPE" -d "$DURATION" -t "$TMP/signals" \
+    >/dev/null || exit 1
+
+# Let the bars catch up with the last signal
+sleep 0.5
+
+require_listener
+
+printf '%4s %8s %8s %10s %10s %10s\n' "bar" "latency" "samples" "p50 (ms)" \
+    "p99 (ms)" "max (ms)"
+
+# Merge the signals and what the bars received in the order they happened.
+# The first signal is sent as the player connects, so it is mixed up with the
+# listener's answer to the new player and left out.
+{
+    awk 'NR > 1 { print $1, "signal", 0 }' "$TMP/signals"
+    for bar in $(seq "$BARS"); do
+        awk -v bar="$bar" '{ print $1, $2, bar }' "$TMP/bar.$bar"
+    done
+} | sort -s -n -k1,1 | awk -v bars="$BARS" '
+    $2 == "signal" {
+        for (bar = 1; bar <= bars; bar++) {
+            hook[bar] = $1
+            shown[bar] = $1
+        }
+    }
+    $2 == "recv" && hook[$3] != "" {
+        print $3, "hook", $1 - hook[$3]
+        hook[$3] = ""
+    }
+    $2 == "shown" && shown[$3] != "" {
+        print $3, "shown", $1 - shown[$3]
+        shown[$3] = ""
+    }' | sort -k1,1n -k2,2 -k3,3n | awk '
+    function percentile(p, i) {
+        i = int(p * n)
+        if (i < p * n)
+            i++
+        return values[i < 1 ? 1 : i] / 1000
+    }
+    function report() {
+        if (n > 0)
+            printf "%4s %8s %8d %10.2f %10.2f %10.2f\n", bar, latency, n,
+                   percentile(0.5), percentile(0.99), values[n] / 1000
+    }
+    ($1 " " $2) != (bar " " latency) {
+        report()
+        bar = $1
+        latency = $2
+        n = 0
+    }
+    { values[++n] = $3 }
+    END { report() }'
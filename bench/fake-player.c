@@ -0,0 +1,571 @@
+// A fake MPRIS player for load testing spotify-listener and spotifyctl
+// without spotify.
+//
+// usage: fake-player [-n name] [-r rate] [-b burst] [-s same|status|track]
+//                    [-a artists] [-m bytes] [-o churn rate] [-d seconds]
+//                    [-t file] [-l x|t]
+//
+// The player owns org.mpris.MediaPlayer2.<name> (spotify by default) on the
+// session bus and answers Get and GetAll of the Player interface and Play,
+// Pause, PlayPause, Stop, Next and Previous, which change its state and
+// announce it with PropertiesChanged like spotify does.
+//
+// With -r, it also sends rate PropertiesChanged signals per second on its
+// own, in bursts of -b signals sent back to back. The shape of the signals is
+// chosen with -s:
+//   same    the same track and status every time, so every signal is read
+//           but none of them changes what polybar shows
+//   status  only PlaybackStatus, toggling between Playing and Paused
+//   track   the whole metadata of a new track every time
+// -a sets the number of artists of a track and -m adds that many bytes of
+// lyrics to its metadata. -o releases and requests the name again churn rate
+// times per second, which makes the bus send NameOwnerChanged twice.
+//
+// With -d, the player exits after that many seconds and prints how many
+// signals it sent and how fast. -t writes the CLOCK_MONOTONIC microseconds
+// every signal of the load was sent at to file, one per line, to match them
+// with what the bars received (see bench/e2e-latency.sh).
+//
+// -l picks the signature of mpris:length: x like the MPRIS spec and players
+// such as mpv and browsers (the default), or t like spotify.
+
+#include <dbus-1.0/dbus/dbus.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PLAYER_PATH "/org/mpris/MediaPlayer2"
+#define PLAYER_IFACE "org.mpris.MediaPlayer2.Player"
+#define PROPERTIES_IFACE "org.freedesktop.DBus.Properties"
+
+// Maximum number of artists of a track
+#define MAX_ARTISTS 64
+
+typedef enum { SHAPE_SAME, SHAPE_STATUS, SHAPE_TRACK } Shape;
+
+typedef struct {
+    DBusConnection* connection;
+    char bus_name[256];
+
+    // Options
+    double rate;
+    int burst;
+    Shape shape;
+    int artists;
+    char* lyrics;
+    double churn_rate;
+    FILE* times;
+    int length_type;
+
+    // State
+    dbus_bool_t playing;
+    long track;
+    long long position_us;
+    long long playing_since_us;
+
+    // Counters
+    unsigned long sent;
+    unsigned long churns;
+} Player;
+
+static volatile sig_atomic_t STOP = 0;
+
+static void stop_handler(int sig) { STOP = 1; }
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long position_us(const Player* player) {
+    return player->position_us +
+           (player->playing ? now_us() - player->playing_since_us : 0);
+}
+
+static void set_playing(Player* player, const dbus_bool_t playing) {
+    player->position_us = position_us(player);
+    player->playing_since_us = now_us();
+    player->playing = playing;
+}
+
+// Open a dict entry of an a{sv} and the variant of its value
+static void open_entry(DBusMessageIter* dict, const char* key,
+                       const char* signature, DBusMessageIter* entry,
+                       DBusMessageIter* variant) {
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, entry);
+    dbus_message_iter_append_basic(entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(entry, DBUS_TYPE_VARIANT, signature,
+                                     variant);
+}
+
+static void close_entry(DBusMessageIter* dict, DBusMessageIter* entry,
+                        DBusMessageIter* variant) {
+    dbus_message_iter_close_container(entry, variant);
+    dbus_message_iter_close_container(dict, entry);
+}
+
+static void append_basic_entry(DBusMessageIter* dict, const char* key,
+                               const int type, const void* value) {
+    const char signature[2] = {(char)type, '\0'};
+    DBusMessageIter entry, variant;
+
+    open_entry(dict, key, signature, &entry, &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    close_entry(dict, &entry, &variant);
+}
+
+static void append_string_entry(DBusMessageIter* dict, const char* key,
+                                const char* value) {
+    append_basic_entry(dict, key, DBUS_TYPE_STRING, &value);
+}
+
+static void append_strings_entry(DBusMessageIter* dict, const char* key,
+                                 const char* values[], const int count) {
+    DBusMessageIter entry, variant, array;
+
+    open_entry(dict, key, "as", &entry, &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s", &array);
+    for (int i = 0; i < count; i++)
+        dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &values[i]);
+    dbus_message_iter_close_container(&variant, &array);
+    close_entry(dict, &entry, &variant);
+}
+
+// Append the Metadata property of the current track as an a{sv}
+static void append_metadata(DBusMessageIter* iter, const Player* player) {
+    char trackid[64], title[64], url[96];
+    char artist_names[MAX_ARTISTS][32];
+    const char* artists[MAX_ARTISTS];
+    // The same 64 bits whichever signature is sent
+    const dbus_int64_t length_us = 200000000;
+    const dbus_int32_t track_number = player->track % 20 + 1;
+    const dbus_int32_t disc_number = 1;
+    const double rating = 0.5;
+    const char* album_artists[] = {"Fake Album Artist"};
+    DBusMessageIter metadata;
+
+    snprintf(trackid, sizeof(trackid), "spotify:track:fake%ld", player->track);
+    snprintf(title, sizeof(title), "Fake Track %ld", player->track);
+    snprintf(url, sizeof(url), "https://open.spotify.com/track/fake%ld",
+             player->track);
+
+    for (int i = 0; i < player->artists; i++) {
+        snprintf(artist_names[i], sizeof(artist_names[i]), "Fake Artist %d",
+                 i + 1);
+        artists[i] = artist_names[i];
+    }
+
+    dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "{sv}", &metadata);
+    append_string_entry(&metadata, "mpris:trackid", trackid);
+    append_basic_entry(&metadata, "mpris:length", player->length_type,
+                       &length_us);
+    append_string_entry(&metadata, "mpris:artUrl",
+                        "https://i.scdn.co/image/fake");
+    append_string_entry(&metadata, "xesam:album", "Fake Album");
+    append_strings_entry(&metadata, "xesam:albumArtist", album_artists, 1);
+    append_strings_entry(&metadata, "xesam:artist", artists, player->artists);
+    append_basic_entry(&metadata, "xesam:autoRating", DBUS_TYPE_DOUBLE,
+                       &rating);
+    append_basic_entry(&metadata, "xesam:discNumber", DBUS_TYPE_INT32,
+                       &disc_number);
+    append_string_entry(&metadata, "xesam:title", title);
+    append_basic_entry(&metadata, "xesam:trackNumber", DBUS_TYPE_INT32,
+                       &track_number);
+    append_string_entry(&metadata, "xesam:url", url);
+    if (player->lyrics != NULL)
+        append_string_entry(&metadata, "xesam:asText", player->lyrics);
+    dbus_message_iter_close_container(iter, &metadata);
+}
+
+static const char* playback_status(const Player* player) {
+    return player->playing ? "Playing" : "Paused";
+}
+
+// Append a property as a variant
+static dbus_bool_t append_property(DBusMessageIter* iter, const Player* player,
+                                   const char* name) {
+    DBusMessageIter variant;
+
+    if (strcmp(name, "PlaybackStatus") == 0) {
+        const char* status = playback_status(player);
+
+        dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "s",
+                                         &variant);
+        dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &status);
+    } else if (strcmp(name, "Metadata") == 0) {
+        dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a{sv}",
+                                         &variant);
+        append_metadata(&variant, player);
+    } else if (strcmp(name, "Position") == 0) {
+        const dbus_int64_t position = position_us(player);
+
+        dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "x",
+                                         &variant);
+        dbus_message_iter_append_basic(&variant, DBUS_TYPE_INT64, &position);
+    } else if (strcmp(name, "Rate") == 0) {
+        const double rate = 1.0;
+
+        dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "d",
+                                         &variant);
+        dbus_message_iter_append_basic(&variant, DBUS_TYPE_DOUBLE, &rate);
+    } else {
+        return FALSE;
+    }
+
+    dbus_message_iter_close_container(iter, &variant);
+    return TRUE;
+}
+
+// Send PropertiesChanged with the metadata, the status or both
+static void send_properties_changed(Player* player,
+                                    const dbus_bool_t metadata,
+                                    const dbus_bool_t status) {
+    const char* iface = PLAYER_IFACE;
+    DBusMessageIter iter, changed, entry, variant, invalidated;
+
+    DBusMessage* msg = dbus_message_new_signal(PLAYER_PATH, PROPERTIES_IFACE,
+                                               "PropertiesChanged");
+
+    dbus_message_iter_init_append(msg, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &iface);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &changed);
+
+    if (metadata) {
+        open_entry(&changed, "Metadata", "a{sv}", &entry, &variant);
+        append_metadata(&variant, player);
+        close_entry(&changed, &entry, &variant);
+    }
+    if (status)
+        append_string_entry(&changed, "PlaybackStatus",
+                            playback_status(player));
+
+    dbus_message_iter_close_container(&iter, &changed);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s",
+                                     &invalidated);
+    dbus_message_iter_close_container(&iter, &invalidated);
+
+    dbus_connection_send(player->connection, msg, NULL);
+    dbus_message_unref(msg);
+    player->sent++;
+}
+
+// Send the next signal of the load
+static void send_load_signal(Player* player) {
+    if (player->times != NULL)
+        fprintf(player->times, "%lld\n", now_us());
+
+    switch (player->shape) {
+        case SHAPE_SAME:
+            send_properties_changed(player, TRUE, TRUE);
+            break;
+        case SHAPE_STATUS:
+            set_playing(player, !player->playing);
+            send_properties_changed(player, FALSE, TRUE);
+            break;
+        case SHAPE_TRACK:
+            player->track++;
+            player->position_us = 0;
+            player->playing_since_us = now_us();
+            send_properties_changed(player, TRUE, TRUE);
+            break;
+    }
+}
+
+// Release the name and request it again
+static void churn_name(Player* player) {
+    dbus_bus_release_name(player->connection, player->bus_name, NULL);
+    dbus_bus_request_name(player->connection, player->bus_name,
+                          DBUS_NAME_FLAG_DO_NOT_QUEUE, NULL);
+    player->churns++;
+}
+
+static DBusMessage* handle_get(Player* player, DBusMessage* call) {
+    const char* iface;
+    const char* name;
+    DBusMessageIter iter;
+
+    if (dbus_message_get_args(call, NULL, DBUS_TYPE_STRING, &iface,
+                              DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID)) {
+        DBusMessage* reply = dbus_message_new_method_return(call);
+
+        dbus_message_iter_init_append(reply, &iter);
+        if (append_property(&iter, player, name))
+            return reply;
+        dbus_message_unref(reply);
+    }
+
+    return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS,
+                                  "Unknown property");
+}
+
+static DBusMessage* handle_get_all(Player* player, DBusMessage* call) {
+    const char* names[] = {"PlaybackStatus", "Metadata", "Position", "Rate"};
+    DBusMessage* reply = dbus_message_new_method_return(call);
+    DBusMessageIter iter, properties, entry;
+
+    dbus_message_iter_init_append(reply, &iter);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}",
+                                     &properties);
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        dbus_message_iter_open_container(&properties, DBUS_TYPE_DICT_ENTRY,
+                                         NULL, &entry);
+        dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &names[i]);
+        append_property(&entry, player, names[i]);
+        dbus_message_iter_close_container(&properties, &entry);
+    }
+
+    dbus_message_iter_close_container(&iter, &properties);
+
+    return reply;
+}
+
+// Apply a Player method. Returns FALSE if the method is unknown.
+static dbus_bool_t handle_command(Player* player, const char* method) {
+    const dbus_bool_t was_playing = player->playing;
+
+    if (strcmp(method, "Play") == 0) {
+        set_playing(player, TRUE);
+    } else if (strcmp(method, "Pause") == 0 || strcmp(method, "Stop") == 0) {
+        set_playing(player, FALSE);
+    } else if (strcmp(method, "PlayPause") == 0) {
+        set_playing(player, !player->playing);
+    } else if (strcmp(method, "Next") == 0 ||
+               strcmp(method, "Previous") == 0) {
+        player->track += strcmp(method, "Next") == 0 ? 1 : -1;
+        player->position_us = 0;
+        player->playing_since_us = now_us();
+        send_properties_changed(player, TRUE, FALSE);
+        return TRUE;
+    } else {
+        return FALSE;
+    }
+
+    if (player->playing != was_playing)
+        send_properties_changed(player, FALSE, TRUE);
+
+    return TRUE;
+}
+
+static void handle_call(Player* player, DBusMessage* call) {
+    const char* iface = dbus_message_get_interface(call);
+    const char* method = dbus_message_get_member(call);
+    DBusMessage* reply;
+
+    if (iface == NULL || method == NULL)
+        return;
+
+    if (strcmp(iface, PROPERTIES_IFACE) == 0 && strcmp(method, "Get") == 0) {
+        reply = handle_get(player, call);
+    } else if (strcmp(iface, PROPERTIES_IFACE) == 0 &&
+               strcmp(method, "GetAll") == 0) {
+        reply = handle_get_all(player, call);
+    } else if (strcmp(iface, PLAYER_IFACE) == 0 &&
+               handle_command(player, method)) {
+        reply = dbus_message_new_method_return(call);
+    } else {
+        reply = dbus_message_new_error(call, DBUS_ERROR_UNKNOWN_METHOD,
+                                       "Unknown method");
+    }
+
+    if (!dbus_message_get_no_reply(call))
+        dbus_connection_send(player->connection, reply, NULL);
+    dbus_message_unref(reply);
+}
+
+static void usage() {
+    fputs("usage: fake-player [-n name] [-r rate] [-b burst] "
+          "[-s same|status|track]\n"
+          "                   [-a artists] [-m bytes] [-o churn rate] "
+          "[-d seconds]\n"
+          "                   [-t file] [-l x|t]\n",
+          stderr);
+}
+
+int main(int argc, char* argv[]) {
+    Player player = {0};
+    const char* name = "spotify";
+    double duration_s = 0;
+    int lyrics_len = 0;
+
+    player.burst = 1;
+    player.artists = 1;
+    player.playing = TRUE;
+    player.length_type = DBUS_TYPE_INT64;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0) {
+            player.rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            player.burst = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            i++;
+            if (strcmp(argv[i], "same") == 0) {
+                player.shape = SHAPE_SAME;
+            } else if (strcmp(argv[i], "status") == 0) {
+                player.shape = SHAPE_STATUS;
+            } else if (strcmp(argv[i], "track") == 0) {
+                player.shape = SHAPE_TRACK;
+            } else {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-a") == 0) {
+            player.artists = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            lyrics_len = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            player.churn_rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            duration_s = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            if (!(player.times = fopen(argv[++i], "w"))) {
+                perror("fake-player");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-l") == 0) {
+            i++;
+            if (strcmp(argv[i], "x") == 0) {
+                player.length_type = DBUS_TYPE_INT64;
+            } else if (strcmp(argv[i], "t") == 0) {
+                player.length_type = DBUS_TYPE_UINT64;
+            } else {
+                usage();
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (player.burst < 1 || player.artists < 1 ||
+        player.artists > MAX_ARTISTS || lyrics_len < 0) {
+        fprintf(stderr, "fake-player: bursts need at least 1 signal and "
+                        "tracks 1 to %d artists\n",
+                MAX_ARTISTS);
+        return 1;
+    }
+
+    if (lyrics_len > 0) {
+        player.lyrics = (char*)malloc(lyrics_len + 1);
+        memset(player.lyrics, 'l', lyrics_len);
+        player.lyrics[lyrics_len] = '\0';
+    }
+
+    snprintf(player.bus_name, sizeof(player.bus_name),
+             "org.mpris.MediaPlayer2.%s", name);
+
+    DBusError err;
+    dbus_error_init(&err);
+
+    if (!(player.connection = dbus_bus_get(DBUS_BUS_SESSION, &err))) {
+        fprintf(stderr, "fake-player: %s\n", err.message);
+        return 1;
+    }
+
+    if (dbus_bus_request_name(player.connection, player.bus_name,
+                              DBUS_NAME_FLAG_DO_NOT_QUEUE, &err) !=
+        DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+        fprintf(stderr, "fake-player: %s is taken\n", player.bus_name);
+        return 1;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    int fd;
+    dbus_connection_get_unix_fd(player.connection, &fd);
+
+    const long long started_us = now_us();
+    const long long end_us =
+        duration_s > 0 ? started_us + (long long)(duration_s * 1e6) : -1;
+    // Bursts and churns are due at fixed intervals from the start, so the
+    // rates hold even if the player falls behind for a while
+    const long long burst_interval_us =
+        player.rate > 0 ? (long long)(player.burst * 1e6 / player.rate) : -1;
+    const long long churn_interval_us =
+        player.churn_rate > 0 ? (long long)(1e6 / player.churn_rate) : -1;
+    unsigned long bursts = 0;
+    long long next_churn_us = started_us + churn_interval_us;
+
+    player.playing_since_us = started_us;
+
+    while (!STOP) {
+        const long long now = now_us();
+        long long next_us = end_us;
+
+        if (end_us >= 0 && now >= end_us)
+            break;
+
+        if (burst_interval_us > 0) {
+            while (started_us + (long long)bursts * burst_interval_us <= now &&
+                   !STOP) {
+                for (int i = 0; i < player.burst; i++)
+                    send_load_signal(&player);
+                bursts++;
+            }
+
+            const long long due_us =
+                started_us + (long long)bursts * burst_interval_us;
+            if (next_us < 0 || due_us < next_us)
+                next_us = due_us;
+        }
+
+        if (churn_interval_us > 0) {
+            if (next_churn_us <= now) {
+                churn_name(&player);
+                next_churn_us += churn_interval_us;
+            }
+            if (next_us < 0 || next_churn_us < next_us)
+                next_us = next_churn_us;
+        }
+
+        dbus_connection_flush(player.connection);
+
+        // Answer method calls until the next signal is due
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        const int timeout_ms =
+            next_us < 0 ? -1 : (int)((next_us - now + 999) / 1000);
+        DBusMessage* msg;
+
+        if (dbus_connection_get_dispatch_status(player.connection) ==
+                DBUS_DISPATCH_DATA_REMAINS ||
+            poll(&pfd, 1, timeout_ms) > 0)
+            dbus_connection_read_write(player.connection, 0);
+
+        while ((msg = dbus_connection_pop_message(player.connection))) {
+            if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_CALL)
+                handle_call(&player, msg);
+            dbus_message_unref(msg);
+        }
+
+        if (!dbus_connection_get_is_connected(player.connection))
+            break;
+    }
+
+    dbus_connection_flush(player.connection);
+
+    const double elapsed_s = (now_us() - started_us) / 1e6;
+
+    if (duration_s > 0)
+        printf("sent=%lu churns=%lu elapsed=%.3fs rate=%.1f/s\n", player.sent,
+               player.churns, elapsed_s,
+               elapsed_s > 0 ? player.sent / elapsed_s : 0);
+
+    if (player.times != NULL)
+        fclose(player.times);
+
+    free(player.lyrics);
+    return 0;
+}
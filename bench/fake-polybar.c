@@ -0,0 +1,189 @@
+// A fake polybar for measuring how long a signal takes to reach a bar.
+//
+// usage: fake-polybar [-d directory] [-e message=command]...
+//
+// Like a bar with enable-ipc = true, this creates polybar_mqueue.<pid> in the
+// directory (/tmp by default) and reads every message written to it until
+// the writer closes it. Every message is printed with the CLOCK_MONOTONIC
+// microseconds its first byte arrived at:
+//   <time> recv <message>
+// Messages written before the last writer closed the file run together, as
+// they do in polybar.
+// With -e, command is run with sh -c whenever message arrives, like polybar
+// runs the hook of an IPC module, and the first line it printed is shown
+// with the time it exited:
+//   <time> shown <message> <output>
+// Commands run one at a time, so a slow command delays the messages after it.
+// The IPC file is removed on SIGINT and SIGTERM.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Maximum number of hooks given with -e
+#define MAX_HOOKS 16
+
+// Longest message read, which is far longer than the listener's
+#define MAX_MESSAGE_LEN 4096
+
+typedef struct {
+    const char* message;
+    const char* command;
+} Hook;
+
+static volatile sig_atomic_t STOP = 0;
+
+static void stop_handler(int sig) { STOP = 1; }
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Run a hook's command and show the first line it printed
+static void run_hook(const Hook* hook) {
+    char output[MAX_MESSAGE_LEN] = "";
+    FILE* pipe = popen(hook->command, "r");
+
+    if (pipe == NULL) {
+        perror("fake-polybar: popen");
+        return;
+    }
+
+    if (fgets(output, sizeof(output), pipe) != NULL) {
+        output[strcspn(output, "\n")] = '\0';
+
+        // Read the rest, so the command isn't stopped by a closed pipe
+        char rest[256];
+        while (fread(rest, 1, sizeof(rest), pipe) > 0)
+            ;
+    }
+
+    pclose(pipe);
+
+    printf("%lld shown %s %s\n", now_us(), hook->message, output);
+}
+
+static void handle_message(const char* message, const long long arrived_us,
+                           const Hook* hooks, const int num_of_hooks) {
+    printf("%lld recv %s\n", arrived_us, message);
+
+    for (int i = 0; i < num_of_hooks; i++) {
+        if (strcmp(hooks[i].message, message) == 0)
+            run_hook(&hooks[i]);
+    }
+}
+
+static int open_ipc_file(const char* path) {
+    const int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+        perror("fake-polybar: open");
+
+    return fd;
+}
+
+static void usage() {
+    fputs("usage: fake-polybar [-d directory] [-e message=command]...\n",
+          stderr);
+}
+
+int main(int argc, char* argv[]) {
+    Hook hooks[MAX_HOOKS];
+    int num_of_hooks = 0;
+    const char* directory = "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            directory = argv[++i];
+        } else if (strcmp(argv[i], "-e") == 0) {
+            char* hook = argv[++i];
+            char* separator = strchr(hook, '=');
+
+            if (separator == NULL || num_of_hooks == MAX_HOOKS) {
+                usage();
+                return 1;
+            }
+
+            *separator = '\0';
+            hooks[num_of_hooks].message = hook;
+            hooks[num_of_hooks].command = separator + 1;
+            num_of_hooks++;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/polybar_mqueue.%d", directory, getpid());
+
+    if (mkfifo(path, 0600) < 0) {
+        perror("fake-polybar: mkfifo");
+        return 1;
+    }
+
+    // poll is interrupted by these either way, which ends the loop
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    // Every message is printed right away, so it can be read while running
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    int fd = open_ipc_file(path);
+    char message[MAX_MESSAGE_LEN];
+    size_t len = 0;
+    long long arrived_us = 0;
+
+    while (!STOP && fd >= 0) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+        if (poll(&pfd, 1, -1) < 0)
+            continue;
+
+        const ssize_t n = read(fd, message + len, sizeof(message) - 1 - len);
+
+        if (n < 0 && errno == EAGAIN)
+            continue;
+
+        if (n > 0) {
+            if (len == 0)
+                arrived_us = now_us();
+            len += n;
+
+            if (len < sizeof(message) - 1)
+                continue;
+        }
+
+        // A message ends when its writer closes the file, like polybar reads
+        // them
+        if (len > 0) {
+            message[len] = '\0';
+            handle_message(message, arrived_us, hooks, num_of_hooks);
+            len = 0;
+        }
+
+        // Once the writer is gone the file stays readable, so it is opened
+        // again to wait for the next writer
+        if (n <= 0) {
+            close(fd);
+            fd = open_ipc_file(path);
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#!/bin/sh
+# Load test spotify-listener and spotifyctl against the fake MPRIS player on a
+# private session bus, at increasing signal rates.
+#
+# usage: bench/load-test.sh [rate]...
+#
+# Build first with:
+#   make -C src all bench
+#
+# Every rate (1 to 10000 signals per second by default) is sent for DURATION
+# seconds by a new fake player. The signals are shaped with SHAPE (same,
+# status or track), BURST, ARTISTS, METADATA (extra bytes of metadata) and
+# CHURN (name changes per second), see bench/fake-player.c. The listener and
+# the player get their own bus and runtime directory, and the listener writes
+# to a fake bar, so running bars and listeners are not affected.
+#
+# For every rate, this prints the rate the player reached, the signals the
+# listener received, the CPU time it used for them, and how long
+# `spotifyctl status` took while the signals were sent.
+
+ROOT=$(dirname "$0")/..
+BIN=$ROOT/bin
+DURATION=${DURATION:-5}
+SHAPE=${SHAPE:-status}
+BURST=${BURST:-1}
+ARTISTS=${ARTISTS:-1}
+METADATA=${METADATA:-0}
+CHURN=${CHURN:-0}
+RUNS=${RUNS:-20}
+
+. "$ROOT/bench/private-bus.sh"
+
+[ $# -eq 0 ] && set -- 1 10 100 1000 10000
+
+require_bins fake-player spawn-bench spotify-listener spotifyctl
+start_private_bus
+start_draining_bar load
+start_listener
+
+# CPU time of the listener in milliseconds. Its name has no spaces, so the
+# user and system time are the 14th and 15th fields.
+cpu_ms() {
+    awk -v tick="$(getconf CLK_TCK)" '{ print ($14 + $15) * 1000 / tick }' \
+        "/proc/$LISTENER/stat"
+}
+
+signals() {
+    "$BIN/spotifyctl" stats | awk '/^Signals received/ { print $NF }'
+}
+
+printf '%8s %10s %10s %10s %8s %10s %12s %12s\n' "rate" "sent/s" \
+    "received" "cpu (ms)" "cpu %" "us/signal" "status mean" "status p95"
+
+for rate in "$@"; do
+    received_before=$(signals)
+    cpu_before=$(cpu_ms)
+
+    "$BIN/fake-player" -r "$rate" -d "$DURATION" -s "$SHAPE" -b "$BURST" \
+        -a "$ARTISTS" -m "$METADATA" -o "$CHURN" >"$TMP/player.out" &
+    PLAYER=$!
+    PIDS="$PIDS $PLAYER"
+
+    # Measure spotifyctl while the signals are sent
+    sleep 0.2
+    status=$("$BIN/spawn-bench" -n "$RUNS" -- "$BIN/spotifyctl" status)
+    wait "$PLAYER"
+
+    # Let the listener catch up before reading its CPU time
+    sleep 0.5
+
+    require_listener
+
+    received=$(($(signals) - received_before))
+    cpu=$(cpu_ms)
+
+    awk -v rate="$rate" -v player="$(cat "$TMP/player.out")" \
+        -v received="$received" -v before="$cpu_before" -v after="$cpu" \
+        -v duration="$DURATION" -v status="$status" 'BEGIN {
+            match(player, /rate=[0-9.]+/)
+            sent = substr(player, RSTART + 5, RLENGTH - 5)
+            match(status, /mean=[0-9.]+ms/)
+            mean = substr(status, RSTART + 5, RLENGTH - 5)
+            match(status, /p95=[0-9.]+ms/)
+            p95 = substr(status, RSTART + 4, RLENGTH - 4)
+            cpu = after - before
+            printf "%8s %10s %10d %10.1f %8.2f %10.2f %12s %12s\n", rate,
+                   sent, received, cpu, cpu / duration / 10,
+                   (received > 0 ? cpu * 1000 / received : 0), mean, p95
+        }'
+done
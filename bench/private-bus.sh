@@ -0,0 +1,85 @@
+# Helpers for the harnesses that run spotify-listener and the fake players and
+# bars on a private session bus, so running bars and listeners are not
+# affected. Sourced by the harnesses after setting BIN:
+#   . "$ROOT/bench/private-bus.sh"
+#
+# Processes started in the background are added to PIDS, which cleanup kills
+# on exit along with the bus.
+
+PIDS=
+
+# Exit unless every executable is built. Names without a slash are looked up
+# in BIN.
+require_bins() {
+    for exe in "$@"; do
+        case $exe in
+            */*) ;;
+            *) exe=$BIN/$exe ;;
+        esac
+
+        if [ ! -x "$exe" ]; then
+            echo "$exe is missing, see the build steps at the top of $0" >&2
+            exit 1
+        fi
+    done
+}
+
+# Kill everything in PIDS and the bus, and remove TMP
+cleanup() {
+    kill $PIDS 2>/dev/null
+    [ -f "$TMP/bus.pid" ] && kill "$(cat "$TMP/bus.pid")" 2>/dev/null
+    rm -rf "$TMP"
+}
+
+# Start a session bus of its own in TMP, a new temporary directory that is
+# also the runtime directory, with an empty IPC directory for bars in
+# TMP/bars
+start_private_bus() {
+    TMP=$(mktemp -d)
+    mkdir "$TMP/bars"
+    export XDG_RUNTIME_DIR=$TMP
+
+    trap cleanup EXIT
+    trap 'exit 1' INT TERM
+
+    dbus-daemon --session --fork --print-address=3 --print-pid=4 \
+        3>"$TMP/bus.address" 4>"$TMP/bus.pid" || exit 1
+    DBUS_SESSION_BUS_ADDRESS=$(cat "$TMP/bus.address")
+    export DBUS_SESSION_BUS_ADDRESS
+}
+
+# Start a bar named polybar_mqueue.<name> that reads its IPC file as fast as
+# it can
+start_draining_bar() {
+    mkfifo "$TMP/bars/polybar_mqueue.$1"
+    (
+        # cat waits for a writer to open the file, and would outlive the
+        # loop if it wasn't stopped with it
+        trap 'kill $reading 2>/dev/null; exit' TERM
+        while :; do
+            cat "$TMP/bars/polybar_mqueue.$1" &
+            reading=$!
+            wait "$reading"
+        done
+    ) >/dev/null &
+    PIDS="$PIDS $!"
+}
+
+# Start spotify-listener writing to the bars in TMP/bars, logging at the
+# level given (warning by default) to TMP/listener.log, and set LISTENER
+start_listener() {
+    "$BIN/spotify-listener" --ipc-dir "$TMP/bars" \
+        --log-level "${1:-warning}" >"$TMP/listener.log" 2>&1 &
+    LISTENER=$!
+    PIDS="$PIDS $LISTENER"
+    sleep 0.5
+}
+
+# Exit with the listener's output if it is no longer running
+require_listener() {
+    if ! kill -0 "$LISTENER" 2>/dev/null; then
+        echo "spotify-listener exited, see its output:" >&2
+        cat "$TMP/listener.log" >&2
+        exit 1
+    fi
+}
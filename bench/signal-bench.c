@@ -0,0 +1,182 @@
+// Measure the CPU time spotify-listener spends per PropertiesChanged signal.
+//
+// usage: signal-bench [-n signals] -- spotify-listener [args]...
+//
+// The listener is started with stdout and stderr sent to /dev/null. After one
+// warmup signal, the same track and playback status is emitted repeatedly, so
+// every signal is decoded but none of them changes the state shown on polybar.
+// The listener's user and system time are read from /proc/<pid>/stat before
+// the signals are sent and once it has gone idle again.
+
+#include <dbus-1.0/dbus/dbus.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Time the listener gets to connect and to go idle between samples
+#define SETTLE_US 200000
+
+static void append_string_entry(DBusMessageIter* dict, const char* key,
+                                const char* value) {
+    DBusMessageIter entry, variant;
+
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "s", &variant);
+    dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &value);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+// Build the signal spotify sends when a track starts playing
+static DBusMessage* new_properties_changed() {
+    const char* iface = "org.mpris.MediaPlayer2.Player";
+    const char* metadata_key = "Metadata";
+    DBusMessageIter iter, changed, entry, variant, metadata;
+
+    DBusMessage* msg = dbus_message_new_signal(
+        "/org/mpris/MediaPlayer2", "org.freedesktop.DBus.Properties",
+        "PropertiesChanged");
+
+    dbus_message_iter_init_append(msg, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &iface);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &changed);
+
+    dbus_message_iter_open_container(&changed, DBUS_TYPE_DICT_ENTRY, NULL,
+                                     &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &metadata_key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "a{sv}",
+                                     &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "{sv}",
+                                     &metadata);
+    append_string_entry(&metadata, "mpris:trackid", "spotify:track:bench");
+    append_string_entry(&metadata, "xesam:title", "Sing For The Moment");
+    dbus_message_iter_close_container(&variant, &metadata);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(&changed, &entry);
+
+    append_string_entry(&changed, "PlaybackStatus", "Playing");
+    dbus_message_iter_close_container(&iter, &changed);
+
+    return msg;
+}
+
+// User and system time of a process in clock ticks
+static long long cpu_ticks(const pid_t pid) {
+    char path[64];
+    char buf[1024];
+    unsigned long long utime, stime;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    const size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[len] = '\0';
+
+    // The command name can contain spaces, so start after its closing paren.
+    // utime and stime are the 12th and 13th fields after it.
+    const char* fields = strrchr(buf, ')');
+    if (fields == NULL ||
+        sscanf(fields + 2,
+               "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime,
+               &stime) != 2)
+        return -1;
+
+    return (long long)(utime + stime);
+}
+
+// Wait until the process stops using CPU, and return its CPU time
+static long long idle_cpu_ticks(const pid_t pid) {
+    long long last = cpu_ticks(pid);
+    long long ticks;
+
+    for (;;) {
+        usleep(SETTLE_US);
+        if ((ticks = cpu_ticks(pid)) == last)
+            return ticks;
+        last = ticks;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int signals = 20000;
+    int i = 1;
+
+    for (; i < argc && strcmp(argv[i], "--") != 0; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            signals = atoi(argv[++i]);
+    }
+
+    if (i + 1 >= argc || signals <= 0) {
+        fputs("usage: signal-bench [-n signals] -- spotify-listener "
+              "[args]...\n",
+              stderr);
+        return 1;
+    }
+
+    char* const* command = argv + i + 1;
+
+    DBusError err;
+    dbus_error_init(&err);
+
+    DBusConnection* connection = dbus_bus_get(DBUS_BUS_SESSION, &err);
+    if (connection == NULL) {
+        fprintf(stderr, "signal-bench: %s\n", err.message);
+        return 1;
+    }
+
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("signal-bench");
+        return 1;
+    }
+
+    if (pid == 0) {
+        const int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execvp(command[0], command);
+        _exit(127);
+    }
+
+    DBusMessage* msg = new_properties_changed();
+
+    // Let the listener add its matches, then show the track once so the
+    // measured signals don't change anything
+    usleep(SETTLE_US);
+    dbus_connection_send(connection, msg, NULL);
+    dbus_connection_flush(connection);
+
+    const long long start = idle_cpu_ticks(pid);
+
+    for (int j = 0; j < signals; j++)
+        dbus_connection_send(connection, msg, NULL);
+    dbus_connection_flush(connection);
+
+    const long long end = idle_cpu_ticks(pid);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    dbus_message_unref(msg);
+
+    if (start < 0 || end < 0) {
+        fputs("signal-bench: the listener exited\n", stderr);
+        return 1;
+    }
+
+    const double cpu_ms = (end - start) * 1000.0 / sysconf(_SC_CLK_TCK);
+
+    printf("signals=%d cpu=%.1fms per_signal=%.2fus\n", signals, cpu_ms,
+           cpu_ms * 1000.0 / signals);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#!/bin/sh
+# Soak spotify-listener with signals, players coming and going and bars
+# appearing and disappearing, and fail if its memory or file descriptors grow.
+#
+# usage: bench/soak-test.sh
+#
+# Build first with:
+#   make -C src all bench
+#
+# The fake player sends RATE signals per second (2000 by default) of SHAPE
+# (track by default, see bench/fake-player.c) for DURATION seconds (1800 by
+# default, so millions of signals), changing its name's owner CHURN times per
+# second, which the listener sees as NameOwnerChanged. Meanwhile a fake bar is
+# started and stopped every BAR_CYCLE seconds, next to one that stays.
+#
+# The listener's RSS, heap in use (from mallinfo2 in `spotifyctl stats`) and
+# open file descriptors are printed every SAMPLE seconds. They are compared
+# after a WARMUP seconds long run of the same load and after the soak, both
+# times once the player and the extra bar are gone. The test fails if the RSS
+# grew by more than RSS_GROWTH KiB, the heap by more than HEAP_GROWTH KiB or
+# the file descriptors by more than FD_GROWTH.
+
+ROOT=$(dirname "$0")/..
+BIN=$ROOT/bin
+RATE=${RATE:-2000}
+SHAPE=${SHAPE:-track}
+DURATION=${DURATION:-1800}
+CHURN=${CHURN:-5}
+BAR_CYCLE=${BAR_CYCLE:-1}
+SAMPLE=${SAMPLE:-60}
+WARMUP=${WARMUP:-30}
+RSS_GROWTH=${RSS_GROWTH:-1024}
+HEAP_GROWTH=${HEAP_GROWTH:-64}
+FD_GROWTH=${FD_GROWTH:-0}
+
+. "$ROOT/bench/private-bus.sh"
+
+require_bins fake-player fake-polybar spotify-listener spotifyctl
+start_private_bus
+
+"$BIN/fake-polybar" -d "$TMP/bars" >/dev/null &
+PIDS="$PIDS $!"
+sleep 0.2
+
+start_listener error
+
+# Run the load for some seconds, with a bar appearing and disappearing
+run_load() {
+    (
+        trap 'kill $cycled $sleeping 2>/dev/null; exit' TERM
+        while :; do
+            "$BIN/fake-polybar" -d "$TMP/bars" >/dev/null &
+            cycled=$!
+            # Waiting lets the trap stop the loop without waiting for sleep
+            sleep "$BAR_CYCLE" &
+            sleeping=$!
+            wait "$sleeping"
+            kill "$cycled"
+            wait "$cycled"
+        done
+    ) &
+    BARS=$!
+    PIDS="$PIDS $BARS"
+
+    "$BIN/fake-player" -r "$RATE" -s "$SHAPE" -o "$CHURN" -d "$1" \
+        >"$TMP/player.out" &
+    PLAYER=$!
+    PIDS="$PIDS $PLAYER"
+}
+
+# Wait for the load to end and the listener to handle the last of it
+stop_load() {
+    wait "$PLAYER"
+    kill "$BARS"
+    wait "$BARS"
+    sleep 1
+
+    require_listener
+}
+
+# Print the time, signals received, RSS (KiB), heap (KiB) and open fds
+sample() {
+    "$BIN/spotifyctl" stats | awk -v elapsed="$1" \
+        -v rss="$(awk '/^VmRSS:/ { print $2 }' "/proc/$LISTENER/status")" \
+        -v fds="$(ls "/proc/$LISTENER/fd" | wc -l)" '
+        /^Signals received/ { signals = $NF }
+        /^Heap in use/ { heap = $NF / 1024 }
+        END { printf "%8s %12d %10d %10d %6d\n", elapsed, signals, rss, heap,
+                     fds }'
+}
+
+printf '%8s %12s %10s %10s %6s\n' "time (s)" "signals" "rss (KiB)" \
+    "heap (KiB)" "fds"
+
+run_load "$WARMUP"
+stop_load
+baseline=$(sample "baseline")
+echo "$baseline"
+
+run_load "$DURATION"
+elapsed=0
+while [ "$elapsed" -lt "$DURATION" ] && kill -0 "$PLAYER" 2>/dev/null; do
+    sleep "$SAMPLE"
+    elapsed=$((elapsed + SAMPLE))
+    sample "$elapsed"
+done
+stop_load
+final=$(sample "final")
+echo "$final"
+
+echo "$baseline
+$final" | awk -v rss_growth="$RSS_GROWTH" -v heap_growth="$HEAP_GROWTH" \
+    -v fd_growth="$FD_GROWTH" '
+    NR == 1 { rss = $3; heap = $4; fds = $5 }
+    NR == 2 {
+        printf "grew by %d KiB of RSS, %d KiB of heap and %d fds\n",
+               $3 - rss, $4 - heap, $5 - fds
+        failed = $3 - rss > rss_growth || $4 - heap > heap_growth ||
+                 $5 - fds > fd_growth
+        print(failed ? "FAILED" : "PASSED")
+        exit failed
+    }'
@@ -0,0 +1,171 @@
+// Run a command repeatedly and report its wall time, CPU time, page faults,
+// context switches and peak RSS.
+//
+// usage: spawn-bench [-n runs] [-w warmup runs] [-o file] -- command [args]...
+//
+// Each run is forked and executed with stdout and stderr sent to /dev/null.
+// The wall time covers fork to exit and the rest is the rusage reported by
+// wait4 for that child alone. The summary prints the wall time percentiles,
+// the means of the rest and the largest RSS. -o also writes every run to
+// file as CSV.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    double wall_ms;
+    double user_ms;
+    double sys_ms;
+    long minor_faults;
+    long major_faults;
+    long context_switches;
+    long max_rss_kb;
+    int status;
+} Run;
+
+static double timeval_ms(const struct timeval* tv) {
+    return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int run_once(char* const argv[], Run* run) {
+    struct rusage usage;
+    const double start = now_ms();
+    const pid_t pid = fork();
+
+    if (pid < 0)
+        return 0;
+
+    if (pid == 0) {
+        const int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    if (wait4(pid, &run->status, 0, &usage) != pid)
+        return 0;
+
+    run->wall_ms = now_ms() - start;
+    run->user_ms = timeval_ms(&usage.ru_utime);
+    run->sys_ms = timeval_ms(&usage.ru_stime);
+    run->minor_faults = usage.ru_minflt;
+    run->major_faults = usage.ru_majflt;
+    run->context_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+    run->max_rss_kb = usage.ru_maxrss;
+
+    return 1;
+}
+
+static int compare_double(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+    int runs = 200;
+    int warmup = 10;
+    const char* csv_path = NULL;
+    int i = 1;
+
+    for (; i < argc && strcmp(argv[i], "--") != 0; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+    }
+
+    if (i + 1 >= argc || runs <= 0) {
+        fputs("usage: spawn-bench [-n runs] [-w warmup runs] [-o file] -- "
+              "command [args]...\n",
+              stderr);
+        return 1;
+    }
+
+    FILE* csv = NULL;
+
+    if (csv_path != NULL) {
+        if (!(csv = fopen(csv_path, "w"))) {
+            perror("spawn-bench");
+            return 1;
+        }
+        fputs("run,wall_ms,user_ms,sys_ms,minor_faults,major_faults,"
+              "context_switches,max_rss_kb,status\n",
+              csv);
+    }
+
+    char* const* command = argv + i + 1;
+    double* wall = (double*)malloc(runs * sizeof(double));
+    long max_rss_kb = 0;
+    double user_ms = 0, sys_ms = 0;
+    long minor_faults = 0, major_faults = 0, context_switches = 0;
+    int failures = 0;
+    Run run;
+
+    for (int j = 0; j < warmup; j++)
+        run_once(command, &run);
+
+    for (int j = 0; j < runs; j++) {
+        if (!run_once(command, &run)) {
+            perror("spawn-bench");
+            return 1;
+        }
+
+        if (!WIFEXITED(run.status) || WEXITSTATUS(run.status) != 0)
+            failures++;
+
+        wall[j] = run.wall_ms;
+        user_ms += run.user_ms;
+        sys_ms += run.sys_ms;
+        minor_faults += run.minor_faults;
+        major_faults += run.major_faults;
+        context_switches += run.context_switches;
+        if (run.max_rss_kb > max_rss_kb)
+            max_rss_kb = run.max_rss_kb;
+
+        if (csv != NULL)
+            fprintf(csv, "%d,%.3f,%.3f,%.3f,%ld,%ld,%ld,%ld,%d\n", j,
+                    run.wall_ms, run.user_ms, run.sys_ms, run.minor_faults,
+                    run.major_faults, run.context_switches, run.max_rss_kb,
+                    run.status);
+    }
+
+    if (csv != NULL && fclose(csv) != 0) {
+        perror("spawn-bench");
+        return 1;
+    }
+
+    qsort(wall, runs, sizeof(double), compare_double);
+
+    double sum = 0;
+    for (int j = 0; j < runs; j++)
+        sum += wall[j];
+
+    // The scripts in bench/ parse this line, so new fields go at the end
+    printf("runs=%d failures=%d mean=%.3fms p50=%.3fms p95=%.3fms "
+           "max_rss=%ldKiB user=%.3fms sys=%.3fms minflt=%.1f majflt=%.1f "
+           "csw=%.1f\n",
+           runs, failures, sum / runs, wall[runs / 2], wall[runs * 95 / 100],
+           max_rss_kb, user_ms / runs, sys_ms / runs,
+           (double)minor_faults / runs, (double)major_faults / runs,
+           (double)context_switches / runs);
+
+    free(wall);
+
+    return failures != 0;
+}
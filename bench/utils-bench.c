@@ -0,0 +1,378 @@
+// Microbenchmarks for the string helpers of utils.c, format_output and the
+// generated metadata decoders, which run on every spotifyctl invocation and
+// every signal the listener receives.
+//
+// usage: utils-bench [-t milliseconds] [filter]
+//
+// Every case is run with twice as many iterations until a run takes at least
+// -t milliseconds (200 by default), and the time and the allocations of that
+// run are reported per iteration. Only the cases whose name contains filter
+// are run. The inputs range from what polybar configurations usually look
+// like to adversarial ones: formats with 100 tokens, 4 KiB titles and
+// metadata with 50 keys where the keys that are read come last.
+// format_output allocates from an arena that is reset after every call, and
+// format_output/short-malloc is the short case with malloc instead.
+//
+// The allocations are counted by alloc-count.c, which is linked in. The
+// metadata is built with libdbus and read back with bus_message_demarshal,
+// so the decoder cases are skipped with the sd-bus backend.
+
+#include <dbus-1.0/dbus/dbus.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/spotifyctl.h"
+#include "../include/utils.h"
+#include "mpris-player.h"
+
+// Length of the long titles and adversarial formats
+#define LONG_LEN 4096
+
+// Number of tokens in the long formats
+#define MANY_TOKENS 100
+
+// Number of keys in the large metadata, including the ones that are read
+#define MANY_KEYS 50
+
+typedef struct {
+    const char* name;
+    void (*run)();
+} Case;
+
+// Counts the allocations of the calling thread, see alloc-count.c
+unsigned long alloc_count();
+
+// Results that must not be optimized away
+static volatile int SINK;
+
+static char LONG_TITLE[LONG_LEN + 1];
+static char PERCENTS[LONG_LEN + 1];
+static char MANY_TOKENS_FORMAT[MANY_TOKENS * 20 + 1];
+
+// Reset after every format_output, like the listener resets its arena after
+// every record
+static Arena FORMAT_ARENA;
+
+static BusMessage* SPOTIFY_REPLY;
+static BusMessage* MANY_KEYS_REPLY;
+static BusMessage* MANY_KEYS_SIGNAL;
+
+static const char* ARTIST = "Eminem";
+static const char* TITLE = "Sing For The Moment";
+static const char* FORMAT = "%artist%: %title%";
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*************** Cases ***************/
+
+static void replace_short() { free(str_replace_all(FORMAT, "%title%", TITLE)); }
+
+static void replace_many_tokens() {
+    free(str_replace_all(MANY_TOKENS_FORMAT, "%title%", TITLE));
+}
+
+static void replace_long_title() {
+    free(str_replace_all(FORMAT, "%title%", LONG_TITLE));
+}
+
+static void trunc_short() { free(str_trunc(TITLE, 30, "...")); }
+
+static void trunc_long_title() { free(str_trunc(LONG_TITLE, 30, "...")); }
+
+static void matches_short() { SINK = num_of_matches(FORMAT, "%title%"); }
+
+static void matches_many_tokens() {
+    SINK = num_of_matches(MANY_TOKENS_FORMAT, "%title%");
+}
+
+static void matches_percents() { SINK = num_of_matches(PERCENTS, "%title%"); }
+
+static void join_path_ipc() {
+    free(join_path("/tmp", "polybar_mqueue.123456"));
+}
+
+static void format_short() {
+    format_output(&FORMAT_ARENA, ARTIST, TITLE, INT_MAX, INT_MAX, INT_MAX,
+                  FORMAT, "...");
+    arena_reset(&FORMAT_ARENA);
+}
+
+static void format_short_malloc() {
+    free(format_output(NULL, ARTIST, TITLE, INT_MAX, INT_MAX, INT_MAX, FORMAT,
+                       "..."));
+}
+
+static void format_limits() {
+    format_output(&FORMAT_ARENA, ARTIST, TITLE, 10, 20, 30, FORMAT, "...");
+    arena_reset(&FORMAT_ARENA);
+}
+
+static void format_long_title() {
+    format_output(&FORMAT_ARENA, ARTIST, LONG_TITLE, 10, 20, 30, FORMAT,
+                  "...");
+    arena_reset(&FORMAT_ARENA);
+}
+
+static void format_many_tokens() {
+    format_output(&FORMAT_ARENA, ARTIST, TITLE, INT_MAX, INT_MAX, INT_MAX,
+                  MANY_TOKENS_FORMAT, "...");
+    arena_reset(&FORMAT_ARENA);
+}
+
+static void metadata_spotify() {
+    MprisMetadata metadata;
+    SINK = mpris_player_read_metadata_reply(SPOTIFY_REPLY, &metadata);
+}
+
+static void metadata_many_keys() {
+    MprisMetadata metadata;
+    SINK = mpris_player_read_metadata_reply(MANY_KEYS_REPLY, &metadata);
+}
+
+static void properties_many_keys() {
+    MprisPlayerProperties properties;
+    SINK = mpris_player_read_properties_changed(MANY_KEYS_SIGNAL, &properties);
+}
+
+static const Case CASES[] = {
+    {"str_replace_all/short", replace_short},
+    {"str_replace_all/100-tokens", replace_many_tokens},
+    {"str_replace_all/4k-title", replace_long_title},
+    {"str_trunc/short", trunc_short},
+    {"str_trunc/4k-title", trunc_long_title},
+    {"num_of_matches/short", matches_short},
+    {"num_of_matches/100-tokens", matches_many_tokens},
+    {"num_of_matches/4k-percents", matches_percents},
+    {"join_path/ipc", join_path_ipc},
+    {"format_output/short", format_short},
+    {"format_output/short-malloc", format_short_malloc},
+    {"format_output/limits", format_limits},
+    {"format_output/4k-title", format_long_title},
+    {"format_output/100-tokens", format_many_tokens},
+    {"read_metadata/spotify", metadata_spotify},
+    {"read_metadata/50-keys", metadata_many_keys},
+    {"read_properties_changed/50-keys", properties_many_keys},
+};
+
+/*************** Inputs ***************/
+
+static void append_entry(DBusMessageIter* dict, const char* key,
+                         const char* signature, const void* value) {
+    DBusMessageIter entry, variant;
+
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature,
+                                     &variant);
+
+    if (signature[0] == DBUS_TYPE_ARRAY) {
+        DBusMessageIter array;
+
+        dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s",
+                                         &array);
+        dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, value);
+        dbus_message_iter_close_container(&variant, &array);
+    } else {
+        dbus_message_iter_append_basic(&variant, signature[0], value);
+    }
+
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+// Append the metadata of a track as a variant, with extra unknown keys
+// before the ones spotify sends
+static void append_metadata(DBusMessageIter* iter, const int extra_keys) {
+    DBusMessageIter variant, dict;
+    const char* trackid = "/com/spotify/track/0jdny0dhgjUwoIp5GkqEaA";
+    const char* art_url = "https://i.scdn.co/image/ab67616d0000b273";
+    const char* album = "The Eminem Show";
+    const char* url = "https://open.spotify.com/track/0jdny0dhgjUwoIp5GkqEaA";
+    const uint64_t length = 339866000;
+    const int32_t number = 17;
+    const double rating = 0.75;
+
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a{sv}",
+                                     &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "{sv}", &dict);
+
+    for (int i = 0; i < extra_keys; i++) {
+        char key[32];
+        const char* value = key;
+
+        snprintf(key, sizeof(key), "xesam:extra%d", i);
+        append_entry(&dict, key, i % 2 == 0 ? "s" : "as", &value);
+    }
+
+    append_entry(&dict, "mpris:trackid", "s", &trackid);
+    append_entry(&dict, "mpris:length", "t", &length);
+    append_entry(&dict, "mpris:artUrl", "s", &art_url);
+    append_entry(&dict, "xesam:album", "s", &album);
+    append_entry(&dict, "xesam:albumArtist", "as", &ARTIST);
+    append_entry(&dict, "xesam:autoRating", "d", &rating);
+    append_entry(&dict, "xesam:trackNumber", "i", &number);
+    append_entry(&dict, "xesam:url", "s", &url);
+    append_entry(&dict, "xesam:artist", "as", &ARTIST);
+    append_entry(&dict, "xesam:title", "s", &TITLE);
+
+    dbus_message_iter_close_container(&variant, &dict);
+    dbus_message_iter_close_container(iter, &variant);
+}
+
+// Serialize a message built with libdbus and read it back with the backend
+static BusMessage* to_bus_message(DBusMessage* message) {
+    BusError err;
+    char* data;
+    int len;
+
+    bus_error_init(&err);
+    dbus_message_set_serial(message, 1);
+
+    if (!dbus_message_marshal(message, &data, &len)) {
+        fputs("utils-bench: Out of memory\n", stderr);
+        exit(1);
+    }
+
+    BusMessage* bus_message = bus_message_demarshal(data, len, &err);
+
+    if (bus_message == NULL)
+        bus_error_free(&err);
+
+    dbus_free(data);
+    dbus_message_unref(message);
+
+    return bus_message;
+}
+
+static BusMessage* metadata_reply(const int extra_keys) {
+    DBusMessage* message = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    DBusMessageIter iter;
+
+    dbus_message_set_reply_serial(message, 1);
+    dbus_message_iter_init_append(message, &iter);
+    append_metadata(&iter, extra_keys);
+
+    return to_bus_message(message);
+}
+
+static BusMessage* properties_changed(const int extra_keys) {
+    DBusMessage* message = dbus_message_new_signal(
+        "/org/mpris/MediaPlayer2", "org.freedesktop.DBus.Properties",
+        "PropertiesChanged");
+    DBusMessageIter iter, dict, entry;
+    const char* iface = "org.mpris.MediaPlayer2.Player";
+    const char* metadata = "Metadata";
+    const char* status = "Playing";
+
+    dbus_message_iter_init_append(message, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &iface);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &dict);
+
+    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL,
+                                     &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &metadata);
+    append_metadata(&entry, extra_keys);
+    dbus_message_iter_close_container(&dict, &entry);
+    append_entry(&dict, "PlaybackStatus", "s", &status);
+
+    dbus_message_iter_close_container(&iter, &dict);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &dict);
+    dbus_message_iter_close_container(&iter, &dict);
+
+    return to_bus_message(message);
+}
+
+static void create_inputs() {
+    for (int i = 0; i < LONG_LEN; i++)
+        LONG_TITLE[i] = TITLE[i % strlen(TITLE)];
+
+    // Almost a token at every position
+    memset(PERCENTS, '%', LONG_LEN);
+
+    for (int i = 0; i < MANY_TOKENS / 2; i++)
+        strcat(MANY_TOKENS_FORMAT, "%artist% - %title% | ");
+
+    // Spotify sends 10 keys, which are read
+    SPOTIFY_REPLY = metadata_reply(0);
+    MANY_KEYS_REPLY = metadata_reply(MANY_KEYS - 10);
+    MANY_KEYS_SIGNAL = properties_changed(MANY_KEYS - 10);
+
+    // The keys after the unknown ones must be found, or the decoder cases
+    // measure nothing
+    MprisMetadata metadata;
+
+    if (MANY_KEYS_REPLY != NULL &&
+        (!mpris_player_read_metadata_reply(MANY_KEYS_REPLY, &metadata) ||
+         !(metadata.present & MPRIS_METADATA_HAS_XESAM_TITLE) ||
+         strcmp(metadata.xesam_title, TITLE) != 0)) {
+        fputs("utils-bench: The metadata isn't decoded\n", stderr);
+        exit(1);
+    }
+}
+
+/*************** Main ***************/
+
+int main(int argc, char* argv[]) {
+    long long min_ns = 200 * 1000000LL;
+    const char* filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            min_ns = atoll(argv[++i]) * 1000000LL;
+        } else if (argv[i][0] != '-' && filter == NULL) {
+            filter = argv[i];
+        } else {
+            fputs("usage: utils-bench [-t milliseconds] [filter]\n", stderr);
+            return 1;
+        }
+    }
+
+    create_inputs();
+
+    printf("%-34s %12s %12s %10s\n", "case", "iterations", "ns/op",
+           "allocs/op");
+
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(Case); i++) {
+        const Case* c = &CASES[i];
+
+        if (filter != NULL && strstr(c->name, filter) == NULL)
+            continue;
+
+        if (strncmp(c->name, "read_", 5) == 0 && SPOTIFY_REPLY == NULL) {
+            printf("%-34s %12s\n", c->name, "skipped");
+            continue;
+        }
+
+        long iterations = 1;
+        long long elapsed_ns;
+        unsigned long allocations;
+
+        while (TRUE) {
+            const unsigned long allocations_before = alloc_count();
+            const long long started_ns = now_ns();
+
+            for (long j = 0; j < iterations; j++)
+                c->run();
+
+            elapsed_ns = now_ns() - started_ns;
+            allocations = alloc_count() - allocations_before;
+
+            if (elapsed_ns >= min_ns)
+                break;
+            iterations *= 2;
+        }
+
+        printf("%-34s %12ld %12.1f %10.2f\n", c->name, iterations,
+               (double)elapsed_ns / iterations,
+               (double)allocations / iterations);
+    }
+
+    return 0;
+}
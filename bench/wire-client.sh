@@ -0,0 +1,29 @@
+#!/bin/sh
+# Compare spotifyctl talking to the session bus through libdbus with the
+# minimal wire protocol client, dynamically and statically linked.
+#
+# usage: bench/wire-client.sh [spotifyctl arguments]
+#
+# Build first with:
+#   make -C src bench spotifyctl-static
+#   make -C src spotifyctl WIRE_CLIENT=1 BIN_DIR=../bin/wire ODIR=../obj/wire
+#
+# Spotify (or another org.mpris.MediaPlayer2.spotify player) must be running
+# on the session bus. The command defaults to 'status'. Player commands are
+# sent with --dbus so they don't go through spotify-listener.
+
+ROOT=$(dirname "$0")/..
+BIN=$ROOT/bin
+RUNS=${RUNS:-200}
+
+[ $# -eq 0 ] && set -- status
+
+for exe in "$BIN/spotifyctl" "$BIN/wire/spotifyctl" "$BIN/spotifyctl-static"; do
+    if [ ! -x "$exe" ]; then
+        echo "$exe is missing, see the build steps at the top of $0" >&2
+        continue
+    fi
+
+    printf '%-28s ' "${exe#$BIN/}"
+    "$BIN/spawn-bench" -n "$RUNS" -- "$exe" --dbus "$@"
+done
@@ -0,0 +1,969 @@
+// Generate typed decoders and method call constructors for the MPRIS Player
+// interface.
+//
+// usage: mpris-gen interface.xml metadata.keys output
+//
+// Reads the introspection XML of org.mpris.MediaPlayer2.Player and a list of
+// metadata keys with the signature of their values, and writes output.h and
+// output.c. The generated code reads messages through the bus interface in
+// utils.h:
+//
+// - Property names and metadata keys are dispatched with a switch over a
+//   perfect hash of the known names, which is found when generating.
+// - The signature of every value is compared with a constant before it is
+//   read, so messages are never walked generically.
+// - Every method, and Properties.Get of every property, has a constructor with
+//   the object path, interface and argument types built in.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ITEMS 32
+#define MAX_ARGS 8
+#define MAX_NAME 128
+
+// Signature of the property that is decoded with the metadata key list
+#define METADATA_SIGNATURE "a{sv}"
+
+typedef struct {
+    char name[MAX_NAME];
+    char type[MAX_NAME];
+    char direction[MAX_NAME];
+} Arg;
+
+/**
+ * A method, signal, property or metadata key
+ */
+typedef struct {
+    char name[MAX_NAME];
+    char type[MAX_NAME];
+    Arg args[MAX_ARGS];
+    int num_of_args;
+} Item;
+
+typedef struct {
+    Item items[MAX_ITEMS];
+    int count;
+} ItemList;
+
+/**
+ * A signature that is read into a C variable
+ */
+typedef struct {
+    const char* signature;
+    char type;
+    const char* c_type;
+    // Arrays are read as their first element
+    int first_of_array;
+} TypeInfo;
+
+static const TypeInfo TYPES[] = {
+    {"s", 's', "const char*", 0},  {"o", 'o', "const char*", 0},
+    {"as", 's', "const char*", 1}, {"ao", 'o', "const char*", 1},
+    {"x", 'x', "int64_t", 0},      {"t", 't', "uint64_t", 0},
+    {"i", 'i', "int32_t", 0},      {"u", 'u', "uint32_t", 0},
+    {"d", 'd', "double", 0},       {"b", 'b', "dbus_bool_t", 0},
+};
+
+/**
+ * Perfect hash of a set of names:
+ * (len * len_mult + name[first] * char_mult + name[len - 1 - last]) % size
+ */
+typedef struct {
+    unsigned int len_mult;
+    unsigned int char_mult;
+    size_t first;
+    size_t last;
+    unsigned int size;
+    size_t min_len;
+    size_t max_len;
+} Hash;
+
+static char OBJECT_PATH[MAX_NAME];
+static char INTERFACE[MAX_NAME];
+static ItemList METHODS, SIGNALS, PROPERTIES, KEYS;
+
+static void die(const char* message, const char* detail) {
+    fprintf(stderr, "mpris-gen: %s%s\n", message, detail);
+    exit(1);
+}
+
+static char* read_file(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        die("cannot open ", path);
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+
+    char* buf = (char*)malloc(size + 1);
+    if (fread(buf, 1, size, file) != (size_t)size)
+        die("cannot read ", path);
+    buf[size] = '\0';
+    fclose(file);
+
+    return buf;
+}
+
+static void copy_name(char* dest, const char* src, const size_t len) {
+    if (len >= MAX_NAME)
+        die("name too long: ", src);
+    memcpy(dest, src, len);
+    dest[len] = '\0';
+}
+
+static Item* add_item(ItemList* list, const char* name, const char* type) {
+    if (list->count == MAX_ITEMS)
+        die("too many items at ", name);
+
+    Item* item = &list->items[list->count++];
+    memset(item, 0, sizeof(Item));
+    copy_name(item->name, name, strlen(name));
+    copy_name(item->type, type, strlen(type));
+
+    return item;
+}
+
+/**
+ * Get the value of an attribute of a tag, or "" if it is missing
+ */
+static void get_attribute(const char* attrs, const size_t attrs_len,
+                          const char* name, char* value) {
+    const size_t name_len = strlen(name);
+    value[0] = '\0';
+
+    for (size_t i = 1; i + name_len + 2 < attrs_len; i++) {
+        const char* attr = attrs + i;
+
+        if (strchr(" \t\n", attrs[i - 1]) != NULL &&
+            strncmp(attr, name, name_len) == 0 && attr[name_len] == '=' &&
+            attr[name_len + 1] == '"') {
+            const char* start = attr + name_len + 2;
+            const char* end = memchr(start, '"', attrs + attrs_len - start);
+            if (end == NULL)
+                die("unterminated attribute ", name);
+            copy_name(value, start, end - start);
+            return;
+        }
+    }
+}
+
+/**
+ * Read the node path, and the methods, signals and properties of the first
+ * interface
+ */
+static void parse_xml(const char* xml) {
+    const char* pos = xml;
+    Item* member = NULL;
+    int in_interface = 0;
+    int interfaces = 0;
+
+    while ((pos = strchr(pos, '<')) != NULL) {
+        // Skip comments and declarations
+        if (strncmp(pos, "<!--", 4) == 0) {
+            if ((pos = strstr(pos, "-->")) == NULL)
+                die("unterminated comment", "");
+            continue;
+        } else if (pos[1] == '!' || pos[1] == '?') {
+            pos++;
+            continue;
+        }
+
+        const char* end = strchr(pos, '>');
+        if (end == NULL)
+            die("unterminated tag", "");
+
+        const int closing = pos[1] == '/';
+        const char* tag = pos + (closing ? 2 : 1);
+        const size_t tag_len = strcspn(tag, " \t\n/>");
+        const char* attrs = tag + tag_len;
+        const size_t attrs_len = end - attrs;
+        char name[MAX_NAME];
+        char type[MAX_NAME];
+
+        get_attribute(attrs, attrs_len, "name", name);
+        get_attribute(attrs, attrs_len, "type", type);
+
+#define TAG_IS(str) (tag_len == strlen(str) && strncmp(tag, str, tag_len) == 0)
+        if (closing) {
+            if (TAG_IS("interface"))
+                in_interface = 0;
+            else if (TAG_IS("method") || TAG_IS("signal"))
+                member = NULL;
+        } else if (TAG_IS("node")) {
+            if (OBJECT_PATH[0] == '\0')
+                strcpy(OBJECT_PATH, name);
+        } else if (TAG_IS("interface")) {
+            // Only the first interface is generated
+            in_interface = interfaces++ == 0;
+            if (in_interface)
+                strcpy(INTERFACE, name);
+        } else if (in_interface && (TAG_IS("method") || TAG_IS("signal"))) {
+            member = add_item(TAG_IS("method") ? &METHODS : &SIGNALS, name, "");
+
+            // <method name="Next"/> has no arguments
+            if (end[-1] == '/')
+                member = NULL;
+        } else if (in_interface && TAG_IS("arg") && member != NULL) {
+            if (member->num_of_args == MAX_ARGS)
+                die("too many arguments in ", member->name);
+
+            Arg* arg = &member->args[member->num_of_args++];
+            strcpy(arg->name, name);
+            strcpy(arg->type, type);
+            get_attribute(attrs, attrs_len, "direction", arg->direction);
+        } else if (in_interface && TAG_IS("property")) {
+            add_item(&PROPERTIES, name, type);
+        }
+#undef TAG_IS
+
+        pos = end + 1;
+    }
+
+    if (OBJECT_PATH[0] == '\0' || INTERFACE[0] == '\0')
+        die("no node path or interface in the XML", "");
+}
+
+/**
+ * Read lines of 'key signature', skipping blank lines and # comments
+ */
+static void parse_keys(char* keys) {
+    for (char* line = strtok(keys, "\n"); line != NULL;
+         line = strtok(NULL, "\n")) {
+        char key[MAX_NAME];
+        char type[MAX_NAME];
+
+        if (line[0] == '#' || strspn(line, " \t") == strlen(line))
+            continue;
+
+        if (sscanf(line, "%127s %127s", key, type) != 2)
+            die("invalid key line: ", line);
+
+        add_item(&KEYS, key, type);
+    }
+}
+
+static const TypeInfo* get_type_info(const char* signature) {
+    for (size_t i = 0; i < sizeof(TYPES) / sizeof(TYPES[0]); i++) {
+        if (strcmp(TYPES[i].signature, signature) == 0)
+            return &TYPES[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Whether a property is decoded into a field
+ */
+static int is_decoded(const Item* property) {
+    return strcmp(property->type, METADATA_SIGNATURE) == 0 ||
+           get_type_info(property->type) != NULL;
+}
+
+/**
+ * Whether every argument of a member with the direction has a basic type
+ */
+static int has_basic_args(const Item* member, const char* direction) {
+    for (int i = 0; i < member->num_of_args; i++) {
+        const TypeInfo* info = get_type_info(member->args[i].type);
+
+        if (strcmp(member->args[i].direction, direction) == 0 &&
+            (info == NULL || info->first_of_array))
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Convert a name like xesam:albumArtist or CanGoNext to xesam_album_artist or
+ * can_go_next, or to upper case if upper is set. The result is valid until
+ * the fourth call after this one.
+ */
+static const char* identifier(const char* name, const int upper) {
+    static char bufs[4][MAX_NAME * 2];
+    static int next_buf = 0;
+    char* buf = bufs[next_buf++ % 4];
+    size_t len = 0;
+
+    for (size_t i = 0; name[i] != '\0'; i++) {
+        char c = name[i];
+
+        if (c >= 'A' && c <= 'Z') {
+            // Start a new word, unless one was just started
+            if (len > 0 && buf[len - 1] != '_')
+                buf[len++] = '_';
+            c = c - 'A' + 'a';
+        } else if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))) {
+            c = '_';
+        }
+
+        buf[len++] = upper && c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+    }
+    buf[len] = '\0';
+
+    return buf;
+}
+
+static unsigned int apply_hash(const Hash* hash, const char* name) {
+    const size_t len = strlen(name);
+
+    return (unsigned int)(len * hash->len_mult +
+                          (unsigned char)name[hash->first] * hash->char_mult +
+                          (unsigned char)name[len - 1 - hash->last]) %
+           hash->size;
+}
+
+/**
+ * Find a perfect hash of the names in a list with as few slots as possible
+ */
+static Hash find_hash(const ItemList* list) {
+    Hash hash;
+
+    hash.min_len = MAX_NAME;
+    hash.max_len = 0;
+    for (int i = 0; i < list->count; i++) {
+        const size_t len = strlen(list->items[i].name);
+        if (len < hash.min_len)
+            hash.min_len = len;
+        if (len > hash.max_len)
+            hash.max_len = len;
+    }
+
+    for (hash.size = list->count; hash.size <= 2 * MAX_ITEMS; hash.size++) {
+        for (hash.first = 0; hash.first < hash.min_len; hash.first++) {
+            for (hash.last = 0; hash.last < hash.min_len; hash.last++) {
+                for (hash.len_mult = 0; hash.len_mult < 8; hash.len_mult++) {
+                    for (hash.char_mult = 1; hash.char_mult < 32;
+                         hash.char_mult++) {
+                        unsigned long long used = 0;
+                        int i;
+
+                        for (i = 0; i < list->count; i++) {
+                            const unsigned int h =
+                                apply_hash(&hash, list->items[i].name);
+                            if (used & (1ULL << h))
+                                break;
+                            used |= 1ULL << h;
+                        }
+
+                        if (i == list->count)
+                            return hash;
+                    }
+                }
+            }
+        }
+    }
+
+    die("no perfect hash found", "");
+    return hash;
+}
+
+/**
+ * Write the enum and constants of a set of names
+ */
+static void write_names_h(FILE* h, const ItemList* list, const char* enum_type,
+                          const char* prefix, const char* name_suffix) {
+    fputs("typedef enum {\n", h);
+    for (int i = 0; i < list->count; i++)
+        fprintf(h, "    %s_%s,\n", prefix,
+                identifier(list->items[i].name, 1));
+    fprintf(h, "    %s_UNKNOWN\n} %s;\n\n", prefix, enum_type);
+
+    for (int i = 0; i < list->count; i++) {
+        const Item* item = &list->items[i];
+        const char* upper = identifier(item->name, 1);
+
+        fprintf(h, "#define %s_%s_%s \"%s\"\n", prefix, upper, name_suffix,
+                item->name);
+        fprintf(h, "#define %s_%s_SIGNATURE \"%s\"\n", prefix, upper,
+                item->type);
+    }
+    fputc('\n', h);
+}
+
+/**
+ * Write a struct with a field for every decoded name
+ */
+static void write_struct_h(FILE* h, const ItemList* list, const char* type,
+                           const char* prefix) {
+    fprintf(h, "// Flags of the fields of %s that were read\n", type);
+    for (int i = 0, bit = 0; i < list->count; i++) {
+        if (is_decoded(&list->items[i]))
+            fprintf(h, "#define %s_HAS_%s (1u << %d)\n", prefix,
+                    identifier(list->items[i].name, 1), bit++);
+    }
+
+    fprintf(h,
+            "\ntypedef struct {\n"
+            "    // %s_HAS_* flags of the fields that were read\n"
+            "    unsigned int present;\n",
+            prefix);
+    for (int i = 0; i < list->count; i++) {
+        const Item* item = &list->items[i];
+
+        if (strcmp(item->type, METADATA_SIGNATURE) == 0)
+            fprintf(h, "    MprisMetadata %s;\n", identifier(item->name, 0));
+        else if (get_type_info(item->type) != NULL)
+            fprintf(h, "    %s %s;\n", get_type_info(item->type)->c_type,
+                    identifier(item->name, 0));
+    }
+    fprintf(h, "} %s;\n\n", type);
+}
+
+/**
+ * Write the function looking up the enum value of a name
+ */
+static void write_lookup_c(FILE* c, const ItemList* list,
+                           const char* enum_type, const char* prefix,
+                           const char* function) {
+    const Hash hash = find_hash(list);
+
+    fprintf(c,
+            "%s %s(const char* name) {\n"
+            "    const size_t len = strlen(name);\n\n"
+            "    if (len < %zu || len > %zu)\n"
+            "        return %s_UNKNOWN;\n\n"
+            "    // Perfect hash of the known names\n"
+            "    switch ((len * %u + (unsigned char)name[%zu] * %u +\n"
+            "             (unsigned char)name[len - %zu]) %%\n"
+            "            %u) {\n",
+            enum_type, function, hash.min_len, hash.max_len, prefix,
+            hash.len_mult, hash.first, hash.char_mult, hash.last + 1,
+            hash.size);
+
+    for (unsigned int slot = 0; slot < hash.size; slot++) {
+        for (int i = 0; i < list->count; i++) {
+            const Item* item = &list->items[i];
+
+            if (apply_hash(&hash, item->name) == slot)
+                fprintf(c,
+                        "        case %u:\n"
+                        "            return strcmp(name, %s_%s_%s) == 0\n"
+                        "                       ? %s_%s\n"
+                        "                       : %s_UNKNOWN;\n",
+                        slot, prefix, identifier(item->name, 1),
+                        list == &KEYS ? "KEY" : "NAME", prefix,
+                        identifier(item->name, 1), prefix);
+        }
+    }
+
+    fprintf(c,
+            "        default:\n"
+            "            return %s_UNKNOWN;\n"
+            "    }\n"
+            "}\n\n",
+            prefix);
+}
+
+/**
+ * Write the case of a dict entry reader storing the value of a name
+ */
+static void write_entry_case_c(FILE* c, const Item* item, const char* prefix,
+                               const char* target) {
+    const TypeInfo* info = get_type_info(item->type);
+    const char* upper = identifier(item->name, 1);
+    const char* field = identifier(item->name, 0);
+
+    if (!is_decoded(item))
+        return;
+
+    fprintf(c, "            case %s_%s:\n", prefix, upper);
+
+    if (info == NULL)
+        fprintf(c,
+                "                if (read_variant_metadata(message, "
+                "contents,\n"
+                "                                          &%s->%s))\n",
+                target, field);
+    else
+        fprintf(c,
+                "                if (%s(message, contents,\n"
+                "                        %s_%s_SIGNATURE, '%c',\n"
+                "                        &%s->%s))\n",
+                info->first_of_array ? "read_variant_first"
+                                     : "read_variant_basic",
+                prefix, upper, info->type, target, field);
+
+    fprintf(c,
+            "                    %s->present |= %s_HAS_%s;\n"
+            "                break;\n",
+            target, prefix, upper);
+}
+
+/**
+ * Write the reader of an a{sv} dict into a struct
+ */
+static void write_dict_reader_c(FILE* c, const ItemList* list,
+                                const char* type, const char* prefix,
+                                const char* function, const char* lookup,
+                                const char* target) {
+    fprintf(c,
+            "static dbus_bool_t %s(BusMessage* message, %s* %s) {\n"
+            "    const char* contents;\n"
+            "    const char* name;\n\n"
+            "    memset(%s, 0, sizeof(%s));\n\n"
+            "    if (bus_message_peek_type(message, &contents) != "
+            "BUS_TYPE_ARRAY ||\n"
+            "        strcmp(contents, \"{sv}\") != 0 ||\n"
+            "        !bus_message_enter(message, BUS_TYPE_ARRAY))\n"
+            "        return FALSE;\n\n"
+            "    // The signature guarantees every entry has a string key and "
+            "a variant\n"
+            "    while (bus_message_enter(message, BUS_TYPE_DICT_ENTRY)) {\n"
+            "        bus_message_read_string(message, &name);\n"
+            "        bus_message_peek_type(message, &contents);\n\n"
+            "        switch (%s(name)) {\n",
+            function, type, target, target, type, lookup);
+
+    for (int i = 0; i < list->count; i++)
+        write_entry_case_c(c, &list->items[i], prefix, target);
+
+    fputs("            default:\n"
+          "                break;\n"
+          "        }\n\n"
+          "        bus_message_exit(message);\n"
+          "    }\n\n"
+          "    bus_message_exit(message);\n\n"
+          "    return TRUE;\n"
+          "}\n\n",
+          c);
+}
+
+/**
+ * Write the parameters of the in arguments of a method or the out arguments
+ * of a signal
+ */
+static void write_params(FILE* out, const Item* member, const char* direction,
+                         const char* qualifier) {
+    for (int i = 0; i < member->num_of_args; i++) {
+        const Arg* arg = &member->args[i];
+
+        const char* c_type = get_type_info(arg->type)->c_type;
+
+        // Strings are const already
+        if (strcmp(arg->direction, direction) == 0)
+            fprintf(out, ",\n        %s%s%s %s",
+                    strncmp(c_type, qualifier, strlen(qualifier)) == 0
+                        ? ""
+                        : qualifier,
+                    c_type, qualifier[0] == '\0' ? "*" : "",
+                    identifier(arg->name, 0));
+    }
+}
+
+static void write_header(FILE* h, const char* guard, const char* xml_name,
+                         const char* keys_name) {
+    fprintf(h,
+            "// Generated by mpris-gen from %s and %s. Do not edit.\n\n"
+            "#ifndef %s\n"
+            "#define %s\n\n"
+            "#include <stdint.h>\n\n"
+            "#include \"utils.h\"\n\n"
+            "#define MPRIS_OBJECT_PATH \"%s\"\n"
+            "#define MPRIS_PLAYER_IFACE \"%s\"\n\n",
+            xml_name, keys_name, guard, guard, OBJECT_PATH, INTERFACE);
+
+    fputs("/*************** Methods ***************/\n", h);
+    for (int i = 0; i < METHODS.count; i++)
+        fprintf(h, "#define MPRIS_PLAYER_METHOD_%s \"%s\"\n",
+                identifier(METHODS.items[i].name, 1), METHODS.items[i].name);
+
+    fputs("\n/*************** Signals ***************/\n", h);
+    for (int i = 0; i < SIGNALS.count; i++)
+        fprintf(h, "#define MPRIS_PLAYER_SIGNAL_%s \"%s\"\n",
+                identifier(SIGNALS.items[i].name, 1), SIGNALS.items[i].name);
+
+    fputs("\n/*************** Metadata ***************/\n", h);
+    write_names_h(h, &KEYS, "MprisMetadataKey", "MPRIS_METADATA", "KEY");
+    write_struct_h(h, &KEYS, "MprisMetadata", "MPRIS_METADATA");
+
+    fputs("/*************** Properties ***************/\n", h);
+    write_names_h(h, &PROPERTIES, "MprisPlayerProperty", "MPRIS_PLAYER",
+                  "NAME");
+    write_struct_h(h, &PROPERTIES, "MprisPlayerProperties", "MPRIS_PLAYER");
+
+    fputs("/*************** Decoders ***************/\n"
+          "// Strings that are read point into the message, so they are only "
+          "valid\n"
+          "// until the message is unreferenced.\n\n"
+          "/**\n"
+          " * Look up a metadata key\n"
+          " *\n"
+          " * @param const char* name The key\n"
+          " *\n"
+          " * @returns MprisMetadataKey The key, or MPRIS_METADATA_UNKNOWN\n"
+          " */\n"
+          "MprisMetadataKey mpris_metadata_key(const char* name);\n\n"
+          "/**\n"
+          " * Look up a property name\n"
+          " *\n"
+          " * @param const char* name The property name\n"
+          " *\n"
+          " * @returns MprisPlayerProperty The property, or "
+          "MPRIS_PLAYER_UNKNOWN\n"
+          " */\n"
+          "MprisPlayerProperty mpris_player_property(const char* name);\n\n"
+          "/**\n"
+          " * Read the changed properties of a PropertiesChanged signal\n"
+          " *\n"
+          " * @param BusMessage* message The signal\n"
+          " * @param MprisPlayerProperties* properties Set to the properties "
+          "that\n"
+          " *                                         changed\n"
+          " *\n"
+          " * @returns dbus_bool_t FALSE if the signal is not about the "
+          "Player\n"
+          " *                      interface or is malformed, otherwise "
+          "TRUE.\n"
+          " */\n"
+          "dbus_bool_t mpris_player_read_properties_changed(\n"
+          "    BusMessage* message, MprisPlayerProperties* properties);\n\n"
+          "// Read the reply to Properties.Get of a property. They return "
+          "FALSE if the\n"
+          "// value does not have the signature of the property.\n",
+          h);
+    for (int i = 0; i < PROPERTIES.count; i++) {
+        const Item* property = &PROPERTIES.items[i];
+
+        if (is_decoded(property))
+            fprintf(h,
+                    "dbus_bool_t mpris_player_read_%s_reply(BusMessage* "
+                    "message,\n        %s* value);\n",
+                    identifier(property->name, 0),
+                    get_type_info(property->type) != NULL
+                        ? get_type_info(property->type)->c_type
+                        : "MprisMetadata");
+    }
+
+    fputs("\n// Read the arguments of a signal. They return FALSE if the "
+          "message is not the\n"
+          "// signal or its arguments do not have the signature of the "
+          "signal.\n",
+          h);
+    for (int i = 0; i < SIGNALS.count; i++) {
+        const Item* signal = &SIGNALS.items[i];
+
+        if (!has_basic_args(signal, "")) {
+            continue;
+        }
+        fprintf(h, "dbus_bool_t mpris_player_read_%s(BusMessage* message",
+                identifier(signal->name, 0));
+        write_params(h, signal, "", "");
+        fputs(");\n", h);
+    }
+
+    fputs("\n/*************** Method calls ***************/\n"
+          "// Create a method call to a player. They return NULL if the "
+          "message could\n"
+          "// not be created. The message must be unreferenced with "
+          "bus_message_unref.\n",
+          h);
+    for (int i = 0; i < METHODS.count; i++) {
+        const Item* method = &METHODS.items[i];
+
+        if (!has_basic_args(method, "in"))
+            continue;
+        fprintf(h,
+                "BusMessage* mpris_player_%s_new(BusConnection* connection,\n"
+                "        const char* destination",
+                identifier(method->name, 0));
+        write_params(h, method, "in", "const ");
+        fputs(");\n", h);
+    }
+    for (int i = 0; i < PROPERTIES.count; i++)
+        fprintf(h,
+                "BusMessage* mpris_player_get_%s_new(BusConnection* "
+                "connection,\n        const char* destination);\n",
+                identifier(PROPERTIES.items[i].name, 0));
+
+    fprintf(h, "\n#endif\n");
+}
+
+static void write_source(FILE* c, const char* header_name,
+                         const char* xml_name, const char* keys_name) {
+    fprintf(c,
+            "// Generated by mpris-gen from %s and %s. Do not edit.\n\n"
+            "#include \"%s\"\n\n"
+            "#include <string.h>\n\n",
+            xml_name, keys_name, header_name);
+
+    write_lookup_c(c, &KEYS, "MprisMetadataKey", "MPRIS_METADATA",
+                   "mpris_metadata_key");
+    write_lookup_c(c, &PROPERTIES, "MprisPlayerProperty", "MPRIS_PLAYER",
+                   "mpris_player_property");
+
+    fputs("/**\n"
+          " * Read a variant holding a value of a basic type. Object paths are "
+          "read as\n"
+          " * strings and unsigned 64-bit integers as signed ones, since "
+          "players disagree\n"
+          " * on the type of some values, e.g. spotify sends mpris:trackid as "
+          "a string\n"
+          " * and mpris:length as unsigned. Unsigned values too large for a "
+          "signed one are\n"
+          " * clamped.\n"
+          " */\n"
+          "static dbus_bool_t read_variant_basic(BusMessage* message,\n"
+          "                                      const char* contents,\n"
+          "                                      const char* signature,\n"
+          "                                      const char type, void* "
+          "value) {\n"
+          "    const dbus_bool_t path = type == BUS_TYPE_STRING &&\n"
+          "                             strcmp(contents, \"o\") == 0;\n"
+          "    const dbus_bool_t unsigned64 = type == BUS_TYPE_INT64 &&\n"
+          "                                   strcmp(contents, \"t\") == 0;\n"
+          "    dbus_bool_t read;\n\n"
+          "    if ((strcmp(contents, signature) != 0 && !path && !unsigned64) "
+          "||\n"
+          "        !bus_message_enter(message, BUS_TYPE_VARIANT))\n"
+          "        return FALSE;\n\n"
+          "    if (unsigned64) {\n"
+          "        uint64_t u;\n\n"
+          "        read = bus_message_read_basic(message, BUS_TYPE_UINT64, "
+          "&u);\n"
+          "        if (read)\n"
+          "            *(int64_t*)value = u > INT64_MAX ? INT64_MAX : "
+          "(int64_t)u;\n"
+          "    } else {\n"
+          "        read = bus_message_read_basic(\n"
+          "            message, path ? BUS_TYPE_OBJECT_PATH : type, value);\n"
+          "    }\n"
+          "    bus_message_exit(message);\n\n"
+          "    return read;\n"
+          "}\n\n"
+          "/**\n"
+          " * Read the first element of a variant holding an array of a basic "
+          "type\n"
+          " */\n"
+          "static dbus_bool_t read_variant_first(BusMessage* message,\n"
+          "                                      const char* contents,\n"
+          "                                      const char* signature,\n"
+          "                                      const char type, void* "
+          "value) {\n"
+          "    dbus_bool_t read = FALSE;\n\n"
+          "    if (strcmp(contents, signature) != 0 ||\n"
+          "        !bus_message_enter(message, BUS_TYPE_VARIANT))\n"
+          "        return FALSE;\n\n"
+          "    if (bus_message_enter(message, BUS_TYPE_ARRAY)) {\n"
+          "        read = bus_message_read_basic(message, type, value);\n"
+          "        bus_message_exit(message);\n"
+          "    }\n"
+          "    bus_message_exit(message);\n\n"
+          "    return read;\n"
+          "}\n\n",
+          c);
+
+    write_dict_reader_c(c, &KEYS, "MprisMetadata", "MPRIS_METADATA",
+                        "read_metadata", "mpris_metadata_key", "metadata");
+
+    fputs("/**\n"
+          " * Read a variant holding metadata\n"
+          " */\n"
+          "static dbus_bool_t read_variant_metadata(BusMessage* message,\n"
+          "                                         const char* contents,\n"
+          "                                         MprisMetadata* "
+          "metadata) {\n"
+          "    dbus_bool_t read;\n\n"
+          "    if (strcmp(contents, \"" METADATA_SIGNATURE
+          "\") != 0 ||\n"
+          "        !bus_message_enter(message, BUS_TYPE_VARIANT))\n"
+          "        return FALSE;\n\n"
+          "    read = read_metadata(message, metadata);\n"
+          "    bus_message_exit(message);\n\n"
+          "    return read;\n"
+          "}\n\n",
+          c);
+
+    write_dict_reader_c(c, &PROPERTIES, "MprisPlayerProperties",
+                        "MPRIS_PLAYER", "read_properties",
+                        "mpris_player_property", "properties");
+
+    fputs("dbus_bool_t mpris_player_read_properties_changed(\n"
+          "    BusMessage* message, MprisPlayerProperties* properties) {\n"
+          "    const char* iface;\n\n"
+          "    bus_message_rewind(message);\n\n"
+          "    if (!bus_message_read_string(message, &iface) ||\n"
+          "        strcmp(iface, MPRIS_PLAYER_IFACE) != 0)\n"
+          "        return FALSE;\n\n"
+          "    return read_properties(message, properties);\n"
+          "}\n\n",
+          c);
+
+    for (int i = 0; i < PROPERTIES.count; i++) {
+        const Item* property = &PROPERTIES.items[i];
+        const TypeInfo* info = get_type_info(property->type);
+        const char* upper = identifier(property->name, 1);
+
+        if (!is_decoded(property))
+            continue;
+
+        fprintf(c,
+                "dbus_bool_t mpris_player_read_%s_reply(BusMessage* "
+                "message,\n        %s* value) {\n"
+                "    const char* contents;\n\n"
+                "    bus_message_rewind(message);\n\n"
+                "    return bus_message_peek_type(message, &contents) ==\n"
+                "               BUS_TYPE_VARIANT &&\n",
+                identifier(property->name, 0),
+                info != NULL ? info->c_type : "MprisMetadata");
+        if (info == NULL)
+            fputs("           read_variant_metadata(message, contents, "
+                  "value);\n}\n\n",
+                  c);
+        else
+            fprintf(c,
+                    "           %s(message, contents,\n"
+                    "                   MPRIS_PLAYER_%s_SIGNATURE, '%c', "
+                    "value);\n}\n\n",
+                    info->first_of_array ? "read_variant_first"
+                                         : "read_variant_basic",
+                    upper, info->type);
+    }
+
+    for (int i = 0; i < SIGNALS.count; i++) {
+        const Item* signal = &SIGNALS.items[i];
+
+        if (!has_basic_args(signal, ""))
+            continue;
+
+        fprintf(c, "dbus_bool_t mpris_player_read_%s(BusMessage* message",
+                identifier(signal->name, 0));
+        write_params(c, signal, "", "");
+        fprintf(c,
+                ") {\n    bus_message_rewind(message);\n\n"
+                "    return bus_message_is_signal(message, MPRIS_PLAYER_IFACE,"
+                "\n                                 MPRIS_PLAYER_SIGNAL_%s)",
+                identifier(signal->name, 1));
+        for (int j = 0; j < signal->num_of_args; j++)
+            fprintf(c,
+                    " &&\n           bus_message_read_basic(message, '%c', %s)",
+                    get_type_info(signal->args[j].type)->type,
+                    identifier(signal->args[j].name, 0));
+        fputs(";\n}\n\n", c);
+    }
+
+    for (int i = 0; i < METHODS.count; i++) {
+        const Item* method = &METHODS.items[i];
+
+        if (!has_basic_args(method, "in"))
+            continue;
+
+        fprintf(c,
+                "BusMessage* mpris_player_%s_new(BusConnection* connection,\n"
+                "        const char* destination",
+                identifier(method->name, 0));
+        write_params(c, method, "in", "const ");
+        fprintf(c,
+                ") {\n"
+                "    BusMessage* message = bus_method_call_new(\n"
+                "        connection, destination, MPRIS_OBJECT_PATH, "
+                "MPRIS_PLAYER_IFACE,\n"
+                "        MPRIS_PLAYER_METHOD_%s);\n",
+                identifier(method->name, 1));
+
+        if (method->num_of_args > 0) {
+            fputs("\n    if (message != NULL &&\n        !(", c);
+            for (int j = 0; j < method->num_of_args; j++)
+                fprintf(c, "%sbus_message_append_basic(message, '%c', &%s)",
+                        j > 0 ? " &&\n          " : "",
+                        get_type_info(method->args[j].type)->type,
+                        identifier(method->args[j].name, 0));
+            fputs(")) {\n"
+                  "        bus_message_unref(message);\n"
+                  "        return NULL;\n"
+                  "    }\n",
+                  c);
+        }
+
+        fputs("\n    return message;\n}\n\n", c);
+    }
+
+    fputs("/**\n"
+          " * Create a Properties.Get call of a Player property\n"
+          " */\n"
+          "static BusMessage* get_property_new(BusConnection* connection,\n"
+          "                                    const char* destination,\n"
+          "                                    const char* property) {\n"
+          "    const char* iface = MPRIS_PLAYER_IFACE;\n"
+          "    BusMessage* message = bus_method_call_new(\n"
+          "        connection, destination, MPRIS_OBJECT_PATH,\n"
+          "        \"org.freedesktop.DBus.Properties\", \"Get\");\n\n"
+          "    if (message != NULL &&\n"
+          "        !(bus_message_append_basic(message, BUS_TYPE_STRING, "
+          "&iface) &&\n"
+          "          bus_message_append_basic(message, BUS_TYPE_STRING, "
+          "&property))) {\n"
+          "        bus_message_unref(message);\n"
+          "        return NULL;\n"
+          "    }\n\n"
+          "    return message;\n"
+          "}\n",
+          c);
+
+    for (int i = 0; i < PROPERTIES.count; i++)
+        fprintf(c,
+                "\nBusMessage* mpris_player_get_%s_new(BusConnection* "
+                "connection,\n        const char* destination) {\n"
+                "    return get_property_new(connection, destination,\n"
+                "                            MPRIS_PLAYER_%s_NAME);\n"
+                "}\n",
+                identifier(PROPERTIES.items[i].name, 0),
+                identifier(PROPERTIES.items[i].name, 1));
+}
+
+static FILE* open_output(const char* output, const char* extension,
+                         char* path) {
+    snprintf(path, MAX_NAME * 2, "%s%s", output, extension);
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        die("cannot write ", path);
+
+    return file;
+}
+
+/**
+ * Get the file name of a path
+ */
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+int main(int argc, char* argv[]) {
+    char h_path[MAX_NAME * 2];
+    char c_path[MAX_NAME * 2];
+    char guard[MAX_NAME * 2];
+
+    if (argc != 4) {
+        fputs("usage: mpris-gen interface.xml metadata.keys output\n",
+              stderr);
+        return 1;
+    }
+
+    parse_xml(read_file(argv[1]));
+    parse_keys(read_file(argv[2]));
+
+    // Only the fields that are read get a flag in the present bitmask
+    if (KEYS.count == 0 || KEYS.count > 32 || PROPERTIES.count > 32)
+        die("between 1 and 32 metadata keys and properties are supported",
+            "");
+
+    FILE* h = open_output(argv[3], ".h", h_path);
+    FILE* c = open_output(argv[3], ".c", c_path);
+
+    snprintf(guard, sizeof(guard), "_%s_H_",
+             identifier(base_name(argv[3]), 1));
+
+    write_header(h, guard, base_name(argv[1]), base_name(argv[2]));
+    write_source(c, base_name(h_path), base_name(argv[1]),
+                 base_name(argv[2]));
+
+    if (fclose(h) != 0 || fclose(c) != 0)
+        die("cannot write ", argv[3]);
+
+    return 0;
+}
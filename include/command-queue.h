@@ -0,0 +1,92 @@
+#ifndef _COMMAND_QUEUE_H_
+#define _COMMAND_QUEUE_H_
+
+#include "command-socket.h"
+#include "utils.h"
+
+// Maximum number of queued commands after coalescing
+#define COMMAND_QUEUE_SIZE 16
+
+// Time in milliseconds to wait for spotify to reply to a forwarded command
+// before moving on to the next one
+#define COMMAND_REPLY_TIMEOUT_MS 1000
+
+/**
+ * A queued command. Consecutive next commands, or consecutive previous
+ * commands, are merged into a single entry with a signed number of skips.
+ */
+typedef struct {
+    Command command;
+    // Number of tracks to skip if command is COMMAND_NEXT. Negative values
+    // skip backwards.
+    int skips;
+} QueuedCommand;
+
+/**
+ * Commands received on the command socket waiting to be forwarded to spotify.
+ * Only one command is in flight at a time so spotify receives them in order,
+ * and commands arriving in the meantime are coalesced with the queued ones.
+ */
+typedef struct {
+    QueuedCommand commands[COMMAND_QUEUE_SIZE];
+    size_t head;
+    size_t len;
+
+    // Reply to the command currently sent to spotify
+    BusPendingCall* in_flight;
+    long long in_flight_since_ms;
+
+    // Counters
+    unsigned long received;
+    unsigned long coalesced;
+    unsigned long dropped;
+    unsigned long sent;
+    unsigned long timed_out;
+} CommandQueue;
+
+/**
+ * Initialize an empty command queue
+ *
+ * @param CommandQueue* queue The queue to initialize
+ */
+void command_queue_init(CommandQueue* queue);
+
+/**
+ * Queue a command, coalescing it with the last queued command if possible. A
+ * play, pause or playpause replaces a queued play or pause, two playpauses
+ * cancel out, and a next or previous adds to queued skips in the same
+ * direction.
+ *
+ * @param CommandQueue* queue The queue
+ * @param Command command The command to queue
+ *
+ * @returns dbus_bool_t Returns FALSE if the queue is full and the command was
+ *                      dropped, otherwise TRUE.
+ */
+dbus_bool_t command_queue_push(CommandQueue* queue, const Command command);
+
+/**
+ * Forward the next queued command to spotify if no command is in flight. This
+ * should be called whenever the connection was dispatched or the timeout
+ * returned by command_queue_timeout_ms expired.
+ *
+ * @param CommandQueue* queue The queue
+ * @param BusConnection* connection The connection to the session bus
+ * @param const char* destination The bus name of the player commands are
+ *                                sent to
+ */
+void command_queue_process(CommandQueue* queue, BusConnection* connection,
+                           const char* destination);
+
+/**
+ * Get the time until command_queue_process needs to be called again, which is
+ * when the command in flight times out
+ *
+ * @param const CommandQueue* queue The queue
+ *
+ * @returns int The timeout in milliseconds, 0 if command_queue_process should
+ *              be called straight away, or -1 if the queue is idle
+ */
+int command_queue_timeout_ms(const CommandQueue* queue);
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef _COMMAND_SOCKET_H_
+#define _COMMAND_SOCKET_H_
+
+#include <stddef.h>
+
+#include "utils.h"
+
+// Name of the listener's command socket in the runtime directory
+#define COMMAND_SOCKET_NAME "spotify-listener.sock"
+
+// Maximum length of a single command line including the newline
+#define COMMAND_LINE_MAX 256
+
+// Prefix of lines telling the listener about a command sent to spotify over
+// DBus, so it can predict the resulting state (e.g. "predict playpause\n")
+#define COMMAND_PREDICT_PREFIX "predict "
+
+// Lines telling the listener that the bars were hidden or shown again, so the
+// marquee only scrolls while it can be seen
+#define COMMAND_BAR_HIDDEN "bar-hidden"
+#define COMMAND_BAR_SHOWN "bar-shown"
+
+// Lines pinning a player, so the listener shows it whenever it is running
+// (e.g. "pin mpv\n"), and unpinning it again
+#define COMMAND_PIN_PREFIX "pin "
+#define COMMAND_UNPIN "unpin"
+
+// Lines asking the listener for its counters and latency histograms, as text
+// for people or in Prometheus format. The listener replies on the same
+// connection and spotifyctl reads the reply until the connection is closed.
+#define COMMAND_STATS "stats"
+#define COMMAND_STATS_PROMETHEUS "stats prometheus"
+
+// Prefix of lines changing the log level of the listener at runtime
+// (e.g. "log-level debug\n")
+#define COMMAND_LOG_LEVEL_PREFIX "log-level "
+
+// Name of the file in the runtime directory holding the bus name of the player
+// the listener elected, so spotifyctl can send commands to it without asking
+// the bus for the players
+#define ELECTED_PLAYER_NAME "spotify-listener.player"
+
+/**
+ * Player commands accepted on the command socket. These are sent as their
+ * spotifyctl names, one per line (e.g. "next\n").
+ */
+typedef enum {
+    COMMAND_PLAY,
+    COMMAND_PAUSE,
+    COMMAND_PLAYPAUSE,
+    COMMAND_NEXT,
+    COMMAND_PREVIOUS,
+    COMMAND_INVALID
+} Command;
+
+/**
+ * A client connected to the command socket
+ */
+typedef struct {
+    int fd;
+    char buf[COMMAND_LINE_MAX];
+    size_t len;
+    // Cleared once the client shut down its side of the connection
+    dbus_bool_t reading;
+
+    // Part of the reply the client's socket didn't take yet, or NULL
+    char* reply;
+    size_t reply_len;
+    size_t reply_sent;
+} CommandClient;
+
+/**
+ * Handler called for every line received from a client
+ *
+ * @param CommandClient* client The client that sent the line
+ * @param const char* line The line without the trailing newline
+ * @param void* user_data The user data passed to command_client_read
+ */
+typedef void (*CommandLineHandler)(CommandClient* client, const char* line,
+                                   void* user_data);
+
+/**
+ * Get the command with the specified name
+ *
+ * @param const char* name The name of the command (e.g. "next")
+ *
+ * @returns Command The command, or COMMAND_INVALID if the name is unknown
+ */
+Command parse_command(const char* name);
+
+/**
+ * Connect to the listener's command socket
+ *
+ * @returns int The connected socket, or -1 if the listener is not reachable
+ */
+int command_socket_connect();
+
+/**
+ * Send commands to the listener over its command socket. The listener
+ * forwards them to spotify over its own DBus connection, so this does not
+ * need to connect to the session bus.
+ *
+ * @param const char* const commands[] The names of the commands to send
+ * @param size_t num_of_commands The number of commands
+ *
+ * @returns dbus_bool_t Returns TRUE if every command was handed to the
+ *                      listener, otherwise FALSE.
+ */
+dbus_bool_t command_socket_send(const char* const commands[],
+                                const size_t num_of_commands);
+
+/**
+ * Send a single line to the listener and read its reply
+ *
+ * @param const char* line The line without the trailing newline
+ *
+ * @returns char* The reply, which must be freed, or NULL if the listener is
+ *                not reachable or didn't reply
+ */
+char* command_socket_query(const char* line);
+
+/**
+ * Create the listening command socket in the runtime directory, replacing any
+ * stale socket left behind by a previous listener. The socket of a listener
+ * that still accepts connections is left alone.
+ *
+ * @returns int The non-blocking listening socket, or -1 on error. errno is
+ *              EADDRINUSE if another listener is running.
+ */
+int command_socket_listen();
+
+/**
+ * Close the listening command socket and remove it from the runtime
+ * directory
+ *
+ * @param int fd The socket returned by command_socket_listen, or -1
+ */
+void command_socket_close(const int fd);
+
+/**
+ * Start reading from a newly accepted client
+ *
+ * @param CommandClient* client The client
+ * @param int fd The client's non-blocking socket
+ */
+void command_client_init(CommandClient* client, const int fd);
+
+/**
+ * Read everything available from a client and call handler for every complete
+ * line.
+ *
+ * @param CommandClient* client The client to read from
+ * @param CommandLineHandler handler The function called for every line
+ * @param void* user_data Extra data passed to the handler
+ *
+ * @returns dbus_bool_t Returns FALSE if the client closed the connection or an
+ *                      error occurred and it should be closed, otherwise TRUE.
+ */
+dbus_bool_t command_client_read(CommandClient* client,
+                                CommandLineHandler handler, void* user_data);
+
+/**
+ * Reply to a client without blocking. As much as the client's socket takes is
+ * written straight away. The rest is kept in client->reply until
+ * command_client_flush writes it once the socket is writable.
+ *
+ * @param CommandClient* client The client to reply to
+ * @param const char* buf The reply
+ * @param size_t len The length of the reply
+ *
+ * @returns dbus_bool_t Returns FALSE if writing failed or the rest couldn't
+ *                      be kept, otherwise TRUE.
+ */
+dbus_bool_t command_client_write(CommandClient* client, const char* buf,
+                                 const size_t len);
+
+/**
+ * Write as much of the rest of a reply as the client's socket takes
+ *
+ * @param CommandClient* client The client
+ *
+ * @returns dbus_bool_t Returns FALSE if writing failed and the client should
+ *                      be closed, otherwise TRUE. client->reply is NULL once
+ *                      the whole reply was written.
+ */
+dbus_bool_t command_client_flush(CommandClient* client);
+
+/**
+ * Close a client's socket and drop the rest of its reply
+ *
+ * @param CommandClient* client The client
+ */
+void command_client_close(CommandClient* client);
+
+#endif
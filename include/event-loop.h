@@ -0,0 +1,206 @@
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include "utils.h"
+
+// Maximum number of sources registered with a loop at once
+#define EVENT_LOOP_MAX_SOURCES 32
+
+typedef struct EventLoop EventLoop;
+typedef struct EventSource EventSource;
+
+/**
+ * Called when a source is ready
+ *
+ * @param EventSource* source The ready source
+ * @param uint32_t events The epoll events that are ready
+ */
+typedef void (*EventHandler)(EventSource* source, const uint32_t events);
+
+/**
+ * Called before the loop waits for events
+ *
+ * @param EventLoop* loop The loop
+ * @param void* user_data The data given to event_loop_set_prepare
+ */
+typedef void (*EventPrepare)(EventLoop* loop, void* user_data);
+
+// What a source's file descriptor is
+typedef enum {
+    EVENT_SOURCE_FD,
+    EVENT_SOURCE_TIMER,
+    EVENT_SOURCE_SIGNAL,
+    EVENT_SOURCE_INOTIFY
+} EventSourceType;
+
+/**
+ * A file descriptor watched by a loop. Timer and signal sources are drained by
+ * the loop before their handler is called, other sources must be read by
+ * their handler.
+ */
+struct EventSource {
+    // -1 if the slot is free
+    int fd;
+    EventSourceType type;
+    uint32_t events;
+    EventHandler handler;
+    void* user_data;
+    EventLoop* loop;
+
+    // CLOCK_MONOTONIC deadline of a timer in milliseconds, or -1 if it is not
+    // armed
+    long long deadline_ms;
+};
+
+/**
+ * A single threaded epoll loop. Every file descriptor the listener waits on,
+ * including timers and signals, is a source of the same loop.
+ */
+struct EventLoop {
+    int epoll_fd;
+    EventSource sources[EVENT_LOOP_MAX_SOURCES];
+
+    EventPrepare prepare;
+    void* prepare_data;
+
+    dbus_bool_t running;
+    // When epoll_wait last returned, in CLOCK_MONOTONIC microseconds
+    long long woke_us;
+};
+
+/**
+ * Initialize an empty loop
+ *
+ * @param EventLoop* loop The loop to initialize
+ *
+ * @returns dbus_bool_t TRUE if the loop was initialized, otherwise FALSE.
+ */
+dbus_bool_t event_loop_init(EventLoop* loop);
+
+/**
+ * Remove all sources of a loop and close it
+ *
+ * @param EventLoop* loop The loop
+ */
+void event_loop_close(EventLoop* loop);
+
+/**
+ * Set a function called every time before the loop waits for events, e.g.
+ * to dispatch messages that were read while handling other sources
+ *
+ * @param EventLoop* loop The loop
+ * @param EventPrepare prepare The function to call
+ * @param void* user_data Data passed to the function
+ */
+void event_loop_set_prepare(EventLoop* loop, EventPrepare prepare,
+                            void* user_data);
+
+/**
+ * Watch a file descriptor. The loop does not take ownership of it.
+ *
+ * @param EventLoop* loop The loop
+ * @param int fd The file descriptor
+ * @param uint32_t events The epoll events to wait for
+ * @param EventHandler handler The function called when fd is ready
+ * @param void* user_data Data stored in the source for the handler
+ *
+ * @returns EventSource* The new source, or NULL on failure.
+ */
+EventSource* event_loop_add_fd(EventLoop* loop, const int fd,
+                               const uint32_t events, EventHandler handler,
+                               void* user_data);
+
+/**
+ * Add a timer. The timer is not armed until event_source_set_timeout is
+ * called, and is disarmed again when it fires.
+ *
+ * @param EventLoop* loop The loop
+ * @param EventHandler handler The function called when the timer fires
+ * @param void* user_data Data stored in the source for the handler
+ *
+ * @returns EventSource* The new source, or NULL on failure.
+ */
+EventSource* event_loop_add_timer(EventLoop* loop, EventHandler handler,
+                                  void* user_data);
+
+/**
+ * Handle a signal in the loop instead of interrupting the process. The
+ * signal is blocked for the calling thread.
+ *
+ * @param EventLoop* loop The loop
+ * @param int signo The signal
+ * @param EventHandler handler The function called when the signal arrives
+ * @param void* user_data Data stored in the source for the handler
+ *
+ * @returns EventSource* The new source, or NULL on failure.
+ */
+EventSource* event_loop_add_signal(EventLoop* loop, const int signo,
+                                   EventHandler handler, void* user_data);
+
+/**
+ * Watch a path with inotify. The handler reads struct inotify_event records
+ * from the source's fd.
+ *
+ * @param EventLoop* loop The loop
+ * @param const char* path The file or directory to watch
+ * @param uint32_t mask The inotify events to watch for
+ * @param EventHandler handler The function called when events are available
+ * @param void* user_data Data stored in the source for the handler
+ *
+ * @returns EventSource* The new source, or NULL on failure.
+ */
+EventSource* event_loop_add_inotify(EventLoop* loop, const char* path,
+                                    const uint32_t mask, EventHandler handler,
+                                    void* user_data);
+
+/**
+ * Change the epoll events a source waits for
+ *
+ * @param EventSource* source The source
+ * @param uint32_t events The epoll events to wait for
+ *
+ * @returns dbus_bool_t TRUE if the events were changed, otherwise FALSE.
+ */
+dbus_bool_t event_source_set_events(EventSource* source,
+                                    const uint32_t events);
+
+/**
+ * Arm or disarm a timer. The timer is only rearmed if its deadline changes.
+ *
+ * @param EventSource* source The timer source
+ * @param int timeout_ms Milliseconds from now until the timer fires, or -1
+ *                       to disarm it
+ *
+ * @returns dbus_bool_t TRUE if the timer was set, otherwise FALSE.
+ */
+dbus_bool_t event_source_set_timeout(EventSource* source,
+                                     const int timeout_ms);
+
+/**
+ * Stop watching a source. File descriptors created by the loop are closed.
+ *
+ * @param EventSource* source The source to remove
+ */
+void event_source_remove(EventSource* source);
+
+/**
+ * Run the loop until event_loop_quit is called
+ *
+ * @param EventLoop* loop The loop
+ *
+ * @returns dbus_bool_t TRUE if the loop was quit, FALSE if waiting for events
+ *                      failed.
+ */
+dbus_bool_t event_loop_run(EventLoop* loop);
+
+/**
+ * Make event_loop_run return once the current handler returns
+ *
+ * @param EventLoop* loop The loop
+ */
+void event_loop_quit(EventLoop* loop);
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef _IPC_WRITER_H_
+#define _IPC_WRITER_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "stats.h"
+#include "utils.h"
+
+// Number of records the ring holds. Must be a power of two.
+#define IPC_RING_SIZE 64
+
+// Maximum number of polybar messages in a single record
+#define IPC_MAX_MESSAGES 4
+
+// Maximum number of bars messages are queued for
+#define IPC_MAX_BARS 16
+
+// Maximum number of messages waiting for a single bar. Messages for the same
+// module replace each other, so this only fills up with unusual messages.
+#define IPC_BAR_QUEUE_SIZE 8
+
+// Maximum number of modules whose text is set at runtime, and the maximum
+// length of their text including the null char
+#define IPC_MAX_TEXT_MODULES 4
+#define IPC_MAX_TEXT_LEN 256
+
+// Time in milliseconds between two messages to the same bar. Without it,
+// polybar sometimes ignores messages.
+#define IPC_MESSAGE_INTERVAL_MS 10
+
+// Longest time in milliseconds between attempts to write to a bar that isn't
+// reading its IPC file
+#define IPC_MAX_RETRY_INTERVAL_MS 1000
+
+// Longest time in milliseconds the writer thread keeps writing the queued
+// messages to the bars once it is stopped
+#define IPC_STOP_TIMEOUT_MS 500
+
+/**
+ * A state change to show on polybar. The messages are sent to every bar in
+ * order.
+ */
+typedef struct {
+    int count;
+    // String literals, so records don't own any memory
+    const char* messages[IPC_MAX_MESSAGES];
+
+    // Module whose text is set instead, or NULL. The text is built at
+    // runtime, so it is copied into the record.
+    const char* text_module;
+    char text[IPC_MAX_TEXT_LEN];
+
+    // When the listener woke up for the event causing the state change, and
+    // when the record was queued
+    long long event_us;
+    long long queued_us;
+} IpcRecord;
+
+/**
+ * A message waiting to be written to a bar
+ */
+typedef struct {
+    const char* message;
+    // When the listener woke up for the event causing it
+    long long event_us;
+} IpcBarMessage;
+
+/**
+ * Text waiting to be shown by a custom/ipc module of a bar
+ */
+typedef struct {
+    // String literal naming the module, or NULL if the slot is free
+    const char* module;
+    char text[IPC_MAX_TEXT_LEN];
+    dbus_bool_t pending;
+    long long event_us;
+} IpcBarText;
+
+/**
+ * The messages waiting to be written to a single bar. A new message for a
+ * module replaces the one already waiting for it (e.g. hook:module/spotify2
+ * replaces hook:module/spotify1), so a bar that is slow to read only gets the
+ * latest state of every module.
+ */
+typedef struct {
+    // Path to the bar's IPC file, or NULL if the slot is free
+    char* path;
+
+    IpcBarMessage messages[IPC_BAR_QUEUE_SIZE];
+    int len;
+    // Only the latest text of every module is kept. It is written once the
+    // messages are.
+    IpcBarText texts[IPC_MAX_TEXT_MODULES];
+
+    // When the next message may be written, and how long to wait after the
+    // next failed attempt
+    long long next_write_us;
+    long long retry_interval_ms;
+
+    // Counters
+    unsigned long delivered;
+    unsigned long replaced;
+    unsigned long dropped;
+    unsigned long retries;
+} IpcBar;
+
+/**
+ * Delivers state changes to polybar on its own thread, so opening the IPC
+ * files and pacing the messages never delays reading signals. The listener
+ * thread is the only producer and the writer thread the only consumer of a
+ * lock-free ring of records. The writer thread spreads every record over the
+ * queues of the bars, and writes to each bar without blocking and at its own
+ * pace.
+ */
+typedef struct {
+    IpcRecord records[IPC_RING_SIZE];
+
+    // Next record to write, only written by the producer
+    _Alignas(64) atomic_size_t head;
+    // Next record to deliver, only written by the writer thread
+    _Alignas(64) atomic_size_t tail;
+
+    // eventfd the writer thread sleeps on while the ring is empty
+    int wake_fd;
+    pthread_t thread;
+    // Set by ipc_writer_stop to make the writer thread exit once the queued
+    // messages are written
+    atomic_bool stopping;
+    const char* ipc_directory;
+
+    // Counters updated by the producer. messages counts the messages and
+    // texts of the queued records, and dispatch is the time from waking up
+    // for an event to queuing its record.
+    _Alignas(64) unsigned long queued;
+    unsigned long messages;
+    unsigned long dropped;
+    size_t max_depth;
+    Histogram dispatch;
+
+    // Bars known to the writer thread, and the memory it lists the IPC files
+    // in, which is reset after every listing
+    _Alignas(64) IpcBar bars[IPC_MAX_BARS];
+    Arena arena;
+
+    // Set when the IPC directory must be listed again before the next record
+    // because a bar may have been added, or on every record if the directory
+    // isn't watched. Bars that are gone are removed when writing to them
+    // fails.
+    atomic_bool bars_changed;
+    atomic_bool unwatched;
+
+    // Counters updated by the writer thread and read by the listener's
+    // thread. dequeued is the time from waking up for an event to the writer
+    // thread taking its record from the ring, and written the time to writing
+    // one of its messages to a bar. Messages replaced by a newer one for the
+    // same module are coalesced.
+    atomic_ulong received;
+    atomic_ulong hooks_sent;
+    atomic_ulong texts_sent;
+    atomic_ulong coalesced;
+    atomic_ulong write_errors;
+    Histogram dequeued;
+    Histogram written;
+} IpcWriter;
+
+/**
+ * Initialize an IPC writer and start its thread
+ *
+ * @param IpcWriter* writer The writer to start
+ * @param const char* ipc_directory The directory containing polybar's IPC
+ *                                  files. It must outlive the writer.
+ *
+ * @returns dbus_bool_t TRUE if the thread was started, otherwise FALSE.
+ */
+dbus_bool_t ipc_writer_start(IpcWriter* writer, const char* ipc_directory);
+
+/**
+ * Stop the writer thread and free the writer. The thread first writes the
+ * queued records to the bars, giving up on bars that aren't reading after
+ * IPC_STOP_TIMEOUT_MS. Must only be called from the same thread as
+ * ipc_writer_push, after the last message was queued.
+ *
+ * @param IpcWriter* writer The writer started by ipc_writer_start
+ */
+void ipc_writer_stop(IpcWriter* writer);
+
+/**
+ * Queue messages to be sent to polybar. This never blocks. Must only be
+ * called from a single thread.
+ *
+ * @param IpcWriter* writer The writer
+ * @param long long event_us When the listener woke up for the event causing
+ *                           the messages
+ * @param int count The number of messages
+ * @param const char* messages[] The messages, which must be string literals
+ *
+ * @returns dbus_bool_t TRUE if the messages were queued, FALSE if there are
+ *                      more than IPC_MAX_MESSAGES or the ring is full.
+ */
+dbus_bool_t ipc_writer_push(IpcWriter* writer, const long long event_us,
+                            const int count, const char* messages[]);
+
+/**
+ * Queue text to be shown by a custom/ipc module through its send action,
+ * which needs polybar 3.6 or later. This never blocks. Must only be called
+ * from the same thread as ipc_writer_push.
+ *
+ * @param IpcWriter* writer The writer
+ * @param long long event_us When the listener woke up for the event causing
+ *                           the text to change
+ * @param const char* module The name of the module, which must be a string
+ *                           literal
+ * @param const char* text The text, which is copied. Longer text is
+ *                         truncated to IPC_MAX_TEXT_LEN - 1 chars.
+ *
+ * @returns dbus_bool_t TRUE if the text was queued, FALSE if the ring is
+ *                      full.
+ */
+dbus_bool_t ipc_writer_push_text(IpcWriter* writer, const long long event_us,
+                                 const char* module, const char* text);
+
+/**
+ * Make the writer thread list the IPC directory again before delivering the
+ * next record. Call this when a new IPC file appears, before queuing the
+ * messages for the new bar. Must only be called from the same thread as
+ * ipc_writer_push.
+ *
+ * @param IpcWriter* writer The writer
+ */
+void ipc_writer_bars_changed(IpcWriter* writer);
+
+/**
+ * Make the writer thread list the IPC directory before every record, for
+ * when new IPC files can't be watched for. Must only be called from the same
+ * thread as ipc_writer_push.
+ *
+ * @param IpcWriter* writer The writer
+ */
+void ipc_writer_unwatched(IpcWriter* writer);
+
+/**
+ * Append the counters of a writer to stats. Must only be called from the
+ * same thread as ipc_writer_push.
+ *
+ * @param IpcWriter* writer The writer
+ * @param StatsBuffer* stats The buffer
+ * @param StatsFormat format The format of the buffer
+ */
+void ipc_writer_counters(IpcWriter* writer, StatsBuffer* stats,
+                         const StatsFormat format);
+
+/**
+ * Append the latency histograms of a writer to stats, after the histogram
+ * header. Must only be called from the same thread as ipc_writer_push.
+ *
+ * @param IpcWriter* writer The writer
+ * @param StatsBuffer* stats The buffer
+ * @param StatsFormat format The format of the buffer
+ */
+void ipc_writer_histograms(IpcWriter* writer, StatsBuffer* stats,
+                           const StatsFormat format);
+
+/**
+ * Get the number of records waiting to be delivered
+ *
+ * @param IpcWriter* writer The writer
+ *
+ * @returns size_t The number of queued records
+ */
+size_t ipc_writer_depth(IpcWriter* writer);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <stdatomic.h>
+
+#include "utils.h"
+
+// Number of records the ring holds. Must be a power of two.
+#define LOG_RING_SIZE 256
+
+// Maximum length of a single record including the null char. Longer records
+// are truncated.
+#define LOG_RECORD_LEN 240
+
+/**
+ * Log levels, most severe first. Errors and warnings are written to stderr,
+ * everything else to stdout.
+ */
+typedef enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} LogLevel;
+
+// Records above this level are skipped before they are formatted. It may be
+// changed at any time from any thread.
+extern atomic_int LOG_THRESHOLD;
+
+/**
+ * Log a printf style message without a trailing newline, if its level is
+ * enabled. This never blocks.
+ */
+#define LOG(level, ...)                                                     \
+    do {                                                                    \
+        if ((int)(level) <=                                                 \
+            atomic_load_explicit(&LOG_THRESHOLD, memory_order_relaxed))     \
+            logger_write(level, __VA_ARGS__);                               \
+    } while (0)
+
+/**
+ * Start the thread writing log records. Before it is started and after it is
+ * stopped, records are written straight away by the logging thread.
+ *
+ * Records are formatted by the thread logging them into a lock-free ring that
+ * any number of threads may log to, and written out by the logger thread. If
+ * stdout or stderr is slow, e.g. when journald rate limits the listener, the
+ * ring fills up and further records are dropped and counted instead of
+ * blocking the thread logging them.
+ *
+ * @returns dbus_bool_t TRUE if the thread was started, otherwise FALSE.
+ */
+dbus_bool_t logger_start();
+
+/**
+ * Write the records left in the ring and stop the logger thread
+ */
+void logger_stop();
+
+/**
+ * Log a message regardless of LOG_THRESHOLD. Use LOG instead, which skips
+ * formatting messages of disabled levels.
+ *
+ * @param LogLevel level The level of the message
+ * @param const char* format The printf format, without a trailing newline
+ * @param ... The arguments of the format
+ */
+void logger_write(const LogLevel level, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Get the level with the specified name
+ *
+ * @param const char* name "error", "warning", "info" or "debug"
+ * @param LogLevel* level Set to the level if the name is known
+ *
+ * @returns dbus_bool_t TRUE if the name is known, otherwise FALSE.
+ */
+dbus_bool_t logger_parse_level(const char* name, LogLevel* level);
+
+/**
+ * Get the name of a level
+ *
+ * @param LogLevel level The level
+ *
+ * @returns const char* The name of the level
+ */
+const char* logger_level_name(const LogLevel level);
+
+/**
+ * Get the number of records dropped because the ring was full
+ *
+ * @returns unsigned long The number of dropped records
+ */
+unsigned long logger_dropped();
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef _MARQUEE_H_
+#define _MARQUEE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+// Maximum width of a marquee in columns
+#define MARQUEE_MAX_WIDTH 60
+
+// Maximum length of a frame in bytes including the null char. Frames are cut
+// short rather than exceeding it, e.g. with many combining characters.
+#define MARQUEE_MAX_FRAME_LEN 256
+
+// Shown between the end of the text and its start while it scrolls
+#define MARQUEE_SEPARATOR "   "
+
+/**
+ * A frame of a marquee, as a slice of its ring
+ */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} MarqueeFrame;
+
+/**
+ * Scrolls text that is wider than a fixed number of columns. The frames are
+ * computed once when the text is set: the text and a separator are stored
+ * twice in a row in a ring, so every rotation of the text is a contiguous
+ * slice of it. Frames start on characters that take up columns, so combining
+ * characters stay with their base character, and wide characters count as two
+ * columns.
+ */
+typedef struct {
+    // Width in columns
+    int width;
+
+    char* text;
+    // The text and separator twice, or just the text if it fits
+    char* ring;
+    MarqueeFrame* frames;
+    int num_of_frames;
+    // Frame returned by the next call to marquee_next_frame
+    int frame;
+
+    // Counters
+    unsigned long texts;
+    unsigned long frames_shown;
+} Marquee;
+
+/**
+ * Initialize a marquee without text
+ *
+ * @param Marquee* marquee The marquee to initialize
+ * @param int width The width in columns, at most MARQUEE_MAX_WIDTH
+ */
+void marquee_init(Marquee* marquee, const int width);
+
+/**
+ * Free the text and frames of a marquee
+ *
+ * @param Marquee* marquee The marquee
+ */
+void marquee_free(Marquee* marquee);
+
+/**
+ * Set the text and compute its frames. The marquee starts at the first frame
+ * again. Nothing is done if the text did not change.
+ *
+ * @param Marquee* marquee The marquee
+ * @param const char* text The UTF-8 text. Invalid bytes count as one column.
+ *
+ * @returns dbus_bool_t TRUE if the text changed, otherwise FALSE.
+ */
+dbus_bool_t marquee_set_text(Marquee* marquee, const char* text);
+
+/**
+ * Check if the text is wider than the marquee, so it needs to scroll
+ *
+ * @param const Marquee* marquee The marquee
+ *
+ * @returns dbus_bool_t TRUE if there is more than one frame, otherwise FALSE.
+ */
+dbus_bool_t marquee_is_scrolling(const Marquee* marquee);
+
+/**
+ * Copy the current frame without moving on to the next one
+ *
+ * @param const Marquee* marquee The marquee
+ * @param char* buf The buffer the frame is copied to
+ * @param size_t size The size of buf, at least MARQUEE_MAX_FRAME_LEN
+ */
+void marquee_frame(const Marquee* marquee, char* buf, const size_t size);
+
+/**
+ * Copy the current frame and move on to the next one
+ *
+ * @param Marquee* marquee The marquee
+ * @param char* buf The buffer the frame is copied to
+ * @param size_t size The size of buf, at least MARQUEE_MAX_FRAME_LEN
+ */
+void marquee_next_frame(Marquee* marquee, char* buf, const size_t size);
+
+#endif
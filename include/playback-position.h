@@ -0,0 +1,146 @@
+#ifndef _PLAYBACK_POSITION_H_
+#define _PLAYBACK_POSITION_H_
+
+#include <stdint.h>
+
+#include "utils.h"
+
+// Time in milliseconds to wait for spotify to reply to a Position request
+// before giving up on it
+#define POSITION_REPLY_TIMEOUT_MS 1000
+
+/**
+ * The playback position of the current track. Spotify only reports the
+ * position when asked for it or when the user seeks, so the position is
+ * anchored whenever it is known and extrapolated from CLOCK_MONOTONIC with the
+ * playback rate in between. The Position property is read once after every
+ * change of track or play state instead of being polled.
+ */
+typedef struct {
+    // Position in microseconds at anchor_us, and the monotonic time it was
+    // known at
+    int64_t position_us;
+    long long anchor_us;
+
+    double rate;
+    // Whether spotify reported the track as playing. Predicted states don't
+    // move the position.
+    dbus_bool_t playing;
+    // Length of the track in microseconds, or 0 if unknown
+    uint64_t length_us;
+
+    // Position needs to be read from spotify
+    dbus_bool_t stale;
+    // Reply to the Position request
+    BusPendingCall* in_flight;
+    long long in_flight_since_ms;
+
+    // Counters
+    unsigned long requested;
+    unsigned long replied;
+    unsigned long seeked;
+    unsigned long timed_out;
+} PlaybackPosition;
+
+/**
+ * Initialize the position of an unknown, paused track
+ *
+ * @param PlaybackPosition* position The position to initialize
+ */
+void playback_position_init(PlaybackPosition* position);
+
+/**
+ * Forget the track, e.g. when spotify exits. A request in flight is
+ * cancelled.
+ *
+ * @param PlaybackPosition* position The position
+ */
+void playback_position_reset(PlaybackPosition* position);
+
+/**
+ * Start a new track at its beginning and read its actual position
+ *
+ * @param PlaybackPosition* position The position
+ * @param uint64_t length_us The length of the track in microseconds, or 0 if
+ *                           unknown
+ */
+void playback_position_set_track(PlaybackPosition* position,
+                                 const uint64_t length_us);
+
+/**
+ * Start or stop moving the position. The actual position is read again if
+ * the play state changed.
+ *
+ * @param PlaybackPosition* position The position
+ * @param dbus_bool_t playing Whether spotify reported the track as playing
+ */
+void playback_position_set_playing(PlaybackPosition* position,
+                                   const dbus_bool_t playing);
+
+/**
+ * Change the rate the position moves at while playing
+ *
+ * @param PlaybackPosition* position The position
+ * @param double rate The playback rate reported by spotify
+ */
+void playback_position_set_rate(PlaybackPosition* position, const double rate);
+
+/**
+ * Anchor the position at a position reported by spotify, e.g. by the Seeked
+ * signal
+ *
+ * @param PlaybackPosition* position The position
+ * @param int64_t position_us The reported position in microseconds
+ */
+void playback_position_seek(PlaybackPosition* position,
+                            const int64_t position_us);
+
+/**
+ * Get the extrapolated position
+ *
+ * @param const PlaybackPosition* position The position
+ * @param long long now_us The current CLOCK_MONOTONIC time in microseconds
+ *
+ * @returns int64_t The position in microseconds, clamped to the length of the
+ *                  track if it is known
+ */
+int64_t playback_position_get_us(const PlaybackPosition* position,
+                                 const long long now_us);
+
+/**
+ * Get the time until the position reaches the next whole second
+ *
+ * @param const PlaybackPosition* position The position
+ *
+ * @returns int The time in milliseconds, or -1 if the position is not moving
+ */
+int playback_position_tick_ms(const PlaybackPosition* position);
+
+/**
+ * Read the position from spotify if it is stale, and anchor it once spotify
+ * replied. This should be called whenever the connection was dispatched or
+ * the timeout returned by playback_position_timeout_ms expired.
+ *
+ * @param PlaybackPosition* position The position
+ * @param BusConnection* connection The connection to the session bus
+ * @param const char* destination The bus name of the player the position is
+ *                                read from
+ *
+ * @returns dbus_bool_t TRUE if the position was anchored at the position
+ *                      spotify replied with, otherwise FALSE.
+ */
+dbus_bool_t playback_position_process(PlaybackPosition* position,
+                                      BusConnection* connection,
+                                      const char* destination);
+
+/**
+ * Get the time until playback_position_process needs to be called again
+ *
+ * @param const PlaybackPosition* position The position
+ *
+ * @returns int The timeout in milliseconds, 0 if playback_position_process
+ *              should be called straight away, or -1 if nothing is pending
+ */
+int playback_position_timeout_ms(const PlaybackPosition* position);
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef _PLAYER_ELECTION_H_
+#define _PLAYER_ELECTION_H_
+
+#include "player-table.h"
+#include "utils.h"
+
+// Maximum number of players in the priority list
+#define ELECTION_MAX_PRIORITIES 8
+
+/**
+ * Picks the player shown on polybar and sent commands. Players are ranked by:
+ *
+ * 1. The pinned player, if it is running
+ * 2. Players that are playing
+ * 3. Their position in the priority list. Players that aren't in it come
+ *    last.
+ * 4. The player that started playing most recently
+ *
+ * Players are named by the part of their bus name after
+ * "org.mpris.MediaPlayer2.", and a name also matches the instances of a player
+ * (e.g. "vlc" matches "org.mpris.MediaPlayer2.vlc.instance1234").
+ *
+ * The ranking is kept up to date from the state the listener already receives
+ * in signals. A player whose state changed only has to be compared with the
+ * elected one, and all players are only compared again when the elected one
+ * got worse or exited.
+ */
+typedef struct {
+    char* priorities[ELECTION_MAX_PRIORITIES];
+    int num_of_priorities;
+    // Name of the pinned player, or NULL
+    char* pinned;
+
+    // NULL if there are no players
+    Player* elected;
+
+    // Counters
+    unsigned long elections;
+    unsigned long rescans;
+} PlayerElection;
+
+/**
+ * Initialize an election without priorities or a pinned player
+ *
+ * @param PlayerElection* election The election to initialize
+ */
+void player_election_init(PlayerElection* election);
+
+/**
+ * Free the priority list and pinned name
+ *
+ * @param PlayerElection* election The election
+ */
+void player_election_free(PlayerElection* election);
+
+/**
+ * Set the priority list. Call player_election_rescan afterwards to apply it
+ * to the players that are already running.
+ *
+ * @param PlayerElection* election The election
+ * @param const char* list Comma separated player names, most preferred first
+ *                         (e.g. "spotify,mpv")
+ *
+ * @returns dbus_bool_t FALSE if there are more than ELECTION_MAX_PRIORITIES
+ *                      names or one is empty, otherwise TRUE.
+ */
+dbus_bool_t player_election_set_priorities(PlayerElection* election,
+                                           const char* list);
+
+/**
+ * Pin a player, so it is elected whenever it is running. Call
+ * player_election_rescan afterwards.
+ *
+ * @param PlayerElection* election The election
+ * @param const char* name The player name, or NULL to unpin
+ */
+void player_election_set_pinned(PlayerElection* election, const char* name);
+
+/**
+ * Rank a player that was just added to the table
+ *
+ * @param PlayerElection* election The election
+ * @param Player* player The new player
+ */
+void player_election_add(PlayerElection* election, Player* player);
+
+/**
+ * Forget a player before it is removed from the table
+ *
+ * @param PlayerElection* election The election
+ * @param Player* player The player that is about to be removed
+ */
+void player_election_remove(PlayerElection* election, Player* player);
+
+/**
+ * Update the elected player after the state of a player changed, or after a
+ * player was added or removed
+ *
+ * @param PlayerElection* election The election
+ * @param PlayerTable* table The players
+ * @param Player* player The player whose state changed, or NULL if one was
+ *                       removed
+ *
+ * @returns dbus_bool_t TRUE if another player was elected, otherwise FALSE.
+ */
+dbus_bool_t player_election_update(PlayerElection* election,
+                                   PlayerTable* table, Player* player);
+
+/**
+ * Rank every player again, e.g. after the priorities or pinned player
+ * changed
+ *
+ * @param PlayerElection* election The election
+ * @param PlayerTable* table The players
+ *
+ * @returns dbus_bool_t TRUE if another player was elected, otherwise FALSE.
+ */
+dbus_bool_t player_election_rescan(PlayerElection* election,
+                                   PlayerTable* table);
+
+#endif
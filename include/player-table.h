@@ -0,0 +1,153 @@
+#ifndef _PLAYER_TABLE_H_
+#define _PLAYER_TABLE_H_
+
+#include <stdint.h>
+
+#include "playback-position.h"
+#include "utils.h"
+
+// Prefix of the bus names of MPRIS players
+#define PLAYER_NAME_PREFIX "org.mpris.MediaPlayer2."
+
+// Maximum number of players tracked at once
+#define PLAYER_TABLE_MAX_PLAYERS 32
+
+// Maximum number of well-known names tracked for a single player, e.g. a base
+// name and an .instance name
+#define PLAYER_MAX_NAMES 4
+
+// Number of buckets of the table. Must be a power of two, and at least twice
+// the number of players so probe sequences stay short.
+#define PLAYER_TABLE_BUCKETS 64
+
+// Playback status reported by a player
+typedef enum {
+    PLAYER_UNKNOWN,
+    PLAYER_STOPPED,
+    PLAYER_PAUSED,
+    PLAYER_PLAYING
+} PlayerStatus;
+
+/**
+ * Everything the listener knows about a single player
+ */
+typedef struct {
+    // Unique bus name the player's signals are sent from (e.g. ":1.42"), or
+    // NULL if the slot is free
+    char* unique_name;
+    // Well-known name method calls are sent to (e.g.
+    // "org.mpris.MediaPlayer2.spotify")
+    char* bus_name;
+    // Every well-known name the player owns, bus_name among them. The player
+    // is only gone once it released all of them.
+    char* names[PLAYER_MAX_NAMES];
+    int num_of_names;
+
+    PlayerStatus status;
+    // NULL until the player reported them
+    char* trackid;
+    char* artist;
+    char* title;
+    PlaybackPosition position;
+
+    // When the player last started playing, or 0 if it never did
+    long long playing_since_us;
+    // Index of the player in the election's priority list, or the length of
+    // the list if it isn't in it
+    int priority;
+
+    // Counters
+    unsigned long signals;
+} Player;
+
+/**
+ * The players currently on the bus, looked up by the unique name of the
+ * sender of a signal. Players live in a fixed array and never move, so
+ * pointers to them stay valid until they are removed. The buckets are an open
+ * addressing hash table of indices into that array with linear probing, so a
+ * lookup hashes the name once and usually compares a single entry no matter
+ * how many players there are.
+ */
+typedef struct {
+    Player players[PLAYER_TABLE_MAX_PLAYERS];
+    // Index + 1 of the player in each bucket, or 0 if the bucket is empty
+    uint8_t buckets[PLAYER_TABLE_BUCKETS];
+    int count;
+
+    // Counters
+    unsigned long lookups;
+    unsigned long probes;
+    unsigned long dropped;
+} PlayerTable;
+
+/**
+ * Initialize an empty table
+ *
+ * @param PlayerTable* table The table to initialize
+ */
+void player_table_init(PlayerTable* table);
+
+/**
+ * Remove all players and free them
+ *
+ * @param PlayerTable* table The table
+ */
+void player_table_free(PlayerTable* table);
+
+/**
+ * Add a player, or get it if its unique name is already in the table. The
+ * well-known name is added to the names the player owns, and commands are
+ * sent to it from then on.
+ *
+ * @param PlayerTable* table The table
+ * @param const char* unique_name The unique bus name of the player
+ * @param const char* bus_name The well-known bus name of the player
+ *
+ * @returns Player* The player, or NULL if the table is full.
+ */
+Player* player_table_add(PlayerTable* table, const char* unique_name,
+                         const char* bus_name);
+
+/**
+ * Get a player by the unique bus name of its connection
+ *
+ * @param PlayerTable* table The table
+ * @param const char* unique_name The unique bus name, e.g. the sender of a
+ *                                signal. This can be NULL.
+ *
+ * @returns Player* The player, or NULL if it is not in the table.
+ */
+Player* player_table_get(PlayerTable* table, const char* unique_name);
+
+/**
+ * Forget a well-known name a player released. If commands were sent to it,
+ * they are sent to another name the player still owns. Remove the player
+ * once it owns no names.
+ *
+ * @param Player* player The player
+ * @param const char* bus_name The released well-known name
+ *
+ * @returns int The number of names the player still owns
+ */
+int player_release_name(Player* player, const char* bus_name);
+
+/**
+ * Remove a player and free its state. The pointer must not be used
+ * afterwards.
+ *
+ * @param PlayerTable* table The table
+ * @param Player* player The player to remove
+ */
+void player_table_remove(PlayerTable* table, Player* player);
+
+/**
+ * Set a string of a player if it changed
+ *
+ * @param char** field The field of the player, e.g. &player->trackid
+ * @param const char* value The new value, or NULL to clear it
+ *
+ * @returns dbus_bool_t TRUE if the value changed, otherwise FALSE.
+ */
+dbus_bool_t player_set_string(char** field, const char* value);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/**
+ * USDT probes of the polybar_spotify provider, for tracing with bpftrace or
+ * perf without turning on debug logs. A probe that isn't traced is a single
+ * nop and its arguments are left wherever they already are, so the probes stay
+ * in release builds. See bench/probes/ for example scripts.
+ *
+ * PROBE(name, args...) takes up to 12 integer or pointer arguments. Strings
+ * are passed as pointers and read with str() in bpftrace.
+ *
+ * The probes are compiled out if the build sets USDT=0 or <sys/sdt.h> (from
+ * systemtap's sdt headers) is missing.
+ */
+
+#if defined(USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SDT
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE(...) STAP_PROBEV(polybar_spotify, __VA_ARGS__)
+#else
+#define PROBE(...) ((void)0)
+#endif
+
+#endif
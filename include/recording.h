@@ -0,0 +1,120 @@
+#ifndef _RECORDING_H_
+#define _RECORDING_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "utils.h"
+
+// First bytes of a recording, identifying its format
+#define RECORDING_MAGIC "SPOTREC1"
+#define RECORDING_MAGIC_LEN 8
+
+// Longest message a recording may hold, which is the longest message the bus
+// accepts
+#define RECORDING_MAX_MESSAGE_LEN (128 * 1024 * 1024)
+
+/**
+ * A file of messages received by the listener, which can be replayed into its
+ * handlers to benchmark them on the same input every time.
+ *
+ * The file starts with RECORDING_MAGIC, followed by a RecordHeader and the
+ * serialized message for every message. Headers are in the byte order of the
+ * machine the recording was made on, and the messages in the DBus wire
+ * format, which records its own byte order.
+ */
+typedef struct {
+    FILE* file;
+    // When the recording was created, which the times of the messages are
+    // relative to
+    long long started_us;
+
+    // Counters
+    unsigned long messages;
+    unsigned long long bytes;
+} Recording;
+
+/**
+ * Header of a message in a recording
+ */
+typedef struct {
+    // Microseconds from the start of the recording to receiving the message
+    int64_t time_us;
+    uint32_t len;
+} RecordHeader;
+
+/**
+ * Create a recording, replacing the file if it exists
+ *
+ * @param Recording* recording The recording to initialize
+ * @param const char* path The path to the file
+ *
+ * @returns dbus_bool_t TRUE if the file was created, otherwise FALSE with
+ *                      errno set.
+ */
+dbus_bool_t recording_create(Recording* recording, const char* path);
+
+/**
+ * Append a message to a recording. Writes are buffered, so the message may
+ * only be in the file once the recording is closed.
+ *
+ * @param Recording* recording The recording
+ * @param BusMessage* message The message
+ * @param long long time_us When the message was received, in CLOCK_MONOTONIC
+ *                          microseconds
+ * @param BusError* err The error set if the message can't be serialized or
+ *                      written
+ *
+ * @returns dbus_bool_t TRUE if the message was appended, otherwise FALSE.
+ */
+dbus_bool_t recording_write(Recording* recording, BusMessage* message,
+                            const long long time_us, BusError* err);
+
+/**
+ * Open a recording to read its messages
+ *
+ * @param Recording* recording The recording to initialize
+ * @param const char* path The path to the file
+ * @param BusError* err The error set if the file can't be read or is not a
+ *                      recording
+ *
+ * @returns dbus_bool_t TRUE if the recording was opened, otherwise FALSE.
+ */
+dbus_bool_t recording_open(Recording* recording, const char* path,
+                           BusError* err);
+
+/**
+ * Read the next message of a recording
+ *
+ * @param Recording* recording The recording
+ * @param long long* time_us Set to the microseconds from the start of the
+ *                           recording to receiving the message
+ * @param BusError* err The error set if the file is cut off or the message
+ *                      can't be read back
+ *
+ * @returns BusMessage* The message, or NULL at the end of the recording or if
+ *                      err was set. This must be freed with
+ *                      bus_message_unref.
+ */
+BusMessage* recording_read(Recording* recording, long long* time_us,
+                           BusError* err);
+
+/**
+ * Write the buffered messages of a recording and close its file
+ *
+ * @param Recording* recording The recording
+ *
+ * @returns dbus_bool_t TRUE if everything was written, otherwise FALSE.
+ */
+dbus_bool_t recording_close(Recording* recording);
+
+/**
+ * Get the number of allocations the calling thread made. This is only defined
+ * when a counting allocator is linked in, such as in spotify-replay, so it
+ * must be checked for NULL.
+ *
+ * @returns unsigned long The number of allocations
+ */
+unsigned long alloc_count() __attribute__((weak));
+
+#endif
@@ -1,61 +1,278 @@
 #ifndef _SPOTIFY_LISTENER_H_
 #define _SPOTIFY_LISTENER_H_
 
-#include <dbus-1.0/dbus/dbus.h>
 #include <stdarg.h>
 
+#include "command-queue.h"
+#include "command-socket.h"
+#include "event-loop.h"
+#include "logger.h"
+#include "marquee.h"
+#include "playback-position.h"
+#include "player-election.h"
+#include "player-table.h"
+#include "recording.h"
+#include "stats.h"
+#include "utils.h"
+
+// Maximum number of spotifyctl clients connected to the command socket at once
+#define MAX_COMMAND_CLIENTS 8
+
+// State of spotify
+typedef enum { PLAYING,
+               PAUSED,
+               EXITED } SpotifyState;
+
+/**
+ * Everything the handlers of the listener's event loop share
+ */
+typedef struct {
+    BusConnection* connection;
+    EventSource* bus_source;
+
+    // Commands received on the command socket
+    CommandQueue queue;
+    CommandClient clients[MAX_COMMAND_CLIENTS];
+
+    // Fire when the command in flight times out and when the pending
+    // prediction expires
+    EventSource* queue_timer;
+    EventSource* prediction_timer;
+
+    // Every MPRIS player on the bus, keyed by unique bus name. The active
+    // player is the one shown on polybar and sent commands, which follows the
+    // player elected by the election. It is NULL if there are no players.
+    PlayerTable players;
+    PlayerElection election;
+    Player* active;
+    // File the bus name of the active player is written to for spotifyctl,
+    // or NULL while replaying a recording
+    char* elected_path;
+
+    // The position timer fires when the position of the active player needs
+    // to be read from it or its reply arrived, and the progress timer when the
+    // position reaches the next second.
+    EventSource* position_timer;
+    EventSource* progress_timer;
+
+    // Scrolls the artist and title of the track while it is playing and the
+    // bars are shown. Its width is 0 if it is disabled. The marquee timer
+    // fires when the next frame is due.
+    Marquee marquee;
+    EventSource* marquee_timer;
+    int marquee_interval_ms;
+    long long marquee_due_ms;
+    dbus_bool_t bars_hidden;
+
+    // Counters. Signals are rejected if they weren't sent by a known player
+    // or are malformed. parse is the time from waking up for a signal to
+    // reading it, and transition the time to applying the state it changed.
+    unsigned long signals;
+    unsigned long rejected;
+    Histogram parse;
+    Histogram transition;
+
+    // Log level debug logs were turned on from, which SIGUSR2 goes back to
+    LogLevel log_level;
+
+    // Signals are recorded to it with --record, otherwise it is NULL
+    Recording* recording;
+} Listener;
+
 /**
- * Send the specified messages to polybar through IPC
+ * Queue the specified messages to be sent to polybar through IPC by the IPC
+ * writer thread. This does not wait for polybar.
  *
  * @param int numOfMsgs Number of variadic messages that will be given as args
- * @param ... char* strings to send
+ * @param ... char* string literals to send
  *
- * @returns dbus_bool_t TRUE if messages successfully sent, FALSE otherwise.
+ * @returns dbus_bool_t TRUE if messages successfully queued, FALSE if polybar
+ *                      is too far behind.
  */
 dbus_bool_t send_ipc_polybar(int numOfMsgs, ...);
 
 /**
- * DBus handler function for PropertiesChanged signals. This is automatically
- * called by DBus when a PropertiesChanged signal is broadcasted.
+ * Bus handler function for PropertiesChanged signals. This is automatically
+ * called by the bus backend for every message received.
  *
- * @param DBusConnection* connection The DBusConnection object
- * @param DBusMessage* message The PropertiesChanged signal message
- * @param void *user_data Pointer to extra user data for handler functions. Not
- *                        used.
+ * @param BusMessage* message The PropertiesChanged signal message
+ * @param void *user_data Pointer to the Listener
  *
- * @returns DBusHandlerResult The result of handling the signal. This returns
- * DBUS_HANDLER_RESULT_HANDLED if it was a signal from spotify contianing the
- * desired information, otherwise returns DBUS_HANDLER_RESULT_NOT_YET_HANDLED.
+ * @returns dbus_bool_t The result of handling the signal. This returns TRUE if
+ * it was a signal from a known player contianing the desired information,
+ * otherwise returns FALSE.
  */
-DBusHandlerResult properties_changed_handler(DBusConnection* connection,
-                                             DBusMessage* message,
-                                             void* user_data);
+dbus_bool_t properties_changed_handler(BusMessage* message, void* user_data);
 
 /**
- * DBus handler function for NameOwnerChanged signals. This is automatically
- * called by DBus when a NameOwnerChanged signal is broadcasted.
+ * Bus handler function for Seeked signals. This is automatically called by the
+ * bus backend for every message received.
  *
- * @param DBusConnection* connection The DBusConnection object
- * @param DBusMessage* message The NameOwnerChanged signal message
- * @param void *user_data Pointer to extra user data for handler functions. Not
- *                        used.
+ * @param BusMessage* message The Seeked signal message
+ * @param void *user_data Pointer to the Listener
  *
- * @returns DBusHandlerResult The result of handling the signal. This returns
- * DBUS_HANDLER_RESULT_HANDLED if it was a signal from spotify indicating a
- * disconnection, otherwise returns DBUS_HANDLER_RESULT_NOT_YET_HANDLED.
+ * @returns dbus_bool_t TRUE if it was a Seeked signal from a known player,
+ *                      otherwise FALSE.
  */
-DBusHandlerResult name_owner_changed_handler(DBusConnection* connection,
-                                             DBusMessage* message,
-                                             void* user_data);
+dbus_bool_t seeked_handler(BusMessage* message, void* user_data);
 
 /**
- * Dummy function used by DBus Handlers for extra user data. Since the handler
- * functions being used do not use any extra data, this function does nothing.
+ * Bus handler function for NameOwnerChanged signals. This is automatically
+ * called by the bus backend for every message received.
+ *
+ * @param BusMessage* message The NameOwnerChanged signal message
+ * @param void *user_data Pointer to the Listener
+ *
+ * @returns dbus_bool_t The result of handling the signal. This returns TRUE if
+ * it was a signal about the name of an MPRIS player, otherwise returns FALSE.
+ */
+dbus_bool_t name_owner_changed_handler(BusMessage* message, void* user_data);
+
+/**
+ * Bus handler function recording the signals the other handlers handle. It
+ * is added before them, and never stops them from seeing a message.
+ *
+ * @param BusMessage* message The received message
+ * @param void *user_data Pointer to the Listener
  *
- * @param void* memory Pointer to memory passed to the handler function to be
- * freed.
+ * @returns dbus_bool_t FALSE, so the other handlers are called.
  */
-void free_user_data(void* memory);
+dbus_bool_t record_handler(BusMessage* message, void* user_data);
+
+/**
+ * Handler for lines received on the command socket. Valid commands are queued
+ * to be forwarded to the active player, and players are pinned or unpinned.
+ *
+ * @param CommandClient* client The client that sent the line
+ * @param const char* line The received line
+ * @param void* user_data Pointer to the Listener
+ */
+void command_line_handler(CommandClient* client, const char* line,
+                          void* user_data);
+
+/**
+ * Event handler for the listening command socket. Accepts all pending
+ * connections and watches them in the loop. Connections beyond
+ * MAX_COMMAND_CLIENTS are closed straight away.
+ *
+ * @param EventSource* source The listening socket's source. Its user data is
+ *                            the Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void command_listen_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for a client of the command socket. Reads and handles its
+ * commands, writes the rest of its reply once its socket is writable, and
+ * closes it once it disconnected and got the whole reply.
+ *
+ * @param EventSource* source The client's source. Its user data is the
+ *                            Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void command_client_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for the bus connection. Messages are read and dispatched by
+ * listener_prepare, so this only has to wake up the loop.
+ *
+ * @param EventSource* source The bus connection's source
+ * @param uint32_t events The ready epoll events
+ */
+void bus_event_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for the command queue timer. Forwards the next command if the
+ * command in flight timed out.
+ *
+ * @param EventSource* source The timer's source. Its user data is the
+ *                            Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void queue_timer_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for the prediction timer. Rolls back the pending prediction.
+ *
+ * @param EventSource* source The timer's source
+ * @param uint32_t events The ready epoll events
+ */
+void prediction_timer_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for the position timer. Reads the position from spotify or
+ * shows the position spotify replied with.
+ *
+ * @param EventSource* source The timer's source. Its user data is the
+ *                            Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void position_timer_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for the progress timer. Shows the position once it reached
+ * the next second.
+ *
+ * @param EventSource* source The timer's source. Its user data is the
+ *                            Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void progress_timer_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for the marquee timer. Shows the next frame of the marquee.
+ *
+ * @param EventSource* source The timer's source. Its user data is the
+ *                            Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void marquee_timer_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for SIGINT and SIGTERM. Stops the event loop so the listener
+ * exits cleanly.
+ *
+ * @param EventSource* source The signal's source
+ * @param uint32_t events The ready epoll events
+ */
+void exit_signal_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for SIGUSR1. Prints the counters and latency histograms.
+ *
+ * @param EventSource* source The signal's source, whose user data is the
+ *                            Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void stats_signal_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for SIGUSR2. Turns debug logs on, or back off to the level
+ * they were turned on from.
+ *
+ * @param EventSource* source The signal's source, whose user data is the
+ *                            Listener.
+ * @param uint32_t events The ready epoll events
+ */
+void log_signal_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Event handler for the polybar IPC directory. Shows the current state on
+ * bars that were started after it last changed.
+ *
+ * @param EventSource* source The inotify source watching the directory
+ * @param uint32_t events The ready epoll events
+ */
+void ipc_directory_handler(EventSource* source, const uint32_t events);
+
+/**
+ * Called before the event loop waits. Forwards queued commands, flushes and
+ * dispatches the bus connection, and arms the timers.
+ *
+ * @param EventLoop* loop The event loop
+ * @param void* user_data Pointer to the Listener
+ */
+void listener_prepare(EventLoop* loop, void* user_data);
 
 /**
  * Updates current stored spotify state and sends IPC messages to polybar to
@@ -88,22 +305,86 @@ dbus_bool_t spotify_paused();
 dbus_bool_t spotify_exited();
 
 /**
- * Updates the currently stored spotify trackid.
+ * Sends the elapsed time and length of the active player's track to the
+ * spotify-progress module, or clears it if no player is running. The text is
+ * only sent when it changed.
  *
- * @param const char* The trackid
+ * @param Listener* listener The listener
+ * @param dbus_bool_t force Send the text even if it did not change
  *
- * @returns TRUE if no error, otherwise FALSE.
+ * @returns dbus_bool_t Returns TRUE if the text was sent, and FALSE otherwise.
  */
-dbus_bool_t update_last_trackid(const char* trackid);
+dbus_bool_t spotify_show_progress(Listener* listener, const dbus_bool_t force);
 
 /**
- * If the trackid has changed, an IPC message is sent to polybar to the status
- * module indicating a track change.
+ * Sends the current frame of the marquee to the spotify-marquee module, or
+ * clears it if spotify is not running. The text is only sent when it changed.
  *
- * @param const char* current_trackid The current trackid reported by spotify
+ * @param Listener* listener The listener
+ * @param dbus_bool_t advance Move on to the next frame afterwards
+ * @param dbus_bool_t force Send the text even if it did not change
  *
- * @returns dbus_bool_t TRUE if the trackid has changed, FALSE otherwise
+ * @returns dbus_bool_t Returns TRUE if the text was sent, and FALSE otherwise.
+ */
+dbus_bool_t spotify_show_marquee(Listener* listener, const dbus_bool_t advance,
+                                 const dbus_bool_t force);
+
+/**
+ * Get the time until the next frame of the marquee is due. The marquee only
+ * scrolls while spotify is playing and the bars are shown.
+ *
+ * @param Listener* listener The listener
+ *
+ * @returns int The timeout in milliseconds, or -1 if the marquee is not
+ *              scrolling
+ */
+int spotify_marquee_timeout_ms(Listener* listener);
+
+/**
+ * Sends IPC messages to polybar to show the current stored spotify state
+ * again, e.g. to a bar that was just started.
+ *
+ * @returns dbus_bool_t Returns TRUE if the messages were sent, and FALSE if
+ *                      spotify is not running.
+ */
+dbus_bool_t spotify_refresh();
+
+/**
+ * Predict the state spotify will be in after a command and show it on polybar
+ * straight away. The prediction is confirmed or rolled back by
+ * spotify_reconcile_prediction when spotify reports its state, or rolled back
+ * by spotify_expire_prediction if spotify doesn't report it in time. A
+ * command that brings the state back to the last confirmed one, like a second
+ * playpause, cancels the pending prediction instead.
+ *
+ * @param Command command The command sent to spotify
+ *
+ * @returns dbus_bool_t Returns TRUE if a prediction was made, FALSE if the
+ *                      command does not change the play state, spotify is
+ *                      not running or polybar is too far behind. The state
+ *                      is then left unchanged.
+ */
+dbus_bool_t spotify_predict(const Command command);
+
+/**
+ * Confirm or contradict the pending prediction with the state reported by
+ * spotify. The caller is responsible for applying the actual state.
+ *
+ * @param SpotifyState actual The state reported by spotify
+ */
+void spotify_reconcile_prediction(const SpotifyState actual);
+
+/**
+ * Get the time until the pending prediction expires
+ *
+ * @returns int The timeout in milliseconds, or -1 if no prediction is pending
+ */
+int spotify_prediction_timeout_ms();
+
+/**
+ * Roll back the pending prediction to the last confirmed state if spotify did
+ * not confirm it within PREDICTION_TIMEOUT_MS.
  */
-dbus_bool_t spotify_update_track(const char* current_trackid);
+void spotify_expire_prediction();
 
 #endif
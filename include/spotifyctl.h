@@ -1,29 +1,27 @@
 #ifndef _SPOTIFY_STATUS_H_
 #define _SPOTIFY_STATUS_H_
 
-#include <dbus-1.0/dbus/dbus.h>
+#include "utils.h"
 
-/**
- * Extract the title of the currently playing song on spotify from a
- * Metadata property DBusMessage
- *
- * @param DBusMessage* msg The Metadata property DBusMessage
- * @returns char* The title of the currently playing track
- */
-char* get_song_title_from_metadata(DBusMessage* msg);
+#ifdef WIRE_CLIENT
+#include "wire-client.h"
+#endif
 
-/**
- * Extract the artist of the currently playing song on spotify from a
- * Metadata property DBusMessage
- *
- * @param DBusMessage* msg The Metadata property DBusMessage
- * @returns char* The artist of the currently playing track
- */
-char* get_song_artist_from_metadata(DBusMessage* msg);
+/*** Program Mode ***/
+typedef enum {
+    MODE_STATUS,
+    MODE_PLAY,
+    MODE_PAUSE,
+    MODE_PREVIOUS,
+    MODE_NEXT,
+    MODE_PLAYPAUSE
+} ProgMode;
 
 /**
  * Build the output message according to the specified format options
  *
+ * @param Arena* arena The arena the output and the strings it is built from
+ *                     are allocated from, or NULL to malloc them
  * @param char* artist The artist name
  * @param char* title The track title
  * @param int max_artist_length The maximum length of the artist in the output
@@ -47,16 +45,113 @@ char* get_song_artist_from_metadata(DBusMessage* msg);
  *                string will be replaced with trunc while sataisfying the
  *                max length constraints.
  */
-char* format_output(const char* artist, const char* title,
+char* format_output(Arena* arena, const char* artist, const char* title,
                     const int max_artist_length, const int max_title_length,
                     const int max_length, const char* format,
                     const char* trunc);
 
+/**
+ * Send a method call without waiting for its reply. The reply times out once
+ * the latency budget set by --timeout runs out.
+ *
+ * @param BusConnection* connection The connection to the session bus
+ * @param BusMessage* msg The method call to send
+ *
+ * @returns BusPendingCall* The pending reply to pass to wait_within_budget,
+ *                          or NULL if the connection is disconnected.
+ */
+BusPendingCall* send_within_budget(BusConnection* connection,
+                                   BusMessage* msg);
+
+/**
+ * Wait for the reply to a method call sent by send_within_budget, giving up
+ * once the latency budget runs out. The connection is only serviced until
+ * DEADLINE_MS.
+ *
+ * @param BusConnection* connection The connection to the session bus
+ * @param BusPendingCall* pending The pending reply. This is freed by the
+ *                                function.
+ * @param BusError* err The error set if the call fails. This is
+ *                      BUS_ERROR_TIMEOUT if the budget ran out.
+ *
+ * @returns BusMessage* The reply, or NULL if err was set. The reply must be
+ *                      unreferenced by the caller.
+ */
+BusMessage* wait_within_budget(BusConnection* connection,
+                               BusPendingCall* pending, BusError* err);
+
+/**
+ * Get the path of the file caching the last good status output for the
+ * specified format options.
+ *
+ * @param int max_artist_length The maximum length of the artist in the output
+ * @param int max_title_length The maximum length of the title in the output
+ * @param int max_length The maximum length of the output string
+ * @param char* format The format string specifying the output
+ * @param char* trunc The string used to indicate truncation
+ *
+ * @returns char* The path to the cache file. This pointer must be freed by the
+ *                caller.
+ */
+char* get_status_cache_path(const int max_artist_length,
+                            const int max_title_length, const int max_length,
+                            const char* format, const char* trunc);
+
+/**
+ * Send commands to the player elected by spotify-listener instead of spotify.
+ * Nothing is changed if the listener doesn't accept connections on its
+ * command socket, e.g. because it crashed, or found no players.
+ */
+void load_elected_player();
+
+/**
+ * Send a method call to spotify requesting the Metadata property
+ *
+ * @param BusConnection* connection The connection to the session bus
+ *
+ * @returns BusPendingCall* The pending reply to pass to get_status, or NULL
+ *                          if the connection is disconnected.
+ */
+BusPendingCall* send_status_request(BusConnection* connection);
+
+/**
+ * Print the status output for a track and cache it for print_status_error
+ *
+ * @param const char* artist The artist name, or NULL if the track has none
+ * @param const char* title The track title, or NULL if the track has none
+ * @param int max_artist_length The maximum length of the artist in the output
+ * @param int max_title_length The maximum length of the title in the output
+ * @param int max_length The maximum length of the output string
+ * @param char* format The format string specifying the output
+ * @param char* trunc The string used to indicate truncation
+ * @param const char* cache_path The path returned by get_status_cache_path
+ */
+void print_status(const char* artist, const char* title,
+                  const int max_artist_length, const int max_title_length,
+                  const int max_length, const char* format, const char* trunc,
+                  const char* cache_path);
+
+/**
+ * Handle a failed status request. If spotify is stuck, the last output printed
+ * with the same options is printed instead of the error. Otherwise the cached
+ * output is removed and spotifyctl exits with the error.
+ *
+ * @param const char* message The error message
+ * @param dbus_bool_t stuck TRUE if spotify is running but did not reply in
+ *                          time
+ * @param const char* cache_path The path returned by get_status_cache_path
+ */
+void print_status_error(const char* message, const dbus_bool_t stuck,
+                        const char* cache_path);
+
 /**
  * Prints the status output message according to the specified format options
- * after making a method call to spotify to obtain the artist and title
+ * after receiving the reply to a status request containing the artist and
+ * title
  *
- * @param DBusConnection connection The DBusConnection object
+ * @param BusConnection* connection The connection to the session bus
+ * @param BusPendingCall* pending The pending reply returned by
+ *                                send_status_request
  * @param int max_artist_length The maximum length of the artist in the output
  * @param int max_title_length The maximum length of the title in the output
  * @param int max_length The maximum length of the output string
@@ -67,19 +162,124 @@ char* format_output(const char* artist, const char* title,
  *                    output was truncated. This will be how the artist, title
  *                    or output ends and will honor the max length constraints.
  *
+ * If spotify does not reply within the latency budget, the last output printed
+ * with the same options is printed instead.
+ */
+void get_status(BusConnection* connection, BusPendingCall* pending,
+                const int max_artist_length, const int max_title_length,
+                const int max_length, const char* format, const char* trunc);
+
+/**
+ * Create the org.mpris.MediaPlayer2.Player method call of a player command
+ *
+ * @param BusConnection* connection The connection to the session bus
+ * @param ProgMode mode The player command
+ *
+ * @returns BusMessage* The method call, or NULL if mode is not a player
+ *                      command. This must be unreferenced by the caller.
+ */
+BusMessage* new_player_call(BusConnection* connection, const ProgMode mode);
+
+/**
+ * Call the org.mpris.MediaPlayer2.Player method of a player command. Unless
+ * --wait was specified, the call is sent without asking spotify for a reply.
+ *
+ * @param BusConnection* connection The connection to the session bus
+ * @param ProgMode mode The player command
+ *
+ * @returns BusPendingCall* The pending reply to pass to wait_player_call if
+ *                          --wait was specified, otherwise NULL.
+ */
+BusPendingCall* spotify_player_call(BusConnection* connection,
+                                    const ProgMode mode);
+
+/**
+ * Wait for spotify to reply to a player method call and exit on error
+ *
+ * @param BusConnection* connection The connection to the session bus
+ * @param BusPendingCall* pending The pending reply returned by
+ *                                spotify_player_call
+ */
+void wait_player_call(BusConnection* connection, BusPendingCall* pending);
+
+/**
+ * Tell spotify-listener about play, pause and playpause commands that are
+ * about to be sent to spotify over DBus so it can show the resulting state
+ * before spotify confirms it.
+ *
+ * @param const ProgMode prog_modes[] The commands in order
+ * @param const char* const command_names[] The names of the commands. Entries
+ *                                          for status are not used.
+ * @param size_t num_of_modes The number of commands
+ */
+void send_predictions(const ProgMode prog_modes[],
+                      const char* const command_names[],
+                      const size_t num_of_modes);
+
+/**
+ * Get the org.mpris.MediaPlayer2.Player method called by a command
+ *
+ * @param ProgMode mode The command
+ *
+ * @returns const char* The name of the method, or NULL if the command is not
+ *                      a player method.
  */
-void get_status(DBusConnection* connection, const int max_artist_length,
-                const int max_title_length, const int max_length,
-                const char* format, const char* trunc);
+const char* get_player_method(const ProgMode mode);
 
+#ifdef WIRE_CLIENT
 /**
- * Call the specified org.mpris.MediaPlayer2.Player method
+ * Print the status from the reply to a status request sent by
+ * run_wire_commands
  *
- * @param DBusConnection* connection The DBusConnection object
- * @param const char* method The name of the org.mpris.MediaPlayer2.Player
- *                           method to call.
+ * @param WireStatus status The result of waiting for the reply
+ * @param const WireReply* reply The reply if status is WIRE_OK
+ * @param int max_artist_length The maximum length of the artist in the output
+ * @param int max_title_length The maximum length of the title in the output
+ * @param int max_length The maximum length of the output string
+ * @param char* format The format string specifying the output
+ * @param char* trunc The string used to indicate truncation
+ */
+void wire_get_status(const WireStatus status, const WireReply* reply,
+                     const int max_artist_length, const int max_title_length,
+                     const int max_length, const char* format,
+                     const char* trunc);
+
+/**
+ * Exit with an error if a player method call sent by run_wire_commands failed
+ *
+ * @param WireStatus status The result of waiting for the reply
+ * @param const WireReply* reply The reply if status is WIRE_OK
+ */
+void wire_check_player_call(const WireStatus status, const WireReply* reply);
+
+/**
+ * Run the commands with the minimal wire protocol client instead of libdbus.
+ * The authentication, Hello and every command are sent in a single write.
+ *
+ * @param const ProgMode prog_modes[] The commands in order
+ * @param size_t num_of_modes The number of commands
+ * @param int max_artist_length The maximum length of the artist in the output
+ * @param int max_title_length The maximum length of the title in the output
+ * @param int max_length The maximum length of the output string
+ * @param char* format The format string specifying the output
+ * @param char* trunc The string used to indicate truncation
+ *
+ * @returns dbus_bool_t Returns FALSE if the session bus address is not
+ *                      supported by the minimal client or connecting failed,
+ *                      in which case nothing was sent. Otherwise TRUE.
+ */
+dbus_bool_t run_wire_commands(const ProgMode prog_modes[],
+                              const size_t num_of_modes,
+                              const int max_artist_length,
+                              const int max_title_length, const int max_length,
+                              const char* format, const char* trunc);
+#endif
+
+/**
+ * Print the time spent in each phase of the command to stderr. This is
+ * registered with atexit when --timings is specified.
  */
-void spotify_player_call(DBusConnection* connection, const char* method);
+void print_timings();
 
 /**
  * Print spotifyctl usage information
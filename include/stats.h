@@ -0,0 +1,184 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "utils.h"
+
+// Every power of two is split into 2^HISTOGRAM_SUB_BITS buckets, so a value is
+// recorded with a relative error of at most 1/2^HISTOGRAM_SUB_BITS
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+// Values below 2^(HISTOGRAM_SUB_BITS + 1) microseconds are recorded exactly,
+// and values of 2^HISTOGRAM_MAX_BITS microseconds (over an hour) or more are
+// recorded as the largest value below it
+#define HISTOGRAM_MAX_BITS 32
+#define HISTOGRAM_BUCKETS \
+    (HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1))
+
+// Size of the buffer stats are formatted into
+#define STATS_BUFFER_SIZE 16384
+
+/**
+ * Log-bucketed histogram of latencies in microseconds, like an HDR histogram
+ * with 3 bits of precision. Recording a value is a count of leading zeros and
+ * an increment, so it is cheap enough for every signal and write.
+ *
+ * Every histogram must only be recorded to by a single thread. Other threads
+ * may read it while it is recorded to: every value they read is whole, but the
+ * buckets may be a few values apart.
+ */
+typedef struct {
+    atomic_ulong buckets[HISTOGRAM_BUCKETS];
+    atomic_ulong count;
+    atomic_ullong sum_us;
+    atomic_ullong max_us;
+} Histogram;
+
+/**
+ * Text that stats are formatted into
+ */
+typedef struct {
+    char buf[STATS_BUFFER_SIZE];
+    size_t len;
+    // Set if text didn't fit and was cut off
+    dbus_bool_t truncated;
+} StatsBuffer;
+
+/**
+ * Format of stats output
+ */
+typedef enum {
+    // Aligned text meant to be read by people
+    STATS_HUMAN,
+    // Prometheus text exposition format
+    STATS_PROMETHEUS
+} StatsFormat;
+
+/**
+ * Add to a counter only written by the calling thread, which other threads
+ * may read. A relaxed load and store is enough, and avoids the locked
+ * instruction of atomic_fetch_add.
+ *
+ * @param atomic_ulong* counter The counter
+ * @param unsigned long n The amount to add
+ */
+static inline void counter_add(atomic_ulong* counter, const unsigned long n) {
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+/**
+ * Initialize an empty histogram
+ *
+ * @param Histogram* histogram The histogram to initialize
+ */
+void histogram_init(Histogram* histogram);
+
+/**
+ * Record a latency. Must only be called from the thread owning the histogram.
+ *
+ * @param Histogram* histogram The histogram
+ * @param long long value_us The latency in microseconds. Negative values are
+ *                           recorded as 0.
+ */
+void histogram_record(Histogram* histogram, long long value_us);
+
+/**
+ * Get the value at a percentile
+ *
+ * @param const Histogram* histogram The histogram
+ * @param double percentile The percentile between 0 and 100
+ *
+ * @returns unsigned long long The highest value of the bucket containing the
+ *                             percentile in microseconds, at most the maximum
+ *                             recorded value, or 0 if the histogram is empty
+ */
+unsigned long long histogram_percentile(const Histogram* histogram,
+                                        const double percentile);
+
+/**
+ * Get the number of recorded values at or below a value
+ *
+ * @param const Histogram* histogram The histogram
+ * @param unsigned long long value_us The value in microseconds. Buckets end
+ *                                    just below powers of two, so the count
+ *                                    is exact for 2^k - 1.
+ *
+ * @returns unsigned long The number of values in the buckets ending at or
+ *                        below value_us
+ */
+unsigned long histogram_count_at_most(const Histogram* histogram,
+                                      const unsigned long long value_us);
+
+/**
+ * Start formatting stats into an empty buffer
+ *
+ * @param StatsBuffer* stats The buffer
+ */
+void stats_buffer_init(StatsBuffer* stats);
+
+/**
+ * Append formatted text to a buffer
+ *
+ * @param StatsBuffer* stats The buffer
+ * @param const char* format The printf format
+ * @param ... The arguments of the format
+ */
+void stats_printf(StatsBuffer* stats, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Append a counter
+ *
+ * @param StatsBuffer* stats The buffer
+ * @param StatsFormat format The format of the buffer
+ * @param const char* name The metric name without the spotify_listener_
+ *                         prefix, e.g. "signals_total"
+ * @param const char* help The description of the counter
+ * @param unsigned long long value The value
+ */
+void stats_counter(StatsBuffer* stats, const StatsFormat format,
+                   const char* name, const char* help,
+                   const unsigned long long value);
+
+/**
+ * Append a gauge, a value that can go down as well as up
+ *
+ * @param StatsBuffer* stats The buffer
+ * @param StatsFormat format The format of the buffer
+ * @param const char* name The metric name without the spotify_listener_
+ *                         prefix, e.g. "heap_bytes"
+ * @param const char* help The description of the gauge
+ * @param unsigned long long value The value
+ */
+void stats_gauge(StatsBuffer* stats, const StatsFormat format,
+                 const char* name, const char* help,
+                 const unsigned long long value);
+
+/**
+ * Append the header of the latency histograms. Must be called once before
+ * stats_histogram.
+ *
+ * @param StatsBuffer* stats The buffer
+ * @param StatsFormat format The format of the buffer
+ */
+void stats_histogram_header(StatsBuffer* stats, const StatsFormat format);
+
+/**
+ * Append a latency histogram of a stage. In Prometheus format, its buckets
+ * end at 2^k - 1 microseconds, the last value below a power of two.
+ *
+ * @param StatsBuffer* stats The buffer
+ * @param StatsFormat format The format of the buffer
+ * @param const char* stage The name of the stage, e.g. "parse"
+ * @param const Histogram* histogram The histogram
+ */
+void stats_histogram(StatsBuffer* stats, const StatsFormat format,
+                     const char* stage, const Histogram* histogram);
+
+#endif
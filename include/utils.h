@@ -1,122 +1,539 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
+#include <pthread.h>
+#include <stdio.h>
+
+#ifdef BUS_SDBUS
+// dbus_bool_t is the boolean type used throughout, so define it without
+// libdbus when building against sd-bus
+typedef unsigned int dbus_bool_t;
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+#else
 #include <dbus-1.0/dbus/dbus.h>
+#endif
+
+/*************** Bus backend ***************/
+// The programs only talk to the bus through the functions below. They are
+// implemented by bus-libdbus.c, or by bus-sdbus.c when built with BUS=sdbus.
+
+/**
+ * A connection to the session bus
+ */
+typedef struct BusConnection BusConnection;
 
 /**
- * Get the string pointed to by a DBusMessageIter
+ * A message with a read cursor. Reading works like sd-bus: the cursor points
+ * at the next value of the current container, and entering a container moves
+ * it inside until the container is exited again.
+ */
+typedef struct BusMessage BusMessage;
+
+/**
+ * The reply to an asynchronous method call
+ */
+typedef struct BusPendingCall BusPendingCall;
+
+/**
+ * An error returned by the bus or by the backend
+ */
+typedef struct {
+    char* name;
+    char* message;
+} BusError;
+
+/**
+ * Handler called for every message received on the connection
+ *
+ * @param BusMessage* message The message
+ * @param void* user_data The user data passed to bus_add_filter
  *
- * @param DBusMessageIter* The iterator pointing to the string
+ * @returns dbus_bool_t TRUE if the message was handled and no other handler
+ *                      should see it, otherwise FALSE.
+ */
+typedef dbus_bool_t (*BusMessageHandler)(BusMessage* message, void* user_data);
+
+// Types are identified by their character in a DBus signature
+#define BUS_TYPE_INVALID '\0'
+#define BUS_TYPE_BOOLEAN 'b'
+#define BUS_TYPE_INT32 'i'
+#define BUS_TYPE_UINT32 'u'
+#define BUS_TYPE_INT64 'x'
+#define BUS_TYPE_UINT64 't'
+#define BUS_TYPE_DOUBLE 'd'
+#define BUS_TYPE_STRING 's'
+#define BUS_TYPE_OBJECT_PATH 'o'
+#define BUS_TYPE_ARRAY 'a'
+#define BUS_TYPE_VARIANT 'v'
+#define BUS_TYPE_STRUCT 'r'
+#define BUS_TYPE_DICT_ENTRY 'e'
+
+// Errors checked by the programs
+#define BUS_ERROR_TIMEOUT "org.freedesktop.DBus.Error.Timeout"
+#define BUS_ERROR_NO_REPLY "org.freedesktop.DBus.Error.NoReply"
+#define BUS_ERROR_DISCONNECTED "org.freedesktop.DBus.Error.Disconnected"
+#define BUS_ERROR_FAILED "org.freedesktop.DBus.Error.Failed"
+#define BUS_ERROR_NOT_SUPPORTED "org.freedesktop.DBus.Error.NotSupported"
+
+/**
+ * Initialize an error so it is not set
  *
- * @returns char* The string pointed to by the iter if it is pointing at a
- *                string. Otherwise, it returns a NULL pointer. This pointer
- *                must be freed by the caller.
+ * @param BusError* err The error
  */
-char* iter_get_string(DBusMessageIter* iter);
+void bus_error_init(BusError* err);
 
 /**
- * Prints the string pointed to by a DBusMessageIter
+ * Set an error, replacing any previous one
  *
- * @param DBusMessage* iter The iterator pointing to a string
+ * @param BusError* err The error
+ * @param const char* name The name of the error
+ * @param const char* message The error message
  */
-void print_string_iter(DBusMessageIter* iter);
+void bus_error_set(BusError* err, const char* name, const char* message);
 
 /**
- * Initialize subiter inside the container pointed to be iter if it is of the
- * specified type.
+ * Check if an error is set
  *
- * @param DBusMessageIter* iter The iterator pointing at a container
- * @param DBusMessageIter* subiter The iterator to initialize inside the
- *                                 container.
- * @param int type The exptected type of the container
+ * @param const BusError* err The error
  *
- * @returns dbus_bool_t Returns TRUE if the specified type matches the type of
- *                      the container and the subiter is successfully
- *                      initialized, otherwise returns FALSE.
+ * @returns dbus_bool_t TRUE if the error is set, otherwise FALSE.
  */
-dbus_bool_t recurse_iter_of_type(DBusMessageIter* iter,
-                                 DBusMessageIter* subiter, const int type);
+dbus_bool_t bus_error_is_set(const BusError* err);
 
 /**
- * Initialize subiter inside the container pointed to be iter if it is of the
- * specified signature.
+ * Check if an error is set and has the specified name
  *
- * @param DBusMessageIter* iter The iterator pointing at a container
- * @param DBusMessageIter* subiter The iterator to initialize inside the
- *                                 container.
- * @param const char* signature The exptected signature of the container
+ * @param const BusError* err The error
+ * @param const char* name The name of the error
  *
- * @returns dbus_bool_t Returns TRUE if the specified signature matches the
- *                      signature of the container and the subiter is
- *                      successfully initialized, otherwise returns FALSE.
+ * @returns dbus_bool_t TRUE if the error has the name, otherwise FALSE.
  */
-dbus_bool_t recurse_iter_of_signature(DBusMessageIter* iter,
-                                      DBusMessageIter* subiter,
-                                      const char* signature);
+dbus_bool_t bus_error_has_name(const BusError* err, const char* name);
 
 /**
- * Initialize entry_iter at an array dict element matching the specified key.
+ * Free the contents of an error so it is not set
  *
- * @param DBusMessageIter* array_iter The iterator pointing at an array of
- *                                    dictionary entries.
- * @param DBusMessageIter* entry_iter The iterator to initialize at the value of
- *                                    the dictionary entry.
- * @param const char* key The key of the dictionary entry.
+ * @param BusError* err The error
+ */
+void bus_error_free(BusError* err);
+
+/**
+ * Connect to the session bus
+ *
+ * @param BusError* err The error set if connecting fails
+ *
+ * @returns BusConnection* The connection, or NULL if err was set
+ */
+BusConnection* bus_connect_session(BusError* err);
+
+/**
+ * Close a connection and free it
  *
- * @returns dbus_bool_t Returns TRUE if a dictionary entry with the specified
- *                      key is found and the entry_iter is successfully
- *                      initialized, otherwise returns FALSE.
+ * @param BusConnection* connection The connection
  */
-dbus_bool_t iter_go_to_key(DBusMessageIter* array_iter,
-                           DBusMessageIter* entry_iter, const char* key);
+void bus_connection_close(BusConnection* connection);
 
 /**
- * Try to recurse the iter into a container that it is pointing at with the
- * specified type. This points the iter to the first element of the container,
- * rather than initializing a new subiter.
+ * Ask the bus to send the connection messages matching a match rule
  *
- * @param DBusMessageIter* iter The iterator pointing at a container
- * @param int type The exptected type of the container
+ * @param BusConnection* connection The connection
+ * @param const char* rule The match rule
+ * @param BusError* err The error set if the bus rejects the rule
  *
- * @returns dbus_bool_t Returns TRUE if the specified type matches the type of
- *                      the container and the iter is successfully inside the
- *                      container, otherwise returns FALSE.
+ * @returns dbus_bool_t TRUE if the rule was added, otherwise FALSE.
  */
-dbus_bool_t iter_try_step_into_type(DBusMessageIter* iter, const int type);
+dbus_bool_t bus_add_match(BusConnection* connection, const char* rule,
+                          BusError* err);
 
 /**
- * Try to recurse the iter into a container that it is pointing at with the
- * specified signature. This points the iter to the first element of the
- * container, rather than initializing a new subiter.
+ * Add a handler called for every message received on the connection, such as
+ * the signals requested with bus_add_match. Handlers are called in the order
+ * they were added, from bus_process.
+ *
+ * @param BusConnection* connection The connection
+ * @param BusMessageHandler handler The handler
+ * @param void* user_data Extra data passed to the handler
+ *
+ * @returns dbus_bool_t TRUE if the handler was added, otherwise FALSE.
+ */
+dbus_bool_t bus_add_filter(BusConnection* connection,
+                           BusMessageHandler handler, void* user_data);
+
+/**
+ * Get the file descriptor of the connection to poll
+ *
+ * @param BusConnection* connection The connection
+ *
+ * @returns int The file descriptor, or -1 on error
+ */
+int bus_get_fd(BusConnection* connection);
+
+/**
+ * Get the poll events to wait for on the connection's file descriptor
+ *
+ * @param BusConnection* connection The connection
+ *
+ * @returns short The poll events
+ */
+short bus_get_events(BusConnection* connection);
+
+/**
+ * Read everything available on the connection without blocking and call the
+ * handlers for every message received.
+ *
+ * @param BusConnection* connection The connection
+ *
+ * @returns dbus_bool_t FALSE if the connection was closed, otherwise TRUE.
+ */
+dbus_bool_t bus_process(BusConnection* connection);
+
+/**
+ * Wait until the connection can be read or the timeout passes, then process
+ * it like bus_process.
+ *
+ * @param BusConnection* connection The connection
+ * @param int timeout_ms The maximum time to wait in milliseconds
+ *
+ * @returns dbus_bool_t FALSE if the connection was closed, otherwise TRUE.
+ */
+dbus_bool_t bus_wait(BusConnection* connection, const int timeout_ms);
+
+/**
+ * Block until every queued message has been written
+ *
+ * @param BusConnection* connection The connection
+ */
+void bus_flush(BusConnection* connection);
+
+/**
+ * Create a method call
+ *
+ * @param BusConnection* connection The connection it will be sent on
+ * @param const char* destination The bus name to send the call to
+ * @param const char* path The object path
+ * @param const char* iface The interface
+ * @param const char* method The method name
  *
- * @param DBusMessageIter* iter The iterator pointing at a container
- * @param const char* signature The exptected signature of the container
+ * @returns BusMessage* The method call, or NULL on error. This must be freed
+ *                      with bus_message_unref.
+ */
+BusMessage* bus_method_call_new(BusConnection* connection,
+                                const char* destination, const char* path,
+                                const char* iface, const char* method);
+
+/**
+ * Create a signal, e.g. to record a signal that was not received
+ *
+ * @param BusConnection* connection The connection it would be sent on
+ * @param const char* path The object path
+ * @param const char* iface The interface
+ * @param const char* member The name of the signal
+ *
+ * @returns BusMessage* The signal, or NULL on error. This must be freed with
+ *                      bus_message_unref.
+ */
+BusMessage* bus_signal_new(BusConnection* connection, const char* path,
+                           const char* iface, const char* member);
+
+/**
+ * Append a string argument to a message
+ *
+ * @param BusMessage* message The message
+ * @param const char* str The string
+ *
+ * @returns dbus_bool_t TRUE if the argument was appended, otherwise FALSE.
+ */
+dbus_bool_t bus_message_append_string(BusMessage* message, const char* str);
+
+/**
+ * Append an argument of a basic type to a message
+ *
+ * @param BusMessage* message The message
+ * @param char type The type of the argument, e.g. BUS_TYPE_INT64
+ * @param const void* value Pointer to the value. For strings and object
+ *                          paths, this points to the const char*.
+ *
+ * @returns dbus_bool_t TRUE if the argument was appended, otherwise FALSE.
+ */
+dbus_bool_t bus_message_append_basic(BusMessage* message, const char type,
+                                     const void* value);
+
+/**
+ * Tell the destination not to reply to a method call
+ *
+ * @param BusMessage* message The method call
+ */
+void bus_message_set_no_reply(BusMessage* message);
+
+/**
+ * Free a message
+ *
+ * @param BusMessage* message The message
+ */
+void bus_message_unref(BusMessage* message);
+
+/**
+ * Queue a message without waiting for a reply
+ *
+ * @param BusConnection* connection The connection
+ * @param BusMessage* message The message
+ *
+ * @returns dbus_bool_t TRUE if the message was queued, otherwise FALSE.
+ */
+dbus_bool_t bus_send(BusConnection* connection, BusMessage* message);
+
+/**
+ * Send a method call and block until its reply arrives
+ *
+ * @param BusConnection* connection The connection
+ * @param BusMessage* message The method call
+ * @param int timeout_ms The time to wait for the reply in milliseconds
+ * @param BusError* err The error set if the call fails or the reply is an
+ *                      error
+ *
+ * @returns BusMessage* The reply, or NULL if err was set. This must be freed
+ *                      with bus_message_unref.
+ */
+BusMessage* bus_call(BusConnection* connection, BusMessage* message,
+                     const int timeout_ms, BusError* err);
+
+/**
+ * Queue a method call and return without waiting for its reply. The reply is
+ * received by bus_process or bus_wait.
+ *
+ * @param BusConnection* connection The connection
+ * @param BusMessage* message The method call
+ * @param int timeout_ms The time after which the backend gives up on the
+ *                       reply in milliseconds
+ *
+ * @returns BusPendingCall* The pending reply, or NULL on error. This must be
+ *                          freed with bus_pending_call_free.
+ */
+BusPendingCall* bus_call_async(BusConnection* connection, BusMessage* message,
+                               const int timeout_ms);
+
+/**
+ * Check if the reply to an asynchronous method call has arrived
+ *
+ * @param BusPendingCall* pending The pending reply
+ *
+ * @returns dbus_bool_t TRUE if the reply arrived, otherwise FALSE.
+ */
+dbus_bool_t bus_pending_call_completed(BusPendingCall* pending);
+
+/**
+ * Take the reply of a completed asynchronous method call
+ *
+ * @param BusPendingCall* pending The completed pending reply
+ * @param BusError* err The error set if the reply is an error
+ *
+ * @returns BusMessage* The reply, or NULL if err was set. This must be freed
+ *                      with bus_message_unref.
+ */
+BusMessage* bus_pending_call_steal_reply(BusPendingCall* pending,
+                                         BusError* err);
+
+/**
+ * Free a pending reply, ignoring the reply if it has not arrived yet
+ *
+ * @param BusPendingCall* pending The pending reply
+ */
+void bus_pending_call_free(BusPendingCall* pending);
+
+/**
+ * Check if a message is a signal with the given interface and member
+ *
+ * @param BusMessage* message The message
+ * @param const char* interface The interface of the signal
+ * @param const char* member The name of the signal
+ *
+ * @returns dbus_bool_t TRUE if the message is that signal, otherwise FALSE.
+ */
+dbus_bool_t bus_message_is_signal(BusMessage* message, const char* interface,
+                                  const char* member);
+
+/**
+ * Get the unique bus name of the sender of a message
  *
- * @returns dbus_bool_t Returns TRUE if the specified signature matches the
- *                      signature of the container and the iter is successfully
- *                      initialized inside the container, otherwise returns
+ * @param BusMessage* message The message
+ *
+ * @returns const char* The sender (e.g. ":1.42"), or NULL if it is unknown.
+ *                      It is owned by the message.
+ */
+const char* bus_message_get_sender(BusMessage* message);
+
+/**
+ * Move the read cursor back to the first argument of a message
+ *
+ * @param BusMessage* message The message
+ */
+void bus_message_rewind(BusMessage* message);
+
+/**
+ * Get the type of the value at the read cursor
+ *
+ * @param BusMessage* message The message
+ * @param const char** contents Set to the signature of the contents if the
+ *                              value is a container. This can be NULL.
+ *
+ * @returns char The type, or BUS_TYPE_INVALID at the end of the container
+ */
+char bus_message_peek_type(BusMessage* message, const char** contents);
+
+/**
+ * Move the read cursor inside the container at the read cursor
+ *
+ * @param BusMessage* message The message
+ * @param char type The expected type of the container
+ *
+ * @returns dbus_bool_t TRUE if the value at the cursor is a container of the
+ *                      expected type and the cursor moved inside it,
+ *                      otherwise FALSE.
+ */
+dbus_bool_t bus_message_enter(BusMessage* message, const char type);
+
+/**
+ * Move the read cursor to the value after the container it is inside
+ *
+ * @param BusMessage* message The message
+ *
+ * @returns dbus_bool_t FALSE if the cursor is not inside a container,
+ *                      otherwise TRUE.
+ */
+dbus_bool_t bus_message_exit(BusMessage* message);
+
+/**
+ * Read the string at the read cursor and move the cursor to the next value
+ *
+ * @param BusMessage* message The message
+ * @param const char** str Set to the string. This points into the message.
+ *
+ * @returns dbus_bool_t TRUE if the value at the cursor is a string, otherwise
  *                      FALSE.
  */
-dbus_bool_t iter_try_step_into_signature(DBusMessageIter* iter,
-                                         const char* signature);
+dbus_bool_t bus_message_read_string(BusMessage* message, const char** str);
+
+/**
+ * Read the value of a basic type at the read cursor and move the cursor to the
+ * next value
+ *
+ * @param BusMessage* message The message
+ * @param char type The expected type of the value, e.g. BUS_TYPE_INT64
+ * @param void* value Set to the value. Strings and object paths are read as
+ *                    const char* pointing into the message, booleans as
+ *                    dbus_bool_t.
+ *
+ * @returns dbus_bool_t TRUE if the value at the cursor has the expected type,
+ *                      otherwise FALSE.
+ */
+dbus_bool_t bus_message_read_basic(BusMessage* message, const char type,
+                                   void* value);
+
+/**
+ * Move the read cursor past the value at the read cursor
+ *
+ * @param BusMessage* message The message
+ *
+ * @returns dbus_bool_t FALSE if the cursor is at the end of the container,
+ *                      otherwise TRUE.
+ */
+dbus_bool_t bus_message_skip(BusMessage* message);
+
+/**
+ * Serialize a message in the DBus wire format, e.g. to store it. A message
+ * that was never sent is given the serial 1, as messages without a serial
+ * can't be read back.
+ *
+ * @param BusMessage* message The message
+ * @param char** data Set to the serialized message. This must be freed with
+ *                    bus_free.
+ * @param int* len Set to the length of the serialized message
+ * @param BusError* err The error set if the message can't be serialized, e.g.
+ *                      because the backend doesn't support it
+ *
+ * @returns dbus_bool_t TRUE if the message was serialized, otherwise FALSE.
+ */
+dbus_bool_t bus_message_marshal(BusMessage* message, char** data, int* len,
+                                BusError* err);
+
+/**
+ * Read back a message serialized by bus_message_marshal. The message is not
+ * associated with a connection, so it can only be read.
+ *
+ * @param const char* data The serialized message
+ * @param int len The length of the serialized message
+ * @param BusError* err The error set if the data is not a valid message or
+ *                      the backend doesn't support it
+ *
+ * @returns BusMessage* The message, or NULL if err was set. This must be
+ *                      freed with bus_message_unref.
+ */
+BusMessage* bus_message_demarshal(const char* data, const int len,
+                                  BusError* err);
+
+/**
+ * Free memory allocated by the backend, such as serialized messages
+ *
+ * @param void* data The memory to free
+ */
+void bus_free(void* data);
+
+/*************** Arena ***************/
+
+// Size of the blocks an arena allocates from. Larger allocations get a block
+// of their own.
+#define ARENA_BLOCK_SIZE 4096
+
+/**
+ * Memory for short-lived strings that are freed all at once, e.g. after an
+ * event or when the program exits. Allocating moves a pointer through the
+ * current block, and malloc is only called when the block is full. A zeroed
+ * Arena is empty.
+ */
+typedef struct {
+    // The block allocated last, which links to the ones before it
+    struct ArenaBlock* block;
+    // Bytes of the current block handed out
+    size_t used;
+
+    // Counters
+    unsigned long blocks;
+} Arena;
+
+/**
+ * Allocate memory from an arena. The functions ending in _a allocate their
+ * result with this.
+ *
+ * @param Arena* arena The arena, or NULL to allocate with malloc
+ * @param size_t size The number of bytes
+ *
+ * @returns void* The memory, aligned like malloc's, or NULL on error. It is
+ *                valid until the arena is reset or freed, or must be freed by
+ *                the caller if it came from malloc.
+ */
+void* arena_alloc(Arena* arena, const size_t size);
 
 /**
- * Try to recurse the iter into an array of dictionary entries and set the iter
- * to point at the value of a dictionary entry of the specified key. This points
- * the iter to the value of the dictionary entry, rather than initializing a new
- * subiter.
+ * Free everything allocated from an arena, keeping its last block for the
+ * next allocations
  *
- * @param DBusMessageIter* iter The iterator pointing at an array of dictionary
- *                              entries.
- * @param const char* key The key of desired dictionary entry
+ * @param Arena* arena The arena
+ */
+void arena_reset(Arena* arena);
+
+/**
+ * Free all blocks of an arena, leaving it empty
  *
- * @returns dbus_bool_t Returns TRUE if a dictionary entry is found with the
- *                      specified key and the iter is successfully initialized
- *                      at the value of this dictionary entry, otherwise
- *                      returns FALSE.
+ * @param Arena* arena The arena
  */
-dbus_bool_t iter_try_step_to_key(DBusMessageIter* element_iter,
-                                 const char* key);
+void arena_free(Arena* arena);
+
+/*************** Helpers ***************/
 
 /**
  * Sleep milliseconds
@@ -128,6 +545,20 @@ dbus_bool_t iter_try_step_to_key(DBusMessageIter* element_iter,
  */
 dbus_bool_t msleep(const long milliseconds);
 
+/**
+ * Start a thread with all signals blocked, so they are left to the thread
+ * handling them, e.g. the listener's event loop with its signalfds
+ *
+ * @param pthread_t* thread Set to the started thread
+ * @param void* (*start)(void*) The function the thread runs
+ * @param void* arg The argument passed to start
+ *
+ * @returns dbus_bool_t Returns TRUE if the thread was started, otherwise
+ *                      FALSE.
+ */
+dbus_bool_t start_thread_without_signals(pthread_t* thread,
+                                         void* (*start)(void*), void* arg);
+
 /**
  * Get an array of paths to polybar's IPC files in the specified directory.
  *
@@ -144,6 +575,16 @@ dbus_bool_t msleep(const long milliseconds);
 dbus_bool_t get_polybar_ipc_paths(const char* ipc_path, char** ptr_paths[],
                                   size_t* num_of_paths);
 
+/**
+ * Like get_polybar_ipc_paths, with the array and the paths allocated from an
+ * arena
+ *
+ * @param Arena* arena The arena, or NULL to malloc the array and every path
+ */
+dbus_bool_t get_polybar_ipc_paths_a(Arena* arena, const char* ipc_path,
+                                    char** ptr_paths[],
+                                    size_t* num_of_paths);
+
 /**
  * Join two paths together. This function takes into account if the first path
  * ends in a '/' and concatenates the two paths together.
@@ -157,6 +598,13 @@ dbus_bool_t get_polybar_ipc_paths(const char* ipc_path, char** ptr_paths[],
  */
 char* join_path(const char* p1, const char* p2);
 
+/**
+ * Like join_path, with the path allocated from an arena
+ *
+ * @param Arena* arena The arena, or NULL to malloc the path
+ */
+char* join_path_a(Arena* arena, const char* p1, const char* p2);
+
 /**
  * Replace all instances of a given string in a source string with another
  * string. This works from left-to-right, replacing 'strstr' with 'test' in the
@@ -170,6 +618,14 @@ char* join_path(const char* p1, const char* p2);
  */
 char* str_replace_all(const char* str, const char* find, const char* repl);
 
+/**
+ * Like str_replace_all, with the new string allocated from an arena
+ *
+ * @param Arena* arena The arena, or NULL to malloc the new string
+ */
+char* str_replace_all_a(Arena* arena, const char* str, const char* find,
+                        const char* repl);
+
 /**
  * Truncate the specified string if it longer than the specified maximum length
  * and end the string with trunc while satisfying the max length constraint.
@@ -183,6 +639,14 @@ char* str_replace_all(const char* str, const char* find, const char* repl);
  */
 char* str_trunc(const char* str, const int max_len, const char* trunc);
 
+/**
+ * Like str_trunc, with the truncated string allocated from an arena
+ *
+ * @param Arena* arena The arena, or NULL to malloc the truncated string
+ */
+char* str_trunc_a(Arena* arena, const char* str, const int max_len,
+                  const char* trunc);
+
 /**
  * Find the number of matches of a given string in another string. This works
  * from left-to-right using similar logic to the str_replace_all function. As a
@@ -196,4 +660,81 @@ char* str_trunc(const char* str, const int max_len, const char* trunc);
  */
 int num_of_matches(const char* str, const char* find);
 
+/**
+ * Get the current CLOCK_MONOTONIC time in milliseconds
+ *
+ * @returns long long The current monotonic time in milliseconds
+ */
+long long monotonic_ms();
+
+/**
+ * Get the current CLOCK_MONOTONIC time in microseconds
+ *
+ * @returns long long The current monotonic time in microseconds
+ */
+long long monotonic_us();
+
+// Prefix of the runtime directory used without $XDG_RUNTIME_DIR, followed by
+// the user's uid
+#define RUNTIME_FALLBACK_PREFIX "/tmp/spotifyctl-"
+
+/**
+ * Get the path to a file in the user's runtime directory. This is
+ * $XDG_RUNTIME_DIR if it is set, otherwise /tmp/spotifyctl-<uid>, which is
+ * created with mode 0700. The fallback directory is refused if it is not a
+ * directory owned by the user that only they can access.
+ *
+ * @param const char* name The name of the file in the runtime directory
+ *
+ * @returns char* The path to the file and NULL on error. This pointer must be
+ *                freed by the caller.
+ */
+char* get_runtime_path(const char* name);
+
+/**
+ * Read the entire contents of a small file into a string.
+ *
+ * @param const char* path The path to the file
+ *
+ * @returns char* The contents of the file and NULL if the file could not be
+ *                read. This pointer must be freed by the caller.
+ */
+char* read_file(const char* path);
+
+/**
+ * Atomically replace the contents of a file by writing to a temporary file
+ * beside it and renaming it into place, so readers never see a partial file.
+ * The temporary file is created with mkstemp, readable only by the user.
+ *
+ * @param const char* path The path to the file
+ * @param const char* contents The new contents of the file
+ *
+ * @returns dbus_bool_t Returns TRUE if the file was replaced, otherwise FALSE.
+ */
+dbus_bool_t write_file_atomic(const char* path, const char* contents);
+
+// Maximum number of phases recorded by timings_mark
+#define TIMINGS_MAX_MARKS 16
+
+/**
+ * Record a CLOCK_MONOTONIC timestamp marking the end of the specified phase.
+ * The first phase is measured from the start of the process. At most
+ * TIMINGS_MAX_MARKS phases are recorded, further marks are ignored.
+ *
+ * @param const char* phase The name of the phase that just ended. This must be
+ *                          a string literal or otherwise outlive the process.
+ *
+ * @returns dbus_bool_t Returns TRUE if the mark was recorded, otherwise FALSE.
+ */
+dbus_bool_t timings_mark(const char* phase);
+
+/**
+ * Print a one-line breakdown of the time spent in each phase recorded by
+ * timings_mark in milliseconds, followed by the total time since the process
+ * started.
+ *
+ * @param FILE* stream The stream to print the breakdown to
+ */
+void timings_print(FILE* stream);
+
 #endif
@@ -0,0 +1,125 @@
+#ifndef _WIRE_CLIENT_H_
+#define _WIRE_CLIENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A minimal DBus client that speaks the wire protocol directly. It only
+ * supports what spotifyctl needs: connecting to a unix socket bus address,
+ * SASL EXTERNAL authentication, sending method calls with string arguments and
+ * decoding the fields of their replies that spotifyctl uses. It only depends on
+ * libc so spotifyctl can be linked statically.
+ */
+typedef struct WireConnection WireConnection;
+
+/**
+ * Result of waiting for the bus
+ */
+typedef enum { WIRE_OK, WIRE_TIMEOUT, WIRE_FAILED } WireStatus;
+
+/**
+ * A method return or error reply
+ */
+typedef struct {
+    // Name of the error if the reply is an error, otherwise NULL
+    char* error_name;
+    // The error message if the reply is an error, otherwise NULL
+    char* error_message;
+    // The body of the reply and its signature
+    unsigned char* body;
+    size_t body_len;
+    char* signature;
+    // TRUE if the body is big endian
+    int big_endian;
+} WireReply;
+
+/**
+ * Connect to the first unix socket address in a DBus address string. The
+ * authentication and Hello call are only queued, they are sent together with
+ * the first method calls by wire_flush.
+ *
+ * @param const char* address The bus address, e.g. the value of
+ *                            DBUS_SESSION_BUS_ADDRESS
+ *
+ * @returns WireConnection* The connection, or NULL if the address has no
+ *                          supported unix socket address or connecting failed.
+ */
+WireConnection* wire_connect(const char* address);
+
+/**
+ * Queue a method call with up to two string arguments
+ *
+ * @param WireConnection* conn The connection
+ * @param const char* destination The bus name to send the call to
+ * @param const char* path The object path
+ * @param const char* iface The interface
+ * @param const char* member The method name
+ * @param const char* const args[] The string arguments
+ * @param int num_of_args The number of arguments, at most 2
+ * @param int no_reply TRUE if the destination should not reply
+ *
+ * @returns uint32_t The serial of the call to pass to wire_wait_reply, or 0
+ *                   on error.
+ */
+uint32_t wire_queue_call(WireConnection* conn, const char* destination,
+                         const char* path, const char* iface,
+                         const char* member, const char* const args[],
+                         const int num_of_args, const int no_reply);
+
+/**
+ * Write everything queued with a single write where possible
+ *
+ * @param WireConnection* conn The connection
+ * @param long long deadline_ms The CLOCK_MONOTONIC time in milliseconds to give
+ *                              up at
+ *
+ * @returns WireStatus WIRE_OK if everything was written
+ */
+WireStatus wire_flush(WireConnection* conn, const long long deadline_ms);
+
+/**
+ * Wait for the reply to a method call, skipping any other messages.
+ *
+ * @param WireConnection* conn The connection
+ * @param uint32_t serial The serial returned by wire_queue_call
+ * @param long long deadline_ms The CLOCK_MONOTONIC time in milliseconds to give
+ *                              up at
+ * @param WireReply* reply The reply to fill in. It must be freed with
+ *                         wire_free_reply if WIRE_OK is returned.
+ *
+ * @returns WireStatus WIRE_OK if the reply was received, WIRE_TIMEOUT if the
+ *                     deadline passed and WIRE_FAILED if the connection failed
+ *                     or the bus rejected the authentication.
+ */
+WireStatus wire_wait_reply(WireConnection* conn, const uint32_t serial,
+                           const long long deadline_ms, WireReply* reply);
+
+/**
+ * Find a string in the a{sv} dictionary inside the variant returned by
+ * org.freedesktop.DBus.Properties.Get. If the value is an array of strings,
+ * the first string is returned.
+ *
+ * @param const WireReply* reply The reply to a Get call
+ * @param const char* key The dictionary key
+ *
+ * @returns char* The string, or NULL if the key was not found. This pointer
+ *                must be freed by the caller.
+ */
+char* wire_reply_find_metadata(const WireReply* reply, const char* key);
+
+/**
+ * Free the contents of a reply
+ *
+ * @param WireReply* reply The reply
+ */
+void wire_free_reply(WireReply* reply);
+
+/**
+ * Close the connection and free it
+ *
+ * @param WireConnection* conn The connection
+ */
+void wire_close(WireConnection* conn);
+
+#endif
@@ -0,0 +1,424 @@
+#include <dbus-1.0/dbus/dbus.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/utils.h"
+
+// Maximum number of nested containers the read cursor can be inside
+#define BUS_MAX_DEPTH 32
+
+// BusConnection and BusPendingCall are the libdbus objects themselves
+#define TO_CONNECTION(connection) ((DBusConnection*)(connection))
+#define TO_PENDING(pending) ((DBusPendingCall*)(pending))
+
+struct BusMessage {
+    DBusMessage* message;
+    // Iterators of the containers the cursor is inside. The last one is the
+    // cursor itself.
+    DBusMessageIter iters[BUS_MAX_DEPTH];
+    int depth;
+    // Signature returned by bus_message_peek_type
+    char contents[256];
+};
+
+/**
+ * A handler added with bus_add_filter
+ */
+typedef struct {
+    BusMessageHandler handler;
+    void* user_data;
+} BusFilter;
+
+/**
+ * Copy a libdbus error into err and free it
+ */
+static void set_error_from_dbus(BusError* err, DBusError* dbus_err) {
+    if (err != NULL)
+        bus_error_set(err, dbus_err->name, dbus_err->message);
+    dbus_error_free(dbus_err);
+}
+
+/**
+ * Point a message's read cursor at its first argument
+ */
+static void init_cursor(BusMessage* message) {
+    message->depth = 0;
+    dbus_message_iter_init(message->message, &message->iters[0]);
+}
+
+/**
+ * Wrap a libdbus message, taking over its reference
+ */
+static BusMessage* wrap_message(DBusMessage* msg) {
+    if (msg == NULL)
+        return NULL;
+
+    BusMessage* message = (BusMessage*)malloc(sizeof(BusMessage));
+    message->message = msg;
+    init_cursor(message);
+
+    return message;
+}
+
+/**
+ * Call a BusFilter for every message libdbus dispatches
+ */
+static DBusHandlerResult filter_handler(DBusConnection* connection,
+                                        DBusMessage* msg, void* user_data) {
+    BusFilter* filter = (BusFilter*)user_data;
+
+    // The message only lives for the duration of the handler
+    BusMessage message;
+    message.message = msg;
+    init_cursor(&message);
+
+    return filter->handler(&message, filter->user_data)
+               ? DBUS_HANDLER_RESULT_HANDLED
+               : DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/**
+ * Call the handlers for every message that has been read
+ */
+static void dispatch_all(DBusConnection* connection) {
+    while (dbus_connection_dispatch(connection) == DBUS_DISPATCH_DATA_REMAINS)
+        ;
+}
+
+BusConnection* bus_connect_session(BusError* err) {
+    DBusError dbus_err;
+    dbus_error_init(&dbus_err);
+
+    DBusConnection* connection = dbus_bus_get(DBUS_BUS_SESSION, &dbus_err);
+
+    if (connection == NULL)
+        set_error_from_dbus(err, &dbus_err);
+
+    return (BusConnection*)connection;
+}
+
+void bus_connection_close(BusConnection* connection) {
+    // The shared connection is closed by libdbus at exit
+    dbus_connection_unref(TO_CONNECTION(connection));
+}
+
+dbus_bool_t bus_add_match(BusConnection* connection, const char* rule,
+                          BusError* err) {
+    DBusError dbus_err;
+    dbus_error_init(&dbus_err);
+
+    dbus_bus_add_match(TO_CONNECTION(connection), rule, &dbus_err);
+
+    if (dbus_error_is_set(&dbus_err)) {
+        set_error_from_dbus(err, &dbus_err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+dbus_bool_t bus_add_filter(BusConnection* connection,
+                           BusMessageHandler handler, void* user_data) {
+    BusFilter* filter = (BusFilter*)malloc(sizeof(BusFilter));
+    filter->handler = handler;
+    filter->user_data = user_data;
+
+    if (!dbus_connection_add_filter(TO_CONNECTION(connection), filter_handler,
+                                    filter, free)) {
+        free(filter);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+int bus_get_fd(BusConnection* connection) {
+    int fd;
+
+    if (!dbus_connection_get_unix_fd(TO_CONNECTION(connection), &fd))
+        return -1;
+
+    return fd;
+}
+
+short bus_get_events(BusConnection* connection) {
+    // Writes are completed by bus_flush
+    return POLLIN;
+}
+
+dbus_bool_t bus_process(BusConnection* connection) {
+    // Read without blocking. Flushing may also have read messages, so always
+    // dispatch afterwards.
+    const dbus_bool_t connected =
+        dbus_connection_read_write(TO_CONNECTION(connection), 0);
+
+    dispatch_all(TO_CONNECTION(connection));
+
+    return connected;
+}
+
+dbus_bool_t bus_wait(BusConnection* connection, const int timeout_ms) {
+    DBusConnection* conn = TO_CONNECTION(connection);
+
+    // Only block if nothing is waiting to be dispatched
+    if (dbus_connection_get_dispatch_status(conn) !=
+            DBUS_DISPATCH_DATA_REMAINS &&
+        !dbus_connection_read_write(conn, timeout_ms))
+        return FALSE;
+
+    dispatch_all(conn);
+
+    return dbus_connection_get_is_connected(conn);
+}
+
+void bus_flush(BusConnection* connection) {
+    dbus_connection_flush(TO_CONNECTION(connection));
+}
+
+BusMessage* bus_method_call_new(BusConnection* connection,
+                                const char* destination, const char* path,
+                                const char* iface, const char* method) {
+    return wrap_message(
+        dbus_message_new_method_call(destination, path, iface, method));
+}
+
+BusMessage* bus_signal_new(BusConnection* connection, const char* path,
+                           const char* iface, const char* member) {
+    return wrap_message(dbus_message_new_signal(path, iface, member));
+}
+
+dbus_bool_t bus_message_append_string(BusMessage* message, const char* str) {
+    return dbus_message_append_args(message->message, DBUS_TYPE_STRING, &str,
+                                    DBUS_TYPE_INVALID);
+}
+
+dbus_bool_t bus_message_append_basic(BusMessage* message, const char type,
+                                     const void* value) {
+    if (!dbus_type_is_basic(type))
+        return FALSE;
+
+    return dbus_message_append_args(message->message, type, value,
+                                    DBUS_TYPE_INVALID);
+}
+
+void bus_message_set_no_reply(BusMessage* message) {
+    dbus_message_set_no_reply(message->message, TRUE);
+}
+
+void bus_message_unref(BusMessage* message) {
+    if (message == NULL)
+        return;
+
+    dbus_message_unref(message->message);
+    free(message);
+}
+
+dbus_bool_t bus_send(BusConnection* connection, BusMessage* message) {
+    return dbus_connection_send(TO_CONNECTION(connection), message->message,
+                                NULL);
+}
+
+BusMessage* bus_call(BusConnection* connection, BusMessage* message,
+                     const int timeout_ms, BusError* err) {
+    DBusError dbus_err;
+    dbus_error_init(&dbus_err);
+
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        TO_CONNECTION(connection), message->message, timeout_ms, &dbus_err);
+
+    if (reply == NULL) {
+        set_error_from_dbus(err, &dbus_err);
+        return NULL;
+    }
+
+    return wrap_message(reply);
+}
+
+BusPendingCall* bus_call_async(BusConnection* connection, BusMessage* message,
+                               const int timeout_ms) {
+    DBusPendingCall* pending = NULL;
+
+    if (!dbus_connection_send_with_reply(TO_CONNECTION(connection),
+                                         message->message, &pending,
+                                         timeout_ms))
+        return NULL;
+
+    // pending is NULL if the connection is disconnected
+    return (BusPendingCall*)pending;
+}
+
+dbus_bool_t bus_pending_call_completed(BusPendingCall* pending) {
+    return dbus_pending_call_get_completed(TO_PENDING(pending));
+}
+
+BusMessage* bus_pending_call_steal_reply(BusPendingCall* pending,
+                                         BusError* err) {
+    DBusError dbus_err;
+    dbus_error_init(&dbus_err);
+
+    DBusMessage* reply = dbus_pending_call_steal_reply(TO_PENDING(pending));
+
+    // Convert error replies, including libdbus' own NoReply, into err
+    if (reply == NULL) {
+        bus_error_set(err, BUS_ERROR_NO_REPLY, "No reply received\n");
+        return NULL;
+    } else if (dbus_set_error_from_message(&dbus_err, reply)) {
+        set_error_from_dbus(err, &dbus_err);
+        dbus_message_unref(reply);
+        return NULL;
+    }
+
+    return wrap_message(reply);
+}
+
+void bus_pending_call_free(BusPendingCall* pending) {
+    if (!dbus_pending_call_get_completed(TO_PENDING(pending)))
+        dbus_pending_call_cancel(TO_PENDING(pending));
+
+    dbus_pending_call_unref(TO_PENDING(pending));
+}
+
+dbus_bool_t bus_message_is_signal(BusMessage* message, const char* interface,
+                                  const char* member) {
+    return dbus_message_is_signal(message->message, interface, member);
+}
+
+const char* bus_message_get_sender(BusMessage* message) {
+    return dbus_message_get_sender(message->message);
+}
+
+void bus_message_rewind(BusMessage* message) { init_cursor(message); }
+
+char bus_message_peek_type(BusMessage* message, const char** contents) {
+    DBusMessageIter* iter = &message->iters[message->depth];
+    const int type = dbus_message_iter_get_arg_type(iter);
+
+    if (contents == NULL)
+        return type;
+
+    *contents = NULL;
+
+    if (type == DBUS_TYPE_VARIANT) {
+        // The contents of a variant are the signature of its value
+        DBusMessageIter sub_iter;
+        dbus_message_iter_recurse(iter, &sub_iter);
+
+        char* signature = dbus_message_iter_get_signature(&sub_iter);
+        snprintf(message->contents, sizeof(message->contents), "%s",
+                 signature);
+        dbus_free(signature);
+
+        *contents = message->contents;
+    } else if (type == DBUS_TYPE_ARRAY || type == DBUS_TYPE_STRUCT ||
+               type == DBUS_TYPE_DICT_ENTRY) {
+        // Strip the array type or the brackets from the signature
+        char* signature = dbus_message_iter_get_signature(iter);
+        const size_t len = strlen(signature);
+
+        if (type == DBUS_TYPE_ARRAY)
+            snprintf(message->contents, sizeof(message->contents), "%s",
+                     signature + 1);
+        else
+            snprintf(message->contents, sizeof(message->contents), "%.*s",
+                     (int)len - 2, signature + 1);
+        dbus_free(signature);
+
+        *contents = message->contents;
+    }
+
+    return type;
+}
+
+dbus_bool_t bus_message_enter(BusMessage* message, const char type) {
+    DBusMessageIter* iter = &message->iters[message->depth];
+
+    if (message->depth + 1 >= BUS_MAX_DEPTH ||
+        dbus_message_iter_get_arg_type(iter) != type ||
+        !dbus_type_is_container(type))
+        return FALSE;
+
+    dbus_message_iter_recurse(iter, &message->iters[message->depth + 1]);
+    message->depth++;
+
+    return TRUE;
+}
+
+dbus_bool_t bus_message_exit(BusMessage* message) {
+    if (message->depth == 0)
+        return FALSE;
+
+    // Continue after the container in the parent
+    message->depth--;
+    dbus_message_iter_next(&message->iters[message->depth]);
+
+    return TRUE;
+}
+
+dbus_bool_t bus_message_read_string(BusMessage* message, const char** str) {
+    DBusMessageIter* iter = &message->iters[message->depth];
+
+    if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_STRING)
+        return FALSE;
+
+    dbus_message_iter_get_basic(iter, str);
+    dbus_message_iter_next(iter);
+
+    return TRUE;
+}
+
+dbus_bool_t bus_message_read_basic(BusMessage* message, const char type,
+                                   void* value) {
+    DBusMessageIter* iter = &message->iters[message->depth];
+
+    if (!dbus_type_is_basic(type) ||
+        dbus_message_iter_get_arg_type(iter) != type)
+        return FALSE;
+
+    dbus_message_iter_get_basic(iter, value);
+    dbus_message_iter_next(iter);
+
+    return TRUE;
+}
+
+dbus_bool_t bus_message_skip(BusMessage* message) {
+    DBusMessageIter* iter = &message->iters[message->depth];
+
+    if (dbus_message_iter_get_arg_type(iter) == DBUS_TYPE_INVALID)
+        return FALSE;
+
+    dbus_message_iter_next(iter);
+
+    return TRUE;
+}
+
+dbus_bool_t bus_message_marshal(BusMessage* message, char** data, int* len,
+                                BusError* err) {
+    // Messages are only given a serial when they are sent
+    if (dbus_message_get_serial(message->message) == 0)
+        dbus_message_set_serial(message->message, 1);
+
+    if (!dbus_message_marshal(message->message, data, len)) {
+        if (err != NULL)
+            bus_error_set(err, BUS_ERROR_FAILED, "Not enough memory");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BusMessage* bus_message_demarshal(const char* data, const int len,
+                                  BusError* err) {
+    DBusError dbus_err;
+    dbus_error_init(&dbus_err);
+
+    DBusMessage* msg = dbus_message_demarshal(data, len, &dbus_err);
+
+    if (msg == NULL)
+        set_error_from_dbus(err, &dbus_err);
+
+    return wrap_message(msg);
+}
+
+void bus_free(void* data) { dbus_free(data); }
@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <systemd/sd-bus.h>
+
+#include "../include/utils.h"
+
+// BusConnection and BusMessage are the sd-bus objects themselves
+#define TO_BUS(connection) ((sd_bus*)(connection))
+#define TO_MESSAGE(message) ((sd_bus_message*)(message))
+
+struct BusPendingCall {
+    sd_bus_slot* slot;
+    // The reply once it arrived
+    sd_bus_message* reply;
+};
+
+/**
+ * A handler added with bus_add_filter
+ */
+typedef struct {
+    BusMessageHandler handler;
+    void* user_data;
+} BusFilter;
+
+/**
+ * Set err from a negative errno returned by sd-bus
+ */
+static void set_error_from_errno(BusError* err, const int r) {
+    if (err != NULL)
+        bus_error_set(err,
+                      r == -ETIMEDOUT ? BUS_ERROR_TIMEOUT : BUS_ERROR_FAILED,
+                      strerror(-r));
+}
+
+/**
+ * Copy an sd-bus error into err
+ */
+static void set_error_from_sdbus(BusError* err, const sd_bus_error* sd_err,
+                                 const int r) {
+    if (err != NULL && sd_bus_error_is_set(sd_err))
+        bus_error_set(err, sd_err->name, sd_err->message);
+    else
+        set_error_from_errno(err, r);
+}
+
+/**
+ * Call a BusFilter for every message sd-bus processes
+ */
+static int filter_handler(sd_bus_message* message, void* user_data,
+                          sd_bus_error* ret_error) {
+    BusFilter* filter = (BusFilter*)user_data;
+
+    // Returning a positive value stops other handlers from seeing it
+    return filter->handler((BusMessage*)message, filter->user_data) ? 1 : 0;
+}
+
+/**
+ * Match callback that leaves the message to the filters
+ */
+static int match_handler(sd_bus_message* message, void* user_data,
+                         sd_bus_error* ret_error) {
+    return 0;
+}
+
+/**
+ * Store the reply of an asynchronous method call
+ */
+static int reply_handler(sd_bus_message* message, void* user_data,
+                         sd_bus_error* ret_error) {
+    BusPendingCall* pending = (BusPendingCall*)user_data;
+
+    pending->reply = sd_bus_message_ref(message);
+
+    return 1;
+}
+
+/**
+ * Process every message that has been read
+ *
+ * @returns int The number of messages processed or a negative errno
+ */
+static int process_all(sd_bus* bus) {
+    int r;
+    int processed = 0;
+
+    while ((r = sd_bus_process(bus, NULL)) > 0)
+        processed++;
+
+    return r < 0 ? r : processed;
+}
+
+BusConnection* bus_connect_session(BusError* err) {
+    sd_bus* bus = NULL;
+    const int r = sd_bus_open_user(&bus);
+
+    if (r < 0) {
+        set_error_from_errno(err, r);
+        return NULL;
+    }
+
+    return (BusConnection*)bus;
+}
+
+void bus_connection_close(BusConnection* connection) {
+    sd_bus_flush_close_unref(TO_BUS(connection));
+}
+
+dbus_bool_t bus_add_match(BusConnection* connection, const char* rule,
+                          BusError* err) {
+    // The slot is floating, so the match lasts as long as the connection
+    const int r =
+        sd_bus_add_match(TO_BUS(connection), NULL, rule, match_handler, NULL);
+
+    if (r < 0) {
+        set_error_from_errno(err, r);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+dbus_bool_t bus_add_filter(BusConnection* connection,
+                           BusMessageHandler handler, void* user_data) {
+    BusFilter* filter = (BusFilter*)malloc(sizeof(BusFilter));
+    filter->handler = handler;
+    filter->user_data = user_data;
+
+    // The filter is never removed, so it is not freed either
+    if (sd_bus_add_filter(TO_BUS(connection), NULL, filter_handler, filter) <
+        0) {
+        free(filter);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+int bus_get_fd(BusConnection* connection) {
+    const int fd = sd_bus_get_fd(TO_BUS(connection));
+    return fd < 0 ? -1 : fd;
+}
+
+short bus_get_events(BusConnection* connection) {
+    const int events = sd_bus_get_events(TO_BUS(connection));
+    return events < 0 ? POLLIN : (short)events;
+}
+
+dbus_bool_t bus_process(BusConnection* connection) {
+    return process_all(TO_BUS(connection)) >= 0;
+}
+
+dbus_bool_t bus_wait(BusConnection* connection, const int timeout_ms) {
+    sd_bus* bus = TO_BUS(connection);
+    int r = process_all(bus);
+
+    // Only block if there was nothing to process
+    if (r == 0) {
+        r = sd_bus_wait(bus, (uint64_t)timeout_ms * 1000);
+        if (r >= 0)
+            r = process_all(bus);
+    }
+
+    return r >= 0;
+}
+
+void bus_flush(BusConnection* connection) { sd_bus_flush(TO_BUS(connection)); }
+
+BusMessage* bus_method_call_new(BusConnection* connection,
+                                const char* destination, const char* path,
+                                const char* iface, const char* method) {
+    sd_bus_message* message = NULL;
+
+    if (sd_bus_message_new_method_call(TO_BUS(connection), &message,
+                                       destination, path, iface, method) < 0)
+        return NULL;
+
+    return (BusMessage*)message;
+}
+
+BusMessage* bus_signal_new(BusConnection* connection, const char* path,
+                           const char* iface, const char* member) {
+    sd_bus_message* message = NULL;
+
+    if (sd_bus_message_new_signal(TO_BUS(connection), &message, path, iface,
+                                  member) < 0)
+        return NULL;
+
+    return (BusMessage*)message;
+}
+
+dbus_bool_t bus_message_append_string(BusMessage* message, const char* str) {
+    return sd_bus_message_append_basic(TO_MESSAGE(message), 's', str) >= 0;
+}
+
+dbus_bool_t bus_message_append_basic(BusMessage* message, const char type,
+                                     const void* value) {
+    // sd-bus takes strings themselves rather than pointers to them
+    if (type == BUS_TYPE_STRING || type == BUS_TYPE_OBJECT_PATH)
+        value = *(const char* const*)value;
+
+    return sd_bus_message_append_basic(TO_MESSAGE(message), type, value) >= 0;
+}
+
+void bus_message_set_no_reply(BusMessage* message) {
+    sd_bus_message_set_expect_reply(TO_MESSAGE(message), 0);
+}
+
+void bus_message_unref(BusMessage* message) {
+    sd_bus_message_unref(TO_MESSAGE(message));
+}
+
+dbus_bool_t bus_send(BusConnection* connection, BusMessage* message) {
+    return sd_bus_send(TO_BUS(connection), TO_MESSAGE(message), NULL) >= 0;
+}
+
+BusMessage* bus_call(BusConnection* connection, BusMessage* message,
+                     const int timeout_ms, BusError* err) {
+    sd_bus_error sd_err = SD_BUS_ERROR_NULL;
+    sd_bus_message* reply = NULL;
+
+    const int r = sd_bus_call(TO_BUS(connection), TO_MESSAGE(message),
+                              (uint64_t)timeout_ms * 1000, &sd_err, &reply);
+
+    if (r < 0) {
+        set_error_from_sdbus(err, &sd_err, r);
+        sd_bus_error_free(&sd_err);
+        return NULL;
+    }
+
+    return (BusMessage*)reply;
+}
+
+BusPendingCall* bus_call_async(BusConnection* connection, BusMessage* message,
+                               const int timeout_ms) {
+    BusPendingCall* pending =
+        (BusPendingCall*)calloc(1, sizeof(BusPendingCall));
+
+    if (sd_bus_call_async(TO_BUS(connection), &pending->slot,
+                          TO_MESSAGE(message), reply_handler, pending,
+                          (uint64_t)timeout_ms * 1000) < 0) {
+        free(pending);
+        return NULL;
+    }
+
+    return pending;
+}
+
+dbus_bool_t bus_pending_call_completed(BusPendingCall* pending) {
+    return pending->reply != NULL;
+}
+
+BusMessage* bus_pending_call_steal_reply(BusPendingCall* pending,
+                                         BusError* err) {
+    sd_bus_message* reply = pending->reply;
+    pending->reply = NULL;
+
+    if (reply == NULL) {
+        bus_error_set(err, BUS_ERROR_NO_REPLY, "No reply received\n");
+        return NULL;
+    }
+
+    // Convert error replies, including sd-bus' own timeouts, into err
+    if (sd_bus_message_is_method_error(reply, NULL)) {
+        set_error_from_sdbus(err, sd_bus_message_get_error(reply), -EIO);
+        sd_bus_message_unref(reply);
+        return NULL;
+    }
+
+    return (BusMessage*)reply;
+}
+
+void bus_pending_call_free(BusPendingCall* pending) {
+    // Unreferencing the slot cancels the call if the reply has not arrived
+    sd_bus_slot_unref(pending->slot);
+    sd_bus_message_unref(pending->reply);
+    free(pending);
+}
+
+dbus_bool_t bus_message_is_signal(BusMessage* message, const char* interface,
+                                  const char* member) {
+    return sd_bus_message_is_signal(TO_MESSAGE(message), interface, member) > 0;
+}
+
+const char* bus_message_get_sender(BusMessage* message) {
+    return sd_bus_message_get_sender(TO_MESSAGE(message));
+}
+
+void bus_message_rewind(BusMessage* message) {
+    sd_bus_message_rewind(TO_MESSAGE(message), 1);
+}
+
+char bus_message_peek_type(BusMessage* message, const char** contents) {
+    char type;
+    const char* peeked_contents = NULL;
+
+    if (sd_bus_message_peek_type(TO_MESSAGE(message), &type,
+                                 &peeked_contents) <= 0)
+        type = BUS_TYPE_INVALID;
+
+    if (contents != NULL)
+        *contents = peeked_contents;
+
+    return type;
+}
+
+dbus_bool_t bus_message_enter(BusMessage* message, const char type) {
+    const char* contents;
+
+    if (bus_message_peek_type(message, &contents) != type || contents == NULL)
+        return FALSE;
+
+    return sd_bus_message_enter_container(TO_MESSAGE(message), type,
+                                          contents) > 0;
+}
+
+dbus_bool_t bus_message_exit(BusMessage* message) {
+    sd_bus_message* m = TO_MESSAGE(message);
+
+    // sd-bus only exits containers that were read to the end
+    while (sd_bus_message_at_end(m, 0) == 0) {
+        if (sd_bus_message_skip(m, NULL) < 0)
+            return FALSE;
+    }
+
+    return sd_bus_message_exit_container(m) >= 0;
+}
+
+dbus_bool_t bus_message_read_string(BusMessage* message, const char** str) {
+    if (bus_message_peek_type(message, NULL) != BUS_TYPE_STRING)
+        return FALSE;
+
+    return sd_bus_message_read_basic(TO_MESSAGE(message), 's', str) > 0;
+}
+
+dbus_bool_t bus_message_read_basic(BusMessage* message, const char type,
+                                   void* value) {
+    if (bus_message_peek_type(message, NULL) != type)
+        return FALSE;
+
+    return sd_bus_message_read_basic(TO_MESSAGE(message), type, value) > 0;
+}
+
+dbus_bool_t bus_message_skip(BusMessage* message) {
+    if (sd_bus_message_at_end(TO_MESSAGE(message), 0) != 0)
+        return FALSE;
+
+    return sd_bus_message_skip(TO_MESSAGE(message), NULL) >= 0;
+}
+
+// sd-bus has no public API to get at the serialized form of a message or to
+// create one from it
+dbus_bool_t bus_message_marshal(BusMessage* message, char** data, int* len,
+                                BusError* err) {
+    if (err != NULL)
+        bus_error_set(err, BUS_ERROR_NOT_SUPPORTED,
+                      "Serializing messages needs the libdbus backend");
+    return FALSE;
+}
+
+BusMessage* bus_message_demarshal(const char* data, const int len,
+                                  BusError* err) {
+    if (err != NULL)
+        bus_error_set(err, BUS_ERROR_NOT_SUPPORTED,
+                      "Reading serialized messages needs the libdbus backend");
+    return NULL;
+}
+
+void bus_free(void* data) { free(data); }
@@ -0,0 +1,170 @@
+#include "../include/command-queue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/utils.h"
+#include "mpris-player.h"
+
+void command_queue_init(CommandQueue* queue) {
+    memset(queue, 0, sizeof(CommandQueue));
+}
+
+/**
+ * Create the org.mpris.MediaPlayer2.Player method call of a command
+ */
+static BusMessage* new_command_call(BusConnection* connection,
+                                    const char* destination,
+                                    const Command command) {
+    switch (command) {
+        case COMMAND_PLAY:
+            return mpris_player_play_new(connection, destination);
+        case COMMAND_PAUSE:
+            return mpris_player_pause_new(connection, destination);
+        case COMMAND_PLAYPAUSE:
+            return mpris_player_play_pause_new(connection, destination);
+        case COMMAND_NEXT:
+            return mpris_player_next_new(connection, destination);
+        case COMMAND_PREVIOUS:
+            return mpris_player_previous_new(connection, destination);
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Get the last queued command
+ */
+static QueuedCommand* command_queue_tail(CommandQueue* queue) {
+    if (queue->len == 0)
+        return NULL;
+
+    return &queue->commands[(queue->head + queue->len - 1) %
+                            COMMAND_QUEUE_SIZE];
+}
+
+/**
+ * Remove the last queued command
+ */
+static void command_queue_pop_tail(CommandQueue* queue) { queue->len--; }
+
+dbus_bool_t command_queue_push(CommandQueue* queue, const Command command) {
+    QueuedCommand* tail = command_queue_tail(queue);
+
+    queue->received++;
+
+    if (command == COMMAND_INVALID)
+        return FALSE;
+
+    // Next and previous are queued as a number of skips
+    const int skips =
+        command == COMMAND_NEXT ? 1 : (command == COMMAND_PREVIOUS ? -1 : 0);
+
+    if (tail != NULL) {
+        if (skips != 0 && tail->command == COMMAND_NEXT &&
+            (tail->skips > 0) == (skips > 0)) {
+            // Add to the queued skips in the same direction. A previous is
+            // not the inverse of a next, since it restarts the track that
+            // was skipped to, so those are queued separately.
+            tail->skips += skips;
+            queue->coalesced++;
+            return TRUE;
+        } else if (skips == 0 && tail->command != COMMAND_NEXT) {
+            // The play state after the queued command is known, so the new
+            // command can replace it
+            if (command != COMMAND_PLAYPAUSE)
+                tail->command = command;
+            else if (tail->command == COMMAND_PLAY)
+                tail->command = COMMAND_PAUSE;
+            else if (tail->command == COMMAND_PAUSE)
+                tail->command = COMMAND_PLAY;
+            else
+                command_queue_pop_tail(queue);
+            queue->coalesced++;
+            return TRUE;
+        }
+    }
+
+    if (queue->len == COMMAND_QUEUE_SIZE) {
+        queue->dropped++;
+        return FALSE;
+    }
+
+    // Append a new entry
+    queue->len++;
+    tail = command_queue_tail(queue);
+    tail->command = skips != 0 ? COMMAND_NEXT : command;
+    tail->skips = skips;
+
+    return TRUE;
+}
+
+void command_queue_process(CommandQueue* queue, BusConnection* connection,
+                           const char* destination) {
+    if (queue->in_flight != NULL) {
+        // Wait for spotify to reply unless it is taking too long
+        if (!bus_pending_call_completed(queue->in_flight) &&
+            command_queue_timeout_ms(queue) > 0)
+            return;
+
+        // Freeing the pending reply cancels it if spotify has not replied
+        if (!bus_pending_call_completed(queue->in_flight))
+            queue->timed_out++;
+
+        bus_pending_call_free(queue->in_flight);
+        queue->in_flight = NULL;
+    }
+
+    if (queue->len == 0)
+        return;
+
+    QueuedCommand* head = &queue->commands[queue->head];
+    Command command = head->command;
+
+    if (command == COMMAND_NEXT) {
+        // Send one skip at a time and keep the rest queued
+        if (head->skips < 0) {
+            command = COMMAND_PREVIOUS;
+            head->skips++;
+        } else {
+            head->skips--;
+        }
+
+        if (head->skips == 0) {
+            queue->head = (queue->head + 1) % COMMAND_QUEUE_SIZE;
+            queue->len--;
+        }
+    } else {
+        queue->head = (queue->head + 1) % COMMAND_QUEUE_SIZE;
+        queue->len--;
+    }
+
+    BusMessage* msg = new_command_call(connection, destination, command);
+
+    if (msg == NULL)
+        return;
+
+    // Wait for the reply before sending the next command so spotify handles
+    // them in order
+    queue->in_flight = bus_call_async(connection, msg, COMMAND_REPLY_TIMEOUT_MS);
+    if (queue->in_flight != NULL) {
+        queue->in_flight_since_ms = monotonic_ms();
+        queue->sent++;
+    }
+
+    bus_message_unref(msg);
+}
+
+int command_queue_timeout_ms(const CommandQueue* queue) {
+    // Queued commands can be sent straight away
+    if (queue->in_flight == NULL)
+        return queue->len > 0 ? 0 : -1;
+
+    if (bus_pending_call_completed(queue->in_flight))
+        return 0;
+
+    const long long remaining = queue->in_flight_since_ms +
+                                COMMAND_REPLY_TIMEOUT_MS - monotonic_ms();
+
+    return remaining > 0 ? (int)remaining : 0;
+}
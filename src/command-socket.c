@@ -0,0 +1,388 @@
+#include "../include/command-socket.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/utils.h"
+
+// Time in milliseconds spotifyctl waits for the listener while sending a
+// query and reading the reply
+#define QUERY_TIMEOUT_MS 1000
+
+// Command names in the order of the Command enum
+const char* const COMMAND_NAMES[] = {"play", "pause", "playpause", "next",
+                                     "previous"};
+
+Command parse_command(const char* name) {
+    for (int i = 0; i < COMMAND_INVALID; i++) {
+        if (strcmp(name, COMMAND_NAMES[i]) == 0)
+            return i;
+    }
+
+    return COMMAND_INVALID;
+}
+
+/**
+ * Fill in the address of the command socket
+ *
+ * @param struct sockaddr_un* addr The address to fill in
+ *
+ * @returns dbus_bool_t Returns FALSE if the path is too long, otherwise TRUE.
+ */
+static dbus_bool_t get_command_socket_addr(struct sockaddr_un* addr) {
+    char* path = get_runtime_path(COMMAND_SOCKET_NAME);
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+
+    if (path == NULL || strlen(path) >= sizeof(addr->sun_path)) {
+        free(path);
+        return FALSE;
+    }
+
+    strcpy(addr->sun_path, path);
+    free(path);
+
+    return TRUE;
+}
+
+int command_socket_connect() {
+    struct sockaddr_un addr;
+
+    if (!get_command_socket_addr(&addr))
+        return -1;
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+
+    // Fails straight away if the listener is not running
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+dbus_bool_t command_socket_send(const char* const commands[],
+                                const size_t num_of_commands) {
+    char buf[COMMAND_LINE_MAX * 4];
+    size_t len = 0;
+
+    // Build all lines first so they are sent with a single write
+    for (size_t i = 0; i < num_of_commands; i++) {
+        const size_t command_len = strlen(commands[i]);
+
+        // +1 for newline
+        if (len + command_len + 1 > sizeof(buf))
+            return FALSE;
+
+        memcpy(buf + len, commands[i], command_len);
+        len += command_len;
+        buf[len++] = '\n';
+    }
+
+    const int fd = command_socket_connect();
+
+    if (fd < 0)
+        return FALSE;
+
+    size_t written = 0;
+
+    while (written < len) {
+        const ssize_t n = write(fd, buf + written, len - written);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            close(fd);
+            return FALSE;
+        }
+
+        written += n;
+    }
+
+    close(fd);
+
+    return TRUE;
+}
+
+/**
+ * Write a whole buffer to a socket, waiting for it to become writable
+ */
+static dbus_bool_t write_all(const int fd, const char* buf, const size_t len) {
+    size_t written = 0;
+
+    while (written < len) {
+        const ssize_t n = write(fd, buf + written, len - written);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd writable = {.fd = fd, .events = POLLOUT};
+
+            if (poll(&writable, 1, QUERY_TIMEOUT_MS) <= 0)
+                return FALSE;
+            continue;
+        }
+
+        if (n <= 0)
+            return FALSE;
+
+        written += n;
+    }
+
+    return TRUE;
+}
+
+char* command_socket_query(const char* line) {
+    const int fd = command_socket_connect();
+
+    if (fd < 0)
+        return NULL;
+
+    // The listener closes the connection after replying once it sees the end
+    // of the query
+    if (!write_all(fd, line, strlen(line)) || !write_all(fd, "\n", 1) ||
+        shutdown(fd, SHUT_WR) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = 4096;
+    size_t len = 0;
+    char* reply = malloc(size);
+
+    while (reply != NULL) {
+        struct pollfd readable = {.fd = fd, .events = POLLIN};
+
+        if (poll(&readable, 1, QUERY_TIMEOUT_MS) <= 0)
+            break;
+
+        const ssize_t n = read(fd, reply + len, size - len - 1);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            break;
+
+        len += n;
+
+        if (len + 1 == size) {
+            char* bigger = realloc(reply, size * 2);
+
+            if (bigger == NULL) {
+                free(reply);
+                reply = NULL;
+                break;
+            }
+
+            reply = bigger;
+            size *= 2;
+        }
+    }
+
+    close(fd);
+
+    if (reply == NULL || len == 0) {
+        free(reply);
+        return NULL;
+    }
+
+    reply[len] = '\0';
+
+    return reply;
+}
+
+int command_socket_listen() {
+    struct sockaddr_un addr;
+
+    if (!get_command_socket_addr(&addr))
+        return -1;
+
+    const int fd =
+        socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+
+    // Don't take the socket away from a listener that is still running
+    const int running = command_socket_connect();
+
+    if (running >= 0) {
+        close(running);
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    // Remove a socket left behind by a listener that didn't exit cleanly
+    unlink(addr.sun_path);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void command_socket_close(const int fd) {
+    struct sockaddr_un addr;
+
+    if (fd < 0)
+        return;
+
+    close(fd);
+
+    if (get_command_socket_addr(&addr))
+        unlink(addr.sun_path);
+}
+
+void command_client_init(CommandClient* client, const int fd) {
+    client->fd = fd;
+    client->len = 0;
+    client->reading = TRUE;
+    client->reply = NULL;
+    client->reply_len = 0;
+    client->reply_sent = 0;
+}
+
+dbus_bool_t command_client_read(CommandClient* client,
+                                CommandLineHandler handler, void* user_data) {
+    while (TRUE) {
+        const ssize_t n = read(client->fd, client->buf + client->len,
+                               sizeof(client->buf) - client->len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        // Nothing more to read for now
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return TRUE;
+
+        if (n <= 0)
+            return FALSE;
+
+        client->len += n;
+
+        char* line = client->buf;
+        char* newline;
+
+        // Handle every complete line
+        while ((newline = memchr(line, '\n',
+                                 client->len - (line - client->buf)))) {
+            *newline = '\0';
+            handler(client, line, user_data);
+            line = newline + 1;
+        }
+
+        // Move the incomplete line to the start of the buffer
+        client->len -= line - client->buf;
+        memmove(client->buf, line, client->len);
+
+        // A line that doesn't fit in the buffer is not a valid command
+        if (client->len == sizeof(client->buf))
+            return FALSE;
+    }
+}
+
+/**
+ * Write as much of a buffer to a non-blocking socket as it takes. A client
+ * that went away is a failed write, not a SIGPIPE.
+ *
+ * @returns dbus_bool_t FALSE if writing failed, otherwise TRUE. The number of
+ *                      bytes written is stored in sent.
+ */
+static dbus_bool_t write_some(const int fd, const char* buf, const size_t len,
+                              size_t* sent) {
+    *sent = 0;
+
+    while (*sent < len) {
+        const ssize_t n = send(fd, buf + *sent, len - *sent, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return TRUE;
+
+        if (n <= 0)
+            return FALSE;
+
+        *sent += n;
+    }
+
+    return TRUE;
+}
+
+dbus_bool_t command_client_write(CommandClient* client, const char* buf,
+                                 const size_t len) {
+    const char* rest = buf;
+    size_t rest_len = len;
+
+    // Queued behind the rest of an earlier reply
+    if (client->reply == NULL) {
+        size_t sent;
+
+        if (!write_some(client->fd, buf, len, &sent))
+            return FALSE;
+
+        rest += sent;
+        rest_len -= sent;
+    }
+
+    if (rest_len == 0)
+        return TRUE;
+
+    char* reply = realloc(client->reply, client->reply_len + rest_len);
+
+    if (reply == NULL)
+        return FALSE;
+
+    memcpy(reply + client->reply_len, rest, rest_len);
+    client->reply = reply;
+    client->reply_len += rest_len;
+
+    return TRUE;
+}
+
+dbus_bool_t command_client_flush(CommandClient* client) {
+    size_t sent;
+
+    if (client->reply == NULL)
+        return TRUE;
+
+    const dbus_bool_t ok =
+        write_some(client->fd, client->reply + client->reply_sent,
+                   client->reply_len - client->reply_sent, &sent);
+
+    client->reply_sent += sent;
+
+    if (client->reply_sent == client->reply_len) {
+        free(client->reply);
+        client->reply = NULL;
+        client->reply_len = 0;
+        client->reply_sent = 0;
+    }
+
+    return ok;
+}
+
+void command_client_close(CommandClient* client) {
+    close(client->fd);
+    free(client->reply);
+    command_client_init(client, -1);
+}
@@ -0,0 +1,243 @@
+#include "../include/event-loop.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "../include/utils.h"
+
+/**
+ * Register a file descriptor in a free slot
+ */
+static EventSource* add_source(EventLoop* loop, const int fd,
+                               const EventSourceType type,
+                               const uint32_t events, EventHandler handler,
+                               void* user_data) {
+    EventSource* source = NULL;
+
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++) {
+        if (loop->sources[i].fd < 0) {
+            source = &loop->sources[i];
+            break;
+        }
+    }
+
+    if (source == NULL)
+        return NULL;
+
+    struct epoll_event event = {.events = events, .data.ptr = source};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        return NULL;
+
+    source->fd = fd;
+    source->type = type;
+    source->events = events;
+    source->handler = handler;
+    source->user_data = user_data;
+    source->loop = loop;
+    source->deadline_ms = -1;
+
+    return source;
+}
+
+/**
+ * Discard the expirations of a timer or the pending signals of a signalfd
+ */
+static void drain_source(EventSource* source) {
+    if (source->type == EVENT_SOURCE_TIMER) {
+        uint64_t expirations;
+
+        if (read(source->fd, &expirations, sizeof(expirations)) > 0)
+            source->deadline_ms = -1;
+    } else if (source->type == EVENT_SOURCE_SIGNAL) {
+        struct signalfd_siginfo info;
+
+        while (read(source->fd, &info, sizeof(info)) > 0)
+            ;
+    }
+}
+
+dbus_bool_t event_loop_init(EventLoop* loop) {
+    memset(loop, 0, sizeof(EventLoop));
+
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++)
+        loop->sources[i].fd = -1;
+
+    return (loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) >= 0;
+}
+
+void event_loop_close(EventLoop* loop) {
+    for (int i = 0; i < EVENT_LOOP_MAX_SOURCES; i++) {
+        if (loop->sources[i].fd >= 0)
+            event_source_remove(&loop->sources[i]);
+    }
+
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+}
+
+void event_loop_set_prepare(EventLoop* loop, EventPrepare prepare,
+                            void* user_data) {
+    loop->prepare = prepare;
+    loop->prepare_data = user_data;
+}
+
+EventSource* event_loop_add_fd(EventLoop* loop, const int fd,
+                               const uint32_t events, EventHandler handler,
+                               void* user_data) {
+    return add_source(loop, fd, EVENT_SOURCE_FD, events, handler, user_data);
+}
+
+EventSource* event_loop_add_timer(EventLoop* loop, EventHandler handler,
+                                  void* user_data) {
+    const int fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (fd < 0)
+        return NULL;
+
+    EventSource* source = add_source(loop, fd, EVENT_SOURCE_TIMER, EPOLLIN,
+                                     handler, user_data);
+    if (source == NULL)
+        close(fd);
+
+    return source;
+}
+
+EventSource* event_loop_add_signal(EventLoop* loop, const int signo,
+                                   EventHandler handler, void* user_data) {
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+
+    // The signal must be blocked to be read from the signalfd instead
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return NULL;
+
+    const int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    EventSource* source = add_source(loop, fd, EVENT_SOURCE_SIGNAL, EPOLLIN,
+                                     handler, user_data);
+    if (source == NULL)
+        close(fd);
+
+    return source;
+}
+
+EventSource* event_loop_add_inotify(EventLoop* loop, const char* path,
+                                    const uint32_t mask, EventHandler handler,
+                                    void* user_data) {
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (fd < 0)
+        return NULL;
+
+    if (inotify_add_watch(fd, path, mask) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    EventSource* source = add_source(loop, fd, EVENT_SOURCE_INOTIFY, EPOLLIN,
+                                     handler, user_data);
+    if (source == NULL)
+        close(fd);
+
+    return source;
+}
+
+dbus_bool_t event_source_set_events(EventSource* source,
+                                    const uint32_t events) {
+    if (events == source->events)
+        return TRUE;
+
+    struct epoll_event event = {.events = events, .data.ptr = source};
+    if (epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) <
+        0)
+        return FALSE;
+
+    source->events = events;
+
+    return TRUE;
+}
+
+dbus_bool_t event_source_set_timeout(EventSource* source,
+                                     const int timeout_ms) {
+    const long long deadline_ms =
+        timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+
+    if (deadline_ms == source->deadline_ms)
+        return TRUE;
+
+    // An absolute deadline, since a relative timeout of 0 disarms the timer
+    struct itimerspec spec = {0};
+    if (deadline_ms >= 0) {
+        spec.it_value.tv_sec = deadline_ms / 1000;
+        spec.it_value.tv_nsec = (deadline_ms % 1000) * 1000000;
+    }
+
+    if (timerfd_settime(source->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+        return FALSE;
+
+    source->deadline_ms = deadline_ms;
+
+    return TRUE;
+}
+
+void event_source_remove(EventSource* source) {
+    epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+
+    // Plain file descriptors belong to the caller
+    if (source->type != EVENT_SOURCE_FD)
+        close(source->fd);
+
+    source->fd = -1;
+}
+
+dbus_bool_t event_loop_run(EventLoop* loop) {
+    struct epoll_event events[EVENT_LOOP_MAX_SOURCES];
+
+    loop->running = TRUE;
+
+    while (loop->running) {
+        if (loop->prepare != NULL) {
+            loop->prepare(loop, loop->prepare_data);
+
+            if (!loop->running)
+                break;
+        }
+
+        const int n =
+            epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_SOURCES, -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+
+        loop->woke_us = monotonic_us();
+
+        for (int i = 0; i < n && loop->running; i++) {
+            EventSource* source = (EventSource*)events[i].data.ptr;
+
+            // Skip sources removed by an earlier handler
+            if (source->fd < 0)
+                continue;
+
+            drain_source(source);
+            source->handler(source, events[i].events);
+        }
+    }
+
+    return TRUE;
+}
+
+void event_loop_quit(EventLoop* loop) { loop->running = FALSE; }
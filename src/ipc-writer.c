@@ -0,0 +1,568 @@
+#include "../include/ipc-writer.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../include/logger.h"
+#include "../include/probes.h"
+#include "../include/utils.h"
+
+/**
+ * Get the length of the module part of a message, i.e. the message without
+ * the hook number at its end
+ */
+static size_t module_len(const char* message) {
+    size_t len = strlen(message);
+
+    while (len > 0 && isdigit((unsigned char)message[len - 1]))
+        len--;
+
+    return len;
+}
+
+/**
+ * Queue a message for a bar, replacing the waiting message for the same
+ * module if there is one
+ */
+static void bar_push(IpcBar* bar, const char* message,
+                     const long long event_us) {
+    const size_t len = module_len(message);
+
+    for (int i = 0; i < bar->len; i++) {
+        const char* waiting = bar->messages[i].message;
+
+        if (module_len(waiting) == len && strncmp(waiting, message, len) == 0) {
+            bar->messages[i] = (IpcBarMessage){message, event_us};
+            bar->replaced++;
+            return;
+        }
+    }
+
+    if (bar->len == IPC_BAR_QUEUE_SIZE) {
+        bar->dropped++;
+        return;
+    }
+
+    bar->messages[bar->len++] = (IpcBarMessage){message, event_us};
+}
+
+/**
+ * Set the text of a module for a bar, replacing its text if it is still
+ * waiting
+ */
+static void bar_push_text(IpcBar* bar, const char* module, const char* text,
+                          const long long event_us) {
+    IpcBarText* slot = NULL;
+
+    for (int i = 0; i < IPC_MAX_TEXT_MODULES; i++) {
+        IpcBarText* t = &bar->texts[i];
+
+        if (t->module != NULL && strcmp(t->module, module) == 0) {
+            slot = t;
+            break;
+        } else if (t->module == NULL && slot == NULL) {
+            slot = t;
+        }
+    }
+
+    if (slot == NULL) {
+        bar->dropped++;
+        return;
+    }
+
+    if (slot->module != NULL && slot->pending)
+        bar->replaced++;
+
+    slot->module = module;
+    strcpy(slot->text, text);
+    slot->pending = TRUE;
+    slot->event_us = event_us;
+}
+
+/**
+ * Get the text waiting to be written to a bar, if no messages are waiting
+ */
+static IpcBarText* bar_pending_text(IpcBar* bar) {
+    for (int i = 0; i < IPC_MAX_TEXT_MODULES; i++) {
+        if (bar->texts[i].module != NULL && bar->texts[i].pending)
+            return &bar->texts[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Forget a bar whose IPC file is gone
+ */
+static void remove_bar(IpcBar* bar) {
+    if (bar->len > 0)
+        LOG(LOG_LEVEL_INFO, "Bar '%s' is gone, dropped %d messages", bar->path,
+            bar->len);
+
+    free(bar->path);
+    memset(bar, 0, sizeof(IpcBar));
+}
+
+/**
+ * Match the bars with the IPC files currently in the IPC directory. Listing
+ * the directory is slow with a busy /tmp, so this is only done when a bar may
+ * have been added.
+ */
+static void update_bars(IpcWriter* writer) {
+    dbus_bool_t found[IPC_MAX_BARS] = {FALSE};
+    char** paths;
+    size_t num_of_paths;
+
+    // Pass address of pointer to array of strings
+    if (!get_polybar_ipc_paths_a(&writer->arena, writer->ipc_directory, &paths,
+                                 &num_of_paths))
+        return;
+
+    for (size_t p = 0; p < num_of_paths; p++) {
+        IpcBar* bar = NULL;
+        IpcBar* free_slot = NULL;
+
+        for (int i = 0; i < IPC_MAX_BARS; i++) {
+            IpcBar* b = &writer->bars[i];
+
+            if (b->path == NULL) {
+                if (free_slot == NULL)
+                    free_slot = b;
+            } else if (strcmp(b->path, paths[p]) == 0) {
+                bar = b;
+                break;
+            }
+        }
+
+        if (bar == NULL && free_slot != NULL) {
+            // The path outlives the arena, so the bar keeps a copy
+            bar = free_slot;
+            bar->path = strdup(paths[p]);
+            bar->retry_interval_ms = IPC_MESSAGE_INTERVAL_MS;
+        } else if (bar == NULL) {
+            LOG(LOG_LEVEL_WARNING, "Too many bars, ignoring '%s'", paths[p]);
+            continue;
+        }
+
+        found[bar - writer->bars] = TRUE;
+    }
+
+    arena_reset(&writer->arena);
+
+    for (int i = 0; i < IPC_MAX_BARS; i++) {
+        if (writer->bars[i].path != NULL && !found[i])
+            remove_bar(&writer->bars[i]);
+    }
+}
+
+/**
+ * Spread the messages of a record over the queues of all bars
+ */
+static void queue_record(IpcWriter* writer, const IpcRecord* record) {
+    int num_of_bars = 0;
+
+    // Pairs with the release in ipc_writer_bars_changed, so the new IPC file
+    // is listed
+    if (atomic_exchange_explicit(&writer->bars_changed, FALSE,
+                                 memory_order_acquire) ||
+        atomic_load_explicit(&writer->unwatched, memory_order_relaxed))
+        update_bars(writer);
+
+    for (int i = 0; i < IPC_MAX_BARS; i++) {
+        IpcBar* bar = &writer->bars[i];
+
+        if (bar->path == NULL)
+            continue;
+
+        const unsigned long replaced = bar->replaced;
+
+        for (int m = 0; m < record->count; m++)
+            bar_push(bar, record->messages[m], record->event_us);
+        if (record->text_module != NULL)
+            bar_push_text(bar, record->text_module, record->text,
+                          record->event_us);
+        counter_add(&writer->coalesced, bar->replaced - replaced);
+        num_of_bars++;
+    }
+
+    const long long now_us = monotonic_us();
+    const long long wait_us = now_us - record->queued_us;
+
+    counter_add(&writer->received, 1);
+    histogram_record(&writer->dequeued, now_us - record->event_us);
+
+    // Text changes as often as every second, so only messages are logged
+    if (record->count == 0)
+        return;
+
+    LOG(LOG_LEVEL_INFO,
+        "Queued %d messages for %d bars: dispatch %.3fms, queued %.3fms, %zu "
+        "waiting",
+        record->count, num_of_bars,
+        (record->queued_us - record->event_us) / 1000.0, wait_us / 1000.0,
+        ipc_writer_depth(writer));
+}
+
+/**
+ * Write a message to a bar's IPC file without blocking
+ *
+ * @returns int 0 if the message was written, otherwise a negative errno.
+ *              -ENXIO and -EAGAIN mean the bar isn't reading at the moment.
+ */
+static int write_message(const char* path, const char* message) {
+    const int fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0) {
+        PROBE(ipc_write, path, message, 0, -errno);
+        return -errno;
+    }
+
+    // Messages are shorter than PIPE_BUF, so they are written whole or not at
+    // all
+    const ssize_t n = write(fd, message, strlen(message));
+    const int r = n < 0 ? -errno : 0;
+
+    PROBE(ipc_write, path, message, n < 0 ? 0 : n, r);
+
+    close(fd);
+
+    return r;
+}
+
+/**
+ * Write the next waiting message, or else the next waiting text, to every bar
+ * that is due
+ *
+ * @returns long long When the next bar is due, or -1 if nothing is waiting
+ */
+static long long write_bars(IpcWriter* writer, const long long now_us) {
+    long long next_us = -1;
+
+    for (int i = 0; i < IPC_MAX_BARS; i++) {
+        IpcBar* bar = &writer->bars[i];
+
+        if (bar->path == NULL)
+            continue;
+
+        IpcBarText* text = bar->len > 0 ? NULL : bar_pending_text(bar);
+
+        if (bar->len == 0 && text == NULL)
+            continue;
+
+        if (bar->next_write_us <= now_us) {
+            char text_message[IPC_MAX_TEXT_LEN + 64];
+            const char* message;
+            long long event_us;
+
+            if (text == NULL) {
+                message = bar->messages[0].message;
+                event_us = bar->messages[0].event_us;
+            } else {
+                snprintf(text_message, sizeof(text_message),
+                         "action:#%s.send.%s", text->module, text->text);
+                message = text_message;
+                event_us = text->event_us;
+            }
+
+            const int r = write_message(bar->path, message);
+
+            if (r < 0)
+                counter_add(&writer->write_errors, 1);
+
+            if (r == -ENOENT) {
+                remove_bar(bar);
+                continue;
+            }
+
+            if (r < 0) {
+                // Back off while the bar isn't reading
+                bar->retries++;
+                bar->next_write_us = now_us + bar->retry_interval_ms * 1000;
+                if (bar->retry_interval_ms * 2 <= IPC_MAX_RETRY_INTERVAL_MS)
+                    bar->retry_interval_ms *= 2;
+            } else {
+                if (text == NULL) {
+                    LOG(LOG_LEVEL_INFO, "Sending the message '%s' to '%s'",
+                        message, bar->path);
+
+                    bar->len--;
+                    memmove(&bar->messages[0], &bar->messages[1],
+                            bar->len * sizeof(IpcBarMessage));
+                } else {
+                    text->pending = FALSE;
+                }
+
+                bar->next_write_us = now_us + IPC_MESSAGE_INTERVAL_MS * 1000;
+                bar->retry_interval_ms = IPC_MESSAGE_INTERVAL_MS;
+                bar->delivered++;
+
+                counter_add(text == NULL ? &writer->hooks_sent
+                                         : &writer->texts_sent,
+                            1);
+                histogram_record(&writer->written, now_us - event_us);
+
+                if (text == NULL && bar->len == 0)
+                    LOG(LOG_LEVEL_INFO,
+                        "Bar '%s' is up to date: %lu delivered, %lu replaced, "
+                        "%lu dropped, %lu retries",
+                        bar->path, bar->delivered, bar->replaced, bar->dropped,
+                        bar->retries);
+            }
+        }
+
+        if ((bar->len > 0 || bar_pending_text(bar) != NULL) &&
+            (next_us < 0 || bar->next_write_us < next_us))
+            next_us = bar->next_write_us;
+    }
+
+    return next_us;
+}
+
+/**
+ * Deliver records until the writer is stopped and the queued messages are
+ * written
+ */
+static void* writer_thread(void* arg) {
+    IpcWriter* writer = (IpcWriter*)arg;
+    size_t tail = atomic_load_explicit(&writer->tail, memory_order_relaxed);
+    struct pollfd wake = {.fd = writer->wake_fd, .events = POLLIN};
+    long long stop_us = -1;
+
+    while (TRUE) {
+        // Pairs with the release in ipc_writer_stop. Every record queued
+        // before stopping is then seen below.
+        const dbus_bool_t stopping =
+            atomic_load_explicit(&writer->stopping, memory_order_acquire);
+        const size_t head =
+            atomic_load_explicit(&writer->head, memory_order_acquire);
+
+        while (tail != head) {
+            // Copy the record so its slot can be reused straight away
+            const IpcRecord record =
+                writer->records[tail & (IPC_RING_SIZE - 1)];
+            atomic_store_explicit(&writer->tail, ++tail, memory_order_release);
+
+            queue_record(writer, &record);
+        }
+
+        const long long next_us = write_bars(writer, monotonic_us());
+        int timeout_ms = -1;
+
+        if (stopping) {
+            if (stop_us < 0)
+                stop_us = monotonic_us() + IPC_STOP_TIMEOUT_MS * 1000;
+
+            // Give up on bars that aren't reading
+            if (next_us < 0 || next_us >= stop_us)
+                break;
+        }
+
+        if (next_us >= 0) {
+            // Round up so the bar is due when poll returns
+            const long long remaining_us = next_us - monotonic_us();
+            timeout_ms = remaining_us > 0 ? (int)((remaining_us + 999) / 1000)
+                                          : 0;
+        }
+
+        // The eventfd counter keeps wakeups sent since the ring was checked
+        if (poll(&wake, 1, timeout_ms) > 0) {
+            uint64_t wakeups;
+
+            if (read(writer->wake_fd, &wakeups, sizeof(wakeups)) < 0 &&
+                errno != EAGAIN)
+                msleep(10);
+        }
+    }
+
+    return NULL;
+}
+
+dbus_bool_t ipc_writer_start(IpcWriter* writer, const char* ipc_directory) {
+    memset(writer, 0, sizeof(IpcWriter));
+    writer->ipc_directory = ipc_directory;
+    // Find the bars that are already running
+    atomic_init(&writer->bars_changed, TRUE);
+
+    if ((writer->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return FALSE;
+
+    if (!start_thread_without_signals(&writer->thread, writer_thread,
+                                      writer)) {
+        close(writer->wake_fd);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void ipc_writer_stop(IpcWriter* writer) {
+    const uint64_t wakeup = 1;
+
+    atomic_store_explicit(&writer->stopping, TRUE, memory_order_release);
+    write(writer->wake_fd, &wakeup, sizeof(wakeup));
+    pthread_join(writer->thread, NULL);
+
+    for (int i = 0; i < IPC_MAX_BARS; i++) {
+        IpcBar* bar = &writer->bars[i];
+
+        if (bar->path != NULL && bar->len > 0)
+            LOG(LOG_LEVEL_WARNING,
+                "Bar '%s' isn't reading, dropped %d messages", bar->path,
+                bar->len);
+
+        free(bar->path);
+        bar->path = NULL;
+    }
+
+    arena_free(&writer->arena);
+    close(writer->wake_fd);
+    writer->wake_fd = -1;
+}
+
+/**
+ * Get the next free record of the ring
+ *
+ * @returns IpcRecord* The record, or NULL if the ring is full
+ */
+static IpcRecord* next_record(IpcWriter* writer) {
+    const size_t head =
+        atomic_load_explicit(&writer->head, memory_order_relaxed);
+    const size_t tail =
+        atomic_load_explicit(&writer->tail, memory_order_acquire);
+
+    // The writer thread never blocks on a bar, so the ring only fills up if
+    // it is starved. Callers keep their old state and apply it again on the
+    // next signal.
+    if (head - tail == IPC_RING_SIZE) {
+        writer->dropped++;
+        return NULL;
+    }
+
+    return &writer->records[head & (IPC_RING_SIZE - 1)];
+}
+
+/**
+ * Publish the record returned by next_record to the writer thread and wake
+ * it up
+ */
+static void publish_record(IpcWriter* writer, IpcRecord* record,
+                           const long long event_us) {
+    const size_t head =
+        atomic_load_explicit(&writer->head, memory_order_relaxed);
+    const size_t tail =
+        atomic_load_explicit(&writer->tail, memory_order_relaxed);
+    const long long queued_us = monotonic_us();
+
+    record->event_us = event_us;
+    record->queued_us = queued_us;
+
+    atomic_store_explicit(&writer->head, head + 1, memory_order_release);
+
+    const size_t depth = head + 1 - tail;
+
+    writer->queued++;
+    histogram_record(&writer->dispatch, queued_us - event_us);
+    if (depth > writer->max_depth)
+        writer->max_depth = depth;
+
+    const uint64_t wakeup = 1;
+    write(writer->wake_fd, &wakeup, sizeof(wakeup));
+}
+
+dbus_bool_t ipc_writer_push(IpcWriter* writer, const long long event_us,
+                            const int count, const char* messages[]) {
+    if (count > IPC_MAX_MESSAGES)
+        return FALSE;
+
+    IpcRecord* record = next_record(writer);
+    if (record == NULL)
+        return FALSE;
+
+    record->count = count;
+    memcpy(record->messages, messages, count * sizeof(const char*));
+    record->text_module = NULL;
+
+    publish_record(writer, record, event_us);
+    writer->messages += count;
+
+    return TRUE;
+}
+
+dbus_bool_t ipc_writer_push_text(IpcWriter* writer, const long long event_us,
+                                 const char* module, const char* text) {
+    IpcRecord* record = next_record(writer);
+    if (record == NULL)
+        return FALSE;
+
+    record->count = 0;
+    record->text_module = module;
+    snprintf(record->text, sizeof(record->text), "%s", text);
+
+    publish_record(writer, record, event_us);
+    writer->messages++;
+
+    return TRUE;
+}
+
+void ipc_writer_bars_changed(IpcWriter* writer) {
+    atomic_store_explicit(&writer->bars_changed, TRUE, memory_order_release);
+}
+
+void ipc_writer_unwatched(IpcWriter* writer) {
+    atomic_store_explicit(&writer->unwatched, TRUE, memory_order_relaxed);
+}
+
+void ipc_writer_counters(IpcWriter* writer, StatsBuffer* stats,
+                         const StatsFormat format) {
+    stats_counter(stats, format, "records_queued_total",
+                  "Records queued for the IPC writer", writer->queued);
+    stats_counter(stats, format, "messages_queued_total",
+                  "Messages and texts queued for the IPC writer",
+                  writer->messages);
+    stats_counter(stats, format, "records_dropped_total",
+                  "Records dropped because the ring was full",
+                  writer->dropped);
+    stats_counter(stats, format, "records_received_total",
+                  "Records received by the IPC writer",
+                  atomic_load_explicit(&writer->received,
+                                       memory_order_relaxed));
+    stats_counter(stats, format, "hooks_sent_total", "Hooks sent to bars",
+                  atomic_load_explicit(&writer->hooks_sent,
+                                       memory_order_relaxed));
+    stats_counter(stats, format, "texts_sent_total",
+                  "Module texts sent to bars",
+                  atomic_load_explicit(&writer->texts_sent,
+                                       memory_order_relaxed));
+    stats_counter(stats, format, "coalesced_total",
+                  "Messages replaced by a newer one before being sent",
+                  atomic_load_explicit(&writer->coalesced,
+                                       memory_order_relaxed));
+    stats_counter(stats, format, "write_errors_total",
+                  "Failed writes to IPC files",
+                  atomic_load_explicit(&writer->write_errors,
+                                       memory_order_relaxed));
+}
+
+void ipc_writer_histograms(IpcWriter* writer, StatsBuffer* stats,
+                           const StatsFormat format) {
+    stats_histogram(stats, format, "dispatch", &writer->dispatch);
+    stats_histogram(stats, format, "dequeued", &writer->dequeued);
+    stats_histogram(stats, format, "written", &writer->written);
+}
+
+size_t ipc_writer_depth(IpcWriter* writer) {
+    const size_t tail =
+        atomic_load_explicit(&writer->tail, memory_order_acquire);
+    const size_t head =
+        atomic_load_explicit(&writer->head, memory_order_acquire);
+
+    return head - tail;
+}
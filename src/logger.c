@@ -0,0 +1,335 @@
+#include "../include/logger.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../include/utils.h"
+
+// Size of the buffers records are batched in before they are written
+#define LOG_BATCH_SIZE 8192
+
+// Names of the levels in the order of the LogLevel enum
+const char* const LOG_LEVEL_NAMES[] = {"error", "warning", "info", "debug"};
+
+// Prefixes telling journald the level of a line, from sd-daemon.h
+const char* const JOURNAL_PREFIXES[] = {"<3>", "<4>", "<6>", "<7>"};
+
+#ifdef VERBOSE
+atomic_int LOG_THRESHOLD = LOG_LEVEL_DEBUG;
+#else
+atomic_int LOG_THRESHOLD = LOG_LEVEL_INFO;
+#endif
+
+/**
+ * A formatted log line. seq is the position in the ring the record may be
+ * written at next, plus 1 once it holds the record for that position.
+ */
+typedef struct {
+    atomic_size_t seq;
+    LogLevel level;
+    char text[LOG_RECORD_LEN];
+} LogRecord;
+
+/**
+ * Bounded ring of records with any number of producers and the logger thread
+ * as the only consumer. Producers claim a position by moving head forward and
+ * publish the record by updating its seq, so a producer never waits for
+ * another one.
+ */
+static struct {
+    LogRecord records[LOG_RING_SIZE];
+
+    // Next position to claim, shared by the producers
+    _Alignas(64) atomic_size_t head;
+    // Next position to write, only used by the logger thread
+    _Alignas(64) size_t tail;
+
+    // Set while the logger thread is about to sleep on the eventfd, so
+    // producers only wake it when it needs to be woken
+    _Alignas(64) atomic_bool sleeping;
+    atomic_bool running;
+    int wake_fd;
+    pthread_t thread;
+    atomic_bool started;
+    // Set if stdout is connected to journald, which reads the level from a
+    // prefix of every line
+    dbus_bool_t journal;
+
+    // Counters
+    atomic_ulong dropped;
+    unsigned long reported;
+} LOGGER;
+
+/**
+ * Text waiting to be written to stdout or stderr
+ */
+typedef struct {
+    int fd;
+    char buf[LOG_BATCH_SIZE];
+    size_t len;
+} LogBatch;
+
+/**
+ * Write a whole buffer to a file descriptor, giving up on errors
+ */
+static void write_all(const int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        const ssize_t n = write(fd, buf, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+
+        buf += n;
+        len -= n;
+    }
+}
+
+static void batch_flush(LogBatch* batch) {
+    write_all(batch->fd, batch->buf, batch->len);
+    batch->len = 0;
+}
+
+/**
+ * Append a line to a batch, writing the batch first if the line doesn't fit
+ */
+static void batch_append(LogBatch* batch, const LogLevel level,
+                         const char* text) {
+    const char* prefix = LOGGER.journal ? JOURNAL_PREFIXES[level] : "";
+    const size_t prefix_len = strlen(prefix);
+    const size_t len = strlen(text);
+
+    // +1 for newline
+    if (batch->len + prefix_len + len + 1 > sizeof(batch->buf))
+        batch_flush(batch);
+
+    memcpy(batch->buf + batch->len, prefix, prefix_len);
+    batch->len += prefix_len;
+    memcpy(batch->buf + batch->len, text, len);
+    batch->len += len;
+    batch->buf[batch->len++] = '\n';
+}
+
+/**
+ * Write a line straight away, e.g. before the logger thread is started
+ */
+static void write_now(const LogLevel level, const char* text) {
+    LogBatch batch = {level <= LOG_LEVEL_WARNING ? STDERR_FILENO
+                                                 : STDOUT_FILENO};
+
+    // Lines printed with stdio before must come first
+    fflush(stdout);
+    batch_append(&batch, level, text);
+    batch_flush(&batch);
+}
+
+/**
+ * Write every published record
+ *
+ * @returns dbus_bool_t TRUE if any records were written, otherwise FALSE.
+ */
+static dbus_bool_t drain() {
+    static LogBatch out = {STDOUT_FILENO};
+    static LogBatch err = {STDERR_FILENO};
+    dbus_bool_t drained = FALSE;
+
+    while (TRUE) {
+        LogRecord* record = &LOGGER.records[LOGGER.tail & (LOG_RING_SIZE - 1)];
+
+        if (atomic_load_explicit(&record->seq, memory_order_acquire) !=
+            LOGGER.tail + 1)
+            break;
+
+        batch_append(record->level <= LOG_LEVEL_WARNING ? &err : &out,
+                     record->level, record->text);
+
+        // Hand the slot back to the producers for the next lap of the ring
+        atomic_store_explicit(&record->seq, LOGGER.tail + LOG_RING_SIZE,
+                              memory_order_release);
+        LOGGER.tail++;
+        drained = TRUE;
+    }
+
+    const unsigned long dropped =
+        atomic_load_explicit(&LOGGER.dropped, memory_order_relaxed);
+
+    if (dropped != LOGGER.reported) {
+        char text[64];
+
+        snprintf(text, sizeof(text), "Log was too slow, dropped %lu records",
+                 dropped - LOGGER.reported);
+        batch_append(&err, LOG_LEVEL_WARNING, text);
+        LOGGER.reported = dropped;
+    }
+
+    batch_flush(&out);
+    batch_flush(&err);
+
+    return drained;
+}
+
+/**
+ * Check if the record at the tail of the ring was published
+ */
+static dbus_bool_t has_records() {
+    const LogRecord* record =
+        &LOGGER.records[LOGGER.tail & (LOG_RING_SIZE - 1)];
+
+    return atomic_load_explicit(&record->seq, memory_order_acquire) ==
+           LOGGER.tail + 1;
+}
+
+/**
+ * Write records until the logger is stopped
+ */
+static void* logger_thread(void* arg) {
+    struct pollfd wake = {.fd = LOGGER.wake_fd, .events = POLLIN};
+
+    while (TRUE) {
+        drain();
+
+        // Producers check sleeping after publishing their record, so either
+        // they see it set or the record is seen here
+        atomic_store(&LOGGER.sleeping, TRUE);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (has_records() ||
+            !atomic_load_explicit(&LOGGER.running, memory_order_acquire)) {
+            atomic_store(&LOGGER.sleeping, FALSE);
+
+            if (!has_records())
+                return NULL;
+            continue;
+        }
+
+        if (poll(&wake, 1, -1) > 0) {
+            uint64_t wakeups;
+
+            if (read(LOGGER.wake_fd, &wakeups, sizeof(wakeups)) < 0 &&
+                errno != EAGAIN)
+                msleep(10);
+        }
+    }
+}
+
+dbus_bool_t logger_start() {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++)
+        atomic_init(&LOGGER.records[i].seq, i);
+
+    LOGGER.journal = getenv("JOURNAL_STREAM") != NULL;
+    atomic_store(&LOGGER.running, TRUE);
+
+    if ((LOGGER.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return FALSE;
+
+    if (!start_thread_without_signals(&LOGGER.thread, logger_thread, NULL)) {
+        close(LOGGER.wake_fd);
+        return FALSE;
+    }
+
+    // Lines printed with stdio before must come first
+    fflush(stdout);
+    LOGGER.started = TRUE;
+
+    return TRUE;
+}
+
+void logger_stop() {
+    if (!LOGGER.started)
+        return;
+
+    atomic_store_explicit(&LOGGER.running, FALSE, memory_order_release);
+
+    const uint64_t wakeup = 1;
+    write(LOGGER.wake_fd, &wakeup, sizeof(wakeup));
+
+    pthread_join(LOGGER.thread, NULL);
+    close(LOGGER.wake_fd);
+    LOGGER.started = FALSE;
+}
+
+void logger_write(const LogLevel level, const char* format, ...) {
+    va_list args;
+
+    if (!LOGGER.started) {
+        char text[LOG_RECORD_LEN];
+
+        va_start(args, format);
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+
+        write_now(level, text);
+        return;
+    }
+
+    size_t pos = atomic_load_explicit(&LOGGER.head, memory_order_relaxed);
+    LogRecord* record;
+
+    // Claim the next position whose slot the logger thread has written
+    while (TRUE) {
+        record = &LOGGER.records[pos & (LOG_RING_SIZE - 1)];
+
+        const size_t seq =
+            atomic_load_explicit(&record->seq, memory_order_acquire);
+        const intptr_t lap = (intptr_t)seq - (intptr_t)pos;
+
+        if (lap == 0) {
+            // Updates pos if another producer claimed it first
+            if (atomic_compare_exchange_weak_explicit(
+                    &LOGGER.head, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed))
+                break;
+        } else if (lap < 0) {
+            // The ring is full
+            atomic_fetch_add_explicit(&LOGGER.dropped, 1,
+                                      memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&LOGGER.head, memory_order_relaxed);
+        }
+    }
+
+    record->level = level;
+    va_start(args, format);
+    vsnprintf(record->text, sizeof(record->text), format, args);
+    va_end(args);
+
+    atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // The eventfd write never blocks, and is skipped while the logger thread
+    // is awake anyway
+    if (atomic_load_explicit(&LOGGER.sleeping, memory_order_relaxed) &&
+        atomic_exchange(&LOGGER.sleeping, FALSE)) {
+        const uint64_t wakeup = 1;
+        write(LOGGER.wake_fd, &wakeup, sizeof(wakeup));
+    }
+}
+
+dbus_bool_t logger_parse_level(const char* name, LogLevel* level) {
+    for (int i = 0; i <= LOG_LEVEL_DEBUG; i++) {
+        if (strcmp(name, LOG_LEVEL_NAMES[i]) == 0) {
+            *level = i;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+const char* logger_level_name(const LogLevel level) {
+    return LOG_LEVEL_NAMES[level];
+}
+
+unsigned long logger_dropped() {
+    return atomic_load_explicit(&LOGGER.dropped, memory_order_relaxed);
+}
@@ -0,0 +1,184 @@
+#define _XOPEN_SOURCE 700
+
+#include "../include/marquee.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+/**
+ * Decode the UTF-8 character at the start of a string
+ *
+ * @returns size_t The length of the character in bytes. An invalid byte is
+ *                 decoded as U+FFFD on its own.
+ */
+static size_t decode_utf8(const char* str, uint32_t* cp) {
+    const unsigned char* s = (const unsigned char*)str;
+    size_t len;
+    uint32_t c;
+
+    if (s[0] < 0x80) {
+        *cp = s[0];
+        return 1;
+    } else if ((s[0] & 0xE0) == 0xC0) {
+        len = 2;
+        c = s[0] & 0x1F;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        len = 3;
+        c = s[0] & 0x0F;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        len = 4;
+        c = s[0] & 0x07;
+    } else {
+        *cp = 0xFFFD;
+        return 1;
+    }
+
+    // A continuation byte is never the null char, so this stops at the end
+    // of the string
+    for (size_t i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *cp = 0xFFFD;
+            return 1;
+        }
+        c = c << 6 | (s[i] & 0x3F);
+    }
+
+    *cp = c;
+    return len;
+}
+
+/**
+ * Get the number of columns a character takes up
+ */
+static int char_width(const uint32_t cp) {
+    const int width = wcwidth((wchar_t)cp);
+
+    // Control characters and characters unknown to the locale
+    return width < 0 ? 1 : width;
+}
+
+/**
+ * Find the end of the frame starting at an offset of the ring
+ */
+static uint32_t frame_end(const Marquee* marquee, const size_t start) {
+    size_t end = start;
+    int width = 0;
+
+    while (marquee->ring[end] != '\0') {
+        uint32_t cp;
+        const size_t len = decode_utf8(marquee->ring + end, &cp);
+        const int w = char_width(cp);
+
+        if (width + w > marquee->width ||
+            end + len - start >= MARQUEE_MAX_FRAME_LEN)
+            break;
+
+        width += w;
+        end += len;
+    }
+
+    return end;
+}
+
+void marquee_init(Marquee* marquee, const int width) {
+    memset(marquee, 0, sizeof(Marquee));
+    marquee->width = width;
+}
+
+void marquee_free(Marquee* marquee) {
+    free(marquee->text);
+    free(marquee->ring);
+    free(marquee->frames);
+
+    marquee->text = NULL;
+    marquee->ring = NULL;
+    marquee->frames = NULL;
+    marquee->num_of_frames = 0;
+    marquee->frame = 0;
+}
+
+dbus_bool_t marquee_set_text(Marquee* marquee, const char* text) {
+    if (marquee->text != NULL && strcmp(marquee->text, text) == 0)
+        return FALSE;
+
+    marquee_free(marquee);
+    marquee->text = strdup(text);
+    marquee->texts++;
+
+    const size_t len = strlen(text);
+    int text_width = 0;
+
+    for (size_t i = 0; i < len;) {
+        uint32_t cp;
+        i += decode_utf8(text + i, &cp);
+        text_width += char_width(cp);
+    }
+
+    if (text_width <= marquee->width) {
+        // The text fits, so its only frame is the whole text
+        marquee->ring = strdup(text);
+        marquee->frames = (MarqueeFrame*)malloc(sizeof(MarqueeFrame));
+        marquee->frames[0] = (MarqueeFrame){0, frame_end(marquee, 0)};
+        marquee->num_of_frames = 1;
+
+        return TRUE;
+    }
+
+    // The second copy holds the part of the frames that wraps around, so
+    // every frame is contiguous
+    const size_t cycle_len = len + strlen(MARQUEE_SEPARATOR);
+    // +1 for null char
+    const size_t ring_size = cycle_len * 2 + 1;
+
+    marquee->ring = (char*)malloc(ring_size * sizeof(char));
+    snprintf(marquee->ring, ring_size, "%s%s%s%s", text, MARQUEE_SEPARATOR,
+             text, MARQUEE_SEPARATOR);
+
+    // There are at most as many frames as bytes in the cycle
+    marquee->frames = (MarqueeFrame*)malloc(cycle_len * sizeof(MarqueeFrame));
+
+    for (size_t start = 0; start < cycle_len;) {
+        uint32_t cp;
+        const size_t char_len = decode_utf8(marquee->ring + start, &cp);
+
+        // Combining characters stay with the character before them
+        if (char_width(cp) > 0)
+            marquee->frames[marquee->num_of_frames++] =
+                (MarqueeFrame){start, frame_end(marquee, start)};
+
+        start += char_len;
+    }
+
+    return TRUE;
+}
+
+dbus_bool_t marquee_is_scrolling(const Marquee* marquee) {
+    return marquee->num_of_frames > 1;
+}
+
+void marquee_frame(const Marquee* marquee, char* buf, const size_t size) {
+    if (marquee->num_of_frames == 0) {
+        buf[0] = '\0';
+        return;
+    }
+
+    const MarqueeFrame* frame = &marquee->frames[marquee->frame];
+    size_t len = frame->end - frame->start;
+
+    if (len >= size)
+        len = size - 1;
+
+    memcpy(buf, marquee->ring + frame->start, len);
+    buf[len] = '\0';
+}
+
+void marquee_next_frame(Marquee* marquee, char* buf, const size_t size) {
+    marquee_frame(marquee, buf, size);
+
+    if (marquee->num_of_frames > 0) {
+        marquee->frame = (marquee->frame + 1) % marquee->num_of_frames;
+        marquee->frames_shown++;
+    }
+}
@@ -0,0 +1,193 @@
+#include "../include/playback-position.h"
+
+#include <string.h>
+
+#include "../include/utils.h"
+#include "mpris-player.h"
+
+/**
+ * Cancel the Position request in flight. Its reply would be older than the
+ * change that made it outdated.
+ */
+static void cancel_request(PlaybackPosition* position) {
+    if (position->in_flight == NULL)
+        return;
+
+    bus_pending_call_free(position->in_flight);
+    position->in_flight = NULL;
+}
+
+/**
+ * Anchor the position at its extrapolated value, so it can change speed
+ */
+static void reanchor(PlaybackPosition* position) {
+    const long long now_us = monotonic_us();
+
+    position->position_us = playback_position_get_us(position, now_us);
+    position->anchor_us = now_us;
+}
+
+void playback_position_init(PlaybackPosition* position) {
+    memset(position, 0, sizeof(PlaybackPosition));
+    position->rate = 1.0;
+}
+
+void playback_position_reset(PlaybackPosition* position) {
+    cancel_request(position);
+
+    position->position_us = 0;
+    position->anchor_us = monotonic_us();
+    position->rate = 1.0;
+    position->playing = FALSE;
+    position->length_us = 0;
+    position->stale = FALSE;
+}
+
+void playback_position_set_track(PlaybackPosition* position,
+                                 const uint64_t length_us) {
+    cancel_request(position);
+
+    position->position_us = 0;
+    position->anchor_us = monotonic_us();
+    position->length_us = length_us;
+    position->stale = TRUE;
+}
+
+void playback_position_set_playing(PlaybackPosition* position,
+                                   const dbus_bool_t playing) {
+    if (playing == position->playing)
+        return;
+
+    reanchor(position);
+    position->playing = playing;
+
+    // Spotify may have been playing for a while before it reported it
+    cancel_request(position);
+    position->stale = TRUE;
+}
+
+void playback_position_set_rate(PlaybackPosition* position, const double rate) {
+    reanchor(position);
+    position->rate = rate;
+}
+
+void playback_position_seek(PlaybackPosition* position,
+                            const int64_t position_us) {
+    cancel_request(position);
+
+    position->position_us = position_us;
+    position->anchor_us = monotonic_us();
+    position->stale = FALSE;
+    position->seeked++;
+}
+
+int64_t playback_position_get_us(const PlaybackPosition* position,
+                                 const long long now_us) {
+    int64_t position_us = position->position_us;
+
+    if (position->playing && position->rate > 0)
+        position_us += (int64_t)((now_us - position->anchor_us) *
+                                 position->rate);
+
+    if (position_us < 0)
+        return 0;
+    if (position->length_us > 0 && (uint64_t)position_us > position->length_us)
+        return position->length_us;
+
+    return position_us;
+}
+
+int playback_position_tick_ms(const PlaybackPosition* position) {
+    if (!position->playing || position->rate <= 0)
+        return -1;
+
+    const int64_t position_us =
+        playback_position_get_us(position, monotonic_us());
+
+    // The track ended, spotify will report the next one
+    if (position->length_us > 0 &&
+        (uint64_t)position_us >= position->length_us)
+        return -1;
+
+    const int64_t next_second_us = (position_us / 1000000 + 1) * 1000000;
+    const double remaining_us = (next_second_us - position_us) / position->rate;
+
+    // Round up and add a millisecond, since timer deadlines are whole
+    // milliseconds and must not fire before the second is reached
+    return (int)((remaining_us + 999) / 1000) + 1;
+}
+
+dbus_bool_t playback_position_process(PlaybackPosition* position,
+                                      BusConnection* connection,
+                                      const char* destination) {
+    if (position->in_flight != NULL) {
+        if (!bus_pending_call_completed(position->in_flight)) {
+            // Keep extrapolating the last known position if spotify is stuck
+            if (playback_position_timeout_ms(position) == 0) {
+                position->timed_out++;
+                cancel_request(position);
+            }
+            return FALSE;
+        }
+
+        BusError err;
+        int64_t position_us;
+
+        bus_error_init(&err);
+
+        BusMessage* reply =
+            bus_pending_call_steal_reply(position->in_flight, &err);
+        const dbus_bool_t anchored =
+            reply != NULL &&
+            mpris_player_read_position_reply(reply, &position_us);
+
+        if (reply != NULL)
+            bus_message_unref(reply);
+        bus_error_free(&err);
+        bus_pending_call_free(position->in_flight);
+        position->in_flight = NULL;
+
+        if (!anchored)
+            return FALSE;
+
+        position->position_us = position_us;
+        position->anchor_us = monotonic_us();
+        position->replied++;
+
+        return TRUE;
+    }
+
+    if (!position->stale)
+        return FALSE;
+
+    position->stale = FALSE;
+
+    BusMessage* msg =
+        mpris_player_get_position_new(connection, destination);
+    if (msg == NULL)
+        return FALSE;
+
+    position->in_flight =
+        bus_call_async(connection, msg, POSITION_REPLY_TIMEOUT_MS);
+    bus_message_unref(msg);
+
+    if (position->in_flight != NULL) {
+        position->in_flight_since_ms = monotonic_ms();
+        position->requested++;
+    }
+
+    return FALSE;
+}
+
+int playback_position_timeout_ms(const PlaybackPosition* position) {
+    if (position->in_flight == NULL)
+        return position->stale ? 0 : -1;
+
+    if (bus_pending_call_completed(position->in_flight))
+        return 0;
+
+    const long long remaining = position->in_flight_since_ms +
+                                POSITION_REPLY_TIMEOUT_MS - monotonic_ms();
+
+    return remaining > 0 ? (int)remaining : 0;
+}
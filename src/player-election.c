@@ -0,0 +1,167 @@
+#include "../include/player-election.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/player-table.h"
+#include "../include/utils.h"
+
+/**
+ * Check if a player name matches the bus name of a player or one of its
+ * instances
+ */
+static dbus_bool_t name_matches(const char* bus_name, const char* name) {
+    const size_t prefix_len = strlen(PLAYER_NAME_PREFIX);
+    const size_t name_len = strlen(name);
+
+    if (strncmp(bus_name, PLAYER_NAME_PREFIX, prefix_len) != 0 ||
+        strncmp(bus_name + prefix_len, name, name_len) != 0)
+        return FALSE;
+
+    const char next = bus_name[prefix_len + name_len];
+
+    return next == '\0' || next == '.';
+}
+
+/**
+ * Get the index of a player in the priority list
+ */
+static int get_priority(const PlayerElection* election, const Player* player) {
+    for (int i = 0; i < election->num_of_priorities; i++) {
+        if (name_matches(player->bus_name, election->priorities[i]))
+            return i;
+    }
+
+    return election->num_of_priorities;
+}
+
+/**
+ * Check if a player ranks above another one
+ */
+static dbus_bool_t ranks_above(const PlayerElection* election,
+                               const Player* a, const Player* b) {
+    if (election->pinned != NULL) {
+        const dbus_bool_t a_pinned = name_matches(a->bus_name, election->pinned);
+        const dbus_bool_t b_pinned = name_matches(b->bus_name, election->pinned);
+
+        if (a_pinned != b_pinned)
+            return a_pinned;
+    }
+
+    const dbus_bool_t a_playing = a->status == PLAYER_PLAYING;
+    const dbus_bool_t b_playing = b->status == PLAYER_PLAYING;
+
+    if (a_playing != b_playing)
+        return a_playing;
+
+    if (a->priority != b->priority)
+        return a->priority < b->priority;
+
+    return a->playing_since_us > b->playing_since_us;
+}
+
+/**
+ * Elect a player, counting the election if it changed the elected player
+ */
+static dbus_bool_t elect(PlayerElection* election, Player* player) {
+    if (player == election->elected)
+        return FALSE;
+
+    election->elected = player;
+    election->elections++;
+
+    return TRUE;
+}
+
+void player_election_init(PlayerElection* election) {
+    memset(election, 0, sizeof(PlayerElection));
+}
+
+void player_election_free(PlayerElection* election) {
+    for (int i = 0; i < election->num_of_priorities; i++)
+        free(election->priorities[i]);
+
+    free(election->pinned);
+    memset(election, 0, sizeof(PlayerElection));
+}
+
+dbus_bool_t player_election_set_priorities(PlayerElection* election,
+                                           const char* list) {
+    char* names[ELECTION_MAX_PRIORITIES];
+    int num_of_names = 0;
+
+    for (const char* start = list;;) {
+        const char* end = strchr(start, ',');
+        const size_t len = end != NULL ? (size_t)(end - start) : strlen(start);
+
+        if (len == 0 || num_of_names == ELECTION_MAX_PRIORITIES) {
+            for (int i = 0; i < num_of_names; i++)
+                free(names[i]);
+            return FALSE;
+        }
+
+        names[num_of_names++] = strndup(start, len);
+
+        if (end == NULL)
+            break;
+        start = end + 1;
+    }
+
+    for (int i = 0; i < election->num_of_priorities; i++)
+        free(election->priorities[i]);
+
+    memcpy(election->priorities, names, num_of_names * sizeof(char*));
+    election->num_of_priorities = num_of_names;
+
+    return TRUE;
+}
+
+void player_election_set_pinned(PlayerElection* election, const char* name) {
+    free(election->pinned);
+    election->pinned = name != NULL ? strdup(name) : NULL;
+}
+
+void player_election_add(PlayerElection* election, Player* player) {
+    player->priority = get_priority(election, player);
+}
+
+void player_election_remove(PlayerElection* election, Player* player) {
+    if (player == election->elected)
+        election->elected = NULL;
+}
+
+dbus_bool_t player_election_update(PlayerElection* election,
+                                   PlayerTable* table, Player* player) {
+    // The elected player may have dropped below another one
+    if (election->elected == NULL || player == election->elected)
+        return player_election_rescan(election, table);
+
+    if (player != NULL && ranks_above(election, player, election->elected))
+        return elect(election, player);
+
+    return FALSE;
+}
+
+dbus_bool_t player_election_rescan(PlayerElection* election,
+                                   PlayerTable* table) {
+    Player* best = NULL;
+
+    election->rescans++;
+
+    for (int i = 0; i < PLAYER_TABLE_MAX_PLAYERS; i++) {
+        Player* player = &table->players[i];
+
+        if (player->unique_name == NULL)
+            continue;
+
+        player->priority = get_priority(election, player);
+
+        // The elected player keeps its place among equally ranked players
+        if (best == NULL || ranks_above(election, player, best) ||
+            (player == election->elected &&
+             !ranks_above(election, best, player)))
+            best = player;
+    }
+
+    return elect(election, best);
+}
@@ -0,0 +1,179 @@
+#include "../include/player-table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/utils.h"
+
+/**
+ * Hash a unique bus name with FNV-1a
+ */
+static uint32_t hash_name(const char* name) {
+    uint32_t hash = 2166136261u;
+
+    for (const unsigned char* c = (const unsigned char*)name; *c != '\0'; c++)
+        hash = (hash ^ *c) * 16777619u;
+
+    return hash;
+}
+
+/**
+ * Find the bucket holding a name, or the empty bucket ending its probe
+ * sequence
+ */
+static size_t find_bucket(PlayerTable* table, const char* unique_name) {
+    size_t bucket = hash_name(unique_name) & (PLAYER_TABLE_BUCKETS - 1);
+
+    table->lookups++;
+
+    // The table is never full, so there is always an empty bucket
+    while (table->buckets[bucket] != 0) {
+        const Player* player = &table->players[table->buckets[bucket] - 1];
+
+        table->probes++;
+        if (strcmp(player->unique_name, unique_name) == 0)
+            break;
+
+        bucket = (bucket + 1) & (PLAYER_TABLE_BUCKETS - 1);
+    }
+
+    return bucket;
+}
+
+/**
+ * Add a well-known name to the names a player owns, unless it is already
+ * among them, e.g. when it was found both by listing the names and by its
+ * NameOwnerChanged signal
+ */
+static void add_name(Player* player, const char* bus_name) {
+    for (int i = 0; i < player->num_of_names; i++) {
+        if (strcmp(player->names[i], bus_name) == 0)
+            return;
+    }
+
+    if (player->num_of_names < PLAYER_MAX_NAMES)
+        player->names[player->num_of_names++] = strdup(bus_name);
+}
+
+void player_table_init(PlayerTable* table) {
+    memset(table, 0, sizeof(PlayerTable));
+}
+
+void player_table_free(PlayerTable* table) {
+    for (int i = 0; i < PLAYER_TABLE_MAX_PLAYERS; i++) {
+        if (table->players[i].unique_name != NULL)
+            player_table_remove(table, &table->players[i]);
+    }
+}
+
+Player* player_table_add(PlayerTable* table, const char* unique_name,
+                         const char* bus_name) {
+    const size_t bucket = find_bucket(table, unique_name);
+
+    if (table->buckets[bucket] != 0) {
+        Player* player = &table->players[table->buckets[bucket] - 1];
+
+        player_set_string(&player->bus_name, bus_name);
+        add_name(player, bus_name);
+        return player;
+    }
+
+    if (table->count == PLAYER_TABLE_MAX_PLAYERS) {
+        table->dropped++;
+        return NULL;
+    }
+
+    for (int i = 0; i < PLAYER_TABLE_MAX_PLAYERS; i++) {
+        Player* player = &table->players[i];
+
+        if (player->unique_name != NULL)
+            continue;
+
+        memset(player, 0, sizeof(Player));
+        player->unique_name = strdup(unique_name);
+        player->bus_name = strdup(bus_name);
+        add_name(player, bus_name);
+        playback_position_init(&player->position);
+
+        table->buckets[bucket] = i + 1;
+        table->count++;
+
+        return player;
+    }
+
+    return NULL;
+}
+
+Player* player_table_get(PlayerTable* table, const char* unique_name) {
+    if (unique_name == NULL)
+        return NULL;
+
+    const size_t bucket = find_bucket(table, unique_name);
+
+    return table->buckets[bucket] != 0
+               ? &table->players[table->buckets[bucket] - 1]
+               : NULL;
+}
+
+int player_release_name(Player* player, const char* bus_name) {
+    for (int i = 0; i < player->num_of_names; i++) {
+        if (strcmp(player->names[i], bus_name) != 0)
+            continue;
+
+        free(player->names[i]);
+        player->names[i] = player->names[--player->num_of_names];
+        player->names[player->num_of_names] = NULL;
+        break;
+    }
+
+    if (player->num_of_names > 0 && strcmp(player->bus_name, bus_name) == 0)
+        player_set_string(&player->bus_name, player->names[0]);
+
+    return player->num_of_names;
+}
+
+void player_table_remove(PlayerTable* table, Player* player) {
+    size_t bucket = find_bucket(table, player->unique_name);
+
+    // Move later entries of the probe sequence back into the gap, so lookups
+    // never need tombstones
+    for (size_t next = (bucket + 1) & (PLAYER_TABLE_BUCKETS - 1);
+         table->buckets[next] != 0;
+         next = (next + 1) & (PLAYER_TABLE_BUCKETS - 1)) {
+        const Player* moved = &table->players[table->buckets[next] - 1];
+        const size_t home =
+            hash_name(moved->unique_name) & (PLAYER_TABLE_BUCKETS - 1);
+
+        // The entry can only move back if its home bucket is not between the
+        // gap and its current bucket
+        if (((next - home) & (PLAYER_TABLE_BUCKETS - 1)) >=
+            ((next - bucket) & (PLAYER_TABLE_BUCKETS - 1))) {
+            table->buckets[bucket] = table->buckets[next];
+            bucket = next;
+        }
+    }
+
+    table->buckets[bucket] = 0;
+    table->count--;
+
+    playback_position_reset(&player->position);
+    free(player->unique_name);
+    free(player->bus_name);
+    for (int i = 0; i < player->num_of_names; i++)
+        free(player->names[i]);
+    free(player->trackid);
+    free(player->artist);
+    free(player->title);
+    memset(player, 0, sizeof(Player));
+}
+
+dbus_bool_t player_set_string(char** field, const char* value) {
+    if (*field == NULL ? value == NULL
+                       : value != NULL && strcmp(*field, value) == 0)
+        return FALSE;
+
+    free(*field);
+    *field = value != NULL ? strdup(value) : NULL;
+
+    return TRUE;
+}
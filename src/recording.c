@@ -0,0 +1,127 @@
+#include "../include/recording.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/utils.h"
+
+// Size of the buffer of a recording's file, so recording a message rarely
+// needs a write
+#define RECORDING_BUFFER_SIZE 65536
+
+dbus_bool_t recording_create(Recording* recording, const char* path) {
+    memset(recording, 0, sizeof(Recording));
+
+    if (!(recording->file = fopen(path, "wb")))
+        return FALSE;
+
+    setvbuf(recording->file, NULL, _IOFBF, RECORDING_BUFFER_SIZE);
+    recording->started_us = monotonic_us();
+
+    if (fwrite(RECORDING_MAGIC, 1, RECORDING_MAGIC_LEN, recording->file) !=
+        RECORDING_MAGIC_LEN) {
+        fclose(recording->file);
+        recording->file = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+dbus_bool_t recording_write(Recording* recording, BusMessage* message,
+                            const long long time_us, BusError* err) {
+    RecordHeader header;
+    char* data;
+    int len;
+
+    if (!bus_message_marshal(message, &data, &len, err))
+        return FALSE;
+
+    header.time_us = time_us - recording->started_us;
+    header.len = len;
+
+    const dbus_bool_t written =
+        fwrite(&header, sizeof(header), 1, recording->file) == 1 &&
+        fwrite(data, 1, len, recording->file) == (size_t)len;
+
+    bus_free(data);
+
+    if (!written) {
+        bus_error_set(err, BUS_ERROR_FAILED, strerror(errno));
+        return FALSE;
+    }
+
+    recording->messages++;
+    recording->bytes += sizeof(header) + len;
+
+    return TRUE;
+}
+
+dbus_bool_t recording_open(Recording* recording, const char* path,
+                           BusError* err) {
+    char magic[RECORDING_MAGIC_LEN];
+
+    memset(recording, 0, sizeof(Recording));
+
+    if (!(recording->file = fopen(path, "rb"))) {
+        bus_error_set(err, BUS_ERROR_FAILED, strerror(errno));
+        return FALSE;
+    }
+
+    if (fread(magic, 1, sizeof(magic), recording->file) != sizeof(magic) ||
+        memcmp(magic, RECORDING_MAGIC, RECORDING_MAGIC_LEN) != 0) {
+        bus_error_set(err, BUS_ERROR_FAILED, "Not a recording");
+        fclose(recording->file);
+        recording->file = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BusMessage* recording_read(Recording* recording, long long* time_us,
+                           BusError* err) {
+    RecordHeader header;
+
+    const size_t n = fread(&header, 1, sizeof(header), recording->file);
+
+    // A recording ends after a whole message
+    if (n == 0 && feof(recording->file))
+        return NULL;
+
+    if (n != sizeof(header) || header.len > RECORDING_MAX_MESSAGE_LEN) {
+        bus_error_set(err, BUS_ERROR_FAILED, "Recording is cut off");
+        return NULL;
+    }
+
+    char* data = (char*)malloc(header.len);
+
+    if (fread(data, 1, header.len, recording->file) != header.len) {
+        bus_error_set(err, BUS_ERROR_FAILED, "Recording is cut off");
+        free(data);
+        return NULL;
+    }
+
+    BusMessage* message = bus_message_demarshal(data, header.len, err);
+    free(data);
+
+    if (message == NULL)
+        return NULL;
+
+    *time_us = header.time_us;
+    recording->messages++;
+    recording->bytes += sizeof(header) + header.len;
+
+    return message;
+}
+
+dbus_bool_t recording_close(Recording* recording) {
+    if (recording->file == NULL)
+        return TRUE;
+
+    const dbus_bool_t closed = fclose(recording->file) == 0;
+    recording->file = NULL;
+
+    return closed;
+}
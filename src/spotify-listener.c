@@ -1,74 +1,125 @@
+#define _GNU_SOURCE
+
 #include "../include/spotify-listener.h"
 
-#include <dbus-1.0/dbus/dbus.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <locale.h>
+#include <malloc.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../include/command-queue.h"
+#include "../include/command-socket.h"
+#include "../include/event-loop.h"
+#include "../include/ipc-writer.h"
+#include "../include/logger.h"
+#include "../include/marquee.h"
+#include "../include/playback-position.h"
+#include "../include/player-election.h"
+#include "../include/player-table.h"
+#include "../include/probes.h"
+#include "../include/recording.h"
 #include "../include/utils.h"
+#include "mpris-player.h"
 
-#ifdef VERBOSE
-const dbus_bool_t VERBOSE = TRUE;
-#else
-const dbus_bool_t VERBOSE = FALSE;
-#endif
-
+// Directory polybar creates its IPC files in, unless --ipc-dir is given
 const char* POLYBAR_IPC_DIRECTORY = "/tmp";
 
-// Used to check if track has changed
-char* last_trackid = NULL;
+// Delivers state changes to polybar on its own thread
+IpcWriter IPC_WRITER;
+
+// Waits for signals, commands, timers and new bars
+EventLoop EVENT_LOOP;
+
+// Commands are sent to it until a player is found
+const char* DEFAULT_PLAYER_NAME = "org.mpris.MediaPlayer2.spotify";
+
+// Time in milliseconds to wait for the bus to list the players at startup
+const int DISCOVERY_TIMEOUT_MS = 1000;
 
 // Current state of spotify
-typedef enum { PLAYING,
-               PAUSED,
-               EXITED } SpotifyState;
 SpotifyState CURRENT_SPOTIFY_STATE = EXITED;
 
+// Time in milliseconds to wait for spotify to confirm a predicted state before
+// rolling it back
+const long long PREDICTION_TIMEOUT_MS = 1000;
+
+// State shown on polybar ahead of spotify confirming it
+struct {
+    dbus_bool_t pending;
+    SpotifyState predicted;
+    // State to roll back to if the prediction is not confirmed
+    SpotifyState previous;
+    // When the command was received and when its hook was sent
+    long long command_us;
+    long long applied_us;
+
+    // Counters
+    unsigned long made;
+    unsigned long confirmed;
+    unsigned long rolled_back;
+    unsigned long cancelled;
+} prediction = {FALSE};
+
+// custom/ipc module showing the elapsed time and length of the track
+const char* PROGRESS_MODULE = "spotify-progress";
+
+// Text last sent to the progress module
+char last_progress[IPC_MAX_TEXT_LEN] = "";
+
+// custom/ipc module scrolling the artist and title of the track
+const char* MARQUEE_MODULE = "spotify-marquee";
+
+// Frames per second of the marquee unless --marquee-fps is given
+const int DEFAULT_MARQUEE_FPS = 10;
+
+// Text last sent to the marquee module
+char last_marquee[IPC_MAX_TEXT_LEN] = "";
+
 // DBus signals to listen for
 const char* PROPERTIES_CHANGED_MATCH =
     "interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',"
     "path='/org/mpris/MediaPlayer2'";
+const char* SEEKED_MATCH =
+    "interface='org.mpris.MediaPlayer2.Player',member='Seeked',"
+    "path='/org/mpris/MediaPlayer2'";
 const char* NAME_OWNER_CHANGED_MATCH =
     "interface='org.freedesktop.DBus',member='NameOwnerChanged',path='/org/"
-    "freedesktop/DBus'";
-
-dbus_bool_t update_last_trackid(const char* trackid) {
-    if (trackid != NULL) {
-        // +1 for null char
-        size_t size = strlen(trackid) + 1;
-
-        last_trackid = (char*)realloc(last_trackid, size);
-        last_trackid[0] = '\0';
+    "freedesktop/DBus',arg0namespace='org.mpris.MediaPlayer2'";
 
-        strcpy(last_trackid, trackid);
-
-        return TRUE;
-    } else {
-        return FALSE;
-    }
+/**
+ * Show pause, next, and previous button on polybar
+ */
+static dbus_bool_t show_playing() {
+    return send_ipc_polybar(4, "hook:module/playpause2",
+                            "hook:module/previous2", "hook:module/next2",
+                            "hook:module/spotify2");
 }
 
-dbus_bool_t spotify_update_track(const char* current_trackid) {
-    // If trackid didn't change
-    if (last_trackid != NULL && strcmp(current_trackid, last_trackid) != 0) {
-        puts("Track Changed");
-        // Send message to update track name
-        if (send_ipc_polybar(1, "hook:module/spotify2"))
-            return TRUE;
-    }
-    return FALSE;
+/**
+ * Show play, next, and previous button on polybar
+ */
+static dbus_bool_t show_paused() {
+    return send_ipc_polybar(4, "hook:module/playpause3",
+                            "hook:module/previous2", "hook:module/next2",
+                            "hook:module/spotify2");
 }
 
 dbus_bool_t spotify_playing() {
     if (CURRENT_SPOTIFY_STATE != PLAYING) {
-        puts("Song is playing");
-        // Show pause, next, and previous button on polybar
-        if (send_ipc_polybar(4, "hook:module/playpause2",
-                             "hook:module/previous2", "hook:module/next2",
-                             "hook:module/spotify2")) {
+        LOG(LOG_LEVEL_INFO, "Song is playing");
+        if (show_playing()) {
+            PROBE(state_change, CURRENT_SPOTIFY_STATE, PLAYING);
             CURRENT_SPOTIFY_STATE = PLAYING;
             return TRUE;
         }
@@ -78,11 +129,9 @@ dbus_bool_t spotify_playing() {
 
 dbus_bool_t spotify_paused() {
     if (CURRENT_SPOTIFY_STATE != PAUSED) {
-        puts("Song is paused");
-        // Show play, next, and previous button on polybar
-        if (send_ipc_polybar(4, "hook:module/playpause3",
-                             "hook:module/previous2", "hook:module/next2",
-                             "hook:module/spotify2")) {
+        LOG(LOG_LEVEL_INFO, "Song is paused");
+        if (show_paused()) {
+            PROBE(state_change, CURRENT_SPOTIFY_STATE, PAUSED);
             CURRENT_SPOTIFY_STATE = PAUSED;
             return TRUE;
         }
@@ -96,6 +145,7 @@ dbus_bool_t spotify_exited() {
         if (send_ipc_polybar(4, "hook:module/playpause1",
                              "hook:module/previous1", "hook:module/next1",
                              "hook:module/spotify1")) {
+            PROBE(state_change, CURRENT_SPOTIFY_STATE, EXITED);
             CURRENT_SPOTIFY_STATE = EXITED;
             return TRUE;
         }
@@ -103,51 +153,533 @@ dbus_bool_t spotify_exited() {
     return FALSE;
 }
 
+/**
+ * Format a duration as M:SS, or H:MM:SS if it is an hour or longer
+ */
+static void format_duration(char* buf, const size_t size,
+                            const int64_t seconds) {
+    if (seconds >= 3600)
+        snprintf(buf, size, "%" PRId64 ":%02d:%02d", seconds / 3600,
+                 (int)(seconds / 60 % 60), (int)(seconds % 60));
+    else
+        snprintf(buf, size, "%" PRId64 ":%02d", seconds / 60,
+                 (int)(seconds % 60));
+}
+
+dbus_bool_t spotify_show_progress(Listener* listener, const dbus_bool_t force) {
+    char progress[IPC_MAX_TEXT_LEN] = "";
+
+    if (CURRENT_SPOTIFY_STATE != EXITED && listener->active != NULL) {
+        const PlaybackPosition* position = &listener->active->position;
+        char elapsed[32];
+        char length[32];
+
+        format_duration(elapsed, sizeof(elapsed),
+                        playback_position_get_us(position, monotonic_us()) /
+                            1000000);
+
+        if (position->length_us > 0) {
+            format_duration(length, sizeof(length),
+                            position->length_us / 1000000);
+            snprintf(progress, sizeof(progress), "%s / %s", elapsed, length);
+        } else {
+            snprintf(progress, sizeof(progress), "%s", elapsed);
+        }
+    }
+
+    if (!force && strcmp(progress, last_progress) == 0)
+        return FALSE;
+
+    if (!ipc_writer_push_text(&IPC_WRITER, EVENT_LOOP.woke_us, PROGRESS_MODULE,
+                              progress)) {
+        LOG(LOG_LEVEL_WARNING,
+            "Polybar is not keeping up, dropped the progress");
+        return FALSE;
+    }
+
+    strcpy(last_progress, progress);
+
+    return TRUE;
+}
+
+dbus_bool_t spotify_show_marquee(Listener* listener, const dbus_bool_t advance,
+                                 const dbus_bool_t force) {
+    char frame[IPC_MAX_TEXT_LEN] = "";
+
+    if (listener->marquee.width == 0)
+        return FALSE;
+
+    if (CURRENT_SPOTIFY_STATE != EXITED) {
+        if (advance)
+            marquee_next_frame(&listener->marquee, frame, sizeof(frame));
+        else
+            marquee_frame(&listener->marquee, frame, sizeof(frame));
+    }
+
+    if (!force && strcmp(frame, last_marquee) == 0)
+        return FALSE;
+
+    if (!ipc_writer_push_text(&IPC_WRITER, EVENT_LOOP.woke_us, MARQUEE_MODULE,
+                              frame)) {
+        LOG(LOG_LEVEL_WARNING,
+            "Polybar is not keeping up, dropped a marquee frame");
+        return FALSE;
+    }
+
+    strcpy(last_marquee, frame);
+
+    return TRUE;
+}
+
+int spotify_marquee_timeout_ms(Listener* listener) {
+    if (!marquee_is_scrolling(&listener->marquee) ||
+        CURRENT_SPOTIFY_STATE != PLAYING || listener->bars_hidden) {
+        listener->marquee_due_ms = -1;
+        return -1;
+    }
+
+    const long long now_ms = monotonic_ms();
+
+    // Carry on scrolling one frame after it stopped
+    if (listener->marquee_due_ms < 0)
+        listener->marquee_due_ms = now_ms + listener->marquee_interval_ms;
+
+    return listener->marquee_due_ms > now_ms
+               ? (int)(listener->marquee_due_ms - now_ms)
+               : 0;
+}
+
+/**
+ * Scroll the artist and title of the active player's track from the start if
+ * they changed
+ */
+static void update_marquee(Listener* listener) {
+    const Player* player = listener->active;
+    char text[512] = "";
+
+    if (listener->marquee.width == 0)
+        return;
+
+    if (player != NULL && player->title != NULL) {
+        if (player->artist != NULL)
+            snprintf(text, sizeof(text), "%s: %s", player->artist,
+                     player->title);
+        else
+            snprintf(text, sizeof(text), "%s", player->title);
+    }
+
+    if (marquee_set_text(&listener->marquee, text)) {
+        listener->marquee_due_ms = -1;
+        spotify_show_marquee(listener, TRUE, FALSE);
+    }
+}
+
+dbus_bool_t spotify_refresh() {
+    switch (CURRENT_SPOTIFY_STATE) {
+        case PLAYING:
+            return show_playing();
+        case PAUSED:
+            return show_paused();
+        default:
+            return FALSE;
+    }
+}
+
+dbus_bool_t spotify_predict(const Command command) {
+    SpotifyState predicted;
+
+    // Nothing to predict if spotify is not running
+    if (CURRENT_SPOTIFY_STATE == EXITED)
+        return FALSE;
+
+    switch (command) {
+        case COMMAND_PLAY:
+            predicted = PLAYING;
+            break;
+        case COMMAND_PAUSE:
+            predicted = PAUSED;
+            break;
+        case COMMAND_PLAYPAUSE:
+            predicted = CURRENT_SPOTIFY_STATE == PLAYING ? PAUSED : PLAYING;
+            break;
+        default:
+            return FALSE;
+    }
+
+    // A command repeating the confirmed state, like play while playing, won't
+    // be reported by spotify, so expiring would count it as rolled back
+    if (predicted == CURRENT_SPOTIFY_STATE && !prediction.pending)
+        return FALSE;
+
+    // Only the play/pause button differs between playing and paused, so the
+    // other modules don't need to be updated. Nothing is predicted if polybar
+    // is too far behind to show it.
+    if (predicted != CURRENT_SPOTIFY_STATE &&
+        !send_ipc_polybar(1, predicted == PLAYING ? "hook:module/playpause2"
+                                                  : "hook:module/playpause3"))
+        return FALSE;
+
+    // Keep the last confirmed state to roll back to
+    if (!prediction.pending)
+        prediction.previous = CURRENT_SPOTIFY_STATE;
+
+    prediction.made++;
+
+    if (prediction.pending && predicted == prediction.previous) {
+        // The commands undo each other, e.g. two playpauses that may cancel
+        // out in the queue, so spotify may never report a change. The last
+        // confirmed state is right either way, and expiring would count it
+        // as rolled back.
+        prediction.pending = FALSE;
+        prediction.cancelled++;
+        LOG(LOG_LEVEL_INFO, "Prediction cancelled by the next command");
+    } else {
+        prediction.pending = TRUE;
+        prediction.predicted = predicted;
+        prediction.command_us = monotonic_us();
+    }
+
+    CURRENT_SPOTIFY_STATE = predicted;
+    prediction.applied_us = monotonic_us();
+
+    return TRUE;
+}
+
+void spotify_reconcile_prediction(const SpotifyState actual) {
+    if (!prediction.pending)
+        return;
+
+    const long long now_us = monotonic_us();
+    const double perceived_ms =
+        (prediction.applied_us - prediction.command_us) / 1000.0;
+    const double actual_ms = (now_us - prediction.command_us) / 1000.0;
+
+    prediction.pending = FALSE;
+
+    if (actual == prediction.predicted) {
+        prediction.confirmed++;
+        LOG(LOG_LEVEL_INFO,
+            "Prediction confirmed: perceived %.3fms, confirmed %.3fms",
+            perceived_ms, actual_ms);
+    } else {
+        // The caller applies the actual state
+        prediction.rolled_back++;
+        LOG(LOG_LEVEL_INFO, "Prediction contradicted after %.3fms", actual_ms);
+    }
+}
+
+int spotify_prediction_timeout_ms() {
+    if (!prediction.pending)
+        return -1;
+
+    const long long remaining_us = prediction.command_us +
+                                   PREDICTION_TIMEOUT_MS * 1000 -
+                                   monotonic_us();
+
+    // Round up so the timer doesn't fire just before the timeout
+    return remaining_us > 0 ? (int)((remaining_us + 999) / 1000) : 0;
+}
+
+void spotify_expire_prediction() {
+    if (!prediction.pending || spotify_prediction_timeout_ms() > 0)
+        return;
+
+    prediction.pending = FALSE;
+    prediction.rolled_back++;
+    LOG(LOG_LEVEL_INFO, "Prediction not confirmed within %lldms, rolling back",
+        PREDICTION_TIMEOUT_MS);
+
+    if (prediction.previous == PLAYING)
+        spotify_playing();
+    else if (prediction.previous == PAUSED)
+        spotify_paused();
+}
+
 dbus_bool_t send_ipc_polybar(int numOfMsgs, ...) {
-    char** paths;
-    size_t num_of_paths;
+    const char* messages[IPC_MAX_MESSAGES];
     va_list args;
 
-    // Pass address of pointer to array of strings
-    get_polybar_ipc_paths(POLYBAR_IPC_DIRECTORY, &paths, &num_of_paths);
+    if (numOfMsgs > IPC_MAX_MESSAGES)
+        return FALSE;
 
-    for (size_t p = 0; p < num_of_paths; p++) {
-        FILE* fp;
+    va_start(args, numOfMsgs);
+    for (int m = 0; m < numOfMsgs; m++)
+        messages[m] = va_arg(args, char*);
+    va_end(args);
 
-        va_start(args, numOfMsgs);
-        for (int m = 0; m < numOfMsgs; m++) {
-            const char* message = va_arg(args, char*);
+    if (!ipc_writer_push(&IPC_WRITER, EVENT_LOOP.woke_us, numOfMsgs, messages)) {
+        LOG(LOG_LEVEL_WARNING, "Polybar is not keeping up, dropped %d messages",
+            numOfMsgs);
+        PROBE(ipc_queue, numOfMsgs, messages[0], FALSE);
+        return FALSE;
+    }
 
-            fp = fopen(paths[p], "w");
-            fputs(message, fp);
-            printf("%s%s%s%s%s\n", "Sending the message '", message, "' to '",
-                   paths[p], "'");
+    PROBE(ipc_queue, numOfMsgs, messages[0], TRUE);
 
-            fclose(fp);
+    return TRUE;
+}
 
-            // Without sleep, requests are sometimes ignored
-            msleep(10);
-        }
-        va_end(args);
+/**
+ * Parse the PlaybackStatus property of a player
+ */
+static PlayerStatus parse_player_status(const char* status) {
+    if (strcmp(status, "Playing") == 0)
+        return PLAYER_PLAYING;
+    if (strcmp(status, "Paused") == 0)
+        return PLAYER_PAUSED;
+    if (strcmp(status, "Stopped") == 0)
+        return PLAYER_STOPPED;
+
+    return PLAYER_UNKNOWN;
+}
+
+/**
+ * Get the bus name commands and Position requests are sent to
+ */
+static const char* active_destination(const Listener* listener) {
+    return listener->active != NULL ? listener->active->bus_name
+                                    : DEFAULT_PLAYER_NAME;
+}
+
+/**
+ * Show the state of the active player on polybar, e.g. after another player
+ * became active. The modules are hidden until the player reports its state.
+ */
+static void show_active_player(Listener* listener) {
+    const Player* player = listener->active;
+
+    // The prediction was made for the previous player
+    prediction.pending = FALSE;
 
-        free(paths[p]);
+    if (player == NULL || player->status == PLAYER_UNKNOWN) {
+        spotify_exited();
+    } else {
+        CURRENT_SPOTIFY_STATE =
+            player->status == PLAYER_PLAYING ? PLAYING : PAUSED;
+        spotify_refresh();
     }
 
-    free(paths);
+    update_marquee(listener);
+    spotify_show_marquee(listener, FALSE, FALSE);
+    spotify_show_progress(listener, FALSE);
+}
 
-    return TRUE;
+/**
+ * Show the elected player on polybar if it isn't shown already, and tell
+ * spotifyctl where to send commands
+ */
+static void follow_election(Listener* listener) {
+    Player* player = listener->election.elected;
+
+    if (player == listener->active)
+        return;
+
+    listener->active = player;
+
+    if (player != NULL)
+        LOG(LOG_LEVEL_INFO, "Showing player '%s'", player->bus_name);
+
+    // spotifyctl reads the name instead of asking the bus for the players
+    if (listener->elected_path != NULL && player != NULL)
+        write_file_atomic(listener->elected_path, player->bus_name);
+    else if (listener->elected_path != NULL)
+        unlink(listener->elected_path);
+
+    show_active_player(listener);
+}
+
+/**
+ * Start tracking a player that connected to the bus
+ */
+static void add_player(Listener* listener, const char* unique_name,
+                       const char* bus_name) {
+    Player* player =
+        player_table_add(&listener->players, unique_name, bus_name);
+
+    if (player == NULL) {
+        LOG(LOG_LEVEL_WARNING, "Too many players, ignoring '%s'", bus_name);
+        return;
+    }
+
+    LOG(LOG_LEVEL_DEBUG, "Player '%s' connected as %s", bus_name, unique_name);
+
+    player_election_add(&listener->election, player);
+    if (player_election_update(&listener->election, &listener->players,
+                               player))
+        follow_election(listener);
 }
 
-DBusHandlerResult properties_changed_handler(DBusConnection* connection,
-                                             DBusMessage* message,
-                                             void* user_data) {
-    if (VERBOSE)
-        puts("Running properties_changed_handler");
-    DBusMessageIter iter;
-    DBusMessageIter sub_iter;
-    dbus_bool_t is_spotify = FALSE;
-    dbus_message_iter_init(message, &iter);
+/**
+ * Forget a name a player released. Stop tracking the player once it released
+ * all of its names, and show another one if it was active.
+ */
+static void remove_player(Listener* listener, const char* unique_name,
+                          const char* bus_name) {
+    Player* player = player_table_get(&listener->players, unique_name);
+
+    if (player == NULL)
+        return;
+
+    // The player is still running under another name, e.g. its base name
+    // after releasing an .instance name
+    if (player_release_name(player, bus_name) > 0) {
+        LOG(LOG_LEVEL_DEBUG, "Player '%s' released '%s'", player->bus_name,
+            bus_name);
+
+        // The name decides the player's priority
+        player_election_add(&listener->election, player);
+        if (player_election_update(&listener->election, &listener->players,
+                                   player))
+            follow_election(listener);
+        else if (player == listener->active && listener->elected_path != NULL)
+            write_file_atomic(listener->elected_path, player->bus_name);
+        return;
+    }
+
+    LOG(LOG_LEVEL_INFO, "Player '%s' disconnected", player->bus_name);
+
+    const dbus_bool_t was_active = player == listener->active;
+
+    player_election_remove(&listener->election, player);
+    player_table_remove(&listener->players, player);
+
+    if (was_active) {
+        // Scroll the track from the start if the player is started again
+        listener->active = NULL;
+        marquee_set_text(&listener->marquee, "");
+
+        player_election_update(&listener->election, &listener->players, NULL);
+        follow_election(listener);
+
+        if (listener->active == NULL) {
+            if (listener->elected_path != NULL)
+                unlink(listener->elected_path);
+            show_active_player(listener);
+        }
+    }
+}
+
+/**
+ * Append a message to the recording, and stop recording if it can't be
+ * written
+ */
+static void record_message(Listener* listener, BusMessage* message) {
+    BusError err;
+
+    bus_error_init(&err);
+
+    if (recording_write(listener->recording, message, monotonic_us(), &err))
+        return;
+
+    LOG(LOG_LEVEL_ERROR, "Stopped recording: %s", err.message);
+    bus_error_free(&err);
+    recording_close(listener->recording);
+    listener->recording = NULL;
+}
+
+/**
+ * Record a player found at startup as the NameOwnerChanged signal it sent
+ * when it connected, so a replay starts out with the same players
+ */
+static void record_player(Listener* listener, const char* bus_name,
+                          const char* unique_name) {
+    if (listener->recording == NULL)
+        return;
+
+    BusMessage* signal =
+        bus_signal_new(listener->connection, "/org/freedesktop/DBus",
+                       "org.freedesktop.DBus", "NameOwnerChanged");
+
+    if (signal != NULL && bus_message_append_string(signal, bus_name) &&
+        bus_message_append_string(signal, "") &&
+        bus_message_append_string(signal, unique_name))
+        record_message(listener, signal);
+
+    if (signal != NULL)
+        bus_message_unref(signal);
+}
+
+/**
+ * Find the players that were already on the bus when the listener started
+ */
+static void discover_players(Listener* listener) {
+    const size_t prefix_len = strlen(PLAYER_NAME_PREFIX);
+    BusError err;
+    const char* name;
+
+    bus_error_init(&err);
+
+    BusMessage* msg = bus_method_call_new(
+        listener->connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "ListNames");
+    if (msg == NULL)
+        return;
+
+    BusMessage* reply =
+        bus_call(listener->connection, msg, DISCOVERY_TIMEOUT_MS, &err);
+    bus_message_unref(msg);
+
+    if (reply == NULL) {
+        LOG(LOG_LEVEL_ERROR, "Failed to list players: %s", err.message);
+        bus_error_free(&err);
+        return;
+    }
+
+    /**
+     * Format of ListNames reply
+     * array [
+     *     string "org.freedesktop.DBus"
+     *     string ":1.42"
+     *     string "org.mpris.MediaPlayer2.spotify"
+     *     .
+     *     .
+     *     .
+     * ]
+     *
+     */
+
+    if (bus_message_enter(reply, BUS_TYPE_ARRAY)) {
+        while (bus_message_read_string(reply, &name)) {
+            if (strncmp(name, PLAYER_NAME_PREFIX, prefix_len) != 0)
+                continue;
+
+            // Signals are sent from the unique name of the player
+            BusMessage* call = bus_method_call_new(
+                listener->connection, "org.freedesktop.DBus",
+                "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                "GetNameOwner");
+            BusMessage* owner_reply = NULL;
+            const char* owner;
+
+            if (call != NULL && bus_message_append_string(call, name))
+                owner_reply = bus_call(listener->connection, call,
+                                       DISCOVERY_TIMEOUT_MS, &err);
+
+            if (owner_reply != NULL &&
+                bus_message_read_string(owner_reply, &owner)) {
+                record_player(listener, name, owner);
+                add_player(listener, owner, name);
+            }
 
+            // The player may have exited in the meantime
+            if (owner_reply != NULL)
+                bus_message_unref(owner_reply);
+            if (call != NULL)
+                bus_message_unref(call);
+            bus_error_free(&err);
+            bus_error_init(&err);
+        }
+    }
+
+    bus_message_unref(reply);
+}
+
+/**
+ * Apply the properties a player changed. This is the body of
+ * properties_changed_handler, which wraps it in probes.
+ */
+static dbus_bool_t properties_changed(BusMessage* message,
+                                      Listener* listener) {
     /**
      * Format of PropertiesChanged signal
      * string "org.mpris.MediaPlayer2.Player"
@@ -172,84 +704,186 @@ DBusHandlerResult properties_changed_handler(DBusConnection* connection,
      *
      */
 
-    char* interface_name = iter_get_string(&iter);
-
-    // Check if interface is correct
-    if (interface_name != NULL &&
-        strcmp(interface_name, "org.mpris.MediaPlayer2.Player") != 0) {
-        if (VERBOSE)
-            puts(
-                "Interface of PropertiesChanged signal not "
-                "org.mpris.MediaPlayer2.Player");
-        free(interface_name);
-        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-    }
-    free(interface_name);
-
-    dbus_message_iter_next(&iter);
-
-    // Recurse into array
-    if (!(recurse_iter_of_type(&iter, &sub_iter, DBUS_TYPE_ARRAY) &&
-          // Go to value with Metadata key
-          iter_try_step_to_key(&sub_iter, "Metadata") &&
-          // Step into variant value
-          iter_try_step_into_type(&sub_iter, DBUS_TYPE_VARIANT) &&
-          // Step into array of metadata
-          iter_try_step_into_signature(&sub_iter, "a{sv}") &&
-          // Go to value with key mpris:trackid
-          iter_try_step_to_key(&sub_iter, "mpris:trackid") &&
-          // Step into container
-          iter_try_step_into_type(&sub_iter, DBUS_TYPE_VARIANT) &&
-          // Verify string type
-          dbus_message_iter_get_arg_type(&sub_iter) == DBUS_TYPE_STRING)) {
-        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-    }
-
-    // Make sure trackid begins with spotify
-    char* trackid = iter_get_string(&sub_iter);
-    if (trackid != NULL && strncmp(trackid, "spotify", 7) == 0) {
-        spotify_update_track(trackid);
-        update_last_trackid(trackid);
-        is_spotify = TRUE;
-
-        if (VERBOSE)
-            puts("Spotify Detected");
-    }
-
-    free(trackid);
-
-    if (is_spotify) {
-        // Recurse into array
-        if (!(recurse_iter_of_type(&iter, &sub_iter, DBUS_TYPE_ARRAY) &&
-              // Step to PlaybackStatus key
-              iter_try_step_to_key(&sub_iter, "PlaybackStatus") &&
-              // Recurse into variant value
-              iter_try_step_into_type(&sub_iter, DBUS_TYPE_VARIANT) &&
-              // Verify string type
-              dbus_message_iter_get_arg_type(&sub_iter) == DBUS_TYPE_STRING)) {
-            return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    MprisPlayerProperties properties;
+
+    // Check if interface is correct and read the changed properties
+    if (!mpris_player_read_properties_changed(message, &properties)) {
+        LOG(LOG_LEVEL_DEBUG,
+            "Interface of PropertiesChanged signal not "
+            "org.mpris.MediaPlayer2.Player");
+        return FALSE;
+    }
+
+    listener->signals++;
+
+    // Players are told apart by the connection the signal was sent from
+    Player* player =
+        player_table_get(&listener->players, bus_message_get_sender(message));
+    if (player == NULL) {
+        LOG(LOG_LEVEL_DEBUG,
+            "PropertiesChanged signal not sent by a known player");
+        listener->rejected++;
+        return FALSE;
+    }
+
+    histogram_record(&listener->parse, monotonic_us() - EVENT_LOOP.woke_us);
+
+    const dbus_bool_t active = player == listener->active;
+    const MprisMetadata* metadata = &properties.metadata;
+
+    player->signals++;
+
+    // Metadata always contains the whole track, so missing keys are cleared
+    if (properties.present & MPRIS_PLAYER_HAS_METADATA) {
+        const dbus_bool_t first_track = player->trackid == NULL;
+
+        if (metadata->present & MPRIS_METADATA_HAS_MPRIS_TRACKID &&
+            player_set_string(&player->trackid, metadata->mpris_trackid)) {
+            // Players only report the position when asked for it
+            playback_position_set_track(
+                &player->position,
+                metadata->present & MPRIS_METADATA_HAS_MPRIS_LENGTH &&
+                        metadata->mpris_length > 0
+                    ? (uint64_t)metadata->mpris_length
+                    : 0);
+
+            if (active && !first_track) {
+                LOG(LOG_LEVEL_INFO, "Track Changed");
+                send_ipc_polybar(1, "hook:module/spotify2");
+            }
         }
 
-        // Update polybar modules
-        char* status = iter_get_string(&sub_iter);
-        if (strcmp(status, "Paused") == 0) {
-            spotify_paused();
-        } else if (strcmp(status, "Playing") == 0) {
+        player_set_string(&player->title,
+                          metadata->present & MPRIS_METADATA_HAS_XESAM_TITLE
+                              ? metadata->xesam_title
+                              : NULL);
+        player_set_string(&player->artist,
+                          metadata->present & MPRIS_METADATA_HAS_XESAM_ARTIST
+                              ? metadata->xesam_artist
+                              : NULL);
+
+        if (active)
+            update_marquee(listener);
+    }
+
+    if (properties.present & MPRIS_PLAYER_HAS_RATE)
+        playback_position_set_rate(&player->position, properties.rate);
+
+    if (properties.present & MPRIS_PLAYER_HAS_PLAYBACK_STATUS) {
+        const PlayerStatus status =
+            parse_player_status(properties.playback_status);
+
+        if (status == PLAYER_PLAYING && player->status != PLAYER_PLAYING)
+            player->playing_since_us = monotonic_us();
+
+        player->status = status;
+        playback_position_set_playing(&player->position,
+                                      status == PLAYER_PLAYING);
+
+        // Starting or stopping playback may elect another player
+        if (player_election_update(&listener->election, &listener->players,
+                                   player)) {
+            follow_election(listener);
+            histogram_record(&listener->transition,
+                             monotonic_us() - EVENT_LOOP.woke_us);
+            return TRUE;
+        }
+
+        // Update polybar modules. A stopped player is shown as paused.
+        if (!active) {
+            return TRUE;
+        } else if (player->status == PLAYER_PLAYING) {
+            spotify_reconcile_prediction(PLAYING);
             spotify_playing();
+        } else if (player->status != PLAYER_UNKNOWN) {
+            spotify_reconcile_prediction(PAUSED);
+            spotify_paused();
         }
+    }
+
+    // The track may have been reported before the player was shown
+    if (active) {
+        spotify_show_marquee(listener, FALSE, FALSE);
+        spotify_show_progress(listener, FALSE);
+        histogram_record(&listener->transition,
+                         monotonic_us() - EVENT_LOOP.woke_us);
+    }
+
+    return TRUE;
+}
+
+dbus_bool_t properties_changed_handler(BusMessage* message, void* user_data) {
+    LOG(LOG_LEVEL_DEBUG, "Running properties_changed_handler");
+    Listener* listener = (Listener*)user_data;
+
+    PROBE(properties_changed_entry, bus_message_get_sender(message),
+          EVENT_LOOP.woke_us);
+
+    const dbus_bool_t handled = properties_changed(message, listener);
+
+    // The track and state of the active player after the signal, which may
+    // have come from another player
+    PROBE(properties_changed_return, handled,
+          listener->active != NULL ? listener->active->trackid : NULL,
+          CURRENT_SPOTIFY_STATE);
+
+    return handled;
+}
+
+dbus_bool_t seeked_handler(BusMessage* message, void* user_data) {
+    Listener* listener = (Listener*)user_data;
+    int64_t position_us;
+
+    /**
+     * Format of Seeked signal
+     * int64 position in microseconds
+     *
+     */
 
-        free(status);
+    if (!mpris_player_read_seeked(message, &position_us))
+        return FALSE;
+
+    Player* player =
+        player_table_get(&listener->players, bus_message_get_sender(message));
+
+    listener->signals++;
+    if (player == NULL) {
+        listener->rejected++;
+        return FALSE;
     }
 
-    return DBUS_HANDLER_RESULT_HANDLED;
+    histogram_record(&listener->parse, monotonic_us() - EVENT_LOOP.woke_us);
+
+    LOG(LOG_LEVEL_DEBUG, "Seeked to %" PRId64 "us", position_us);
+
+    playback_position_seek(&player->position, position_us);
+    if (player == listener->active)
+        spotify_show_progress(listener, FALSE);
+
+    return TRUE;
 }
 
-DBusHandlerResult name_owner_changed_handler(DBusConnection* connection,
-                                             DBusMessage* message,
-                                             void* user_data) {
-    if (VERBOSE)
-        puts("Starting handler for name owner changed");
+dbus_bool_t record_handler(BusMessage* message, void* user_data) {
+    Listener* listener = (Listener*)user_data;
+
+    // Only the signals the match rules ask for, not e.g. the NameAcquired
+    // signal the bus sends to every connection
+    if (listener->recording != NULL &&
+        (bus_message_is_signal(message, "org.freedesktop.DBus.Properties",
+                               "PropertiesChanged") ||
+         bus_message_is_signal(message, "org.mpris.MediaPlayer2.Player",
+                               "Seeked") ||
+         bus_message_is_signal(message, "org.freedesktop.DBus",
+                               "NameOwnerChanged")))
+        record_message(listener, message);
 
+    return FALSE;
+}
+
+dbus_bool_t name_owner_changed_handler(BusMessage* message, void* user_data) {
+    LOG(LOG_LEVEL_DEBUG, "Starting handler for name owner changed");
+
+    Listener* listener = (Listener*)user_data;
     const char* name;
     const char* old_owner;
     const char* new_owner;
@@ -262,73 +896,853 @@ DBusHandlerResult name_owner_changed_handler(DBusConnection* connection,
      *
      */
 
+    if (!bus_message_is_signal(message, "org.freedesktop.DBus",
+                               "NameOwnerChanged"))
+        return FALSE;
+
+    listener->signals++;
+
     // Try to get message arguments
-    if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &name,
-                               DBUS_TYPE_STRING, &old_owner, DBUS_TYPE_STRING,
-                               &new_owner, DBUS_TYPE_INVALID)) {
-        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    if (!(bus_message_read_string(message, &name) &&
+          bus_message_read_string(message, &old_owner) &&
+          bus_message_read_string(message, &new_owner)) ||
+        strncmp(name, PLAYER_NAME_PREFIX, strlen(PLAYER_NAME_PREFIX)) != 0) {
+        listener->rejected++;
+        return FALSE;
     }
 
-    // If name matches spotify and new owner is "", spotify disconnected
-    if (strcmp(name, "org.mpris.MediaPlayer2.spotify") == 0 &&
-        strcmp(new_owner, "") == 0) {
-        puts("Spotify disconnected");
-        spotify_exited();
-        return DBUS_HANDLER_RESULT_HANDLED;
+    histogram_record(&listener->parse, monotonic_us() - EVENT_LOOP.woke_us);
+
+    // The name moves from the old owner to the new one, either of which is ""
+    // if the name was released or acquired
+    if (strcmp(old_owner, "") != 0)
+        remove_player(listener, old_owner, name);
+    if (strcmp(new_owner, "") != 0)
+        add_player(listener, new_owner, name);
+
+    histogram_record(&listener->transition,
+                     monotonic_us() - EVENT_LOOP.woke_us);
+
+    return TRUE;
+}
+
+/**
+ * Change the log level at runtime
+ */
+static void set_log_level(Listener* listener, const LogLevel level) {
+    const LogLevel previous = atomic_exchange(&LOG_THRESHOLD, level);
+
+    // Remember the level debug logs were turned on from, to go back to it
+    if (level == LOG_LEVEL_DEBUG && previous != LOG_LEVEL_DEBUG)
+        listener->log_level = previous;
+
+    // Logged regardless of the level, so it is clear where logs stop or start
+    logger_write(LOG_LEVEL_INFO, "Log level set to %s",
+                 logger_level_name(level));
+}
+
+/**
+ * Get the bytes of the heap that are allocated, to watch the listener for
+ * leaks
+ */
+static unsigned long long heap_in_use() {
+#if __GLIBC__ > 2 || __GLIBC__ == 2 && __GLIBC_MINOR__ >= 33
+    const struct mallinfo2 info = mallinfo2();
+#else
+    const struct mallinfo info = mallinfo();
+#endif
+
+    // Small allocations come from the arenas and large ones are mapped
+    return (unsigned long long)info.uordblks + info.hblkhd;
+}
+
+/**
+ * Format the counters and latency histograms of the listener and its IPC
+ * writer
+ */
+static void format_stats(Listener* listener, StatsBuffer* stats,
+                         const StatsFormat format) {
+    stats_buffer_init(stats);
+
+    stats_counter(stats, format, "signals_total", "Signals received",
+                  listener->signals);
+    stats_counter(stats, format, "signals_rejected_total",
+                  "Signals rejected", listener->rejected);
+    stats_counter(stats, format, "elections_total",
+                  "Times another player was elected",
+                  listener->election.elections);
+    stats_counter(stats, format, "predictions_total", "Predictions made",
+                  prediction.made);
+    stats_counter(stats, format, "predictions_rolled_back_total",
+                  "Predictions rolled back", prediction.rolled_back);
+    stats_counter(stats, format, "predictions_cancelled_total",
+                  "Predictions cancelled by a command undoing them",
+                  prediction.cancelled);
+    ipc_writer_counters(&IPC_WRITER, stats, format);
+    stats_counter(stats, format, "log_records_dropped_total",
+                  "Log records dropped because the log was too slow",
+                  logger_dropped());
+    stats_gauge(stats, format, "heap_bytes", "Heap in use (bytes)",
+                heap_in_use());
+
+    stats_histogram_header(stats, format);
+    stats_histogram(stats, format, "parse", &listener->parse);
+    stats_histogram(stats, format, "transition", &listener->transition);
+    ipc_writer_histograms(&IPC_WRITER, stats, format);
+
+    if (stats->truncated)
+        LOG(LOG_LEVEL_WARNING, "Stats were truncated");
+}
+
+void command_line_handler(CommandClient* client, const char* line,
+                          void* user_data) {
+    Listener* listener = (Listener*)user_data;
+    CommandQueue* queue = &listener->queue;
+    const size_t predict_prefix_len = strlen(COMMAND_PREDICT_PREFIX);
+
+    LOG(LOG_LEVEL_DEBUG, "Received command '%s'", line);
+
+    if (strcmp(line, COMMAND_STATS) == 0 ||
+        strcmp(line, COMMAND_STATS_PROMETHEUS) == 0) {
+        static StatsBuffer stats;
+
+        format_stats(listener, &stats,
+                     strcmp(line, COMMAND_STATS) == 0 ? STATS_HUMAN
+                                                      : STATS_PROMETHEUS);
+        if (!command_client_write(client, stats.buf, stats.len))
+            LOG(LOG_LEVEL_WARNING, "Failed to reply with stats");
+        return;
+    }
+
+    if (strncmp(line, COMMAND_LOG_LEVEL_PREFIX,
+                strlen(COMMAND_LOG_LEVEL_PREFIX)) == 0) {
+        LogLevel level;
+
+        if (logger_parse_level(line + strlen(COMMAND_LOG_LEVEL_PREFIX),
+                               &level))
+            set_log_level(listener, level);
+        else
+            LOG(LOG_LEVEL_WARNING, "Invalid log level in '%s'", line);
+        return;
+    }
+
+    // The marquee stops scrolling while it can't be seen
+    if (strcmp(line, COMMAND_BAR_HIDDEN) == 0 ||
+        strcmp(line, COMMAND_BAR_SHOWN) == 0) {
+        listener->bars_hidden = strcmp(line, COMMAND_BAR_HIDDEN) == 0;
+        return;
+    }
+
+    if (strncmp(line, COMMAND_PIN_PREFIX, strlen(COMMAND_PIN_PREFIX)) == 0 ||
+        strcmp(line, COMMAND_UNPIN) == 0) {
+        const char* name = strcmp(line, COMMAND_UNPIN) == 0
+                               ? NULL
+                               : line + strlen(COMMAND_PIN_PREFIX);
+
+        player_election_set_pinned(&listener->election, name);
+        if (player_election_rescan(&listener->election, &listener->players))
+            follow_election(listener);
+        return;
     }
 
-    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    // spotifyctl sent the command to spotify itself, only predict the result
+    if (strncmp(line, COMMAND_PREDICT_PREFIX, predict_prefix_len) == 0) {
+        spotify_predict(parse_command(line + predict_prefix_len));
+        return;
+    }
+
+    const Command command = parse_command(line);
+
+    if (command == COMMAND_INVALID) {
+        LOG(LOG_LEVEL_WARNING, "Invalid command '%s'", line);
+        return;
+    }
+
+    // Show the expected state straight away instead of waiting for spotify,
+    // unless the queue is full and the command was dropped
+    if (command_queue_push(queue, command))
+        spotify_predict(command);
 }
 
-void free_user_data(void* memory) {}
+void command_listen_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+    int fd;
+
+    while ((fd = accept4(source->fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        CommandClient* client = NULL;
+
+        for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+            if (listener->clients[i].fd < 0) {
+                client = &listener->clients[i];
+                break;
+            }
+        }
+
+        // Too many clients, spotifyctl will fall back to DBus
+        if (client == NULL ||
+            event_loop_add_fd(source->loop, fd, EPOLLIN,
+                              command_client_handler, listener) == NULL) {
+            close(fd);
+            continue;
+        }
+
+        command_client_init(client, fd);
+    }
+}
+
+void command_client_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        CommandClient* client = &listener->clients[i];
+
+        if (client->fd != source->fd)
+            continue;
+
+        dbus_bool_t ok = command_client_flush(client);
+
+        // spotifyctl shuts down its side after a query, and still reads the
+        // rest of the reply
+        if (ok && client->reading && (events & ~EPOLLOUT))
+            client->reading =
+                command_client_read(client, command_line_handler, listener);
+
+        // Wait for the socket to take the rest of the reply instead of
+        // blocking the loop
+        if (ok && (client->reading || client->reply != NULL) &&
+            event_source_set_events(
+                source, (client->reading ? EPOLLIN : 0) |
+                            (client->reply != NULL ? EPOLLOUT : 0)))
+            return;
+
+        event_source_remove(source);
+        command_client_close(client);
+
+        return;
+    }
+}
+
+void bus_event_handler(EventSource* source, const uint32_t events) {
+    // Messages are read and dispatched before the loop waits again
+}
+
+void queue_timer_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+
+    command_queue_process(&listener->queue, listener->connection,
+                          active_destination(listener));
+}
+
+void prediction_timer_handler(EventSource* source, const uint32_t events) {
+    spotify_expire_prediction();
+}
+
+void position_timer_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+    Player* player = listener->active;
+
+    if (player != NULL &&
+        playback_position_process(&player->position, listener->connection,
+                                  player->bus_name))
+        spotify_show_progress(listener, FALSE);
+}
+
+void progress_timer_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+
+    spotify_show_progress(listener, FALSE);
+}
+
+void marquee_timer_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+    const long long now_ms = monotonic_ms();
+
+    spotify_show_marquee(listener, TRUE, FALSE);
+
+    // Skip frames instead of catching up if the loop fell behind
+    listener->marquee_due_ms += listener->marquee_interval_ms;
+    if (listener->marquee_due_ms <= now_ms)
+        listener->marquee_due_ms = now_ms + listener->marquee_interval_ms;
+}
+
+void exit_signal_handler(EventSource* source, const uint32_t events) {
+    event_loop_quit(source->loop);
+}
+
+void stats_signal_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+    static StatsBuffer stats;
+
+    format_stats(listener, &stats, STATS_HUMAN);
+    fwrite(stats.buf, 1, stats.len, stdout);
+    fflush(stdout);
+}
+
+void log_signal_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+
+    set_log_level(listener, atomic_load(&LOG_THRESHOLD) != LOG_LEVEL_DEBUG
+                                ? LOG_LEVEL_DEBUG
+                                : listener->log_level);
+}
+
+void ipc_directory_handler(EventSource* source, const uint32_t events) {
+    Listener* listener = (Listener*)source->user_data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    dbus_bool_t new_bar = FALSE;
+    ssize_t len;
+
+    while ((len = read(source->fd, buf, sizeof(buf))) > 0) {
+        for (char* ptr = buf; ptr < buf + len;) {
+            const struct inotify_event* event = (struct inotify_event*)ptr;
+
+            // Every bar creates its own IPC file when it starts
+            if (event->len > 0 &&
+                strncmp(event->name, "polybar_mqueue", 14) == 0)
+                new_bar = TRUE;
+
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (new_bar)
+        ipc_writer_bars_changed(&IPC_WRITER);
+
+    if (new_bar && spotify_refresh()) {
+        LOG(LOG_LEVEL_INFO, "New bar detected");
+        spotify_show_progress(listener, TRUE);
+        spotify_show_marquee(listener, FALSE, TRUE);
+    }
+}
+
+void listener_prepare(EventLoop* loop, void* user_data) {
+    Listener* listener = (Listener*)user_data;
+
+    // Forward the next command if spotify replied to the last one
+    command_queue_process(&listener->queue, listener->connection,
+                          active_destination(listener));
+    bus_flush(listener->connection);
+
+    // Call handlers for all messages that have been read. Flushing may also
+    // read messages, so this must come after it.
+    if (!bus_process(listener->connection)) {
+        event_loop_quit(loop);
+        return;
+    }
 
-int main() {
-    DBusConnection* connection;
-    DBusError err;
+    LOG(LOG_LEVEL_DEBUG, "In dispatch loop");
 
-    dbus_error_init(&err);
+    const short bus_events = bus_get_events(listener->connection);
+    event_source_set_events(listener->bus_source,
+                            (bus_events & POLLIN ? EPOLLIN : 0) |
+                                (bus_events & POLLOUT ? EPOLLOUT : 0));
+
+    // Dispatching may have completed the command in flight or made or
+    // confirmed a prediction
+    event_source_set_timeout(listener->queue_timer,
+                             command_queue_timeout_ms(&listener->queue));
+    event_source_set_timeout(listener->prediction_timer,
+                             spotify_prediction_timeout_ms());
+
+    // Signals may have made the position stale or stopped it, and the reply
+    // to reading it may have arrived. Only the active player is shown.
+    const Player* player = listener->active;
+
+    event_source_set_timeout(
+        listener->position_timer,
+        player != NULL ? playback_position_timeout_ms(&player->position) : -1);
+    event_source_set_timeout(
+        listener->progress_timer,
+        CURRENT_SPOTIFY_STATE == EXITED || player == NULL
+            ? -1
+            : playback_position_tick_ms(&player->position));
+    event_source_set_timeout(listener->marquee_timer,
+                             spotify_marquee_timeout_ms(listener));
+}
+
+/**
+ * Print how much CPU time the listener used, e.g. to judge the cost of the
+ * marquee
+ */
+static void print_usage_stats(const Listener* listener,
+                              const long long started_ms) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return;
+
+    const double cpu_s = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) /
+                             1000000.0;
+    const double wall_s = (monotonic_ms() - started_ms) / 1000.0;
+
+    LOG(LOG_LEVEL_INFO,
+        "Used %.3fs of CPU time in %.1fs (%.3f%%), showed %lu marquee frames",
+        cpu_s, wall_s, wall_s > 0 ? cpu_s / wall_s * 100 : 0,
+        listener->marquee.frames_shown);
+}
+
+/**
+ * The handlers a replayed message is passed to, in the order they are added
+ * to the bus connection
+ */
+static const struct {
+    const char* name;
+    BusMessageHandler handler;
+} REPLAY_HANDLERS[] = {
+    {"PropertiesChanged", properties_changed_handler},
+    {"Seeked", seeked_handler},
+    {"NameOwnerChanged", name_owner_changed_handler},
+};
+
+/**
+ * Sleep until a CLOCK_MONOTONIC time in microseconds
+ */
+static void sleep_until_us(const long long due_us) {
+    const struct timespec due = {due_us / 1000000, due_us % 1000000 * 1000};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) ==
+           EINTR)
+        ;
+}
+
+/**
+ * Pass a replayed message to the handlers like the bus connection would
+ *
+ * @returns const char* The name of the handler that handled it, or NULL
+ */
+static const char* replay_message(Listener* listener, BusMessage* message) {
+    const size_t count = sizeof(REPLAY_HANDLERS) / sizeof(REPLAY_HANDLERS[0]);
+
+    for (size_t i = 0; i < count; i++) {
+        // Every handler reads the message from the start
+        bus_message_rewind(message);
+
+        if (REPLAY_HANDLERS[i].handler(message, listener))
+            return REPLAY_HANDLERS[i].name;
+    }
+
+    return NULL;
+}
+
+/**
+ * Pass the signals of a recording to the handlers, at the pace they were
+ * recorded at or as fast as possible, and print how long the handlers took,
+ * how much they allocated and how many messages they queued for polybar for
+ * every signal. Allocations are only counted by spotify-replay.
+ *
+ * @returns int The exit code
+ */
+static int replay(Listener* listener, const char* path,
+                  const dbus_bool_t fast) {
+    static StatsBuffer stats;
+    Recording recording;
+    Histogram latency;
+    BusError err;
+    BusMessage* message;
+    long long time_us;
+    unsigned long handled = 0;
+    unsigned long allocs = 0;
+    unsigned long hooks = 0;
+
+    bus_error_init(&err);
+
+    if (!recording_open(&recording, path, &err)) {
+        fprintf(stderr, "Failed to open recording '%s': %s\n", path,
+                err.message);
+        bus_error_free(&err);
+        return 1;
+    }
+
+    histogram_init(&latency);
+    printf("%8s %12s %-18s %-20s %10s %8s %6s\n", "signal", "offset (ms)",
+           "handler", "sender", "time (us)", "allocs", "hooks");
+
+    const long long started_us = monotonic_us();
+
+    while ((message = recording_read(&recording, &time_us, &err)) != NULL) {
+        if (!fast)
+            sleep_until_us(started_us + time_us);
+
+        const unsigned long allocs_before = alloc_count ? alloc_count() : 0;
+        const unsigned long hooks_before = IPC_WRITER.messages;
+
+        // Latencies are measured from here, like from waking up for a signal
+        EVENT_LOOP.woke_us = monotonic_us();
+
+        const char* handler = replay_message(listener, message);
+        const long long handler_us = monotonic_us() - EVENT_LOOP.woke_us;
+        const unsigned long event_allocs =
+            alloc_count ? alloc_count() - allocs_before : 0;
+        const unsigned long event_hooks = IPC_WRITER.messages - hooks_before;
+        const char* sender = bus_message_get_sender(message);
+
+        histogram_record(&latency, handler_us);
+        handled += handler != NULL;
+        allocs += event_allocs;
+        hooks += event_hooks;
+
+        printf("%8lu %12.3f %-18s %-20s %10lld ", recording.messages,
+               time_us / 1000.0, handler != NULL ? handler : "-",
+               sender != NULL ? sender : "-", handler_us);
+        if (alloc_count)
+            printf("%8lu %6lu\n", event_allocs, event_hooks);
+        else
+            printf("%8s %6lu\n", "-", event_hooks);
+
+        bus_message_unref(message);
+    }
+
+    const double replay_ms = (monotonic_us() - started_us) / 1000.0;
+    const dbus_bool_t failed = bus_error_is_set(&err);
+
+    if (failed) {
+        fprintf(stderr, "Stopped replaying after %lu signals: %s\n",
+                recording.messages, err.message);
+        bus_error_free(&err);
+    }
+
+    recording_close(&recording);
+
+    stats_buffer_init(&stats);
+    stats_printf(&stats, "\nReplayed %lu signals in %.3fms\n",
+                 recording.messages, replay_ms);
+    stats_counter(&stats, STATS_HUMAN, "signals_handled", "Signals handled",
+                  handled);
+    if (alloc_count)
+        stats_counter(&stats, STATS_HUMAN, "allocations",
+                      "Allocations by the handlers", allocs);
+    stats_counter(&stats, STATS_HUMAN, "messages_queued",
+                  "Messages and texts queued for polybar", hooks);
+    stats_histogram_header(&stats, STATS_HUMAN);
+    stats_histogram(&stats, STATS_HUMAN, "handler", &latency);
+    fwrite(stats.buf, 1, stats.len, stdout);
+    fflush(stdout);
+
+    return failed ? 1 : 0;
+}
+
+static void print_usage() {
+    puts("usage: spotify-listener [--marquee-width <columns>] "
+         "[--marquee-fps <frames>]");
+    puts("                        [--priority <player>,...] [--pin <player>]");
+    puts("                        [--log-level error|warning|info|debug]");
+    puts("                        [--ipc-dir <directory>]");
+    puts("                        [--record <file> | --replay <file> "
+         "[--replay-fast]]");
+}
+
+int main(int argc, char* argv[]) {
+    Listener listener = {0};
+    BusError err;
+    int marquee_width = 0;
+    int marquee_fps = DEFAULT_MARQUEE_FPS;
+    const long long started_ms = monotonic_ms();
+    dbus_bool_t log_level_set = FALSE;
+    Recording recording;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    dbus_bool_t replay_fast = FALSE;
+    dbus_bool_t ipc_dir_set = FALSE;
+    char replay_ipc_dir[] = "/tmp/spotify-replay.XXXXXX";
+    int listen_fd = -1;
+
+    player_election_init(&listener.election);
+    listener.log_level = LOG_LEVEL_INFO;
+
+    // Parse commandline options
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--marquee-width") == 0 && i + 1 < argc) {
+            marquee_width = atoi(argv[++i]);
+            if (marquee_width <= 0 || marquee_width > MARQUEE_MAX_WIDTH) {
+                fprintf(stderr, "Marquee width must be between 1 and %d!\n",
+                        MARQUEE_MAX_WIDTH);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--marquee-fps") == 0 && i + 1 < argc) {
+            marquee_fps = atoi(argv[++i]);
+            if (marquee_fps <= 0 || marquee_fps > 1000) {
+                fputs("Marquee fps must be between 1 and 1000!\n", stderr);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--priority") == 0 && i + 1 < argc) {
+            if (!player_election_set_priorities(&listener.election,
+                                                argv[++i])) {
+                fprintf(stderr,
+                        "Priority must be a list of at most %d players!\n",
+                        ELECTION_MAX_PRIORITIES);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pin") == 0 && i + 1 < argc) {
+            player_election_set_pinned(&listener.election, argv[++i]);
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            LogLevel level;
+
+            if (!logger_parse_level(argv[++i], &level)) {
+                fputs("Log level must be error, warning, info or debug!\n",
+                      stderr);
+                return 1;
+            }
+            atomic_store(&LOG_THRESHOLD, level);
+            log_level_set = TRUE;
+        } else if (strcmp(argv[i], "--ipc-dir") == 0 && i + 1 < argc) {
+            POLYBAR_IPC_DIRECTORY = argv[++i];
+            ipc_dir_set = TRUE;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay-fast") == 0) {
+            replay_fast = TRUE;
+        } else if (strcmp(argv[i], "help") == 0) {
+            print_usage();
+            return 0;
+        } else {
+            fprintf(stderr, "Invalid option '%s'\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (record_path != NULL && replay_path != NULL) {
+        fputs("A recording can't be replayed while recording!\n", stderr);
+        return 1;
+    }
+
+    // Info logs of the handlers would be mixed into the replay's report
+    if (replay_path != NULL && !log_level_set)
+        atomic_store(&LOG_THRESHOLD, LOG_LEVEL_WARNING);
+
+    // Replayed states only go to the running bars if asked to. Otherwise the
+    // messages are still queued, but to an empty directory of their own.
+    if (replay_path != NULL && !ipc_dir_set) {
+        if (mkdtemp(replay_ipc_dir) == NULL) {
+            fprintf(stderr, "Failed to create '%s': %s\n", replay_ipc_dir,
+                    strerror(errno));
+            return 1;
+        }
+
+        POLYBAR_IPC_DIRECTORY = replay_ipc_dir;
+    }
+
+    // Two listeners would fight over the bars, and the second one would take
+    // the command socket and the elected player from the first
+    if (replay_path == NULL) {
+        listen_fd = command_socket_listen();
+
+        if (listen_fd < 0 && errno == EADDRINUSE) {
+            fputs("spotify-listener is already running\n", stderr);
+            return 1;
+        }
+    }
+
+    // Write logs on a separate thread so a slow journald doesn't hold up
+    // handling events
+    if (!logger_start())
+        fputs("Failed to start the log thread, logs are written directly\n",
+              stderr);
+
+    // The marquee needs to know how wide characters are
+    if (setlocale(LC_CTYPE, "C.UTF-8") == NULL)
+        setlocale(LC_CTYPE, "");
+
+    bus_error_init(&err);
+    player_table_init(&listener.players);
+    histogram_init(&listener.parse);
+    histogram_init(&listener.transition);
+    marquee_init(&listener.marquee, marquee_width);
+    listener.marquee_interval_ms = 1000 / marquee_fps;
+    listener.marquee_due_ms = -1;
+
+    // The file belongs to the running listener while replaying
+    if (replay_path == NULL) {
+        listener.elected_path = get_runtime_path(ELECTED_PLAYER_NAME);
+        if (listener.elected_path != NULL)
+            unlink(listener.elected_path);
+    }
+
+    // Write to polybar on a separate thread so a slow bar doesn't hold up
+    // reading signals
+    if (!ipc_writer_start(&IPC_WRITER, POLYBAR_IPC_DIRECTORY)) {
+        fputs("Failed to start the polybar IPC writer thread\n", stderr);
+        return 1;
+    }
+
+    // Replaying only needs the handlers, not the bus or the event loop
+    if (replay_path != NULL) {
+        const int code = replay(&listener, replay_path, replay_fast);
+
+        ipc_writer_stop(&IPC_WRITER);
+        logger_stop();
+        player_table_free(&listener.players);
+        player_election_free(&listener.election);
+        marquee_free(&listener.marquee);
+        if (!ipc_dir_set)
+            rmdir(replay_ipc_dir);
+        return code;
+    }
+
+    if (record_path != NULL) {
+        if (!recording_create(&recording, record_path)) {
+            fprintf(stderr, "Failed to create recording '%s': %s\n",
+                    record_path, strerror(errno));
+            return 1;
+        }
+
+        listener.recording = &recording;
+    }
+
+    if (!event_loop_init(&EVENT_LOOP)) {
+        fputs("Failed to create the event loop\n", stderr);
+        return 1;
+    }
 
     // Connect to session bus
-    if (!(connection = dbus_bus_get(DBUS_BUS_SESSION, &err))) {
+    if (!(listener.connection = bus_connect_session(&err))) {
         fputs(err.message, stderr);
         return 1;
     }
 
     // Receive messages for PropertiesChanged signal to detect track changes
     // or spotify launching
-    dbus_bus_add_match(connection, PROPERTIES_CHANGED_MATCH, &err);
-    if (dbus_error_is_set(&err)) {
+    if (!bus_add_match(listener.connection, PROPERTIES_CHANGED_MATCH, &err)) {
         fputs(err.message, stderr);
         return 1;
     }
 
-    // Receive messages for NameOwnerChanged signal to detect spotify exiting
-    dbus_bus_add_match(connection, NAME_OWNER_CHANGED_MATCH, &err);
-    if (dbus_error_is_set(&err)) {
+    // Receive messages for Seeked signal to keep track of the position
+    if (!bus_add_match(listener.connection, SEEKED_MATCH, &err)) {
         fputs(err.message, stderr);
         return 1;
     }
 
+    // Receive messages for NameOwnerChanged signal to detect players starting
+    // and exiting
+    if (!bus_add_match(listener.connection, NAME_OWNER_CHANGED_MATCH, &err)) {
+        fputs(err.message, stderr);
+        return 1;
+    }
+
+    // Record the signals before any handler can stop the others from seeing
+    // them
+    if (listener.recording != NULL &&
+        !bus_add_filter(listener.connection, record_handler, &listener)) {
+        fputs("Failed to add record handler", stderr);
+        return 1;
+    }
+
     // Register handler for PropertiesChanged signal
-    if (!dbus_connection_add_filter(connection, properties_changed_handler,
-                                    NULL, free_user_data)) {
+    if (!bus_add_filter(listener.connection, properties_changed_handler,
+                        &listener)) {
         fputs("Failed to add properties changed handler", stderr);
         return 1;
     }
 
+    // Register handler for Seeked signal
+    if (!bus_add_filter(listener.connection, seeked_handler, &listener)) {
+        fputs("Failed to add Seeked handler", stderr);
+        return 1;
+    }
+
     // Register handler for NameOwnerChanged signal
-    if (!dbus_connection_add_filter(connection, name_owner_changed_handler,
-                                    NULL, free_user_data)) {
+    if (!bus_add_filter(listener.connection, name_owner_changed_handler,
+                        &listener)) {
         fputs("Failed to add NameOwnerChanged handler", stderr);
         return 1;
     }
 
-    // Read messages and call handlers when neccessary
-    while (dbus_connection_read_write_dispatch(connection, -1)) {
-        if (VERBOSE)
-            puts("In dispatch loop");
+    // Players started before the listener don't send NameOwnerChanged
+    discover_players(&listener);
+
+    const int dbus_fd = bus_get_fd(listener.connection);
+    if (dbus_fd < 0 ||
+        !(listener.bus_source = event_loop_add_fd(
+              &EVENT_LOOP, dbus_fd, EPOLLIN, bus_event_handler, &listener))) {
+        fputs("Failed to watch DBus connection file descriptor", stderr);
+        return 1;
     }
 
-    dbus_connection_unref(connection);
+    if (!(listener.queue_timer = event_loop_add_timer(
+              &EVENT_LOOP, queue_timer_handler, &listener)) ||
+        !(listener.prediction_timer = event_loop_add_timer(
+              &EVENT_LOOP, prediction_timer_handler, &listener)) ||
+        !(listener.position_timer = event_loop_add_timer(
+              &EVENT_LOOP, position_timer_handler, &listener)) ||
+        !(listener.progress_timer = event_loop_add_timer(
+              &EVENT_LOOP, progress_timer_handler, &listener)) ||
+        !(listener.marquee_timer = event_loop_add_timer(
+              &EVENT_LOOP, marquee_timer_handler, &listener))) {
+        fputs("Failed to create timers", stderr);
+        return 1;
+    }
+
+    // Exit cleanly so buffered output is written
+    if (!event_loop_add_signal(&EVENT_LOOP, SIGINT, exit_signal_handler,
+                               NULL) ||
+        !event_loop_add_signal(&EVENT_LOOP, SIGTERM, exit_signal_handler,
+                               NULL)) {
+        fputs("Failed to handle signals", stderr);
+        return 1;
+    }
+
+    // Dump the stats on SIGUSR1, like `spotifyctl stats`, and toggle debug
+    // logs on SIGUSR2
+    if (!event_loop_add_signal(&EVENT_LOOP, SIGUSR1, stats_signal_handler,
+                               &listener) ||
+        !event_loop_add_signal(&EVENT_LOOP, SIGUSR2, log_signal_handler,
+                               &listener))
+        fputs("Failed to handle SIGUSR1 and SIGUSR2\n", stderr);
+
+    // Show the current state on bars started later
+    if (!event_loop_add_inotify(&EVENT_LOOP, POLYBAR_IPC_DIRECTORY,
+                                IN_CREATE | IN_MOVED_TO, ipc_directory_handler,
+                                &listener)) {
+        fputs("Failed to watch for new bars\n", stderr);
+        ipc_writer_unwatched(&IPC_WRITER);
+    }
+
+    // Accept commands from spotifyctl and forward them over this connection
+    command_queue_init(&listener.queue);
+
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++)
+        command_client_init(&listener.clients[i], -1);
+
+    if (listen_fd < 0 ||
+        !event_loop_add_fd(&EVENT_LOOP, listen_fd, EPOLLIN,
+                           command_listen_handler, &listener))
+        fputs("Failed to create command socket, spotifyctl will use DBus\n",
+              stderr);
+
+    event_loop_set_prepare(&EVENT_LOOP, listener_prepare, &listener);
+    event_loop_run(&EVENT_LOOP);
+
+    print_usage_stats(&listener, started_ms);
+
+    if (listener.recording != NULL) {
+        if (recording_close(listener.recording))
+            LOG(LOG_LEVEL_INFO, "Recorded %lu signals (%llu bytes) to '%s'",
+                recording.messages, recording.bytes, record_path);
+        else
+            LOG(LOG_LEVEL_ERROR, "Failed to write recording '%s': %s",
+                record_path, strerror(errno));
+    }
+
+    ipc_writer_stop(&IPC_WRITER);
+    logger_stop();
+
+    event_loop_close(&EVENT_LOOP);
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        if (listener.clients[i].fd >= 0)
+            command_client_close(&listener.clients[i]);
+    }
+    command_socket_close(listen_fd);
+    bus_connection_close(listener.connection);
+    if (listener.elected_path != NULL)
+        unlink(listener.elected_path);
+    free(listener.elected_path);
+    player_table_free(&listener.players);
+    player_election_free(&listener.election);
+    marquee_free(&listener.marquee);
     return 0;
 }
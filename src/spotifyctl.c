@@ -1,41 +1,44 @@
 #include "../include/spotifyctl.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "../include/command-socket.h"
+#include "../include/probes.h"
 #include "../include/utils.h"
+#include "mpris-player.h"
 
 /*************** Constants for DBus ***************/
+// Replaced by the player spotify-listener elected if it is running
 const char* DESTINATION = "org.mpris.MediaPlayer2.spotify";
-const char* PATH = "/org/mpris/MediaPlayer2";
+const char* PATH = MPRIS_OBJECT_PATH;
 
 const char* STATUS_IFACE = "org.freedesktop.DBus.Properties";
 const char* STATUS_METHOD = "Get";
-const char* STATUS_METHOD_ARG_IFACE_NAME = "org.mpris.MediaPlayer2.Player";
-const char* STATUS_METHOD_ARG_PROPERTY_NAME = "Metadata";
+const char* STATUS_METHOD_ARG_IFACE_NAME = MPRIS_PLAYER_IFACE;
+const char* STATUS_METHOD_ARG_PROPERTY_NAME = MPRIS_PLAYER_METADATA_NAME;
 
-const char* PLAYER_IFACE = "org.mpris.MediaPlayer2.Player";
-const char* PLAYER_METHOD_PLAY = "Play";
-const char* PLAYER_METHOD_PAUSE = "Pause";
-const char* PLAYER_METHOD_PLAYPAUSE = "PlayPause";
-const char* PLAYER_METHOD_NEXT = "Next";
-const char* PLAYER_METHOD_PREVIOUS = "Previous";
+const char* PLAYER_IFACE = MPRIS_PLAYER_IFACE;
+const char* PLAYER_METHOD_PLAY = MPRIS_PLAYER_METHOD_PLAY;
+const char* PLAYER_METHOD_PAUSE = MPRIS_PLAYER_METHOD_PAUSE;
+const char* PLAYER_METHOD_PLAYPAUSE = MPRIS_PLAYER_METHOD_PLAY_PAUSE;
+const char* PLAYER_METHOD_NEXT = MPRIS_PLAYER_METHOD_NEXT;
+const char* PLAYER_METHOD_PREVIOUS = MPRIS_PLAYER_METHOD_PREVIOUS;
 
-const char* METADATA_TITLE_KEY = "xesam:title";
-const char* METADATA_ARTIST_KEY = "xesam:artist";
+const char* METADATA_TITLE_KEY = MPRIS_METADATA_XESAM_TITLE_KEY;
+const char* METADATA_ARTIST_KEY = MPRIS_METADATA_XESAM_ARTIST_KEY;
 
-/*** Program Mode ***/
-typedef enum {
-    MODE_NONE,
-    MODE_STATUS,
-    MODE_PLAY,
-    MODE_PAUSE,
-    MODE_PREVIOUS,
-    MODE_NEXT,
-    MODE_PLAYPAUSE
-} ProgMode;
+/*************** Latency budget ***************/
+// Default time in milliseconds to wait for spotify before giving up
+const int DEFAULT_TIMEOUT_MS = 250;
+
+// Prefix of the files in the runtime directory caching the last good status
+// output. The suffix is a hash of the format options.
+const char* STATUS_CACHE_PREFIX = "spotifyctl-status.";
 
 /*Constant for script options */
 const char* const PARAMETERS[] = {
@@ -45,12 +48,23 @@ const char* const PARAMETERS[] = {
     "--max-length",
     "--format",
     "--trunc",
+    "--timings",
+    "--timeout",
+    "--wait",
+    "--dbus",
+    "--prometheus",
     "status",
     "play",
     "pause",
     "playpause",
     "next",
     "previous",
+    COMMAND_BAR_HIDDEN,
+    COMMAND_BAR_SHOWN,
+    "pin",
+    COMMAND_UNPIN,
+    COMMAND_STATS,
+    "log-level",
     "help"};
 
 const char PARAMETERS_LEN = sizeof(PARAMETERS) / sizeof(char*);
@@ -63,12 +77,23 @@ typedef enum {
     PARAM_MAX_LENGTH,
     PARAM_FORMAT,
     PARAM_TRUNC,
+    PARAM_TIMINGS,
+    PARAM_TIMEOUT,
+    PARAM_WAIT,
+    PARAM_DBUS,
+    PARAM_PROMETHEUS,
     PARAM_STATUS,
     PARAM_PLAY,
     PARAM_PAUSE,
     PARAM_PLAYPAUSE,
     PARAM_NEXT,
     PARAM_PREVIOUS,
+    PARAM_BAR_HIDDEN,
+    PARAM_BAR_SHOWN,
+    PARAM_PIN,
+    PARAM_UNPIN,
+    PARAM_STATS,
+    PARAM_LOG_LEVEL,
     PARAM_HELP
 } PARAMETER_IDENTIFIER;
 
@@ -86,84 +111,33 @@ const char* DEFAULT_PLACEHOLDER = "Spotify";
 const char* TOKEN_TITLE = TOKEN_TITLE_TEMPLATE;
 const char* TOKEN_ARTIST = TOKEN_ARTIST_TEMPLATE;
 
+/* Record the end of a phase for --timings. This compiles to nothing if
+ * spotifyctl is built without TIMINGS. */
+#ifdef TIMINGS
+#define TIMING_MARK(phase) timings_mark(phase)
+#else
+#define TIMING_MARK(phase) ((void)0)
+#endif
+
 // Predictable errors will be hidden if this is TRUE such as if spotify is not
 // running and the status is requested
 dbus_bool_t SUPPRESS_ERRORS = 0;
 
-char* get_song_title_from_metadata(DBusMessage* msg) {
-    DBusMessageIter iter;
-
-    dbus_message_iter_init(msg, &iter);
-
-    char* title = NULL;
-
-    // The message looks like this:
-    // string "org.mpris.MediaPlayer2.Player"
-    // array [
-    //    dict entry(
-    //       string "Metadata"
-    //       variant             array [
-    //          .
-    //          .
-    //          .
-    //             dict entry(
-    //                string "xesam:title"
-    //                variant               string "{track title}"
-    //             )
-    //       ]
-    //    )
-    // ]
-    // The track title is at the path:
-    // variant->array[xesam:title]->variant->string
-
-    if (iter_try_step_into_type(&iter, DBUS_TYPE_VARIANT) &&
-        iter_try_step_into_type(&iter, DBUS_TYPE_ARRAY) &&
-        iter_try_step_to_key(&iter, METADATA_TITLE_KEY) &&
-        iter_try_step_into_type(&iter, DBUS_TYPE_VARIANT)) {
-        title = iter_get_string(&iter);
-    }
+// Player commands wait for spotify to reply if this is TRUE. Otherwise they
+// are sent without asking for a reply.
+dbus_bool_t WAIT_FOR_REPLY = FALSE;
 
-    return title;
-}
+// Player commands are sent through spotify-listener's command socket if it is
+// running, unless this is FALSE
+dbus_bool_t USE_COMMAND_SOCKET = TRUE;
 
-char* get_song_artist_from_metadata(DBusMessage* msg) {
-    DBusMessageIter iter;
-
-    dbus_message_iter_init(msg, &iter);
-
-    char* artist = NULL;
-
-    // The message looks like this:
-    // string "org.mpris.MediaPlayer2.Player"
-    // array [
-    //    dict entry(
-    //       string "Metadata"
-    //       variant             array [
-    //          .
-    //          .
-    //          .
-    //             dict entry(
-    //                string "xesam:artist"
-    //                variant               string "{track artist}"
-    //             )
-    //       ]
-    //    )
-    // ]
-    // The track title is at the path:
-    // variant->array[xesam:artist]->variant->string
-
-    if (iter_try_step_into_type(&iter, DBUS_TYPE_VARIANT) &&
-        iter_try_step_into_type(&iter, DBUS_TYPE_ARRAY) &&
-        iter_try_step_to_key(&iter, METADATA_ARTIST_KEY) &&
-        iter_try_step_into_type(&iter, DBUS_TYPE_VARIANT) &&
-        iter_try_step_into_type(&iter, DBUS_TYPE_ARRAY)) {
-        artist = iter_get_string(&iter);
-    }
+// CLOCK_MONOTONIC time in milliseconds by which spotify must have replied
+long long DEADLINE_MS = 0;
 
-    return artist;
-}
+// Strings that are only needed until spotifyctl exits, freed all at once
+Arena ARENA = {0};
 
-char* format_output(const char* artist, const char* title,
+char* format_output(Arena* arena, const char* artist, const char* title,
                     const int max_artist_length, const int max_title_length,
                     const int max_length, const char* format,
                     const char* trunc) {
@@ -176,7 +150,8 @@ char* format_output(const char* artist, const char* title,
     int title_len = strlen(title);
 
     if (!artist_len && !title_len) {
-        output = (char*)malloc((strlen(DEFAULT_PLACEHOLDER) + 1) * sizeof(char));
+        output = (char*)arena_alloc(
+            arena, (strlen(DEFAULT_PLACEHOLDER) + 1) * sizeof(char));
         if (output == NULL) {
             fprintf(stderr, "Failed output alloc\n");
             exit(1);
@@ -205,7 +180,8 @@ char* format_output(const char* artist, const char* title,
         char* trunc_artist;
 
         // Truncate artist and track title using the truncation string
-        if (!(trunc_title = str_trunc(title, max_title_length, trunc))) {
+        if (!(trunc_title =
+                  str_trunc_a(arena, title, max_title_length, trunc))) {
             if (!SUPPRESS_ERRORS) {
                 fputs(
                     "Failed to truncate title. Please make sure the trunc "
@@ -215,7 +191,8 @@ char* format_output(const char* artist, const char* title,
             }
         }
 
-        if (!(trunc_artist = str_trunc(artist, max_artist_length, trunc))) {
+        if (!(trunc_artist =
+                  str_trunc_a(arena, artist, max_artist_length, trunc))) {
             if (!SUPPRESS_ERRORS) {
                 fputs(
                     "Failed to truncate artist. Please make sure the trunc "
@@ -226,11 +203,12 @@ char* format_output(const char* artist, const char* title,
         }
 
         // Replace all tokens with their values
-        char* temp = str_replace_all(format, TOKEN_ARTIST, trunc_artist);
-        char* temp2 = str_replace_all(temp, TOKEN_TITLE, trunc_title);
+        char* temp =
+            str_replace_all_a(arena, format, TOKEN_ARTIST, trunc_artist);
+        char* temp2 = str_replace_all_a(arena, temp, TOKEN_TITLE, trunc_title);
 
         // Truncate output to max length
-        if (!(output = str_trunc(temp2, max_length, trunc))) {
+        if (!(output = str_trunc_a(arena, temp2, max_length, trunc))) {
             if (!SUPPRESS_ERRORS) {
                 fputs(
                     "Failed to truncate output. Please make sure the trunc "
@@ -239,86 +217,448 @@ char* format_output(const char* artist, const char* title,
             }
             exit(1);
         }
-
-        free(temp);
-        free(temp2);
-        free(trunc_title);
-        free(trunc_artist);
     } else {
         // Replace all tokens with their values
-        char* temp = str_replace_all(format, TOKEN_ARTIST, artist);
-        output = str_replace_all(temp, TOKEN_TITLE, title);
-
-        free(temp);
+        char* temp = str_replace_all_a(arena, format, TOKEN_ARTIST, artist);
+        output = str_replace_all_a(arena, temp, TOKEN_TITLE, title);
     }
 
     return output;
 }
 
-void get_status(DBusConnection* connection, const int max_artist_length,
-                const int max_title_length, const int max_length,
-                const char* format, const char* trunc) {
-    DBusError err;
-    dbus_error_init(&err);
-
-    // Send a message requesting the properties
-    DBusMessage* msg = dbus_message_new_method_call(
-        DESTINATION, PATH, STATUS_IFACE, STATUS_METHOD);
-
-    // Message looks like this:
-    // string "org.mpris.MediaPlayer2.Player"
-    // string "Metadata"
-    dbus_message_append_args(
-        msg, DBUS_TYPE_STRING, &STATUS_METHOD_ARG_IFACE_NAME, DBUS_TYPE_STRING,
-        &STATUS_METHOD_ARG_PROPERTY_NAME, DBUS_TYPE_INVALID);
-
-    // Send and receive reply
-    DBusMessage* reply;
-    reply =
-        dbus_connection_send_with_reply_and_block(connection, msg, 10000, &err);
-    dbus_message_unref(msg);
-
-    if (dbus_error_is_set(&err)) {
-        if (!SUPPRESS_ERRORS)
-            fputs(err.message, stderr);
-        exit(1);
+BusPendingCall* send_within_budget(BusConnection* connection,
+                                   BusMessage* msg) {
+    long long remaining = DEADLINE_MS - monotonic_ms();
+
+    // Connecting may have used up the whole budget already, in which case the
+    // wait times out straight away
+    if (remaining <= 0)
+        remaining = 1;
+
+    // Send without blocking, the reply is collected by wait_within_budget
+    return bus_call_async(connection, msg, (int)remaining);
+}
+
+BusMessage* wait_within_budget(BusConnection* connection,
+                               BusPendingCall* pending, BusError* err) {
+    long long remaining;
+
+    if (pending == NULL) {
+        bus_error_set(err, BUS_ERROR_DISCONNECTED,
+                      "Disconnected from the session bus\n");
+        return NULL;
+    }
+
+    // Process incoming messages until the reply arrives or the budget runs out
+    while (!bus_pending_call_completed(pending) &&
+           (remaining = DEADLINE_MS - monotonic_ms()) > 0) {
+        if (!bus_wait(connection, (int)remaining))
+            break;
+    }
+
+    if (!bus_pending_call_completed(pending)) {
+        bus_pending_call_free(pending);
+        bus_error_set(err, BUS_ERROR_TIMEOUT,
+                      "Timed out waiting for spotify\n");
+        return NULL;
     }
 
-    char* title = get_song_title_from_metadata(reply);
-    char* artist = get_song_artist_from_metadata(reply);
+    // Error replies are converted into err
+    BusMessage* reply = bus_pending_call_steal_reply(pending, err);
+    bus_pending_call_free(pending);
+
+    return reply;
+}
+
+char* get_status_cache_path(const int max_artist_length,
+                            const int max_title_length, const int max_length,
+                            const char* format, const char* trunc) {
+    char lengths[64];
+    snprintf(lengths, sizeof(lengths), "%d,%d,%d", max_artist_length,
+             max_title_length, max_length);
+
+    // 64-bit FNV-1a hash of the options and player, separated by the null
+    // chars
+    const char* options[] = {lengths, format, trunc, DESTINATION};
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(char*); i++) {
+        for (const char* c = options[i];; c++) {
+            hash ^= (unsigned char)*c;
+            hash *= 1099511628211ULL;
+
+            if (*c == '\0')
+                break;
+        }
+    }
+
+    // +17 for 16 hex digits and null char
+    const size_t name_size = strlen(STATUS_CACHE_PREFIX) + 17;
+    char* name = (char*)arena_alloc(&ARENA, name_size * sizeof(char));
+    snprintf(name, name_size, "%s%016llx", STATUS_CACHE_PREFIX,
+             (unsigned long long)hash);
+
+    return get_runtime_path(name);
+}
+
+void load_elected_player() {
+    // The file of a listener that crashed names a player that may be gone
+    const int fd = command_socket_connect();
+
+    if (fd < 0)
+        return;
+    close(fd);
+
+    char* path = get_runtime_path(ELECTED_PLAYER_NAME);
+    char* name = path != NULL ? read_file(path) : NULL;
+
+    free(path);
+
+    // spotify-listener is not running or there are no players
+    if (name == NULL || name[0] == '\0') {
+        free(name);
+        return;
+    }
+
+    // This is kept until spotifyctl exits
+    DESTINATION = name;
+}
+
+BusPendingCall* send_status_request(BusConnection* connection) {
+    // Send a message requesting the Metadata property
+    BusMessage* msg = mpris_player_get_metadata_new(connection, DESTINATION);
 
-    char* output = format_output(artist, title, max_artist_length,
+    if (msg == NULL)
+        return NULL;
+
+    BusPendingCall* pending = send_within_budget(connection, msg);
+    bus_message_unref(msg);
+    PROBE(status_request, DESTINATION);
+
+    return pending;
+}
+
+void print_status(const char* artist, const char* title,
+                  const int max_artist_length, const int max_title_length,
+                  const int max_length, const char* format, const char* trunc,
+                  const char* cache_path) {
+    // Tracks without a title or artist are formatted with an empty one
+    char* output = format_output(&ARENA, artist ? artist : "",
+                                 title ? title : "", max_artist_length,
                                  max_title_length, max_length, format, trunc);
 
     puts(output);
+    TIMING_MARK("format");
+    PROBE(status_print, output, strlen(output) + 1);
+
+    if (cache_path != NULL)
+        write_file_atomic(cache_path, output);
+}
+
+void print_status_error(const char* message, const dbus_bool_t stuck,
+                        const char* cache_path) {
+    // Spotify is running but stuck, so show the last good output instead of
+    // an error
+    if (stuck && cache_path != NULL) {
+        char* cached = read_file(cache_path);
+
+        if (cached != NULL) {
+            puts(cached);
+            free(cached);
+            return;
+        }
+    } else if (cache_path != NULL) {
+        // Spotify is not running, so the cached output is stale
+        unlink(cache_path);
+    }
+
+    if (!SUPPRESS_ERRORS)
+        fputs(message, stderr);
+    exit(1);
+}
 
-    free(output);
-    free(title);
-    free(artist);
+void get_status(BusConnection* connection, BusPendingCall* pending,
+                const int max_artist_length, const int max_title_length,
+                const int max_length, const char* format, const char* trunc) {
+    BusError err;
+    bus_error_init(&err);
+
+    char* cache_path = get_status_cache_path(
+        max_artist_length, max_title_length, max_length, format, trunc);
+
+    // Receive reply
+    BusMessage* reply = wait_within_budget(connection, pending, &err);
+    TIMING_MARK("call");
+    PROBE(status_reply, DESTINATION, bus_error_is_set(&err));
+
+    if (bus_error_is_set(&err)) {
+        print_status_error(err.message,
+                           bus_error_has_name(&err, BUS_ERROR_TIMEOUT) ||
+                               bus_error_has_name(&err, BUS_ERROR_NO_REPLY),
+                           cache_path);
+        free(cache_path);
+        bus_error_free(&err);
+        return;
+    }
+
+    // The reply is a variant holding the metadata dict. Missing keys are
+    // printed as empty strings.
+    MprisMetadata metadata = {0};
+    mpris_player_read_metadata_reply(reply, &metadata);
+    TIMING_MARK("parse");
+    PROBE(status_parse,
+          metadata.present & MPRIS_METADATA_HAS_MPRIS_TRACKID
+              ? metadata.mpris_trackid
+              : NULL,
+          metadata.present & MPRIS_METADATA_HAS_XESAM_ARTIST
+              ? metadata.xesam_artist
+              : NULL,
+          metadata.present & MPRIS_METADATA_HAS_XESAM_TITLE
+              ? metadata.xesam_title
+              : NULL);
+
+    print_status(metadata.present & MPRIS_METADATA_HAS_XESAM_ARTIST
+                     ? metadata.xesam_artist
+                     : NULL,
+                 metadata.present & MPRIS_METADATA_HAS_XESAM_TITLE
+                     ? metadata.xesam_title
+                     : NULL,
+                 max_artist_length, max_title_length, max_length, format,
+                 trunc, cache_path);
+
+    free(cache_path);
+
+    bus_message_unref(reply);
+}
 
-    dbus_message_unref(reply);
+BusMessage* new_player_call(BusConnection* connection, const ProgMode mode) {
+    switch (mode) {
+        case MODE_PLAY:
+            return mpris_player_play_new(connection, DESTINATION);
+        case MODE_PAUSE:
+            return mpris_player_pause_new(connection, DESTINATION);
+        case MODE_PLAYPAUSE:
+            return mpris_player_play_pause_new(connection, DESTINATION);
+        case MODE_NEXT:
+            return mpris_player_next_new(connection, DESTINATION);
+        case MODE_PREVIOUS:
+            return mpris_player_previous_new(connection, DESTINATION);
+        default:
+            return NULL;
+    }
 }
 
-void spotify_player_call(DBusConnection* connection, const char* method) {
-    DBusError err;
-    dbus_error_init(&err);
+BusPendingCall* spotify_player_call(BusConnection* connection,
+                                    const ProgMode mode) {
+    BusPendingCall* pending = NULL;
 
     // Call a org.mpris.MediaPlayer2.Player method
-    DBusMessage* msg =
-        dbus_message_new_method_call(DESTINATION, PATH, PLAYER_IFACE, method);
+    BusMessage* msg = new_player_call(connection, mode);
+
+    if (msg == NULL)
+        return NULL;
+
+    if (WAIT_FOR_REPLY) {
+        pending = send_within_budget(connection, msg);
+    } else {
+        // The player methods don't return anything, so don't make spotify
+        // reply
+        bus_message_set_no_reply(msg);
+        bus_send(connection, msg);
+    }
+
+    bus_message_unref(msg);
+
+    return pending;
+}
 
-    dbus_connection_send_with_reply_and_block(connection, msg, 10000, &err);
-    dbus_message_unref(msg);
+void wait_player_call(BusConnection* connection, BusPendingCall* pending) {
+    BusError err;
+    bus_error_init(&err);
 
-    if (dbus_error_is_set(&err)) {
+    BusMessage* reply = wait_within_budget(connection, pending, &err);
+    TIMING_MARK("call");
+
+    if (reply != NULL)
+        bus_message_unref(reply);
+
+    if (bus_error_is_set(&err)) {
         if (!SUPPRESS_ERRORS)
             fputs(err.message, stderr);
         exit(1);
     }
 }
 
+void send_predictions(const ProgMode prog_modes[],
+                      const char* const command_names[],
+                      const size_t num_of_modes) {
+    char** lines = (char**)malloc(num_of_modes * sizeof(char*));
+    size_t num_of_lines = 0;
+
+    for (size_t i = 0; i < num_of_modes; i++) {
+        // Only these commands change the play state
+        if (prog_modes[i] != MODE_PLAY && prog_modes[i] != MODE_PAUSE &&
+            prog_modes[i] != MODE_PLAYPAUSE)
+            continue;
+
+        // +1 for null char
+        const size_t size =
+            strlen(COMMAND_PREDICT_PREFIX) + strlen(command_names[i]) + 1;
+        lines[num_of_lines] = (char*)malloc(size * sizeof(char));
+        snprintf(lines[num_of_lines], size, "%s%s", COMMAND_PREDICT_PREFIX,
+                 command_names[i]);
+        num_of_lines++;
+    }
+
+    if (num_of_lines > 0)
+        command_socket_send((const char* const*)lines, num_of_lines);
+
+    for (size_t i = 0; i < num_of_lines; i++)
+        free(lines[i]);
+    free(lines);
+}
+
+const char* get_player_method(const ProgMode mode) {
+    switch (mode) {
+        case MODE_PLAY:
+            return PLAYER_METHOD_PLAY;
+        case MODE_PAUSE:
+            return PLAYER_METHOD_PAUSE;
+        case MODE_PLAYPAUSE:
+            return PLAYER_METHOD_PLAYPAUSE;
+        case MODE_NEXT:
+            return PLAYER_METHOD_NEXT;
+        case MODE_PREVIOUS:
+            return PLAYER_METHOD_PREVIOUS;
+        default:
+            return NULL;
+    }
+}
+
+#ifdef WIRE_CLIENT
+void wire_get_status(const WireStatus status, const WireReply* reply,
+                     const int max_artist_length, const int max_title_length,
+                     const int max_length, const char* format,
+                     const char* trunc) {
+    char* cache_path = get_status_cache_path(
+        max_artist_length, max_title_length, max_length, format, trunc);
+
+    PROBE(status_reply, DESTINATION,
+          status != WIRE_OK || reply->error_name != NULL);
+
+    if (status == WIRE_TIMEOUT) {
+        print_status_error("Timed out waiting for spotify\n", TRUE, cache_path);
+    } else if (status == WIRE_FAILED) {
+        print_status_error("Disconnected from the session bus\n", FALSE,
+                           cache_path);
+    } else if (reply->error_name != NULL) {
+        print_status_error(reply->error_message,
+                           strcmp(reply->error_name, BUS_ERROR_NO_REPLY) == 0,
+                           cache_path);
+    } else {
+        char* title = wire_reply_find_metadata(reply, METADATA_TITLE_KEY);
+        char* artist = wire_reply_find_metadata(reply, METADATA_ARTIST_KEY);
+        TIMING_MARK("parse");
+        PROBE(status_parse, NULL, artist, title);
+
+        print_status(artist, title, max_artist_length, max_title_length,
+                     max_length, format, trunc, cache_path);
+
+        free(title);
+        free(artist);
+    }
+
+    free(cache_path);
+}
+
+void wire_check_player_call(const WireStatus status, const WireReply* reply) {
+    const char* message = NULL;
+
+    if (status == WIRE_TIMEOUT)
+        message = "Timed out waiting for spotify\n";
+    else if (status == WIRE_FAILED)
+        message = "Disconnected from the session bus\n";
+    else if (reply->error_name != NULL)
+        message = reply->error_message;
+
+    if (message != NULL) {
+        if (!SUPPRESS_ERRORS)
+            fputs(message, stderr);
+        exit(1);
+    }
+}
+
+dbus_bool_t run_wire_commands(const ProgMode prog_modes[],
+                              const size_t num_of_modes,
+                              const int max_artist_length,
+                              const int max_title_length, const int max_length,
+                              const char* format, const char* trunc) {
+    WireConnection* connection =
+        wire_connect(getenv("DBUS_SESSION_BUS_ADDRESS"));
+
+    if (connection == NULL)
+        return FALSE;
+
+    TIMING_MARK("connect");
+
+    const char* const status_args[] = {STATUS_METHOD_ARG_IFACE_NAME,
+                                       STATUS_METHOD_ARG_PROPERTY_NAME};
+    uint32_t* serials = (uint32_t*)calloc(num_of_modes, sizeof(uint32_t));
+
+    // Queue every command so they are written together with the
+    // authentication and Hello
+    for (size_t i = 0; i < num_of_modes; i++) {
+        if (prog_modes[i] == MODE_STATUS) {
+            serials[i] = wire_queue_call(connection, DESTINATION, PATH,
+                                         STATUS_IFACE, STATUS_METHOD,
+                                         status_args, 2, FALSE);
+            PROBE(status_request, DESTINATION);
+        } else
+            serials[i] = wire_queue_call(
+                connection, DESTINATION, PATH, PLAYER_IFACE,
+                get_player_method(prog_modes[i]), NULL, 0, !WAIT_FOR_REPLY);
+    }
+
+    if (wire_flush(connection, DEADLINE_MS) != WIRE_OK) {
+        if (!SUPPRESS_ERRORS)
+            fputs("Failed to write to the session bus\n", stderr);
+        exit(1);
+    }
+
+    TIMING_MARK("send");
+
+    // Handle replies in the order the commands were given
+    for (size_t i = 0; i < num_of_modes; i++) {
+        WireReply reply = {NULL};
+
+        if (prog_modes[i] != MODE_STATUS && !WAIT_FOR_REPLY)
+            continue;
+
+        const WireStatus status =
+            wire_wait_reply(connection, serials[i], DEADLINE_MS, &reply);
+        TIMING_MARK("call");
+
+        if (prog_modes[i] == MODE_STATUS)
+            wire_get_status(status, &reply, max_artist_length,
+                            max_title_length, max_length, format, trunc);
+        else
+            wire_check_player_call(status, &reply);
+
+        if (status == WIRE_OK)
+            wire_free_reply(&reply);
+    }
+
+    free(serials);
+    wire_close(connection);
+
+    return TRUE;
+}
+#endif
+
+void print_timings() { timings_print(stderr); }
+
 void print_usage() {
-    puts("usage: spotifyctl [ -q ] [options] <command>");
+    puts("usage: spotifyctl [ -q ] [options] <command>...");
     puts("");
     puts("  Commands:");
     puts("    play           Play spotify");
@@ -328,6 +668,24 @@ void print_usage() {
     puts("    previous       Go to the previous track on spotify");
     puts("    status         Print the status of spotify including the track");
     puts("                   title and artist name.");
+    puts("    bar-hidden     Tell spotify-listener the bar was hidden, so the");
+    puts("                   marquee stops scrolling.");
+    puts("    bar-shown      Tell spotify-listener the bar is shown again.");
+    puts("    pin <player>   Tell spotify-listener to show the player whenever");
+    puts("                   it is running, e.g. 'pin mpv'.");
+    puts("    unpin          Let spotify-listener show the player that started");
+    puts("                   playing last again.");
+    puts("    stats          Print the counters and latency histograms of");
+    puts("                   spotify-listener.");
+    puts("    log-level <level>");
+    puts("                   Set the log level of spotify-listener to error,");
+    puts("                   warning, info or debug.");
+    puts("");
+    puts("  Multiple commands are run in the order given over one connection,");
+    puts("  e.g. 'spotifyctl next status'.");
+    puts("");
+    puts("  Commands are sent to the player spotify-listener shows, or to");
+    puts("  spotify if it is not running.");
     puts("");
     puts("  Options:");
     puts("    --max-artist-length       The maximum length of the artist name");
@@ -359,6 +717,23 @@ void print_usage() {
     puts("                              specified. This will count towards");
     puts("                              the max lengths. This can be blank.");
     puts("                                Default: '...'");
+    puts("    --timeout                 The time in milliseconds to wait for");
+    puts("                              spotify to reply. If it takes longer,");
+    puts("                              status prints the last output it");
+    puts("                              printed with the same options.");
+    puts("                                Default: 250");
+    puts("    --wait                    Wait for spotify to reply to");
+    puts("                              play/pause/playpause/next/previous");
+    puts("                              and report errors. By default these");
+    puts("                              are sent without waiting.");
+    puts("    --dbus                    Send play/pause/playpause/next/");
+    puts("                              previous to spotify directly instead");
+    puts("                              of through spotify-listener.");
+    puts("    --prometheus              Print stats in the Prometheus text");
+    puts("                              format.");
+    puts("    --timings                 Print a breakdown of the time spent");
+    puts("                              in each phase of the command to");
+    puts("                              stderr.");
     puts("    -q                        Hide errors");
     puts("");
     puts("  Examples:");
@@ -387,16 +762,28 @@ void print_usage() {
 }
 
 int main(int argc, char* argv[]) {
-    DBusConnection* connection;
-    DBusError err;
+    TIMING_MARK("exec");
+
+    // Commands in the order they were given
+    ProgMode* prog_modes = (ProgMode*)malloc(argc * sizeof(ProgMode));
+    const char** command_names = (const char**)malloc(argc * sizeof(char*));
+    size_t num_of_modes = 0;
+    // Lines only meant for spotify-listener
+    const char** listener_lines = (const char**)malloc(argc * sizeof(char*));
+    size_t num_of_listener_lines = 0;
+    char* pin_line = NULL;
+    char* log_level_line = NULL;
+    dbus_bool_t print_stats = FALSE;
+    dbus_bool_t prometheus = FALSE;
+    dbus_bool_t only_player_commands = TRUE;
 
     // Default options
-    ProgMode prog_mode = MODE_NONE;
     int max_artist_length = INT_MAX;
     int max_title_length = INT_MAX;
     int max_length = INT_MAX;
     char* status_format = DEFAULT_FORMAT_TEMPLATE;
     char* trunc = "...";
+    int timeout_ms = DEFAULT_TIMEOUT_MS;
 
     // Parameter index found in list
     PARAMETER_IDENTIFIER param_index;
@@ -449,28 +836,105 @@ int main(int argc, char* argv[]) {
                 trunc = argv[++i];
                 break;
             }
+            case PARAM_TIMINGS: {
+#ifdef TIMINGS
+                // Print the breakdown however spotifyctl exits
+                atexit(print_timings);
+#else
+                if (!SUPPRESS_ERRORS)
+                    fputs("spotifyctl was built without timings support\n",
+                          stderr);
+#endif
+                break;
+            }
+            case PARAM_TIMEOUT: {
+                timeout_ms = atoi(argv[++i]);
+                if (timeout_ms <= 0) {
+                    fputs("Timeout must be a positive integer!\n", stderr);
+                    return 1;
+                }
+                break;
+            }
+            case PARAM_DBUS: {
+                USE_COMMAND_SOCKET = FALSE;
+                break;
+            }
+            case PARAM_WAIT: {
+                WAIT_FOR_REPLY = TRUE;
+                break;
+            }
+            case PARAM_PROMETHEUS: {
+                prometheus = TRUE;
+                break;
+            }
             case PARAM_STATUS: {
-                prog_mode = MODE_STATUS;
+                prog_modes[num_of_modes++] = MODE_STATUS;
+                only_player_commands = FALSE;
                 break;
             }
             case PARAM_PLAY: {
-                prog_mode = MODE_PLAY;
+                command_names[num_of_modes] = argv[i];
+                prog_modes[num_of_modes++] = MODE_PLAY;
                 break;
             }
             case PARAM_PAUSE: {
-                prog_mode = MODE_PAUSE;
+                command_names[num_of_modes] = argv[i];
+                prog_modes[num_of_modes++] = MODE_PAUSE;
                 break;
             }
             case PARAM_PLAYPAUSE: {
-                prog_mode = MODE_PLAYPAUSE;
+                command_names[num_of_modes] = argv[i];
+                prog_modes[num_of_modes++] = MODE_PLAYPAUSE;
                 break;
             }
             case PARAM_NEXT: {
-                prog_mode = MODE_NEXT;
+                command_names[num_of_modes] = argv[i];
+                prog_modes[num_of_modes++] = MODE_NEXT;
                 break;
             }
             case PARAM_PREVIOUS: {
-                prog_mode = MODE_PREVIOUS;
+                command_names[num_of_modes] = argv[i];
+                prog_modes[num_of_modes++] = MODE_PREVIOUS;
+                break;
+            }
+            case PARAM_BAR_HIDDEN:
+            case PARAM_BAR_SHOWN:
+            case PARAM_UNPIN: {
+                listener_lines[num_of_listener_lines++] = argv[i];
+                break;
+            }
+            case PARAM_PIN: {
+                if (i + 1 >= argc || argv[i + 1][0] == '\0' ||
+                    pin_line != NULL) {
+                    fputs("Pin needs the name of one player!\n", stderr);
+                    return 1;
+                }
+
+                // +1 for null char
+                const size_t size =
+                    strlen(COMMAND_PIN_PREFIX) + strlen(argv[++i]) + 1;
+                pin_line = (char*)malloc(size * sizeof(char));
+                snprintf(pin_line, size, "%s%s", COMMAND_PIN_PREFIX, argv[i]);
+                listener_lines[num_of_listener_lines++] = pin_line;
+                break;
+            }
+            case PARAM_LOG_LEVEL: {
+                if (i + 1 >= argc || log_level_line != NULL) {
+                    fputs("Log level needs one level!\n", stderr);
+                    return 1;
+                }
+
+                // +1 for null char
+                const size_t size =
+                    strlen(COMMAND_LOG_LEVEL_PREFIX) + strlen(argv[++i]) + 1;
+                log_level_line = (char*)malloc(size * sizeof(char));
+                snprintf(log_level_line, size, "%s%s",
+                         COMMAND_LOG_LEVEL_PREFIX, argv[i]);
+                listener_lines[num_of_listener_lines++] = log_level_line;
+                break;
+            }
+            case PARAM_STATS: {
+                print_stats = TRUE;
                 break;
             }
             case PARAM_HELP: {
@@ -479,58 +943,168 @@ int main(int argc, char* argv[]) {
             }
             default: {
                 fprintf(stderr, "Invalid option '%s'\n", argv[i]);
-                fputs("usage: spotifyctl [ -q ] [options] <command>\n", stderr);
+                fputs("usage: spotifyctl [ -q ] [options] <command>...\n",
+                      stderr);
                 fputs("Try 'spotifyctl help' for more information\n", stderr);
                 return 1;
             }
         }
     }
 
-    dbus_error_init(&err);
+    // Only spotify-listener cares whether the bars are visible and which
+    // player is pinned
+    if (num_of_listener_lines > 0) {
+        if (!command_socket_send(listener_lines, num_of_listener_lines) &&
+            !SUPPRESS_ERRORS)
+            fputs("spotify-listener is not running\n", stderr);
+
+        if (num_of_modes == 0 && !print_stats) {
+            free(pin_line);
+            free(log_level_line);
+            free(listener_lines);
+            free(command_names);
+            free(prog_modes);
+            arena_free(&ARENA);
+            return 0;
+        }
+    }
+    free(pin_line);
+    free(log_level_line);
+    free(listener_lines);
+
+    // Stats are kept by spotify-listener, which replies on the command socket
+    if (print_stats) {
+        char* stats = command_socket_query(prometheus ? COMMAND_STATS_PROMETHEUS
+                                                      : COMMAND_STATS);
+
+        if (stats == NULL) {
+            if (!SUPPRESS_ERRORS)
+                fputs("spotify-listener is not running\n", stderr);
+            free(command_names);
+            free(prog_modes);
+            arena_free(&ARENA);
+            return 1;
+        }
+
+        fputs(stats, stdout);
+        free(stats);
+
+        if (num_of_modes == 0) {
+            free(command_names);
+            free(prog_modes);
+            arena_free(&ARENA);
+            return 0;
+        }
+    }
+
+    if (num_of_modes == 0) {
+        fputs("No command specified\n", stderr);
+        fputs("Try 'spotifyctl help' for more information\n", stderr);
+        free(command_names);
+        free(prog_modes);
+        arena_free(&ARENA);
+        return 1;
+    }
+
+    TIMING_MARK("args");
+
+    // Hand player commands to spotify-listener, which forwards them over its
+    // existing connection. This avoids connecting to the session bus.
+    if (USE_COMMAND_SOCKET && only_player_commands && !WAIT_FOR_REPLY) {
+        if (command_socket_send(command_names, num_of_modes)) {
+            TIMING_MARK("send");
+            free(command_names);
+            free(prog_modes);
+            arena_free(&ARENA);
+            return 0;
+        }
+
+        // The listener is not running
+        USE_COMMAND_SOCKET = FALSE;
+    }
+
+    // Let spotify-listener show the expected play state while spotify is
+    // called over DBus
+    if (USE_COMMAND_SOCKET)
+        send_predictions(prog_modes, command_names, num_of_modes);
+
+    // Address the player spotify-listener shows. Reading its name is much
+    // cheaper than asking the bus for the players and their state.
+    load_elected_player();
+
+    // The budget includes connecting to the session bus
+    DEADLINE_MS = monotonic_ms() + timeout_ms;
+
+#ifdef WIRE_CLIENT
+    // Talk to the bus directly, falling back to libdbus for addresses the
+    // minimal client does not support
+    if (run_wire_commands(prog_modes, num_of_modes, max_artist_length,
+                          max_title_length, max_length, status_format,
+                          trunc)) {
+        free(command_names);
+        free(prog_modes);
+        arena_free(&ARENA);
+        return 0;
+    }
+#endif
+
+#ifdef WIRE_CLIENT_ONLY
+    if (!SUPPRESS_ERRORS)
+        fputs("Failed to connect to the session bus\n", stderr);
+    free(command_names);
+    free(prog_modes);
+    arena_free(&ARENA);
+    return 1;
+#else
+    BusConnection* connection;
+    BusError err;
+
+    bus_error_init(&err);
 
     // Connect to session bus
-    if (!(connection = dbus_bus_get(DBUS_BUS_SESSION, &err))) {
+    if (!(connection = bus_connect_session(&err))) {
         if (!SUPPRESS_ERRORS)
             fputs(err.message, stderr);
+        bus_error_free(&err);
+        free(command_names);
+        free(prog_modes);
+        arena_free(&ARENA);
         return 1;
     }
 
-    // Call function based on command supplied
-    switch (prog_mode) {
-        case MODE_NONE: {
-            fputs("No command specified\n", stderr);
-            fputs("Try 'spotifyctl help' for more information\n", stderr);
-            dbus_connection_unref(connection);
-            return 1;
-        }
-        case MODE_STATUS: {
-            get_status(connection, max_artist_length, max_title_length,
-                       max_length, status_format, trunc);
-            break;
-        }
-        case MODE_PLAY: {
-            spotify_player_call(connection, PLAYER_METHOD_PLAY);
-            break;
-        }
-        case MODE_PAUSE: {
-            spotify_player_call(connection, PLAYER_METHOD_PAUSE);
-            break;
-        }
-        case MODE_PLAYPAUSE: {
-            spotify_player_call(connection, PLAYER_METHOD_PLAYPAUSE);
-            break;
-        }
-        case MODE_NEXT: {
-            spotify_player_call(connection, PLAYER_METHOD_NEXT);
-            break;
-        }
-        case MODE_PREVIOUS: {
-            spotify_player_call(connection, PLAYER_METHOD_PREVIOUS);
-            break;
-        }
+    TIMING_MARK("connect");
+
+    BusPendingCall** pending =
+        (BusPendingCall**)calloc(num_of_modes, sizeof(BusPendingCall*));
+
+    // Send every command before waiting for any reply so they are pipelined
+    for (size_t i = 0; i < num_of_modes; i++) {
+        if (prog_modes[i] == MODE_STATUS)
+            pending[i] = send_status_request(connection);
+        else
+            pending[i] = spotify_player_call(connection, prog_modes[i]);
     }
 
-    dbus_connection_unref(connection);
+    // Make sure commands that don't wait for a reply are written before exit
+    bus_flush(connection);
+    TIMING_MARK("send");
+
+    // Handle replies in the order the commands were given
+    for (size_t i = 0; i < num_of_modes; i++) {
+        if (prog_modes[i] == MODE_STATUS)
+            get_status(connection, pending[i], max_artist_length,
+                       max_title_length, max_length, status_format, trunc);
+        else if (pending[i] != NULL)
+            wait_player_call(connection, pending[i]);
+    }
+
+    free(pending);
+    free(command_names);
+    free(prog_modes);
+    arena_free(&ARENA);
+
+    bus_connection_close(connection);
 
     return 0;
+#endif
 }
@@ -0,0 +1,213 @@
+#include "../include/stats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/utils.h"
+
+// Prefix of every metric in Prometheus format
+#define METRIC_PREFIX "spotify_listener_"
+
+// Prometheus buckets end at 2^bits - 1 microseconds, up to these bits (33s)
+#define PROMETHEUS_MAX_BITS 25
+
+/**
+ * Get the bucket of a value
+ */
+static int bucket_of(unsigned long long value_us) {
+    if (value_us < HISTOGRAM_SUB_BUCKETS)
+        return (int)value_us;
+
+    const int shift = 63 - __builtin_clzll(value_us) - HISTOGRAM_SUB_BITS;
+
+    // The top bits of the value are between HISTOGRAM_SUB_BUCKETS and twice
+    // that, which continues the buckets of the next lower power of two
+    return shift * HISTOGRAM_SUB_BUCKETS + (int)(value_us >> shift);
+}
+
+/**
+ * Get the highest value of a bucket
+ */
+static unsigned long long bucket_high(const int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+
+    const int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    const unsigned long long top = bucket - shift * HISTOGRAM_SUB_BUCKETS;
+
+    return ((top + 1) << shift) - 1;
+}
+
+void histogram_init(Histogram* histogram) {
+    memset(histogram, 0, sizeof(Histogram));
+}
+
+void histogram_record(Histogram* histogram, long long value_us) {
+    const unsigned long long max = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+
+    if (value_us < 0)
+        value_us = 0;
+    if ((unsigned long long)value_us > max)
+        value_us = max;
+
+    counter_add(&histogram->buckets[bucket_of(value_us)], 1);
+    counter_add(&histogram->count, 1);
+    atomic_store_explicit(
+        &histogram->sum_us,
+        atomic_load_explicit(&histogram->sum_us, memory_order_relaxed) +
+            value_us,
+        memory_order_relaxed);
+
+    if ((unsigned long long)value_us >
+        atomic_load_explicit(&histogram->max_us, memory_order_relaxed))
+        atomic_store_explicit(&histogram->max_us, value_us,
+                              memory_order_relaxed);
+}
+
+unsigned long long histogram_percentile(const Histogram* histogram,
+                                        const double percentile) {
+    const unsigned long count =
+        atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    const unsigned long long max_us =
+        atomic_load_explicit(&histogram->max_us, memory_order_relaxed);
+
+    if (count == 0)
+        return 0;
+
+    // The rank of the value at the percentile, rounded up
+    unsigned long rank = (unsigned long)(percentile / 100 * count + 0.999999);
+    unsigned long seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->buckets[i],
+                                     memory_order_relaxed);
+
+        if (seen >= rank)
+            return bucket_high(i) < max_us ? bucket_high(i) : max_us;
+    }
+
+    return max_us;
+}
+
+unsigned long histogram_count_at_most(const Histogram* histogram,
+                                      const unsigned long long value_us) {
+    unsigned long count = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS && bucket_high(i) <= value_us; i++)
+        count += atomic_load_explicit(&histogram->buckets[i],
+                                      memory_order_relaxed);
+
+    return count;
+}
+
+void stats_buffer_init(StatsBuffer* stats) {
+    stats->buf[0] = '\0';
+    stats->len = 0;
+    stats->truncated = FALSE;
+}
+
+void stats_printf(StatsBuffer* stats, const char* format, ...) {
+    const size_t available = sizeof(stats->buf) - stats->len;
+    va_list args;
+
+    va_start(args, format);
+    const int n = vsnprintf(stats->buf + stats->len, available, format, args);
+    va_end(args);
+
+    if (n < 0)
+        return;
+
+    if ((size_t)n >= available) {
+        stats->len = sizeof(stats->buf) - 1;
+        stats->truncated = TRUE;
+    } else {
+        stats->len += n;
+    }
+}
+
+void stats_counter(StatsBuffer* stats, const StatsFormat format,
+                   const char* name, const char* help,
+                   const unsigned long long value) {
+    if (format == STATS_PROMETHEUS) {
+        stats_printf(stats,
+                     "# HELP " METRIC_PREFIX "%s %s\n"
+                     "# TYPE " METRIC_PREFIX "%s counter\n" METRIC_PREFIX
+                     "%s %llu\n",
+                     name, help, name, name, value);
+    } else {
+        stats_printf(stats, "%-52s %llu\n", help, value);
+    }
+}
+
+void stats_gauge(StatsBuffer* stats, const StatsFormat format,
+                 const char* name, const char* help,
+                 const unsigned long long value) {
+    if (format == STATS_PROMETHEUS) {
+        stats_printf(stats,
+                     "# HELP " METRIC_PREFIX "%s %s\n"
+                     "# TYPE " METRIC_PREFIX "%s gauge\n" METRIC_PREFIX
+                     "%s %llu\n",
+                     name, help, name, name, value);
+    } else {
+        stats_printf(stats, "%-52s %llu\n", help, value);
+    }
+}
+
+void stats_histogram_header(StatsBuffer* stats, const StatsFormat format) {
+    if (format == STATS_PROMETHEUS)
+        stats_printf(stats,
+                     "# HELP " METRIC_PREFIX
+                     "latency_seconds Time from waking up for an event to the "
+                     "end of each stage\n"
+                     "# TYPE " METRIC_PREFIX "latency_seconds histogram\n");
+    else
+        stats_printf(stats, "\n%-14s %10s %10s %10s %10s %10s %10s\n",
+                     "Latency (us)", "count", "mean", "p50", "p90", "p99",
+                     "max");
+}
+
+void stats_histogram(StatsBuffer* stats, const StatsFormat format,
+                     const char* stage, const Histogram* histogram) {
+    const unsigned long count =
+        atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    const unsigned long long sum_us =
+        atomic_load_explicit(&histogram->sum_us, memory_order_relaxed);
+
+    if (format == STATS_HUMAN) {
+        stats_printf(stats, "%-14s %10lu %10llu %10llu %10llu %10llu %10llu\n",
+                     stage, count, count > 0 ? sum_us / count : 0,
+                     histogram_percentile(histogram, 50),
+                     histogram_percentile(histogram, 90),
+                     histogram_percentile(histogram, 99),
+                     (unsigned long long)atomic_load_explicit(
+                         &histogram->max_us, memory_order_relaxed));
+        return;
+    }
+
+    // le includes its bound, and the buckets end just below powers of two,
+    // so a bound there counts every value up to it and none above it
+    for (int bits = 0; bits <= PROMETHEUS_MAX_BITS; bits++) {
+        const unsigned long long le_us = (1ULL << bits) - 1;
+
+        stats_printf(stats,
+                     METRIC_PREFIX
+                     "latency_seconds_bucket{stage=\"%s\",le=\"%.6f\"} %lu\n",
+                     stage, le_us / 1e6,
+                     histogram_count_at_most(histogram, le_us));
+    }
+
+    stats_printf(stats,
+                 METRIC_PREFIX
+                 "latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n",
+                 stage, count);
+    stats_printf(stats,
+                 METRIC_PREFIX "latency_seconds_sum{stage=\"%s\"} %.6f\n",
+                 stage, sum_us / 1e6);
+    stats_printf(stats,
+                 METRIC_PREFIX "latency_seconds_count{stage=\"%s\"} %lu\n",
+                 stage, count);
+}
@@ -2,154 +2,56 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
-void print_string_iter(DBusMessageIter* iter) {
-    int type = dbus_message_iter_get_arg_type(iter);
-
-    if (type == DBUS_TYPE_STRING) {
-        DBusBasicValue value;
-        dbus_message_iter_get_basic(iter, &value);
-        puts(value.str);
-    }
-}
-
-char* iter_get_string(DBusMessageIter* iter) {
-    int type = dbus_message_iter_get_arg_type(iter);
-
-    char* str;
-
-    // Make sure it is a string
-    if (type == DBUS_TYPE_STRING) {
-        DBusBasicValue value;
-        dbus_message_iter_get_basic(iter, &value);
-
-        // +1 for null char
-        size_t size = (strlen(value.str) + 1) * sizeof(char);
-        str = (char*)malloc(size);
-        strcpy(str, value.str);
-
-        return str;
-    }
-
-    return NULL;
-}
-
-dbus_bool_t recurse_iter_of_type(DBusMessageIter* iter,
-                                 DBusMessageIter* subiter, const int type) {
-    const int iter_type = dbus_message_iter_get_arg_type(iter);
-
-    // Check if iter type matches
-    if (iter_type == type) {
-        // Initialize subiter in container pointed to by iter
-        dbus_message_iter_recurse(iter, subiter);
-        return TRUE;
-    }
+// Phase marks recorded by timings_mark
+static struct {
+    const char* phase;
+    struct timespec ts;
+} timing_marks[TIMINGS_MAX_MARKS];
+static size_t num_of_timing_marks = 0;
 
-    return FALSE;
-}
+// Difference between CLOCK_BOOTTIME and CLOCK_MONOTONIC at the first mark
+static double boottime_offset_ms = 0;
 
-dbus_bool_t recurse_iter_of_signature(DBusMessageIter* iter,
-                                      DBusMessageIter* subiter,
-                                      const char* signature) {
-    char* iter_signature = dbus_message_iter_get_signature(iter);
-
-    // Check if iter signature matches
-    if (strcmp(iter_signature, signature) == 0) {
-        // Initialize subiter in container pointer to by iter
-        dbus_message_iter_recurse(iter, subiter);
-        dbus_free(iter_signature);
-        return TRUE;
-    } else {
-        dbus_free(iter_signature);
-        return FALSE;
-    }
+void bus_error_init(BusError* err) {
+    err->name = NULL;
+    err->message = NULL;
 }
 
-dbus_bool_t iter_go_to_key(DBusMessageIter* element_iter,
-                           DBusMessageIter* entry_iter, const char* key) {
-    const int iter_type = dbus_message_iter_get_arg_type(element_iter);
-    char* iter_signature = dbus_message_iter_get_signature(element_iter);
-
-    // Make sure iter is on dict entry and signature matches string-variant
-    // entry
-    if (iter_type != DBUS_TYPE_DICT_ENTRY ||
-        strcmp(iter_signature, "{sv}") != 0) {
-        dbus_free(iter_signature);
-        return FALSE;
-    }
-
-    dbus_free(iter_signature);
-
-    int current_type;
-
-    // Iterate through dict elements
-    while ((current_type = dbus_message_iter_get_arg_type(element_iter)) !=
-           DBUS_TYPE_INVALID) {
-        // Try to recurse into dict container
-        recurse_iter_of_type(element_iter, entry_iter, DBUS_TYPE_DICT_ENTRY);
-
-        // Get dict entry key
-        DBusBasicValue value;
-        dbus_message_iter_get_basic(entry_iter, &value);
-        const char* k = value.str;
-
-        // Check if dict key matches key argument
-        if (strcmp(k, key) == 0) {
-            // Move iter to value of dict entry and return
-            dbus_message_iter_next(entry_iter);
-            return TRUE;
-        }
-
-        // Go to next dict entry
-        dbus_message_iter_next(element_iter);
-    }
-
-    // No dict entry with specified key found
-    return FALSE;
+/**
+ * Copy a string into a newly allocated string
+ */
+static char* copy_string(const char* str) {
+    // +1 for null char
+    char* copy = (char*)malloc((strlen(str) + 1) * sizeof(char));
+    strcpy(copy, str);
+    return copy;
 }
 
-dbus_bool_t iter_try_step_into_type(DBusMessageIter* iter, const int type) {
-    DBusMessageIter sub_iter;
-
-    // Try to initialize sub_iter inside container pointed to by iter if type
-    // matches
-    if (!recurse_iter_of_type(iter, &sub_iter, type))
-        return FALSE;
-
-    *iter = sub_iter;
-
-    return TRUE;
+void bus_error_set(BusError* err, const char* name, const char* message) {
+    bus_error_free(err);
+    err->name = copy_string(name);
+    err->message = copy_string(message != NULL ? message : name);
 }
 
-dbus_bool_t iter_try_step_to_key(DBusMessageIter* element_iter,
-                                 const char* key) {
-    DBusMessageIter kv_iter;
+dbus_bool_t bus_error_is_set(const BusError* err) { return err->name != NULL; }
 
-    // Try to initialize kv_iter at value associated with key
-    if (!iter_go_to_key(element_iter, &kv_iter, key))
-        return FALSE;
-
-    *element_iter = kv_iter;
-
-    return TRUE;
+dbus_bool_t bus_error_has_name(const BusError* err, const char* name) {
+    return err->name != NULL && strcmp(err->name, name) == 0;
 }
 
-dbus_bool_t iter_try_step_into_signature(DBusMessageIter* iter,
-                                         const char* signature) {
-    DBusMessageIter sub_iter;
-
-    // Try to initialize sub_iter insider container pointed to by iter if
-    // signature matches
-    if (!recurse_iter_of_signature(iter, &sub_iter, signature))
-        return FALSE;
-
-    *iter = sub_iter;
-
-    return TRUE;
+void bus_error_free(BusError* err) {
+    free(err->name);
+    free(err->message);
+    bus_error_init(err);
 }
 
 dbus_bool_t msleep(const long milliseconds) {
@@ -174,154 +76,209 @@ dbus_bool_t msleep(const long milliseconds) {
     return TRUE;
 }
 
-char* join_path(const char* p1, const char* p2) {
-    const size_t len1 = strlen(p1);
-    const size_t len2 = strlen(p2);
+// spotifyctl-static starts no threads, and a static libc would link in the
+// thread support for this alone
+#ifndef WIRE_CLIENT_ONLY
+dbus_bool_t start_thread_without_signals(pthread_t* thread,
+                                         void* (*start)(void*), void* arg) {
+    // The thread inherits the signal mask of the thread creating it
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
 
-    char* res;
+    const int r = pthread_create(thread, NULL, start, arg);
 
-    // Check if last character of p1 is '/'
-    if (p1[len1 - 1] != '/') {
-        // +1 for null char and +1 for '/'
-        const size_t res_size = (len1 + len2 + 2) * sizeof(char);
-        res = (char*)malloc(res_size);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
-        // Join p1 and p2 with '/'
-        strcpy(res, p1);
-        strcat(res, "/");
-        strcat(res, p2);
+    return r == 0;
+}
+#endif
+
+/**
+ * A block of memory an arena hands out allocations from
+ */
+struct ArenaBlock {
+    struct ArenaBlock* previous;
+    size_t size;
+    // max_align_t, so allocations at multiples of ARENA_ALIGNMENT are aligned
+    // for any type like malloc's
+    max_align_t data[];
+};
+
+// Every allocation from an arena is rounded up to this
+#define ARENA_ALIGNMENT sizeof(max_align_t)
+
+void* arena_alloc(Arena* arena, const size_t size) {
+    if (arena == NULL)
+        return malloc(size);
+
+    const size_t aligned =
+        (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+    if (arena->block == NULL || arena->used + aligned > arena->block->size) {
+        const size_t block_size =
+            aligned > ARENA_BLOCK_SIZE ? aligned : ARENA_BLOCK_SIZE;
+        struct ArenaBlock* block = (struct ArenaBlock*)malloc(
+            sizeof(struct ArenaBlock) + block_size);
+
+        if (block == NULL)
+            return NULL;
+
+        block->previous = arena->block;
+        block->size = block_size;
+        arena->block = block;
+        arena->used = 0;
+        arena->blocks++;
+    }
 
-        return res;
-    } else if (p1[len1 - 1] == '/') {
-        // +1 for null char
-        const size_t res_size = (len1 + len2 + 1) * sizeof(char);
-        res = (char*)malloc(res_size);
+    void* memory = (char*)arena->block->data + arena->used;
+    arena->used += aligned;
 
-        // Join p1 and p2
-        strcpy(res, p1);
-        strcat(res, p2);
+    return memory;
+}
 
-        return res;
-    } else {
-        return NULL;
+void arena_reset(Arena* arena) {
+    if (arena->block == NULL)
+        return;
+
+    // The current block is the last one allocated, so it is at least as big
+    // as the largest allocation since the last reset
+    struct ArenaBlock* block = arena->block->previous;
+
+    while (block != NULL) {
+        struct ArenaBlock* previous = block->previous;
+        free(block);
+        block = previous;
     }
+
+    arena->block->previous = NULL;
+    arena->used = 0;
 }
 
-dbus_bool_t get_polybar_ipc_paths(const char* ipc_path, char** ptr_paths[],
-                                  size_t* num_of_paths) {
-    DIR* d;
-    struct dirent* dir;
-    size_t i = 0;
+void arena_free(Arena* arena) {
+    arena_reset(arena);
+    free(arena->block);
+    arena->block = NULL;
+}
 
-    // Start with 3 paths allocated
-    *num_of_paths = 3;
-    // Allocate memory for num_of_paths char* pointers
-    char** paths = (char**)malloc(*num_of_paths * sizeof(char*));
+char* join_path_a(Arena* arena, const char* p1, const char* p2) {
+    const size_t len1 = strlen(p1);
+    const size_t len2 = strlen(p2);
+    // Join p1 and p2 with '/' unless p1 already ends in one
+    const size_t separator_len = len1 > 0 && p1[len1 - 1] != '/' ? 1 : 0;
 
-    d = opendir(ipc_path);
+    // +1 for null char
+    char* res = (char*)arena_alloc(arena, len1 + separator_len + len2 + 1);
 
-    if (d) {
-        // Iterate through every file in ipc_path
-        while ((dir = readdir(d)) != NULL) {
-            const char* name = dir->d_name;
+    if (res == NULL)
+        return NULL;
 
-            // Check if filename starts with polybar_mqueue
-            if (strncmp(name, "polybar_mqueue", 14) == 0) {
-                // Join filename with parent path
-                char* path = join_path(ipc_path, name);
-                size_t len = strlen(path) + 1; // +1 for null char
+    memcpy(res, p1, len1);
+    res[len1] = '/';
+    memcpy(res + len1 + separator_len, p2, len2 + 1);
 
-                if (i >= *num_of_paths) {
-                    // Reallocate 3 additional paths
-                    paths = (char**)realloc(paths, (i + 3) * sizeof(char*));
-                }
+    return res;
+}
 
-                paths[i] = path;
-                i++;
-            }
-        }
+char* join_path(const char* p1, const char* p2) {
+    return join_path_a(NULL, p1, p2);
+}
 
-        // Get actual number of paths
-        *num_of_paths = i;
-        // Reallocate array for actual number of paths
-        paths = (char**)realloc(paths, *num_of_paths * sizeof(char*));
-        // Assign address of array to pointer to array
-        *ptr_paths = paths;
-    } else {
-        closedir(d);
+dbus_bool_t get_polybar_ipc_paths_a(Arena* arena, const char* ipc_path,
+                                    char** ptr_paths[],
+                                    size_t* num_of_paths) {
+    DIR* d = opendir(ipc_path);
+    struct dirent* dir;
+    size_t i = 0;
+
+    if (d == NULL)
         return FALSE;
+
+    // Start with 4 paths allocated
+    size_t capacity = 4;
+    char** paths = (char**)arena_alloc(arena, capacity * sizeof(char*));
+
+    // Iterate through every file in ipc_path
+    while ((dir = readdir(d)) != NULL) {
+        const char* name = dir->d_name;
+
+        // Check if filename starts with polybar_mqueue
+        if (strncmp(name, "polybar_mqueue", 14) != 0)
+            continue;
+
+        if (i == capacity) {
+            // Arena allocations can't grow, so the paths move to an array
+            // twice the size and the old one goes with the arena
+            char** bigger =
+                (char**)arena_alloc(arena, capacity * 2 * sizeof(char*));
+
+            memcpy(bigger, paths, i * sizeof(char*));
+            if (arena == NULL)
+                free(paths);
+            paths = bigger;
+            capacity *= 2;
+        }
+
+        // Join filename with parent path
+        paths[i++] = join_path_a(arena, ipc_path, name);
     }
 
     closedir(d);
+
+    *ptr_paths = paths;
+    *num_of_paths = i;
+
     return TRUE;
 }
 
-char* str_replace_all(const char* str, const char* find, const char* repl) {
-    // Pointer to substring of str
-    const char* substr = str;
-
-    // # of characters that need to be allocated per replacement
-    const int REPL_DIFF = strlen(repl) - strlen(find);
+dbus_bool_t get_polybar_ipc_paths(const char* ipc_path, char** ptr_paths[],
+                                  size_t* num_of_paths) {
+    return get_polybar_ipc_paths_a(NULL, ipc_path, ptr_paths, num_of_paths);
+}
 
-    // Number of additional replacmements to allocate memory for at a time
-    const int REALLOC_RATE = 1;
+char* str_replace_all_a(Arena* arena, const char* str, const char* find,
+                        const char* repl) {
+    const size_t find_len = strlen(find);
+    const size_t repl_len = strlen(repl);
+    const size_t matches = num_of_matches(str, find);
 
-    // Allocate memory for final string assuming only 1 replacement will be
-    // made (REALLOC_RATE=1). For most use-cases, only 1 replacement will be
-    // made. This is an optimization for its main use case. Also add 1 for null
-    // character.
-    size_t new_str_size = strlen(str) + REPL_DIFF * REALLOC_RATE + 1;
-    char* new_str = (char*)calloc(new_str_size, sizeof(char));
+    // Counting the matches first allocates the exact length at once. +1 for
+    // null char.
+    char* new_str = (char*)arena_alloc(
+        arena, strlen(str) - matches * find_len + matches * repl_len + 1);
 
-    int num_of_replacements = 0;
+    if (new_str == NULL)
+        return NULL;
 
-    char* match;
-    size_t actual_len = 0;
+    // Pointer to substring of str, and the end of new_str
+    const char* substr = str;
+    char* end = new_str;
+    const char* match;
 
-    // For every match
+    // For every match, append substr up to the match and the replacement
     while (match = strstr(substr, find)) {
-        // Get offset of first match
-        size_t offset = match - substr;
-
-        // Length of new_str is offset match + length of replacement
-        actual_len += offset + strlen(repl);
-
-        // Reallocate memory every REALLOC_RATE replacements. At 0 replacements,
-        // memory has already been allocated fo REALLOC_RATE replacements.
-        if (num_of_replacements != 0 &&
-            num_of_replacements % REALLOC_RATE == 0) {
-            // Allocate memory for REALLOC_RATE more replacements
-            new_str_size += REPL_DIFF * REALLOC_RATE * sizeof(char);
-            new_str = (char*)realloc(new_str, new_str_size);
-        }
+        const size_t offset = match - substr;
 
-        // Append substr up to offset
-        strncat(new_str, substr, offset);
-        // Append replacement string
-        strcat(new_str, repl);
+        memcpy(end, substr, offset);
+        memcpy(end + offset, repl, repl_len);
+        end += offset + repl_len;
 
         // Shift substr pointer to character after match
-        substr += offset + strlen(find);
-
-        num_of_replacements++;
+        substr = match + find_len;
     }
 
-    // Calculate final length after appending substr
-    actual_len += strlen(substr);
-
-    // Allocate exact amount of memory needed. This will release extra memory or
-    // allocate more memory if no replacements were made and REPL_DIFF < 0 in
-    // which case there would not be enough memory to concat substr.
-    new_str = (char*)realloc(new_str, (actual_len + 1) * sizeof(char));
-
-    // Concatenate rest of substr. This must happen after reallocation in case
-    // REPL_DIFF < 0 and no replacements were made.
-    strcat(new_str, substr);
+    // Append the rest of substr with its null char
+    strcpy(end, substr);
 
     return new_str;
 }
 
-char* str_trunc(const char* str, const int max_len, const char* trunc) {
+char* str_replace_all(const char* str, const char* find, const char* repl) {
+    return str_replace_all_a(NULL, str, find, repl);
+}
+
+char* str_trunc_a(Arena* arena, const char* str, const int max_len,
+                  const char* trunc) {
     const size_t len = strlen(str);
     const size_t trunc_len = strlen(trunc);
     char* new_str;
@@ -331,25 +288,27 @@ char* str_trunc(const char* str, const int max_len, const char* trunc) {
 
     if (len > max_len) {
         // New size is max_len + null char
-        const size_t new_str_size = max_len + 1;
-
-        new_str = (char*)calloc(new_str_size, sizeof(char));
+        if (!(new_str = (char*)arena_alloc(arena, max_len + 1)))
+            return NULL;
 
         // Copy str, leaving room for trunc
-        strncpy(new_str, str, max_len - trunc_len);
-        strcat(new_str, trunc);
+        memcpy(new_str, str, max_len - trunc_len);
+        memcpy(new_str + max_len - trunc_len, trunc, trunc_len + 1);
     } else {
         // +1 for null char
-        const size_t new_str_size = len + 1;
+        if (!(new_str = (char*)arena_alloc(arena, len + 1)))
+            return NULL;
 
-        new_str = (char*)calloc(new_str_size, sizeof(char));
-
-        strcpy(new_str, str);
+        memcpy(new_str, str, len + 1);
     }
 
     return new_str;
 }
 
+char* str_trunc(const char* str, const int max_len, const char* trunc) {
+    return str_trunc_a(NULL, str, max_len, trunc);
+}
+
 int num_of_matches(const char* str, const char* find) {
     const char* substr = str;
     char* match;
@@ -367,3 +326,198 @@ int num_of_matches(const char* str, const char* find) {
 
     return num_of_matches;
 }
+
+long long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+long long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+char* get_runtime_path(const char* name) {
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_dir != NULL && runtime_dir[0] != '\0')
+        return join_path(runtime_dir, name);
+
+    // /tmp is shared with other users, who could plant files or symlinks
+    // under fixed names there, so fall back to a directory only this user
+    // can get into
+    char fallback_dir[64];
+    snprintf(fallback_dir, sizeof(fallback_dir), "%s%u",
+             RUNTIME_FALLBACK_PREFIX, (unsigned)getuid());
+
+    if (mkdir(fallback_dir, 0700) != 0 && errno != EEXIST)
+        return NULL;
+
+    // It may have been created by someone else before us, or be a symlink
+    struct stat st;
+    if (lstat(fallback_dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != getuid() || (st.st_mode & 077) != 0)
+        return NULL;
+
+    return join_path(fallback_dir, name);
+}
+
+char* read_file(const char* path) {
+    FILE* fp = fopen(path, "r");
+
+    if (fp == NULL)
+        return NULL;
+
+    size_t size = 256;
+    size_t len = 0;
+    char* contents = (char*)malloc(size * sizeof(char));
+
+    // Read until EOF, doubling the buffer when it fills up
+    size_t n;
+    while ((n = fread(contents + len, sizeof(char), size - len - 1, fp)) > 0) {
+        len += n;
+
+        if (len == size - 1) {
+            size *= 2;
+            contents = (char*)realloc(contents, size * sizeof(char));
+        }
+    }
+
+    fclose(fp);
+    contents[len] = '\0';
+
+    return contents;
+}
+
+dbus_bool_t write_file_atomic(const char* path, const char* contents) {
+    // mkstemp creates a new file with a unique name, so concurrent writers
+    // don't share a temporary file and an existing file or symlink is never
+    // written through. +8 for ".XXXXXX" and null char
+    const size_t tmp_size = strlen(path) + 8;
+    char* tmp_path = (char*)malloc(tmp_size * sizeof(char));
+    snprintf(tmp_path, tmp_size, "%s.XXXXXX", path);
+
+    const int fd = mkstemp(tmp_path);
+    FILE* fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+
+    if (fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        return FALSE;
+    }
+
+    const dbus_bool_t written = fputs(contents, fp) != EOF;
+
+    // Only move the new file into place if it was written completely
+    if (fclose(fp) != 0 || !written || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        free(tmp_path);
+        return FALSE;
+    }
+
+    free(tmp_path);
+    return TRUE;
+}
+
+/**
+ * Convert a timespec to milliseconds
+ */
+static double timespec_to_ms(const struct timespec* ts) {
+    return ts->tv_sec * 1000.0 + ts->tv_nsec / 1000000.0;
+}
+
+/**
+ * Get the time the process started in milliseconds on CLOCK_BOOTTIME. This is
+ * read from /proc/self/stat and only has a resolution of a clock tick.
+ *
+ * @returns double The start time of the process or -1 on error
+ */
+static double get_process_start_ms() {
+    char buf[1024];
+    FILE* fp = fopen("/proc/self/stat", "r");
+
+    if (fp == NULL)
+        return -1;
+
+    size_t len = fread(buf, sizeof(char), sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+    // The process name may contain spaces, so start after its closing paren
+    char* field = strrchr(buf, ')');
+    if (field == NULL)
+        return -1;
+
+    // starttime is field 22, the state after the name is field 3
+    for (int i = 3; i <= 22; i++) {
+        field = strchr(field + 1, ' ');
+        if (field == NULL)
+            return -1;
+    }
+
+    const unsigned long long start_ticks = strtoull(field + 1, NULL, 10);
+    const long ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+    if (ticks_per_sec <= 0)
+        return -1;
+
+    return start_ticks * 1000.0 / ticks_per_sec;
+}
+
+dbus_bool_t timings_mark(const char* phase) {
+    if (num_of_timing_marks >= TIMINGS_MAX_MARKS)
+        return FALSE;
+
+    clock_gettime(CLOCK_MONOTONIC,
+                  &timing_marks[num_of_timing_marks].ts);
+    timing_marks[num_of_timing_marks].phase = phase;
+
+    // Remember how far CLOCK_BOOTTIME is ahead so the process start time can
+    // be placed on the CLOCK_MONOTONIC timeline later
+    if (num_of_timing_marks == 0) {
+        struct timespec boottime;
+        clock_gettime(CLOCK_BOOTTIME, &boottime);
+        boottime_offset_ms =
+            timespec_to_ms(&boottime) - timespec_to_ms(&timing_marks[0].ts);
+    }
+
+    num_of_timing_marks++;
+
+    return TRUE;
+}
+
+void timings_print(FILE* stream) {
+    if (num_of_timing_marks == 0)
+        return;
+
+    const double first_ms = timespec_to_ms(&timing_marks[0].ts);
+    double start_ms = get_process_start_ms();
+
+    // Fall back to measuring from the first mark if the start time is unknown
+    if (start_ms < 0)
+        start_ms = first_ms;
+    else
+        start_ms -= boottime_offset_ms;
+
+    // The start time has a resolution of a clock tick, so never let the first
+    // phase go negative
+    if (start_ms > first_ms)
+        start_ms = first_ms;
+
+    double prev_ms = start_ms;
+
+    fputs("timings:", stream);
+
+    for (size_t i = 0; i < num_of_timing_marks; i++) {
+        const double ms = timespec_to_ms(&timing_marks[i].ts);
+        fprintf(stream, " %s=%.3fms", timing_marks[i].phase, ms - prev_ms);
+        prev_ms = ms;
+    }
+
+    fprintf(stream, " total=%.3fms\n", prev_ms - start_ms);
+}
@@ -0,0 +1,842 @@
+#include "../include/wire-client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/*************** Constants from the DBus specification ***************/
+#define WIRE_METHOD_CALL 1
+#define WIRE_METHOD_RETURN 2
+#define WIRE_ERROR 3
+
+#define WIRE_FLAG_NO_REPLY_EXPECTED 0x1
+
+#define WIRE_FIELD_PATH 1
+#define WIRE_FIELD_INTERFACE 2
+#define WIRE_FIELD_MEMBER 3
+#define WIRE_FIELD_ERROR_NAME 4
+#define WIRE_FIELD_REPLY_SERIAL 5
+#define WIRE_FIELD_DESTINATION 6
+#define WIRE_FIELD_SIGNATURE 8
+
+// Size of the fixed part of a message header
+#define WIRE_HEADER_SIZE 16
+
+// Maximum size of a message
+#define WIRE_MAX_MESSAGE_SIZE (128 * 1024 * 1024)
+
+/**
+ * A growable byte buffer
+ */
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t size;
+} WireBuffer;
+
+/**
+ * A cursor over a received message. Alignment is relative to the start of
+ * data, which must be the start of the message or an 8-byte aligned offset in
+ * it.
+ */
+typedef struct {
+    const unsigned char* data;
+    size_t len;
+    size_t pos;
+    int big_endian;
+} WireReader;
+
+struct WireConnection {
+    int fd;
+    uint32_t next_serial;
+    // TRUE once the server accepted the authentication
+    int authenticated;
+    // Bytes waiting to be written
+    WireBuffer out;
+    // Bytes read but not parsed yet
+    WireBuffer in;
+};
+
+/*************** Writing ***************/
+
+static int buf_reserve(WireBuffer* buf, const size_t n) {
+    if (buf->len + n <= buf->size)
+        return 1;
+
+    size_t size = buf->size ? buf->size : 256;
+    while (size < buf->len + n)
+        size *= 2;
+
+    unsigned char* data = (unsigned char*)realloc(buf->data, size);
+    if (data == NULL)
+        return 0;
+
+    buf->data = data;
+    buf->size = size;
+
+    return 1;
+}
+
+static void buf_append(WireBuffer* buf, const void* data, const size_t n) {
+    if (buf_reserve(buf, n)) {
+        memcpy(buf->data + buf->len, data, n);
+        buf->len += n;
+    }
+}
+
+static void buf_pad(WireBuffer* buf, const size_t alignment) {
+    static const unsigned char zeros[8] = {0};
+    buf_append(buf, zeros, (alignment - buf->len % alignment) % alignment);
+}
+
+static void buf_u8(WireBuffer* buf, const uint8_t value) {
+    buf_append(buf, &value, 1);
+}
+
+static void buf_u32(WireBuffer* buf, const uint32_t value) {
+    buf_pad(buf, 4);
+    buf_append(buf, &value, 4);
+}
+
+static void buf_string(WireBuffer* buf, const char* str) {
+    const size_t len = strlen(str);
+    buf_u32(buf, len);
+    // +1 for null char
+    buf_append(buf, str, len + 1);
+}
+
+static void buf_signature(WireBuffer* buf, const char* sig) {
+    const size_t len = strlen(sig);
+    buf_u8(buf, len);
+    // +1 for null char
+    buf_append(buf, sig, len + 1);
+}
+
+/**
+ * Append a header field. Fields are a struct of a byte code and a variant.
+ */
+static void buf_field(WireBuffer* buf, const uint8_t code, const char type,
+                      const char* value) {
+    const char sig[2] = {type, '\0'};
+
+    buf_pad(buf, 8);
+    buf_u8(buf, code);
+    buf_signature(buf, sig);
+
+    if (type == 'g')
+        buf_signature(buf, value);
+    else
+        buf_string(buf, value);
+}
+
+/**
+ * Get the byte identifying the byte order of this machine in messages
+ */
+static uint8_t native_endian() {
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one ? 'l' : 'B';
+}
+
+/*************** Reading ***************/
+
+static uint32_t swap_u32(const uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) |
+           (value << 24);
+}
+
+static int rd_align(WireReader* r, const size_t alignment) {
+    const size_t pos = (r->pos + alignment - 1) / alignment * alignment;
+
+    if (pos > r->len)
+        return 0;
+
+    r->pos = pos;
+    return 1;
+}
+
+static int rd_skip_bytes(WireReader* r, const size_t n) {
+    if (n > r->len - r->pos)
+        return 0;
+
+    r->pos += n;
+    return 1;
+}
+
+static int rd_u8(WireReader* r, uint8_t* value) {
+    if (r->pos + 1 > r->len)
+        return 0;
+
+    *value = r->data[r->pos++];
+    return 1;
+}
+
+static int rd_u32(WireReader* r, uint32_t* value) {
+    if (!rd_align(r, 4) || r->pos + 4 > r->len)
+        return 0;
+
+    memcpy(value, r->data + r->pos, 4);
+    r->pos += 4;
+
+    if (r->big_endian != (native_endian() == 'B'))
+        *value = swap_u32(*value);
+
+    return 1;
+}
+
+/**
+ * Read a string or object path. The returned pointer points into the message.
+ */
+static int rd_string(WireReader* r, const char** str) {
+    uint32_t len;
+
+    // +1 for null char
+    if (!rd_u32(r, &len) || len >= r->len - r->pos ||
+        r->data[r->pos + len] != '\0')
+        return 0;
+
+    *str = (const char*)(r->data + r->pos);
+    r->pos += len + 1;
+    return 1;
+}
+
+/**
+ * Read a signature. The returned pointer points into the message.
+ */
+static int rd_signature(WireReader* r, const char** sig) {
+    uint8_t len;
+
+    // +1 for null char
+    if (!rd_u8(r, &len) || len >= r->len - r->pos ||
+        r->data[r->pos + len] != '\0')
+        return 0;
+
+    *sig = (const char*)(r->data + r->pos);
+    r->pos += len + 1;
+    return 1;
+}
+
+/**
+ * Get the alignment of the type that a signature starts with
+ */
+static size_t type_alignment(const char type) {
+    switch (type) {
+        case 'n':
+        case 'q':
+            return 2;
+        case 'b':
+        case 'i':
+        case 'u':
+        case 'h':
+        case 'a':
+        case 's':
+        case 'o':
+            return 4;
+        case 'x':
+        case 't':
+        case 'd':
+        case '(':
+        case '{':
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * Get the end of the single complete type that a signature starts with
+ */
+static const char* sig_next(const char* sig) {
+    if (*sig == 'a')
+        return sig_next(sig + 1);
+
+    if (*sig == '(' || *sig == '{') {
+        const char close = *sig == '(' ? ')' : '}';
+
+        sig++;
+        while (*sig != '\0' && *sig != close)
+            sig = sig_next(sig);
+
+        return *sig == '\0' ? sig : sig + 1;
+    }
+
+    return *sig == '\0' ? sig : sig + 1;
+}
+
+/**
+ * Skip the value of the single complete type at the start of *sig and advance
+ * *sig past it
+ */
+static int rd_skip(WireReader* r, const char** sig) {
+    const char type = **sig;
+    const char* str;
+
+    switch (type) {
+        case 'y':
+            *sig += 1;
+            return rd_skip_bytes(r, 1);
+        case 'n':
+        case 'q':
+        case 'b':
+        case 'i':
+        case 'u':
+        case 'h':
+        case 'x':
+        case 't':
+        case 'd': {
+            // Fixed size types are as big as their alignment
+            const size_t size = type_alignment(type);
+            *sig += 1;
+            return rd_align(r, size) && rd_skip_bytes(r, size);
+        }
+        case 's':
+        case 'o':
+            *sig += 1;
+            return rd_string(r, &str);
+        case 'g':
+            *sig += 1;
+            return rd_signature(r, &str);
+        case 'v': {
+            const char* inner;
+            *sig += 1;
+            return rd_signature(r, &inner) && rd_skip(r, &inner) &&
+                   *inner == '\0';
+        }
+        case 'a': {
+            uint32_t len;
+            const char* element = *sig + 1;
+
+            *sig = sig_next(*sig);
+
+            // The padding to the first element is not part of the length
+            return rd_u32(r, &len) && rd_align(r, type_alignment(*element)) &&
+                   rd_skip_bytes(r, len);
+        }
+        case '(':
+        case '{': {
+            const char close = type == '(' ? ')' : '}';
+
+            if (!rd_align(r, 8))
+                return 0;
+
+            *sig += 1;
+            while (**sig != close) {
+                if (**sig == '\0' || !rd_skip(r, sig))
+                    return 0;
+            }
+
+            *sig += 1;
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+/*************** Connecting ***************/
+
+static long long wire_monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Copy a percent-encoded address value into dst
+ */
+static int unescape_value(const char* src, const size_t len, char* dst,
+                          const size_t dst_size) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (n + 1 >= dst_size)
+            return -1;
+
+        if (src[i] == '%' && i + 2 < len) {
+            char hex[3] = {src[i + 1], src[i + 2], '\0'};
+            dst[n++] = (char)strtol(hex, NULL, 16);
+            i += 2;
+        } else {
+            dst[n++] = src[i];
+        }
+    }
+
+    dst[n] = '\0';
+    return (int)n;
+}
+
+/**
+ * Try to connect to a single "unix:path=..." or "unix:abstract=..." address
+ */
+static int connect_unix_address(const char* entry, const size_t entry_len) {
+    const char* unix_prefix = "unix:";
+    const size_t unix_prefix_len = strlen(unix_prefix);
+
+    if (entry_len < unix_prefix_len ||
+        strncmp(entry, unix_prefix, unix_prefix_len) != 0)
+        return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    socklen_t addr_len = 0;
+    const char* key = entry + unix_prefix_len;
+    const char* end = entry + entry_len;
+
+    // Key-value pairs are separated by commas
+    while (key < end && addr_len == 0) {
+        const char* comma = memchr(key, ',', end - key);
+        const char* pair_end = comma ? comma : end;
+        const char* equals = memchr(key, '=', pair_end - key);
+
+        if (equals != NULL) {
+            const size_t key_len = equals - key;
+            const char* value = equals + 1;
+            const size_t value_len = pair_end - value;
+
+            if (key_len == 4 && strncmp(key, "path", 4) == 0) {
+                if (unescape_value(value, value_len, addr.sun_path,
+                                   sizeof(addr.sun_path)) > 0)
+                    addr_len = sizeof(addr);
+            } else if (key_len == 8 && strncmp(key, "abstract", 8) == 0) {
+                // Abstract socket names start with a null byte
+                const int n = unescape_value(value, value_len, addr.sun_path + 1,
+                                             sizeof(addr.sun_path) - 1);
+                if (n > 0)
+                    addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + n;
+            }
+        }
+
+        key = pair_end + 1;
+    }
+
+    if (addr_len == 0)
+        return -1;
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr*)&addr, addr_len) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Reads and writes are bounded by poll from here on
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+WireConnection* wire_connect(const char* address) {
+    int fd = -1;
+
+    if (address == NULL)
+        return NULL;
+
+    // Try each address separated by semicolons until one connects
+    const char* entry = address;
+    while (fd < 0 && *entry != '\0') {
+        const char* semicolon = strchr(entry, ';');
+        const size_t entry_len =
+            semicolon ? (size_t)(semicolon - entry) : strlen(entry);
+
+        fd = connect_unix_address(entry, entry_len);
+
+        if (semicolon == NULL)
+            break;
+        entry = semicolon + 1;
+    }
+
+    if (fd < 0)
+        return NULL;
+
+    WireConnection* conn = (WireConnection*)calloc(1, sizeof(WireConnection));
+    conn->fd = fd;
+    conn->next_serial = 1;
+
+    // SASL EXTERNAL with the uid as a hex encoded decimal string. BEGIN is
+    // sent straight away without waiting for OK or negotiating unix fd passing.
+    char uid[32];
+    char auth[128];
+    snprintf(uid, sizeof(uid), "%u", (unsigned)getuid());
+
+    size_t len = 0;
+    auth[len++] = '\0';
+    len += snprintf(auth + len, sizeof(auth) - len, "AUTH EXTERNAL ");
+    for (const char* c = uid; *c != '\0'; c++)
+        len += snprintf(auth + len, sizeof(auth) - len, "%02x",
+                        (unsigned char)*c);
+    len += snprintf(auth + len, sizeof(auth) - len, "\r\nBEGIN\r\n");
+
+    buf_append(&conn->out, auth, len);
+
+    // Hello must be the first method call on a connection
+    wire_queue_call(conn, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                    "org.freedesktop.DBus", "Hello", NULL, 0, 0);
+
+    return conn;
+}
+
+uint32_t wire_queue_call(WireConnection* conn, const char* destination,
+                         const char* path, const char* iface,
+                         const char* member, const char* const args[],
+                         const int num_of_args, const int no_reply) {
+    WireBuffer body = {NULL, 0, 0};
+    WireBuffer msg = {NULL, 0, 0};
+    char signature[3] = {'\0'};
+
+    if (num_of_args > 2)
+        return 0;
+
+    for (int i = 0; i < num_of_args; i++) {
+        buf_string(&body, args[i]);
+        signature[i] = 's';
+    }
+
+    const uint32_t serial = conn->next_serial++;
+
+    // Fixed part of the header
+    buf_u8(&msg, native_endian());
+    buf_u8(&msg, WIRE_METHOD_CALL);
+    buf_u8(&msg, no_reply ? WIRE_FLAG_NO_REPLY_EXPECTED : 0);
+    buf_u8(&msg, 1);
+    buf_u32(&msg, body.len);
+    buf_u32(&msg, serial);
+
+    // Array of header fields, its length is filled in below
+    buf_u32(&msg, 0);
+    const size_t fields_start = msg.len;
+
+    buf_field(&msg, WIRE_FIELD_PATH, 'o', path);
+    buf_field(&msg, WIRE_FIELD_DESTINATION, 's', destination);
+    buf_field(&msg, WIRE_FIELD_INTERFACE, 's', iface);
+    buf_field(&msg, WIRE_FIELD_MEMBER, 's', member);
+    if (num_of_args > 0)
+        buf_field(&msg, WIRE_FIELD_SIGNATURE, 'g', signature);
+
+    if (msg.data == NULL) {
+        free(body.data);
+        return 0;
+    }
+
+    const uint32_t fields_len = msg.len - fields_start;
+    memcpy(msg.data + fields_start - 4, &fields_len, 4);
+
+    // The body starts at an 8-byte boundary
+    buf_pad(&msg, 8);
+    buf_append(&msg, body.data, body.len);
+
+    buf_append(&conn->out, msg.data, msg.len);
+
+    free(body.data);
+    free(msg.data);
+
+    return serial;
+}
+
+/**
+ * Wait until the connection is ready for the specified events
+ */
+static WireStatus wire_poll(WireConnection* conn, const short events,
+                            const long long deadline_ms) {
+    struct pollfd pfd = {.fd = conn->fd, .events = events};
+
+    for (;;) {
+        const long long remaining = deadline_ms - wire_monotonic_ms();
+
+        if (remaining <= 0)
+            return WIRE_TIMEOUT;
+
+        const int res = poll(&pfd, 1, (int)remaining);
+
+        if (res > 0)
+            return WIRE_OK;
+        if (res < 0 && errno != EINTR)
+            return WIRE_FAILED;
+    }
+}
+
+WireStatus wire_flush(WireConnection* conn, const long long deadline_ms) {
+    size_t written = 0;
+
+    while (written < conn->out.len) {
+        const ssize_t n =
+            write(conn->fd, conn->out.data + written, conn->out.len - written);
+
+        if (n > 0) {
+            written += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            const WireStatus status = wire_poll(conn, POLLOUT, deadline_ms);
+            if (status != WIRE_OK)
+                return status;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return WIRE_FAILED;
+        }
+    }
+
+    conn->out.len = 0;
+
+    return WIRE_OK;
+}
+
+/**
+ * Read whatever is available into the input buffer, waiting until the
+ * deadline if nothing is
+ */
+static WireStatus wire_read(WireConnection* conn, const long long deadline_ms) {
+    for (;;) {
+        if (!buf_reserve(&conn->in, 4096))
+            return WIRE_FAILED;
+
+        const ssize_t n = read(conn->fd, conn->in.data + conn->in.len,
+                               conn->in.size - conn->in.len);
+
+        if (n > 0) {
+            conn->in.len += n;
+            return WIRE_OK;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            const WireStatus status = wire_poll(conn, POLLIN, deadline_ms);
+            if (status != WIRE_OK)
+                return status;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return WIRE_FAILED;
+        }
+    }
+}
+
+/**
+ * Remove the first n bytes of the input buffer
+ */
+static void wire_consume(WireConnection* conn, const size_t n) {
+    conn->in.len -= n;
+    memmove(conn->in.data, conn->in.data + n, conn->in.len);
+}
+
+/**
+ * Parse the server's reply to the authentication
+ */
+static WireStatus wire_check_auth(WireConnection* conn) {
+    const unsigned char* crlf = NULL;
+
+    for (size_t i = 0; i + 1 < conn->in.len; i++) {
+        if (conn->in.data[i] == '\r' && conn->in.data[i + 1] == '\n') {
+            crlf = conn->in.data + i;
+            break;
+        }
+    }
+
+    // Not the whole line yet
+    if (crlf == NULL)
+        return WIRE_TIMEOUT;
+
+    if (conn->in.len < 3 || memcmp(conn->in.data, "OK ", 3) != 0)
+        return WIRE_FAILED;
+
+    conn->authenticated = 1;
+    wire_consume(conn, crlf + 2 - conn->in.data);
+
+    return WIRE_OK;
+}
+
+/**
+ * Copy a string into a newly allocated string
+ */
+static char* copy_string(const char* str) {
+    char* copy = (char*)malloc(strlen(str) + 1);
+    if (copy != NULL)
+        strcpy(copy, str);
+    return copy;
+}
+
+/**
+ * Parse the message at the start of the input buffer
+ *
+ * @returns size_t The size of the message if a complete message was parsed,
+ *                 otherwise 0. -1 cast to size_t if the message is invalid.
+ */
+static size_t wire_parse_message(WireConnection* conn, uint8_t* type,
+                                 uint32_t* reply_serial, WireReply* reply) {
+    WireReader r = {conn->in.data, conn->in.len, 0, 0};
+    uint8_t endian, version, flags;
+    uint32_t body_len, serial, fields_len;
+
+    if (conn->in.len < WIRE_HEADER_SIZE)
+        return 0;
+
+    rd_u8(&r, &endian);
+    if (endian != 'l' && endian != 'B')
+        return (size_t)-1;
+    r.big_endian = endian == 'B';
+
+    rd_u8(&r, type);
+    rd_u8(&r, &flags);
+    rd_u8(&r, &version);
+    rd_u32(&r, &body_len);
+    rd_u32(&r, &serial);
+    rd_u32(&r, &fields_len);
+
+    if (body_len > WIRE_MAX_MESSAGE_SIZE || fields_len > WIRE_MAX_MESSAGE_SIZE)
+        return (size_t)-1;
+
+    const size_t body_start = (WIRE_HEADER_SIZE + fields_len + 7) / 8 * 8;
+    const size_t total = body_start + body_len;
+
+    if (conn->in.len < total)
+        return 0;
+
+    // Only look at the header fields from here on
+    r.len = WIRE_HEADER_SIZE + fields_len;
+    *reply_serial = 0;
+
+    const char* error_name = NULL;
+    const char* signature = "";
+
+    while (r.pos < r.len) {
+        uint8_t code;
+        const char* sig;
+
+        if (!rd_align(&r, 8) || !rd_u8(&r, &code) || !rd_signature(&r, &sig))
+            return (size_t)-1;
+
+        if (code == WIRE_FIELD_REPLY_SERIAL && strcmp(sig, "u") == 0) {
+            if (!rd_u32(&r, reply_serial))
+                return (size_t)-1;
+        } else if (code == WIRE_FIELD_ERROR_NAME && strcmp(sig, "s") == 0) {
+            if (!rd_string(&r, &error_name))
+                return (size_t)-1;
+        } else if (code == WIRE_FIELD_SIGNATURE && strcmp(sig, "g") == 0) {
+            if (!rd_signature(&r, &signature))
+                return (size_t)-1;
+        } else if (!rd_skip(&r, &sig) || *sig != '\0') {
+            return (size_t)-1;
+        }
+    }
+
+    memset(reply, 0, sizeof(WireReply));
+    reply->big_endian = r.big_endian;
+    reply->signature = copy_string(signature);
+    reply->body_len = body_len;
+    reply->body = (unsigned char*)malloc(body_len ? body_len : 1);
+    memcpy(reply->body, conn->in.data + body_start, body_len);
+
+    if (*type == WIRE_ERROR) {
+        reply->error_name =
+            copy_string(error_name ? error_name : "org.freedesktop.DBus.Error.Failed");
+
+        // The error message is the first argument if there is one
+        WireReader body = {reply->body, body_len, 0, r.big_endian};
+        const char* message;
+        if (signature[0] == 's' && rd_string(&body, &message))
+            reply->error_message = copy_string(message);
+        else
+            reply->error_message = copy_string(reply->error_name);
+    }
+
+    return total;
+}
+
+WireStatus wire_wait_reply(WireConnection* conn, const uint32_t serial,
+                           const long long deadline_ms, WireReply* reply) {
+    for (;;) {
+        if (!conn->authenticated) {
+            const WireStatus status = wire_check_auth(conn);
+            if (status == WIRE_FAILED)
+                return WIRE_FAILED;
+        }
+
+        // Handle every complete message that was read
+        while (conn->authenticated) {
+            uint8_t type;
+            uint32_t reply_serial;
+            const size_t size =
+                wire_parse_message(conn, &type, &reply_serial, reply);
+
+            if (size == (size_t)-1)
+                return WIRE_FAILED;
+            if (size == 0)
+                break;
+
+            wire_consume(conn, size);
+
+            if ((type == WIRE_METHOD_RETURN || type == WIRE_ERROR) &&
+                reply_serial == serial)
+                return WIRE_OK;
+
+            // Skip the Hello reply, NameAcquired and any other messages
+            wire_free_reply(reply);
+        }
+
+        const WireStatus status = wire_read(conn, deadline_ms);
+        if (status != WIRE_OK)
+            return status;
+    }
+}
+
+char* wire_reply_find_metadata(const WireReply* reply, const char* key) {
+    WireReader r = {reply->body, reply->body_len, 0, reply->big_endian};
+    const char* sig;
+    uint32_t len;
+
+    // The body is a variant containing an a{sv}
+    if (reply->error_name != NULL || strcmp(reply->signature, "v") != 0 ||
+        !rd_signature(&r, &sig) || strcmp(sig, "a{sv}") != 0 ||
+        !rd_u32(&r, &len) || !rd_align(&r, 8) || len > r.len - r.pos)
+        return NULL;
+
+    const size_t end = r.pos + len;
+
+    while (r.pos < end) {
+        const char* k;
+        const char* value_sig;
+        const char* value;
+
+        if (!rd_align(&r, 8) || !rd_string(&r, &k) ||
+            !rd_signature(&r, &value_sig))
+            return NULL;
+
+        if (strcmp(k, key) == 0) {
+            // A string, or the first of an array of strings
+            if (strcmp(value_sig, "s") == 0 && rd_string(&r, &value))
+                return copy_string(value);
+
+            if (strcmp(value_sig, "as") == 0 && rd_u32(&r, &len) && len > 0 &&
+                rd_string(&r, &value))
+                return copy_string(value);
+
+            return NULL;
+        }
+
+        if (!rd_skip(&r, &value_sig) || *value_sig != '\0')
+            return NULL;
+    }
+
+    return NULL;
+}
+
+void wire_free_reply(WireReply* reply) {
+    free(reply->error_name);
+    free(reply->error_message);
+    free(reply->body);
+    free(reply->signature);
+    memset(reply, 0, sizeof(WireReply));
+}
+
+void wire_close(WireConnection* conn) {
+    close(conn->fd);
+    free(conn->out.data);
+    free(conn->in.data);
+    free(conn);
+}